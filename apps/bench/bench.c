@@ -0,0 +1,355 @@
+/*
+ * Copyright (c) 2019 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <ftw.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#endif
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+#include <crystal.h>
+#include <ela_hive.h>
+
+#define MAX_NODES           (32)
+#define DEFAULT_PORT        "9095"
+
+typedef struct bench_ctx {
+    HiveConnect *connect;
+    IPFSCid cid;
+    size_t size;
+    int ops;
+    bool length_only;
+    int failures;
+    pthread_mutex_t lock;
+} bench_ctx_t;
+
+static void usage(void)
+{
+    printf("hivebench, a utility measuring how Hive IPFS operations scale with threads.\n");
+    printf("Usage: hivebench [OPTION]... NODE_IP[:NODE_PORT]|SOCKET_PATH ...\n");
+    printf("Description: hivebench uploads a payload through one shared connection, then"
+           " reads it back from 1, 2, 4, ... threads sharing that connection and reports"
+           " the throughput of each round.\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("  -t, --threads=N               Maximum number of threads (default: online CPUs).\n");
+    printf("  -n, --ops=N                   Operations per thread in each round (default: 50).\n");
+    printf("  -s, --size=BYTES              Payload size in bytes (default: 4096).\n");
+    printf("  -l, --length-only             Only query the file length, do not download.\n");
+    printf("  -b, --hedge-budget=F          Fraction of reads that may be hedged (default: 0).\n");
+    printf("  -c, --cache                   Serve reads from the local object cache.\n");
+    printf("\n");
+}
+
+static double now_in_seconds(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void *worker_entry(void *arg)
+{
+    bench_ctx_t *ctx = (bench_ctx_t *)arg;
+    void *buf;
+    int failures = 0;
+    int i;
+
+    buf = malloc(ctx->size);
+    if (!buf)
+        return NULL;
+
+    for (i = 0; i < ctx->ops; i++) {
+        ssize_t rc;
+
+        if (ctx->length_only)
+            rc = hive_ipfs_get_file_length(ctx->connect, &ctx->cid);
+        else
+            rc = hive_ipfs_get_file_to_buffer(ctx->connect, &ctx->cid, false,
+                                              buf, ctx->size);
+        if (rc != (ssize_t)ctx->size)
+            failures++;
+    }
+
+    free(buf);
+
+    pthread_mutex_lock(&ctx->lock);
+    ctx->failures += failures;
+    pthread_mutex_unlock(&ctx->lock);
+
+    return NULL;
+}
+
+static int run_round(bench_ctx_t *ctx, int nthreads, double *ops_per_sec)
+{
+    pthread_t *tids;
+    double started;
+    double elapsed;
+    int i;
+
+    tids = (pthread_t *)calloc(nthreads, sizeof(pthread_t));
+    if (!tids)
+        return -1;
+
+    ctx->failures = 0;
+    started = now_in_seconds();
+
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&tids[i], NULL, worker_entry, ctx) != 0) {
+            nthreads = i;
+            break;
+        }
+    }
+
+    for (i = 0; i < nthreads; i++)
+        pthread_join(tids[i], NULL);
+
+    elapsed = now_in_seconds() - started;
+    free(tids);
+
+    if (!nthreads)
+        return -1;
+
+    *ops_per_sec = (double)nthreads * ctx->ops / elapsed;
+    return 0;
+}
+
+static void logging(const char *fmt, va_list args)
+{
+    //DO NOTHING.
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag,
+                        struct FTW *ftw)
+{
+    return remove(path);
+}
+
+/*
+ * The client leaves its node table and object cache behind.
+ */
+static void remove_data_location(const char *path)
+{
+    nftw(path, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+int main(int argc, char *argv[])
+{
+    char addrs[MAX_NODES][256];
+    IPFSNode nodes[MAX_NODES] = {0};
+    IPFSConnectOptions connect_opts;
+    IPFSStats stats;
+    HiveOptions opts;
+    HiveClient *client;
+    bench_ctx_t ctx;
+    char data_location[] = "/tmp/hivebench-XXXXXX";
+    double baseline = 0;
+    double hedge_budget = 0;
+    bool use_cache = false;
+    int max_threads = 0;
+    int node_count = 0;
+    uint8_t *payload;
+    size_t i;
+    int n;
+    int rc;
+
+    int opt;
+    struct option options[] = {
+        {"threads",     required_argument, NULL, 't'},
+        {"ops",         required_argument, NULL, 'n'},
+        {"size",        required_argument, NULL, 's'},
+        {"length-only", no_argument,       NULL, 'l'},
+        {"hedge-budget",required_argument, NULL, 'b'},
+        {"cache",       no_argument,       NULL, 'c'},
+        {"help",        no_argument,       NULL, 'h'},
+        {NULL,          0,                 NULL,  0 }
+    };
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.ops = 50;
+    ctx.size = 4096;
+
+    while ((opt = getopt_long(argc, argv, "t:n:s:lb:ch?", options, NULL)) != -1) {
+        switch (opt) {
+        case 't':
+            max_threads = atoi(optarg);
+            break;
+        case 'n':
+            ctx.ops = atoi(optarg);
+            break;
+        case 's':
+            ctx.size = (size_t)atol(optarg);
+            break;
+        case 'l':
+            ctx.length_only = true;
+            break;
+        case 'b':
+            hedge_budget = atof(optarg);
+            break;
+        case 'c':
+            use_cache = true;
+            break;
+        case 'h':
+        case '?':
+        default:
+            usage();
+            exit(-1);
+        }
+    }
+
+    if (optind >= argc || ctx.ops <= 0 || !ctx.size) {
+        usage();
+        exit(-1);
+    }
+
+    if (max_threads <= 0)
+        max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (max_threads <= 0)
+        max_threads = 1;
+
+    for (n = optind; n < argc && node_count < MAX_NODES; n++) {
+        char *port;
+
+        snprintf(addrs[node_count], sizeof(addrs[0]), "%s", argv[n]);
+        if (addrs[node_count][0] == '/') {
+            nodes[node_count].unix_socket = addrs[node_count];
+            node_count++;
+            continue;
+        }
+
+        port = strrchr(addrs[node_count], ':');
+        if (port && strchr(addrs[node_count], ':') == port)
+            *port++ = '\0';
+        else
+            port = DEFAULT_PORT;
+
+        nodes[node_count].ipv4 = strchr(addrs[node_count], ':') ? NULL : addrs[node_count];
+        nodes[node_count].ipv6 = strchr(addrs[node_count], ':') ? addrs[node_count] : NULL;
+        nodes[node_count].port = port;
+        node_count++;
+    }
+
+    vlog_init(3, NULL, logging);
+
+    if (!mkdtemp(data_location)) {
+        printf("cannot create data location.\n");
+        return -1;
+    }
+
+    opts.data_location = data_location;
+    client = hive_client_new(&opts);
+    if (!client) {
+        printf("cannot create hive client (0x%x).\n", hive_get_error());
+        remove_data_location(data_location);
+        return -1;
+    }
+
+    memset(&connect_opts, 0, sizeof(connect_opts));
+    connect_opts.backendType    = HiveBackendType_IPFS;
+    connect_opts.rpc_node_count = node_count;
+    connect_opts.rpcNodes       = nodes;
+    connect_opts.hedge_budget   = hedge_budget;
+    connect_opts.cache_capacity = use_cache ? 0 : -1;
+
+    ctx.connect = hive_client_connect(client, (HiveConnectOptions *)&connect_opts);
+    if (!ctx.connect) {
+        printf("cannot connect to IPFS nodes (0x%x).\n", hive_get_error());
+        hive_client_close(client);
+        remove_data_location(data_location);
+        return -1;
+    }
+
+    payload = (uint8_t *)malloc(ctx.size);
+    if (!payload) {
+        hive_client_disconnect(ctx.connect);
+        hive_client_close(client);
+        remove_data_location(data_location);
+        return -1;
+    }
+
+    srand((unsigned)time(NULL));
+    for (i = 0; i < ctx.size; i++)
+        payload[i] = (uint8_t)rand();
+
+    rc = hive_ipfs_put_file_from_buffer(ctx.connect, payload, ctx.size, false, &ctx.cid);
+    free(payload);
+    if (rc < 0) {
+        printf("cannot upload payload (0x%x).\n", hive_get_error());
+        hive_client_disconnect(ctx.connect);
+        hive_client_close(client);
+        remove_data_location(data_location);
+        return -1;
+    }
+
+    pthread_mutex_init(&ctx.lock, NULL);
+
+    printf("payload %s, %zu bytes, %d ops per thread, %s\n", ctx.cid.content,
+           ctx.size, ctx.ops, ctx.length_only ? "length only" : "full reads");
+    printf("%8s %12s %10s %10s\n", "threads", "ops/s", "speedup", "failures");
+
+    for (n = 1; ; n = n * 2 > max_threads && n < max_threads ? max_threads : n * 2) {
+        double ops_per_sec;
+
+        if (run_round(&ctx, n, &ops_per_sec) < 0) {
+            printf("cannot start worker threads.\n");
+            break;
+        }
+
+        if (n == 1)
+            baseline = ops_per_sec;
+
+        printf("%8d %12.1f %9.2fx %10d\n", n, ops_per_sec,
+               ops_per_sec / baseline, ctx.failures);
+
+        if (n >= max_threads)
+            break;
+    }
+
+    if (hedge_budget > 0 && !hive_ipfs_get_stats(ctx.connect, &stats))
+        printf("hedges fired %llu, won %llu\n",
+               (unsigned long long)stats.hedges_fired,
+               (unsigned long long)stats.hedges_won);
+
+    pthread_mutex_destroy(&ctx.lock);
+    hive_client_disconnect(ctx.connect);
+    hive_client_close(client);
+    remove_data_location(data_location);
+
+    return 0;
+}
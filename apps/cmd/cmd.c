@@ -253,6 +253,7 @@ static void client_connect(ctx_t *ctx, int argc, char **argv)
             node->ipv4 = cfg->ipfs_rpc_nodes[i]->ipv4;
             node->ipv6 = cfg->ipfs_rpc_nodes[i]->ipv6;
             node->port = cfg->ipfs_rpc_nodes[i]->port;
+            node->unix_socket = cfg->ipfs_rpc_nodes[i]->unix_socket;
         }
 
         IPFSConnectOptions opts = {
@@ -102,6 +102,9 @@ static void rpc_node_destructor(void *obj)
 
     if (node->port)
         free((void *)node->port);
+
+    if (node->unix_socket)
+        free((void *)node->unix_socket);
 }
 
 cmd_cfg_t *load_config(const char *config_file)
@@ -203,7 +206,13 @@ cmd_cfg_t *load_config(const char *config_file)
         else
             node->ipv6 = NULL;
 
-        if (!node->ipv4 && !node->ipv6) {
+        rc = config_setting_lookup_string(nd, "unix_socket", &stropt);
+        if (rc && *stropt)
+            node->unix_socket = (const char *)strdup(stropt);
+        else
+            node->unix_socket = NULL;
+
+        if (!node->ipv4 && !node->ipv6 && !node->unix_socket) {
             fprintf(stderr, "Missing IPFS RPC node ip address.\n");
             config_destroy(&cfg);
             deref(config);
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2019 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#include <io.h>
+#include <crystal.h>
+#endif
+
+#include "atomic_file.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+static int mkstemp(char *template)
+{
+    errno_t err;
+
+    err = _mktemp_s(template, strlen(template) + 1);
+    if (err) {
+        errno = err;
+        return -1;
+    }
+
+    return open(template, O_RDWR | O_CREAT | O_EXCL | O_BINARY, S_IRUSR | S_IWUSR);
+}
+
+#define fsync(fd)           _commit(fd)
+
+static int replace_file(const char *from, const char *to)
+{
+    if (!MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        errno = EACCES;
+        return -1;
+    }
+
+    return 0;
+}
+#else
+#define replace_file(from, to)  rename(from, to)
+#endif
+
+int atomic_write_file(const char *path, const void *data, size_t len, mode_t mode)
+{
+    char tmp_path[PATH_MAX];
+    const char *p = (const char *)data;
+    size_t left = len;
+    int saved_errno;
+    int rc;
+    int fd;
+
+    rc = snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+    if (rc < 0 || rc >= (int)sizeof(tmp_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    fd = mkstemp(tmp_path);
+    if (fd < 0)
+        return -1;
+
+    while (left > 0) {
+        ssize_t nwr = write(fd, p, left);
+        if (nwr < 0) {
+            if (errno == EINTR)
+                continue;
+            goto error_exit;
+        }
+
+        p += nwr;
+        left -= (size_t)nwr;
+    }
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    if (fchmod(fd, mode) < 0)
+        goto error_exit;
+#endif
+
+    if (fsync(fd) < 0)
+        goto error_exit;
+
+    if (close(fd) < 0) {
+        fd = -1;
+        goto error_exit;
+    }
+    fd = -1;
+
+    if (replace_file(tmp_path, path) < 0)
+        goto error_exit;
+
+    return 0;
+
+error_exit:
+    saved_errno = errno;
+    if (fd >= 0)
+        close(fd);
+    remove(tmp_path);
+    errno = saved_errno;
+    return -1;
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+int sync_dir(const char *dir)
+{
+    /* Renames are written through already. */
+    return 0;
+}
+#else
+int sync_dir(const char *dir)
+{
+    int saved_errno;
+    int fd;
+
+    fd = open(dir, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    if (fsync(fd) < 0 && errno != EINVAL) {
+        saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+
+    close(fd);
+    return 0;
+}
+#endif
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2019 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ATOMIC_FILE_H__
+#define __ATOMIC_FILE_H__
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+/*
+ * Replace the content of a file atomically: the data is written to a
+ * temporary file in the same directory, flushed to disk and renamed over
+ * the target, so readers see either the old or the new content in full.
+ * Return 0 on success, or -1 with errno set.
+ */
+int atomic_write_file(const char *path, const void *data, size_t len, mode_t mode);
+
+/*
+ * Flush a directory, so that the files renamed into it or removed from
+ * it stay so after a crash; atomic_write_file does not flush the
+ * directory of the file it replaces. Filesystems unable to flush a
+ * directory are taken as flushing it with every change.
+ * Return 0 on success, or -1 with errno set.
+ */
+int sync_dir(const char *dir);
+
+#endif // __ATOMIC_FILE_H__
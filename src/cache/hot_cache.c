@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2019 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <crystal.h>
+
+#include "hot_cache.h"
+#include "lru.h"
+#include "fnv.h"
+
+/*
+ * Objects bigger than this share of the budget are not cached, so a
+ * single large read can not flush the small hot objects out.
+ */
+#define OBJECT_SHARE            (8)
+
+/*
+ * Keys are spread over slots holding the generation of their last
+ * write; keys sharing a slot only drop each other's copies more often.
+ */
+#define GENERATION_SLOTS        (256)
+
+typedef struct hot_entry {
+    hash_entry_t he;
+    lru_node_t lru;
+    hot_object_t *object;
+    time_t validated;
+    char key[0];
+} hot_entry_t;
+
+struct hot_cache {
+    pthread_mutex_t lock;
+    hashtable_t *entries;
+    lru_node_t lru;
+    size_t used;
+    size_t budget;
+
+    /*
+     * Bumped by each removal, which stamps the slot of its key with it.
+     */
+    uint64_t generation;
+    uint64_t written[GENERATION_SLOTS];
+
+    uint64_t hits;
+    uint64_t revalidations;
+    uint64_t misses;
+};
+
+static void entry_destructor(void *p)
+{
+    hot_entry_t *entry = (hot_entry_t *)p;
+
+    if (entry->object)
+        deref(entry->object);
+}
+
+/*
+ * Called with the lock held.
+ */
+static void entry_remove(hot_cache_t *cache, hot_entry_t *entry)
+{
+    lru_unlink(&entry->lru);
+    cache->used -= entry->object->size;
+
+    entry = (hot_entry_t *)hashtable_remove(cache->entries, entry->key,
+                                            strlen(entry->key));
+    if (entry)
+        deref(entry);
+}
+
+static void hot_cache_destructor(void *p)
+{
+    hot_cache_t *cache = (hot_cache_t *)p;
+
+    if (cache->entries)
+        deref(cache->entries);
+
+    pthread_mutex_destroy(&cache->lock);
+}
+
+hot_cache_t *hot_cache_new(size_t budget)
+{
+    hot_cache_t *cache;
+
+    cache = (hot_cache_t *)rc_zalloc(sizeof(hot_cache_t), hot_cache_destructor);
+    if (!cache)
+        return NULL;
+
+    pthread_mutex_init(&cache->lock, NULL);
+    lru_init(&cache->lru);
+    cache->budget = budget;
+
+    cache->entries = hashtable_create(64, 0, NULL, NULL);
+    if (!cache->entries) {
+        deref(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+void hot_cache_close(hot_cache_t *cache)
+{
+    if (cache)
+        deref(cache);
+}
+
+hot_object_t *hot_cache_get(hot_cache_t *cache, const char *key, int max_age,
+                            bool *fresh)
+{
+    hot_object_t *object = NULL;
+    hot_entry_t *entry;
+
+    pthread_mutex_lock(&cache->lock);
+
+    entry = (hot_entry_t *)hashtable_get(cache->entries, key, strlen(key));
+    if (entry) {
+        lru_unlink(&entry->lru);
+        lru_push_front(&cache->lru, &entry->lru);
+
+        object = (hot_object_t *)ref(entry->object);
+        *fresh = max_age > 0 && time(NULL) - entry->validated < max_age;
+        deref(entry);
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+
+    return object;
+}
+
+uint64_t hot_cache_generation(hot_cache_t *cache)
+{
+    uint64_t generation;
+
+    pthread_mutex_lock(&cache->lock);
+    generation = cache->generation;
+    pthread_mutex_unlock(&cache->lock);
+
+    return generation;
+}
+
+void hot_cache_put(hot_cache_t *cache, const char *key, const char *tag,
+                   const void *data, size_t size, uint64_t generation)
+{
+    hot_object_t *object;
+    hot_entry_t *entry;
+    size_t len = strlen(key);
+
+    if (size > cache->budget / OBJECT_SHARE || strlen(tag) >= HOT_CACHE_MAX_TAG_LEN) {
+        hot_cache_remove(cache, key);
+        return;
+    }
+
+    object = (hot_object_t *)rc_zalloc(sizeof(hot_object_t) + size, NULL);
+    entry = (hot_entry_t *)rc_zalloc(sizeof(hot_entry_t) + len + 1, entry_destructor);
+    if (!object || !entry) {
+        if (object)
+            deref(object);
+        if (entry)
+            deref(entry);
+        hot_cache_remove(cache, key);
+        return;
+    }
+
+    object->size = size;
+    strcpy(object->tag, tag);
+    if (size)
+        memcpy(object->data, data, size);
+
+    strcpy(entry->key, key);
+    entry->object = object;
+    entry->validated = time(NULL);
+    entry->he.data = entry;
+    entry->he.key = entry->key;
+    entry->he.keylen = len;
+
+    pthread_mutex_lock(&cache->lock);
+
+    if (cache->written[fnv1a64(key) % GENERATION_SLOTS] > generation) {
+        pthread_mutex_unlock(&cache->lock);
+        deref(entry);
+        return;
+    }
+
+    {
+        hot_entry_t *old;
+
+        old = (hot_entry_t *)hashtable_get(cache->entries, key, len);
+        if (old) {
+            entry_remove(cache, old);
+            deref(old);
+        }
+    }
+
+    hashtable_put(cache->entries, &entry->he);
+    lru_push_front(&cache->lru, &entry->lru);
+    cache->used += size;
+
+    while (cache->used > cache->budget && !lru_empty(&cache->lru))
+        entry_remove(cache, lru_entry(lru_last(&cache->lru),
+                                      hot_entry_t, lru));
+
+    pthread_mutex_unlock(&cache->lock);
+
+    deref(entry);
+}
+
+void hot_cache_validate(hot_cache_t *cache, const char *key, const char *tag)
+{
+    hot_entry_t *entry;
+
+    pthread_mutex_lock(&cache->lock);
+
+    entry = (hot_entry_t *)hashtable_get(cache->entries, key, strlen(key));
+    if (entry) {
+        if (!strcmp(entry->object->tag, tag))
+            entry->validated = time(NULL);
+        deref(entry);
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void hot_cache_remove(hot_cache_t *cache, const char *key)
+{
+    hot_entry_t *entry;
+
+    pthread_mutex_lock(&cache->lock);
+    cache->written[fnv1a64(key) % GENERATION_SLOTS] = ++cache->generation;
+
+    entry = (hot_entry_t *)hashtable_get(cache->entries, key, strlen(key));
+    if (entry) {
+        entry_remove(cache, entry);
+        deref(entry);
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void hot_cache_count(hot_cache_t *cache, hot_cache_outcome_t outcome)
+{
+    pthread_mutex_lock(&cache->lock);
+
+    switch (outcome) {
+    case HOT_CACHE_HIT:
+        cache->hits++;
+        break;
+
+    case HOT_CACHE_REVALIDATED:
+        cache->hits++;
+        cache->revalidations++;
+        break;
+
+    case HOT_CACHE_MISS:
+        cache->misses++;
+        break;
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void hot_cache_get_stats(hot_cache_t *cache, HiveCacheStats *stats)
+{
+    pthread_mutex_lock(&cache->lock);
+
+    stats->hits          = cache->hits;
+    stats->revalidations = cache->revalidations;
+    stats->misses        = cache->misses;
+    stats->bytes         = cache->used;
+    stats->objects       = hashtable_size(cache->entries);
+
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2019 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __HOT_CACHE_H__
+#define __HOT_CACHE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ela_hive.h"
+
+#define HOT_CACHE_MAX_TAG_LEN   (128)
+
+typedef struct hot_cache hot_cache_t;
+
+/*
+ * A copy of a remote object as last read, together with the version tag
+ * (e.g. an eTag) it was read with. Objects are immutable: a newer read
+ * replaces the object, so a reference stays valid whatever happens to
+ * the cache meanwhile.
+ */
+typedef struct hot_object {
+    size_t size;
+    char tag[HOT_CACHE_MAX_TAG_LEN];
+    uint8_t data[0];
+} hot_object_t;
+
+typedef enum hot_cache_outcome {
+    HOT_CACHE_HIT,          // Served from memory without asking the server.
+    HOT_CACHE_REVALIDATED,  // Served from memory once the server confirmed it.
+    HOT_CACHE_MISS          // Read from the server.
+} hot_cache_outcome_t;
+
+/*
+ * Create a cache of recently read mutable objects, kept in memory and
+ * keyed by their remote path. The least recently used objects are evicted
+ * once they take more than budget bytes.
+ *
+ * A read answered before a concurrent write completes must not cache the
+ * old object afterwards. Reads therefore take the generation of the cache
+ * before they are sent, and their copy is dropped if the object was
+ * removed since; writers remove it again once written.
+ */
+hot_cache_t *hot_cache_new(size_t budget);
+
+void hot_cache_close(hot_cache_t *cache);
+
+/*
+ * Return a reference to the object cached under key, to be released with
+ * deref(), or NULL if there is none. fresh tells whether the server has
+ * confirmed the object within the last max_age seconds.
+ */
+hot_object_t *hot_cache_get(hot_cache_t *cache, const char *key, int max_age,
+                            bool *fresh);
+
+uint64_t hot_cache_generation(hot_cache_t *cache);
+
+/*
+ * Cache a copy of an object just read with the given tag, by a read sent
+ * at generation, replacing any older one. Ignored if the object has been
+ * removed since. Objects too big for a fair share of the budget are
+ * skipped.
+ */
+void hot_cache_put(hot_cache_t *cache, const char *key, const char *tag,
+                   const void *data, size_t size, uint64_t generation);
+
+/*
+ * Record that the server has just confirmed the object cached under key
+ * with the given tag is still current.
+ */
+void hot_cache_validate(hot_cache_t *cache, const char *key, const char *tag);
+
+/*
+ * Forget the object cached under key, e.g. once it has been written.
+ */
+void hot_cache_remove(hot_cache_t *cache, const char *key);
+
+/*
+ * Account for how a read was served.
+ */
+void hot_cache_count(hot_cache_t *cache, hot_cache_outcome_t outcome);
+
+void hot_cache_get_stats(hot_cache_t *cache, HiveCacheStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __HOT_CACHE_H__
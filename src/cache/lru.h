@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2019 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __LRU_H__
+#define __LRU_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Intrusive recency list, shared by the caches: a list head, and a node
+ * embedded in each entry, most recently used first.
+ */
+typedef struct lru_node {
+    struct lru_node *prev;
+    struct lru_node *next;
+} lru_node_t;
+
+/*
+ * The entry of the given type a node is embedded in as member.
+ */
+#define lru_entry(node, type, member)  \
+    ((type *)((char *)(node) - offsetof(type, member)))
+
+static inline void lru_init(lru_node_t *head)
+{
+    head->prev = head;
+    head->next = head;
+}
+
+static inline bool lru_empty(const lru_node_t *head)
+{
+    return head->prev == head;
+}
+
+/*
+ * The least recently used node; the list must not be empty.
+ */
+static inline lru_node_t *lru_last(const lru_node_t *head)
+{
+    return head->prev;
+}
+
+static inline void lru_unlink(lru_node_t *node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+}
+
+static inline void lru_push_front(lru_node_t *head, lru_node_t *node)
+{
+    node->prev = head;
+    node->next = head->next;
+    head->next->prev = node;
+    head->next = node;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LRU_H__ */
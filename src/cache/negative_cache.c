@@ -0,0 +1,355 @@
+/*
+ * Copyright (c) 2019 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <crystal.h>
+
+#include "negative_cache.h"
+#include "fnv.h"
+
+#define BLOOM_BITS_PER_ENTRY    (10)
+#define BLOOM_MIN_BITS          (1024)
+#define BLOOM_HASHES            (7)
+
+/*
+ * Absent paths remembered at most; beyond it expired ones are swept, or
+ * all are forgotten if none has expired.
+ */
+#define MAX_ABSENT_ENTRIES      (4096)
+
+/*
+ * Paths are spread over slots holding the generation of their last
+ * write; paths sharing a slot only drop each other's entries more often.
+ */
+#define GENERATION_SLOTS        (256)
+
+typedef struct absent_entry {
+    hash_entry_t he;
+    time_t expires_at;
+    char path[0];
+} absent_entry_t;
+
+typedef struct bloom_filter {
+    hash_entry_t he;
+    time_t expires_at;
+    size_t nbits;
+    uint8_t *bits;
+    char folder[0];
+} bloom_filter_t;
+
+struct negative_cache {
+    pthread_mutex_t lock;
+    int ttl;
+    hashtable_t *absent;
+    hashtable_t *blooms;
+
+    /*
+     * Bumped by each write, which stamps the slot of its path with it.
+     */
+    uint64_t generation;
+    uint64_t written[GENERATION_SLOTS];
+};
+
+/*
+ * Kirsch-Mitzenmacher double hashing: the k probe positions are derived
+ * from the two halves of a single 64-bit hash.
+ */
+static void bloom_add(bloom_filter_t *bloom, const char *name)
+{
+    uint64_t hash = fnv1a64(name);
+    uint32_t h1 = (uint32_t)hash;
+    uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+    int i;
+
+    for (i = 0; i < BLOOM_HASHES; i++) {
+        size_t bit = (h1 + (uint32_t)i * h2) % bloom->nbits;
+        bloom->bits[bit >> 3] |= (uint8_t)(1 << (bit & 7));
+    }
+}
+
+static bool bloom_contains(bloom_filter_t *bloom, const char *name)
+{
+    uint64_t hash = fnv1a64(name);
+    uint32_t h1 = (uint32_t)hash;
+    uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+    int i;
+
+    for (i = 0; i < BLOOM_HASHES; i++) {
+        size_t bit = (h1 + (uint32_t)i * h2) % bloom->nbits;
+        if (!(bloom->bits[bit >> 3] & (1 << (bit & 7))))
+            return false;
+    }
+
+    return true;
+}
+
+static void bloom_destructor(void *p)
+{
+    bloom_filter_t *bloom = (bloom_filter_t *)p;
+
+    if (bloom->bits)
+        free(bloom->bits);
+}
+
+static void negative_cache_destructor(void *p)
+{
+    negative_cache_t *cache = (negative_cache_t *)p;
+
+    if (cache->absent)
+        deref(cache->absent);
+
+    if (cache->blooms)
+        deref(cache->blooms);
+
+    pthread_mutex_destroy(&cache->lock);
+}
+
+negative_cache_t *negative_cache_new(int ttl)
+{
+    negative_cache_t *cache;
+
+    cache = (negative_cache_t *)rc_zalloc(sizeof(negative_cache_t),
+                                          negative_cache_destructor);
+    if (!cache)
+        return NULL;
+
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->ttl = ttl;
+
+    cache->absent = hashtable_create(64, 0, NULL, NULL);
+    cache->blooms = hashtable_create(4, 0, NULL, NULL);
+    if (!cache->absent || !cache->blooms) {
+        deref(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+void negative_cache_close(negative_cache_t *cache)
+{
+    if (cache)
+        deref(cache);
+}
+
+static void split_path(const char *path, char *folder, size_t len,
+                       const char **name)
+{
+    const char *slash = strrchr(path, '/');
+    size_t folder_len = slash ? (size_t)(slash - path) : 0;
+
+    if (folder_len >= len)
+        folder_len = len - 1;
+
+    memcpy(folder, path, folder_len);
+    folder[folder_len] = '\0';
+    *name = slash ? slash + 1 : path;
+}
+
+uint64_t negative_cache_generation(negative_cache_t *cache)
+{
+    uint64_t generation;
+
+    pthread_mutex_lock(&cache->lock);
+    generation = cache->generation;
+    pthread_mutex_unlock(&cache->lock);
+
+    return generation;
+}
+
+/*
+ * Called with the lock held.
+ */
+static void sweep_absent(negative_cache_t *cache, time_t now)
+{
+    hashtable_iterator_t it;
+    absent_entry_t *entry;
+
+    hashtable_iterate(cache->absent, &it);
+    while (hashtable_iterator_has_next(&it)) {
+        hashtable_iterator_next(&it, NULL, NULL, (void **)&entry);
+
+        if (entry->expires_at <= now)
+            hashtable_iterator_remove(&it);
+
+        deref(entry);
+    }
+
+    if (hashtable_size(cache->absent) >= MAX_ABSENT_ENTRIES)
+        hashtable_clear(cache->absent);
+}
+
+void negative_cache_put(negative_cache_t *cache, const char *path,
+                        uint64_t generation)
+{
+    absent_entry_t *entry;
+    size_t len = strlen(path);
+    time_t now = time(NULL);
+
+    entry = (absent_entry_t *)rc_zalloc(sizeof(absent_entry_t) + len + 1, NULL);
+    if (!entry)
+        return;
+
+    strcpy(entry->path, path);
+    entry->expires_at = now + cache->ttl;
+    entry->he.data = entry;
+    entry->he.key = entry->path;
+    entry->he.keylen = len;
+
+    pthread_mutex_lock(&cache->lock);
+    if (cache->written[fnv1a64(path) % GENERATION_SLOTS] <= generation) {
+        if (hashtable_size(cache->absent) >= MAX_ABSENT_ENTRIES)
+            sweep_absent(cache, now);
+        hashtable_put(cache->absent, &entry->he);
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    deref(entry);
+}
+
+void negative_cache_remove(negative_cache_t *cache, const char *path)
+{
+    bloom_filter_t *bloom;
+    absent_entry_t *entry;
+    char folder[256];
+    const char *name;
+
+    split_path(path, folder, sizeof(folder), &name);
+
+    pthread_mutex_lock(&cache->lock);
+    cache->written[fnv1a64(path) % GENERATION_SLOTS] = ++cache->generation;
+    entry = hashtable_remove(cache->absent, path, strlen(path));
+
+    /*
+     * Bloom filters can not forget, so a created entry is simply added;
+     * a later delete is then tracked through the exact entries.
+     */
+    bloom = hashtable_get(cache->blooms, folder, strlen(folder));
+    if (bloom)
+        bloom_add(bloom, name);
+    pthread_mutex_unlock(&cache->lock);
+
+    if (entry)
+        deref(entry);
+    if (bloom)
+        deref(bloom);
+}
+
+int negative_cache_seed(negative_cache_t *cache, const char *folder,
+                        const char **names, size_t count, uint64_t generation)
+{
+    bloom_filter_t *bloom;
+    size_t len = strlen(folder);
+    size_t i;
+
+    bloom = (bloom_filter_t *)rc_zalloc(sizeof(bloom_filter_t) + len + 1,
+                                        bloom_destructor);
+    if (!bloom)
+        return -1;
+
+    bloom->nbits = count * BLOOM_BITS_PER_ENTRY;
+    if (bloom->nbits < BLOOM_MIN_BITS)
+        bloom->nbits = BLOOM_MIN_BITS;
+
+    bloom->bits = (uint8_t *)calloc(1, (bloom->nbits + 7) / 8);
+    if (!bloom->bits) {
+        deref(bloom);
+        return -1;
+    }
+
+    for (i = 0; i < count; i++)
+        bloom_add(bloom, names[i]);
+
+    strcpy(bloom->folder, folder);
+    bloom->expires_at = time(NULL) + cache->ttl;
+    bloom->he.data = bloom;
+    bloom->he.key = bloom->folder;
+    bloom->he.keylen = len;
+
+    pthread_mutex_lock(&cache->lock);
+    if (cache->generation <= generation)
+        hashtable_put(cache->blooms, &bloom->he);
+    pthread_mutex_unlock(&cache->lock);
+
+    deref(bloom);
+    return 0;
+}
+
+static bloom_filter_t *get_live_bloom(negative_cache_t *cache,
+                                      const char *folder, time_t now)
+{
+    bloom_filter_t *bloom;
+
+    bloom = hashtable_get(cache->blooms, folder, strlen(folder));
+    if (bloom && bloom->expires_at <= now) {
+        deref(bloom);
+        bloom = hashtable_remove(cache->blooms, folder, strlen(folder));
+        if (bloom)
+            deref(bloom);
+        return NULL;
+    }
+
+    return bloom;
+}
+
+bool negative_cache_is_absent(negative_cache_t *cache, const char *path)
+{
+    bloom_filter_t *bloom;
+    absent_entry_t *entry;
+    time_t now = time(NULL);
+    char folder[256];
+    const char *name;
+    bool absent = false;
+
+    split_path(path, folder, sizeof(folder), &name);
+
+    pthread_mutex_lock(&cache->lock);
+
+    entry = hashtable_get(cache->absent, path, strlen(path));
+    if (entry) {
+        absent = entry->expires_at > now;
+        deref(entry);
+
+        if (!absent) {
+            entry = hashtable_remove(cache->absent, path, strlen(path));
+            if (entry)
+                deref(entry);
+        }
+    }
+
+    if (!absent) {
+        bloom = get_live_bloom(cache, folder, now);
+        if (bloom) {
+            absent = !bloom_contains(bloom, name);
+            deref(bloom);
+        }
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+
+    return absent;
+}
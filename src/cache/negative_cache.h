@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2019 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __NEGATIVE_CACHE_H__
+#define __NEGATIVE_CACHE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct negative_cache negative_cache_t;
+
+/*
+ * Create a cache remembering paths known to be absent in the backend.
+ * Every answer it gives expires after ttl seconds.
+ *
+ * A lookup answered before a concurrent write completes must not record
+ * the path absent afterwards. Lookups therefore take the generation of
+ * the cache before they are sent, and what they learnt is dropped if a
+ * write was recorded since.
+ */
+negative_cache_t *negative_cache_new(int ttl);
+
+void negative_cache_close(negative_cache_t *cache);
+
+uint64_t negative_cache_generation(negative_cache_t *cache);
+
+/*
+ * Record that path does not exist, e.g. after a 404 or a delete, as
+ * learnt by a lookup sent at generation. Ignored if path has been
+ * written since.
+ */
+void negative_cache_put(negative_cache_t *cache, const char *path,
+                        uint64_t generation);
+
+/*
+ * Record that path exists now, e.g. after a successful upload.
+ */
+void negative_cache_remove(negative_cache_t *cache, const char *path);
+
+/*
+ * Replace the Bloom filter of a folder with the entry names returned by a
+ * complete listing of that folder, sent at generation. Names not in the
+ * filter are then known to be absent until the filter expires. Ignored if
+ * anything has been written since.
+ */
+int negative_cache_seed(negative_cache_t *cache, const char *folder,
+                        const char **names, size_t count, uint64_t generation);
+
+/*
+ * Return true if path is definitely absent, false if unknown.
+ */
+bool negative_cache_is_absent(negative_cache_t *cache, const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __NEGATIVE_CACHE_H__
@@ -0,0 +1,610 @@
+/*
+ * Copyright (c) 2019 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#if defined(_WIN32) || defined(_WIN64)
+#include <io.h>
+#else
+#include <dirent.h>
+#endif
+
+#include <crystal.h>
+
+#include "object_cache.h"
+#include "lru.h"
+#include "mkdirs.h"
+#include "atomic_file.h"
+
+#ifndef O_BINARY
+#define O_BINARY                0
+#endif
+
+#define MAX_KEY_LEN             (128)
+
+/*
+ * Objects bigger than this share of the memory budget stay on disk only,
+ * so a single large read can not flush the whole hot tier.
+ */
+#define MEM_OBJECT_SHARE        (8)
+
+/*
+ * Temporary files of atomic writes untouched for this long (seconds) are
+ * left over by interrupted writes; younger ones may be in the making by
+ * another process sharing the directory.
+ */
+#define STALE_TEMP_AGE          (60 * 60)
+
+typedef struct cache_entry {
+    hash_entry_t he;
+    lru_node_t lru;
+    size_t size;
+    uint8_t *data;
+    char key[MAX_KEY_LEN + 1];
+} cache_entry_t;
+
+/*
+ * One level of the cache: its entries by key, and the same entries in
+ * recency order, most recently used first.
+ */
+typedef struct tier {
+    hashtable_t *entries;
+    lru_node_t lru;
+    size_t used;
+    size_t budget;
+} tier_t;
+
+struct object_cache {
+    pthread_mutex_t lock;
+    tier_t disk;
+    tier_t mem;
+    char dir[0];
+};
+
+static bool valid_key(const char *key)
+{
+    size_t len = strlen(key);
+    size_t i;
+
+    if (len < 2 || len > MAX_KEY_LEN)
+        return false;
+
+    for (i = 0; i < len; i++) {
+        if (!isalnum((unsigned char)key[i]))
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * CIDs share their leading characters (e.g. "Qm"), so objects are
+ * sharded by the last two.
+ */
+static int object_path(object_cache_t *cache, const char *key, bool shard_only,
+                       char *path, size_t len)
+{
+    const char *shard = key + strlen(key) - 2;
+    int rc;
+
+    if (shard_only)
+        rc = snprintf(path, len, "%s/%s", cache->dir, shard);
+    else
+        rc = snprintf(path, len, "%s/%s/%s", cache->dir, shard, key);
+
+    return (rc < 0 || rc >= (int)len) ? -1 : 0;
+}
+
+static void entry_destructor(void *p)
+{
+    cache_entry_t *entry = (cache_entry_t *)p;
+
+    if (entry->data)
+        free(entry->data);
+}
+
+static cache_entry_t *entry_new(const char *key, size_t size, const void *data)
+{
+    cache_entry_t *entry;
+
+    entry = (cache_entry_t *)rc_zalloc(sizeof(cache_entry_t), entry_destructor);
+    if (!entry)
+        return NULL;
+
+    if (data) {
+        entry->data = (uint8_t *)malloc(size ? size : 1);
+        if (!entry->data) {
+            deref(entry);
+            return NULL;
+        }
+        memcpy(entry->data, data, size);
+    }
+
+    strcpy(entry->key, key);
+    entry->size = size;
+    entry->he.data = entry;
+    entry->he.key = entry->key;
+    entry->he.keylen = strlen(entry->key);
+
+    return entry;
+}
+
+static int tier_init(tier_t *tier, size_t budget)
+{
+    tier->entries = hashtable_create(64, 0, NULL, NULL);
+    if (!tier->entries)
+        return -1;
+
+    lru_init(&tier->lru);
+    tier->budget = budget;
+
+    return 0;
+}
+
+/*
+ * Find an entry and mark it most recently used. The entry returned is
+ * borrowed from the tier and only valid while the lock is held.
+ */
+static cache_entry_t *tier_lookup(tier_t *tier, const char *key)
+{
+    cache_entry_t *entry;
+
+    entry = (cache_entry_t *)hashtable_get(tier->entries, key, strlen(key));
+    if (!entry)
+        return NULL;
+
+    lru_unlink(&entry->lru);
+    lru_push_front(&tier->lru, &entry->lru);
+    deref(entry);
+
+    return entry;
+}
+
+static void tier_insert(tier_t *tier, cache_entry_t *entry)
+{
+    hashtable_put(tier->entries, &entry->he);
+    lru_push_front(&tier->lru, &entry->lru);
+    tier->used += entry->size;
+}
+
+static void tier_remove(tier_t *tier, cache_entry_t *entry)
+{
+    lru_unlink(&entry->lru);
+    tier->used -= entry->size;
+
+    entry = (cache_entry_t *)hashtable_remove(tier->entries, entry->key,
+                                              strlen(entry->key));
+    if (entry)
+        deref(entry);
+}
+
+static void disk_evict(object_cache_t *cache)
+{
+    tier_t *tier = &cache->disk;
+    char path[PATH_MAX];
+
+    while (tier->used > tier->budget && !lru_empty(&tier->lru)) {
+        cache_entry_t *victim = lru_entry(lru_last(&tier->lru),
+                                          cache_entry_t, lru);
+
+        if (!object_path(cache, victim->key, false, path, sizeof(path)))
+            unlink(path);
+
+        tier_remove(tier, victim);
+    }
+}
+
+static void mem_evict(object_cache_t *cache)
+{
+    tier_t *tier = &cache->mem;
+
+    while (tier->used > tier->budget && !lru_empty(&tier->lru))
+        tier_remove(tier, lru_entry(lru_last(&tier->lru),
+                                    cache_entry_t, lru));
+}
+
+static void disk_remember(object_cache_t *cache, const char *key, size_t size)
+{
+    cache_entry_t *entry;
+
+    if (hashtable_exist(cache->disk.entries, key, strlen(key)))
+        return;
+
+    entry = entry_new(key, size, NULL);
+    if (!entry)
+        return;
+
+    tier_insert(&cache->disk, entry);
+    deref(entry);
+
+    disk_evict(cache);
+}
+
+static void disk_forget(object_cache_t *cache, const char *key)
+{
+    cache_entry_t *entry;
+
+    entry = (cache_entry_t *)hashtable_get(cache->disk.entries, key, strlen(key));
+    if (!entry)
+        return;
+
+    deref(entry);
+    tier_remove(&cache->disk, entry);
+}
+
+static void mem_remember(object_cache_t *cache, const char *key,
+                         const void *data, size_t size)
+{
+    cache_entry_t *entry;
+
+    if (size > cache->mem.budget / MEM_OBJECT_SHARE ||
+        hashtable_exist(cache->mem.entries, key, strlen(key)))
+        return;
+
+    entry = entry_new(key, size, data);
+    if (!entry)
+        return;
+
+    tier_insert(&cache->mem, entry);
+    deref(entry);
+
+    mem_evict(cache);
+}
+
+/*
+ * Look an object up on disk. Objects which are not indexed yet may have
+ * been stored by another process sharing the directory, so the disk
+ * itself is checked before giving up. Called with the lock held.
+ */
+static cache_entry_t *disk_lookup(object_cache_t *cache, const char *key)
+{
+    cache_entry_t *entry;
+    char path[PATH_MAX];
+    struct stat st;
+
+    entry = tier_lookup(&cache->disk, key);
+    if (entry)
+        return entry;
+
+    if (object_path(cache, key, false, path, sizeof(path)) < 0 ||
+        stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+        return NULL;
+
+    disk_remember(cache, key, (size_t)st.st_size);
+    return tier_lookup(&cache->disk, key);
+}
+
+static int read_object(const char *path, void *buf, size_t size)
+{
+    uint8_t *p = (uint8_t *)buf;
+    size_t left = size;
+    struct stat st;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_BINARY);
+    if (fd < 0)
+        return -1;
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size != size) {
+        close(fd);
+        return -1;
+    }
+
+    while (left > 0) {
+        ssize_t nrd = read(fd, p,
+#if defined(_WIN32) || defined(_WIN64)
+                           (unsigned)
+#endif
+                           left);
+        if (nrd < 0 && errno == EINTR)
+            continue;
+        if (nrd <= 0) {
+            close(fd);
+            return -1;
+        }
+
+        p += nrd;
+        left -= (size_t)nrd;
+    }
+
+    close(fd);
+    return 0;
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+typedef struct scanned {
+    char key[MAX_KEY_LEN + 1];
+    size_t size;
+    time_t mtime;
+} scanned_t;
+
+static int compare_mtime(const void *a, const void *b)
+{
+    const scanned_t *x = (const scanned_t *)a;
+    const scanned_t *y = (const scanned_t *)b;
+
+    return x->mtime < y->mtime ? -1 : (x->mtime > y->mtime ? 1 : 0);
+}
+
+/*
+ * Index the objects stored by earlier processes, oldest first, so the
+ * budget covers them and they are evicted before fresh ones. Stale
+ * leftovers of interrupted writes are removed.
+ */
+static void scan_objects(object_cache_t *cache)
+{
+    scanned_t *objects = NULL;
+    size_t nobjects = 0;
+    size_t capacity = 0;
+    struct dirent *shard;
+    char path[PATH_MAX];
+    time_t now = time(NULL);
+    DIR *dir;
+    size_t i;
+
+    dir = opendir(cache->dir);
+    if (!dir)
+        return;
+
+    while ((shard = readdir(dir))) {
+        struct dirent *file;
+        DIR *subdir;
+
+        if (strlen(shard->d_name) != 2 || shard->d_name[0] == '.')
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", cache->dir, shard->d_name);
+        subdir = opendir(path);
+        if (!subdir)
+            continue;
+
+        while ((file = readdir(subdir))) {
+            const char *name = file->d_name;
+            size_t len = strlen(name);
+            struct stat st;
+
+            if (name[0] == '.')
+                continue;
+
+            snprintf(path, sizeof(path), "%s/%s/%s", cache->dir,
+                     shard->d_name, name);
+
+            if (stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+                continue;
+
+            if (strchr(name, '.')) {
+                if (now - st.st_mtime > STALE_TEMP_AGE)
+                    unlink(path);
+                continue;
+            }
+
+            if (!valid_key(name) || strcmp(name + len - 2, shard->d_name))
+                continue;
+
+            if (nobjects == capacity) {
+                size_t n = capacity ? capacity * 2 : 256;
+                scanned_t *p = (scanned_t *)realloc(objects, n * sizeof(scanned_t));
+                if (!p)
+                    break;
+
+                objects = p;
+                capacity = n;
+            }
+
+            strcpy(objects[nobjects].key, name);
+            objects[nobjects].size = (size_t)st.st_size;
+            objects[nobjects].mtime = st.st_mtime;
+            nobjects++;
+        }
+
+        closedir(subdir);
+    }
+
+    closedir(dir);
+
+    if (!objects)
+        return;
+
+    qsort(objects, nobjects, sizeof(scanned_t), compare_mtime);
+    for (i = 0; i < nobjects; i++)
+        disk_remember(cache, objects[i].key, objects[i].size);
+
+    free(objects);
+}
+#else
+/*
+ * Without a directory scan, objects stored by earlier processes are
+ * indexed as they are found; the budget only covers indexed ones.
+ */
+#define scan_objects(cache)
+#endif
+
+static void object_cache_destructor(void *p)
+{
+    object_cache_t *cache = (object_cache_t *)p;
+
+    if (cache->disk.entries)
+        deref(cache->disk.entries);
+
+    if (cache->mem.entries)
+        deref(cache->mem.entries);
+
+    pthread_mutex_destroy(&cache->lock);
+}
+
+object_cache_t *object_cache_new(const char *dir, size_t disk_budget,
+                                 size_t mem_budget)
+{
+    object_cache_t *cache;
+    int rc;
+
+    cache = (object_cache_t *)rc_zalloc(sizeof(object_cache_t) + strlen(dir) + 1,
+                                        object_cache_destructor);
+    if (!cache)
+        return NULL;
+
+    pthread_mutex_init(&cache->lock, NULL);
+    strcpy(cache->dir, dir);
+
+    if (tier_init(&cache->disk, disk_budget) < 0 ||
+        tier_init(&cache->mem, mem_budget) < 0) {
+        deref(cache);
+        return NULL;
+    }
+
+    rc = mkdirs(dir, S_IRWXU);
+    if (rc < 0 && errno != EEXIST) {
+        vlogW("ObjectCache: Can not create cache directory %s (%d).", dir, errno);
+        deref(cache);
+        return NULL;
+    }
+
+    scan_objects(cache);
+
+    return cache;
+}
+
+void object_cache_close(object_cache_t *cache)
+{
+    if (cache)
+        deref(cache);
+}
+
+ssize_t object_cache_length(object_cache_t *cache, const char *key)
+{
+    cache_entry_t *entry;
+    ssize_t size = -1;
+
+    if (!valid_key(key))
+        return -1;
+
+    pthread_mutex_lock(&cache->lock);
+
+    entry = tier_lookup(&cache->mem, key);
+    if (!entry)
+        entry = disk_lookup(cache, key);
+    if (entry)
+        size = (ssize_t)entry->size;
+
+    pthread_mutex_unlock(&cache->lock);
+
+    return size;
+}
+
+ssize_t object_cache_get(object_cache_t *cache, const char *key,
+                         void *buf, size_t buflen)
+{
+    cache_entry_t *entry;
+    char path[PATH_MAX];
+    ssize_t size = -1;
+
+    if (!valid_key(key) || object_path(cache, key, false, path, sizeof(path)) < 0)
+        return -1;
+
+    pthread_mutex_lock(&cache->lock);
+
+    entry = tier_lookup(&cache->mem, key);
+    if (entry) {
+        if (entry->size <= buflen) {
+            memcpy(buf, entry->data, entry->size);
+            size = (ssize_t)entry->size;
+        }
+        pthread_mutex_unlock(&cache->lock);
+        return size;
+    }
+
+    entry = disk_lookup(cache, key);
+    if (entry)
+        size = (ssize_t)entry->size;
+
+    pthread_mutex_unlock(&cache->lock);
+
+    if (size < 0 || (size_t)size > buflen)
+        return -1;
+
+    /*
+     * Read outside the lock; the object may have been evicted meanwhile,
+     * by this process or another one sharing the directory.
+     */
+    if (read_object(path, buf, (size_t)size) < 0) {
+        pthread_mutex_lock(&cache->lock);
+        disk_forget(cache, key);
+        pthread_mutex_unlock(&cache->lock);
+        return -1;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    mem_remember(cache, key, buf, (size_t)size);
+    pthread_mutex_unlock(&cache->lock);
+
+    return size;
+}
+
+void object_cache_put(object_cache_t *cache, const char *key,
+                      const void *data, size_t len)
+{
+    char path[PATH_MAX];
+    bool cached;
+    int rc;
+
+    if (!valid_key(key) || len > cache->disk.budget ||
+        object_path(cache, key, true, path, sizeof(path)) < 0)
+        return;
+
+    pthread_mutex_lock(&cache->lock);
+    cached = disk_lookup(cache, key) != NULL;
+    mem_remember(cache, key, data, len);
+    pthread_mutex_unlock(&cache->lock);
+
+    if (cached)
+        return;
+
+    rc = mkdirs(path, S_IRWXU);
+    if (rc < 0 && errno != EEXIST) {
+        vlogW("ObjectCache: Can not create shard %s (%d).", path, errno);
+        return;
+    }
+
+    object_path(cache, key, false, path, sizeof(path));
+    rc = atomic_write_file(path, data, len, S_IRUSR | S_IWUSR);
+    if (rc < 0) {
+        vlogW("ObjectCache: Can not store object %s (%d).", key, errno);
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    disk_remember(cache, key, len);
+    pthread_mutex_unlock(&cache->lock);
+}
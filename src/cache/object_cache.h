@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2019 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __OBJECT_CACHE_H__
+#define __OBJECT_CACHE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include "ela_hive.h"
+
+typedef struct object_cache object_cache_t;
+
+/*
+ * Create a cache of immutable objects keyed by their content address
+ * (e.g. an IPFS CID), kept on disk under dir and sharded by the last two
+ * characters of the key. The least recently used objects are evicted
+ * once they take more than disk_budget bytes. Recently read objects, up
+ * to mem_budget bytes, are also kept in memory.
+ *
+ * Objects are never revalidated, as their content can not change. Other
+ * processes may share the same directory.
+ */
+object_cache_t *object_cache_new(const char *dir, size_t disk_budget,
+                                 size_t mem_budget);
+
+void object_cache_close(object_cache_t *cache);
+
+/*
+ * Return the size of a cached object, or -1 if it is not cached.
+ */
+ssize_t object_cache_length(object_cache_t *cache, const char *key);
+
+/*
+ * Copy a cached object into buf. Return its size, or -1 if it is not
+ * cached or does not fit into buflen bytes.
+ */
+ssize_t object_cache_get(object_cache_t *cache, const char *key,
+                         void *buf, size_t buflen);
+
+/*
+ * Add an object to the cache. The cache is best effort, so failures are
+ * only logged.
+ */
+void object_cache_put(object_cache_t *cache, const char *key,
+                      const void *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __OBJECT_CACHE_H__
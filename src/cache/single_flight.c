@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2019 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <crystal.h>
+
+#include "single_flight.h"
+
+struct flight {
+    hash_entry_t he;
+    bool landed;
+    int followers;
+    int rc;
+    const uint8_t *data;
+    size_t size;
+    char key[0];
+};
+
+/*
+ * Flights are few and short, so one condition serves them all.
+ */
+struct single_flight {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    hashtable_t *flights;
+};
+
+static void single_flight_destructor(void *p)
+{
+    single_flight_t *sf = (single_flight_t *)p;
+
+    if (sf->flights)
+        deref(sf->flights);
+
+    pthread_cond_destroy(&sf->cond);
+    pthread_mutex_destroy(&sf->lock);
+}
+
+single_flight_t *single_flight_new(void)
+{
+    single_flight_t *sf;
+
+    sf = (single_flight_t *)rc_zalloc(sizeof(single_flight_t), single_flight_destructor);
+    if (!sf)
+        return NULL;
+
+    pthread_mutex_init(&sf->lock, NULL);
+    pthread_cond_init(&sf->cond, NULL);
+
+    sf->flights = hashtable_create(16, 0, NULL, NULL);
+    if (!sf->flights) {
+        deref(sf);
+        return NULL;
+    }
+
+    return sf;
+}
+
+void single_flight_close(single_flight_t *sf)
+{
+    if (sf)
+        deref(sf);
+}
+
+bool single_flight_join(single_flight_t *sf, const char *key, flight_t **flight)
+{
+    size_t len = strlen(key);
+    flight_t *f;
+
+    pthread_mutex_lock(&sf->lock);
+
+    while ((f = (flight_t *)hashtable_get(sf->flights, key, len)) != NULL) {
+        f->followers++;
+        while (!f->landed)
+            pthread_cond_wait(&sf->cond, &sf->lock);
+
+        if (f->rc != HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL)) {
+            pthread_mutex_unlock(&sf->lock);
+
+            *flight = f;
+            return false;
+        }
+
+        /* The leader's buffer was too small: the object is still unread. */
+        if (!--f->followers)
+            pthread_cond_broadcast(&sf->cond);
+        deref(f);
+    }
+
+    f = (flight_t *)rc_zalloc(sizeof(flight_t) + len + 1, NULL);
+    if (f) {
+        strcpy(f->key, key);
+        f->he.data = f;
+        f->he.key = f->key;
+        f->he.keylen = len;
+        hashtable_put(sf->flights, &f->he);
+    }
+
+    pthread_mutex_unlock(&sf->lock);
+
+    *flight = f;
+    return true;
+}
+
+void single_flight_land(single_flight_t *sf, flight_t *flight, int rc,
+                        const void *data, size_t size)
+{
+    flight_t *f;
+
+    if (!flight)
+        return;
+
+    pthread_mutex_lock(&sf->lock);
+
+    /*
+     * Readers from now on start a flight of their own. The flight may
+     * have been forgotten, and another one be reading the key now.
+     */
+    f = (flight_t *)hashtable_get(sf->flights, flight->key, strlen(flight->key));
+    if (f == flight)
+        deref(hashtable_remove(sf->flights, flight->key, strlen(flight->key)));
+    if (f)
+        deref(f);
+
+    flight->rc = rc;
+    flight->data = (const uint8_t *)data;
+    flight->size = rc < 0 ? 0 : size;
+    flight->landed = true;
+    pthread_cond_broadcast(&sf->cond);
+
+    while (flight->followers)
+        pthread_cond_wait(&sf->cond, &sf->lock);
+
+    pthread_mutex_unlock(&sf->lock);
+
+    deref(flight);
+}
+
+void single_flight_leave(single_flight_t *sf, flight_t *flight)
+{
+    pthread_mutex_lock(&sf->lock);
+
+    if (!--flight->followers)
+        pthread_cond_broadcast(&sf->cond);
+
+    pthread_mutex_unlock(&sf->lock);
+
+    deref(flight);
+}
+
+void single_flight_forget(single_flight_t *sf, const char *key)
+{
+    size_t len = strlen(key);
+    flight_t *f;
+
+    pthread_mutex_lock(&sf->lock);
+
+    f = (flight_t *)hashtable_remove(sf->flights, key, len);
+    if (f)
+        deref(f);
+
+    pthread_mutex_unlock(&sf->lock);
+}
+
+ssize_t single_flight_copy(flight_t *flight, void *buf, size_t buflen)
+{
+    int rc = flight->rc;
+
+    if (rc >= 0 && flight->size > buflen)
+        rc = HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
+
+    if (rc < 0)
+        return rc;
+
+    if (flight->size)
+        memcpy(buf, flight->data, flight->size);
+
+    return (ssize_t)flight->size;
+}
+
+int single_flight_dup(flight_t *flight, uint8_t **data, size_t *size)
+{
+    uint8_t *buf;
+
+    if (flight->rc < 0)
+        return flight->rc;
+
+    buf = (uint8_t *)malloc(flight->size ? flight->size : 1);
+    if (!buf)
+        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+
+    if (flight->size)
+        memcpy(buf, flight->data, flight->size);
+
+    *data = buf;
+    *size = flight->size;
+    return 0;
+}
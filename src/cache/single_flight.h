@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2019 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __SINGLE_FLIGHT_H__
+#define __SINGLE_FLIGHT_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ela_hive.h"
+
+typedef struct single_flight single_flight_t;
+typedef struct flight flight_t;
+
+/*
+ * Coalesce concurrent reads of the same object into one request. The
+ * first reader of a key leads the flight and reads the object into its
+ * own buffer; readers of the key arriving meanwhile follow it, wait for
+ * it to land and copy the object out of the leader's buffer, which the
+ * leader keeps valid until all of them have.
+ */
+single_flight_t *single_flight_new(void);
+
+void single_flight_close(single_flight_t *sf);
+
+/*
+ * Join the flight reading key. Return true if the caller leads it, in
+ * which case it reads the object and then calls single_flight_land();
+ * *flight is NULL if the flight could not be set up, and the caller just
+ * reads on its own. Otherwise wait for the leader to land and return
+ * false: the caller copies the outcome out with single_flight_copy() or
+ * single_flight_dup(), then calls single_flight_leave(). A leader landing
+ * with HIVEERR_BUFFER_TOO_SMALL read nothing its followers can use: they
+ * join again, and one of them leads the next flight.
+ */
+bool single_flight_join(single_flight_t *sf, const char *key, flight_t **flight);
+
+/*
+ * Publish the outcome of the read, an error or the size bytes of data,
+ * and wait for the followers to be done with data.
+ */
+void single_flight_land(single_flight_t *sf, flight_t *flight, int rc,
+                        const void *data, size_t size);
+
+void single_flight_leave(single_flight_t *sf, flight_t *flight);
+
+/*
+ * Detach the flight reading key, if any, once the object was written:
+ * its followers still get what it read, while readers from now on start
+ * a new flight, and read what was written.
+ */
+void single_flight_forget(single_flight_t *sf, const char *key);
+
+/*
+ * Copy the object the leader read into buf. Return its size, the error
+ * of the leader, or HIVEERR_BUFFER_TOO_SMALL if buf can not hold it.
+ */
+ssize_t single_flight_copy(flight_t *flight, void *buf, size_t buflen);
+
+/*
+ * Copy the object the leader read into a new buffer, to be freed by the
+ * caller. Return 0, or the error of the leader.
+ */
+int single_flight_dup(flight_t *flight, uint8_t **data, size_t *size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __SINGLE_FLIGHT_H__
@@ -81,6 +81,24 @@ enum HiveBackendType {
      */
     HiveBackendType_OneDrive  = 0x10,
 
+    /**
+     * \~English
+     * A directory on the local filesystem.
+     */
+    HiveBackendType_Native    = 0x40,
+
+    /**
+     * \~English
+     * A local cache in front of another connection.
+     */
+    HiveBackendType_Cache     = 0x41,
+
+    /**
+     * \~English
+     * Copies of the content kept on several other connections.
+     */
+    HiveBackendType_Mirror    = 0x42,
+
     /**
      * \~English
      * OwnCloud(not implemented).
@@ -273,8 +291,144 @@ typedef struct OneDriveConnectOptions {
      * User data to be passed as context parameter to callback.
      */
     void *context;
+
+    /**
+     * \~English
+     * Fraction of the access token lifetime, counted back from its expiry,
+     * at which the token is renewed in background (e.g. 0.2 renews a
+     * one-hour token 12 minutes before it expires). 0 selects the default
+     * of 0.2; a negative value disables background renewal, in which case
+     * the token is renewed by the first request that finds it expired.
+     */
+    double token_refresh_ahead;
+
+    /**
+     * \~English
+     * Memory budget in bytes of the cache of recently read files and key
+     * values. A cached copy is revalidated with a conditional request,
+     * which the server answers without the content while it is current.
+     * 0 selects the default of 8 MB; a negative value disables the cache.
+     */
+    ssize_t memory_cache_capacity;
+
+    /**
+     * \~English
+     * Seconds during which a cached copy, once read or revalidated, is
+     * served without asking the server, so changes made elsewhere may go
+     * unseen for that long. 0 revalidates on every read.
+     */
+    int memory_cache_max_age;
 } OneDriveConnectOptions;
 
+/**
+ * \~English
+ * Native connect options. The native backend keeps files and key values
+ * in a local directory, for use without connectivity.
+ */
+typedef struct NativeConnectOptions {
+    /**
+     * \~English
+     * Specifies the backend type of the connection.
+     */
+    int backendType;
+
+    /**
+     * \~English
+     * The directory holding the stored data, created if missing. NULL
+     * selects the "native" directory under the client data location.
+     */
+    const char *root;
+} NativeConnectOptions;
+
+/**
+ * \~English
+ * Cache connect options. The cache keeps copies of the files and key
+ * values of another connection on the local disk, and serves reads from
+ * them while the backend reports the same version (e.g. eTag) of the
+ * content, or when the backend can not be reached. Writes are acknowledged
+ * once flushed to the local disk, and written back to the backend in
+ * background, in order, retried while it fails transiently. Deleting and
+ * listing wait for pending writes to be written back first. A write the
+ * backend rejects for good fails the next call on the same file or key,
+ * with the error of the backend.
+ *
+ * Backends unable to report versions have their reads passed through.
+ */
+typedef struct CacheConnectOptions {
+    /**
+     * \~English
+     * Specifies the backend type of the connection.
+     */
+    int backendType;
+
+    /**
+     * \~English
+     * The connection to cache. Disconnecting the cache connection does not
+     * disconnect it.
+     */
+    HiveConnect *backend;
+
+    /**
+     * \~English
+     * The directory holding the cache, created if missing. NULL selects
+     * the "cache" directory under the client data location. A directory
+     * serves one connection at a time, and must not be shared by caches
+     * of different backends: writes not written back before a disconnect
+     * are written back to the backend it is next connected with.
+     */
+    const char *root;
+
+    /**
+     * \~English
+     * The disk space the cached copies may take, in bytes, the least
+     * recently used being evicted beyond it. 0 selects the default of
+     * 256MB.
+     */
+    size_t capacity;
+} CacheConnectOptions;
+
+/**
+ * \~English
+ * Mirror connect options. The mirror keeps the files and key values it is
+ * given on several connections: writes are made on all of them at once,
+ * taking about as long as the slowest, and succeed once made on a quorum
+ * of them. Reads go to the connection which recently answered fastest,
+ * and move on to the next ones while it fails or lacks the content.
+ * Listings merge those of enough connections to hold every file.
+ *
+ * Only the functions all the connections support are offered, e.g. the
+ * IPFS functions when mirroring IPFS nodes, or the file and key value
+ * functions when mirroring OneDrive and native connections.
+ */
+typedef struct MirrorConnectOptions {
+    /**
+     * \~English
+     * Specifies the backend type of the connection.
+     */
+    int backendType;
+
+    /**
+     * \~English
+     * The connections to mirror, at most 16. Disconnecting the mirror
+     * connection does not disconnect them.
+     */
+    HiveConnect **backends;
+
+    /**
+     * \~English
+     * The count of connections in backends.
+     */
+    size_t count;
+
+    /**
+     * \~English
+     * The count of connections a write must be made on to succeed. 0
+     * requires all of them. A write which fails may still have been made
+     * on some.
+     */
+    size_t quorum;
+} MirrorConnectOptions;
+
 /**
  * \~English
  * The IPFS node.
@@ -297,8 +451,61 @@ typedef struct IPFSNode {
      * TCP service port.
      */
     const char *port;
+
+    /**
+     * \~English
+     * Absolute path of the Unix domain socket the node's API listens on,
+     * for a node running on the same host. When set, requests skip the
+     * TCP loopback stack and ipv4, ipv6 and port are ignored; NULL for a
+     * node reached over TCP.
+     */
+    const char *unix_socket;
 } IPFSNode;
 
+/**
+ * \~English
+ * Circuit breaker state of an IPFS node.
+ */
+typedef enum IPFSNodeState {
+    /**
+     * \~English
+     * The node is healthy and takes requests.
+     */
+    IPFSNodeState_Closed = 0,
+
+    /**
+     * \~English
+     * The node failed and takes no requests. It is re-probed in background
+     * with exponential backoff.
+     */
+    IPFSNodeState_Open = 1,
+
+    /**
+     * \~English
+     * The node answered a re-probe and takes a single trial request,
+     * which closes the circuit on success and opens it again on failure.
+     */
+    IPFSNodeState_HalfOpen = 2
+} IPFSNodeState;
+
+/**
+ * \~English
+ * User defined function to be notified when an IPFS node changes state.
+ * It is called from a background thread of the connection, one change at
+ * a time and in the order they happened.
+ *
+ * @param
+ *      index       [in] Index of the node in rpcNodes of the options.
+ * @param
+ *      node        [in] Addresses of the node.
+ * @param
+ *      state       [in] The new state of the node.
+ * @param
+ *      context     [in] User data.
+ */
+typedef void IPFSNodeStateCallback(size_t index, const IPFSNode *node,
+                                   IPFSNodeState state, void *context);
+
 /**
  * \~English
  * The IPFS connection options.
@@ -321,6 +528,43 @@ typedef struct IPFSConnectOptions {
      * The array of addresses of IPFS RPC nodes.
      */
     IPFSNode *rpcNodes;
+
+    /**
+     * \~English
+     * Fraction of reads which may be hedged, between 0 and 1 (e.g. 0.05
+     * allows at most one hedge per 20 reads). A read which has not got a
+     * first byte within the p95 latency of its node is sent to a second
+     * node too, and the first response wins. 0 disables hedging.
+     */
+    double hedge_budget;
+
+    /**
+     * \~English
+     * Optional callback to be notified of node state changes.
+     */
+    IPFSNodeStateCallback *state_callback;
+
+    /**
+     * \~English
+     * User data to be passed as context parameter to state_callback.
+     */
+    void *state_context;
+
+    /**
+     * \~English
+     * Disk budget in bytes of the local cache of downloaded and uploaded
+     * objects, kept under data_location/ipfs-cache. IPFS content never
+     * changes, so cached reads involve no network at all. 0 selects the
+     * default of 256 MB; a negative value disables the cache.
+     */
+    ssize_t cache_capacity;
+
+    /**
+     * \~English
+     * Maximum count of CIDs looked up per request by
+     * hive_ipfs_get_file_lengths(). 0 selects the default of 64.
+     */
+    size_t lookup_batch_size;
 } IPFSConnectOptions;
 
 /******************************************************************************
@@ -365,6 +609,12 @@ int hive_client_close(HiveClient *client);
  * Connect to a specific backend. Credentials are loaded from persistent location
  * configured to the client instance passed.
  *
+ * The returned connection is thread-safe: file, key-value and IPFS APIs may
+ * be invoked on it from multiple threads concurrently. An expired access
+ * token is refreshed once no matter how many threads find it expired, and
+ * a failing IPFS node is re-probed by a background thread. The connection
+ * must not be disconnected while other threads are still using it.
+ *
  * @param
  *      client      [in] A client instance.
  * @param
@@ -611,6 +861,162 @@ int hive_ipfs_put_file(HiveConnect *connect, const char *from, bool encrypt, IPF
 HIVE_API
 int hive_ipfs_put_file_from_buffer(HiveConnect *connect, const void *from, size_t length, bool encrypt, IPFSCid *cid);
 
+/**
+ * \~English
+ * The options of adding content to IPFS. A field left zero or NULL keeps
+ * the default of the IPFS node, except pin.
+ */
+typedef struct IPFSAddOptions {
+    /**
+     * \~English
+     * Chunking algorithm, such as "size-262144" or "rabin-min-avg-max".
+     */
+    const char *chunker;
+
+    /**
+     * \~English
+     * Whether to store leaf blocks as raw data instead of wrapping them
+     * in unixfs nodes.
+     */
+    bool raw_leaves;
+
+    /**
+     * \~English
+     * CID version, 0 or 1.
+     */
+    int cid_version;
+
+    /**
+     * \~English
+     * Hash function, such as "sha2-256" or "blake2b-256".
+     */
+    const char *hash;
+
+    /**
+     * \~English
+     * Whether to pin the added content on the IPFS node.
+     */
+    bool pin;
+
+    /**
+     * \~English
+     * Whether to split the content into chunks and upload them as
+     * separate blocks in parallel across all usable IPFS nodes, the file
+     * DAG being assembled locally. The resulting CID is the same as that
+     * of a regular add. Only the default chunker, hash, CID version 0
+     * and no raw leaves are supported in this mode.
+     *
+     * The blocks end up spread over the nodes, none holding the whole
+     * DAG; with pin set, the pinning node fetches the rest from its
+     * peers. The nodes must therefore be peered with each other, or the
+     * pin fails after a timeout and the content can not be read whole
+     * from any single node.
+     */
+    bool parallel;
+} IPFSAddOptions;
+
+/**
+ * \~English
+ * User defined function to supply the content being uploaded.
+ *
+ * @param
+ *      buffer      [out] The buffer to fill.
+ * @param
+ *      length      [in] Length of the buffer.
+ * @param
+ *      context     [in] The application defined context data.
+ *
+ * @return
+ *      Return the number of bytes filled in, 0 at the end of the content,
+ *      or -1 to abort the upload.
+ */
+typedef ssize_t HiveReadCallback(void *buffer, size_t length, void *context);
+
+/**
+ * \~English
+ * Upload content to IPFS, streamed from a callback as it is sent so that
+ * content of any size takes constant memory.
+ *
+ * @param
+ *      connect     [in] A connect instance.
+ * @param
+ *      callback    [in] The function supplying the content.
+ * @param
+ *      context     [in] The application defined context data.
+ * @param
+ *      length      [in] Length of the content, or -1 if unknown.
+ * @param
+ *      options     [in] The add options, or NULL for the defaults of the
+ *                       IPFS node.
+ * @param
+ *      cid         [in] CID of uploaded content.
+ *
+ * @return
+ *      If no error occurs, return 0. Otherwise, return -1, and a specific
+ *      error code can be retrieved by calling hive_get_error().
+ */
+HIVE_API
+int hive_ipfs_add(HiveConnect *connect, HiveReadCallback *callback,
+                  void *context, ssize_t length,
+                  const IPFSAddOptions *options, IPFSCid *cid);
+
+/**
+ * \~English
+ * An object of a batch upload to IPFS.
+ */
+typedef struct IPFSAddItem {
+    /**
+     * \~English
+     * Name of the object in the batch, or NULL to name it by its index.
+     * Names must not contain '/', and must be unique when the batch is
+     * wrapped in a directory.
+     */
+    const char *name;
+
+    /**
+     * \~English
+     * Path of a file to upload, or NULL to upload the buffer below.
+     */
+    const char *path;
+
+    /**
+     * \~English
+     * A pointer to the content buffer.
+     */
+    const void *data;
+
+    /**
+     * \~English
+     * Length of the content buffer.
+     */
+    size_t length;
+} IPFSAddItem;
+
+/**
+ * \~English
+ * Upload many buffers or files to IPFS in a single request.
+ *
+ * @param
+ *      connect     [in] A connect instance.
+ * @param
+ *      items       [in] The objects to upload.
+ * @param
+ *      count       [in] The count of objects.
+ * @param
+ *      cids        [out] CIDs of the uploaded objects, in the order of
+ *                        items.
+ * @param
+ *      root        [out] If not NULL, the objects are wrapped in a
+ *                        directory whose CID is returned here.
+ *
+ * @return
+ *      If no error occurs, return 0. Otherwise, return -1, and a specific
+ *      error code can be retrieved by calling hive_get_error().
+ */
+HIVE_API
+int hive_ipfs_put_files(HiveConnect *connect, const IPFSAddItem *items,
+                        size_t count, IPFSCid *cids, IPFSCid *root);
+
 /**
  * \~English
  * Get the length of a file in IPFS.
@@ -627,6 +1033,28 @@ int hive_ipfs_put_file_from_buffer(HiveConnect *connect, const void *from, size_
 HIVE_API
 ssize_t hive_ipfs_get_file_length(HiveConnect *connect, const IPFSCid *cid);
 
+/**
+ * \~English
+ * Get the lengths of many files in IPFS. The CIDs are looked up in
+ * batches, several of them at once.
+ *
+ * @param
+ *      connect    [in] A connect instance.
+ * @param
+ *      cids       [in] CIDs of the files.
+ * @param
+ *      count      [in] The count of CIDs.
+ * @param
+ *      sizes      [out] Lengths of the files, in the order of cids.
+ *
+ * @return
+ *      If no error occurs, return 0. Otherwise, return -1, and a specific
+ *      error code can be retrieved by calling hive_get_error().
+ */
+HIVE_API
+int hive_ipfs_get_file_lengths(HiveConnect *connect, const IPFSCid *cids,
+                               size_t count, ssize_t *sizes);
+
 /**
  * \~English
  * Download a file in IPFS to buffer.
@@ -649,6 +1077,31 @@ ssize_t hive_ipfs_get_file_length(HiveConnect *connect, const IPFSCid *cid);
 HIVE_API
 ssize_t hive_ipfs_get_file_to_buffer(HiveConnect *connect, const IPFSCid *cid,  bool decrypt, void *to, size_t bulen);
 
+/**
+ * \~English
+ * Download a byte range of a file in IPFS to buffer. Only the range is
+ * transferred, and the file may be larger than HIVE_MAX_FILE_SIZE.
+ *
+ * @param
+ *      connect    [in] A connect instance.
+ * @param
+ *      cid        [in] CID of the file.
+ * @param
+ *      offset     [in] Offset of the first byte to read.
+ * @param
+ *      length     [in] Count of bytes to read, and length of the buffer.
+ * @param
+ *      to         [in] A pointer to buffer.
+ *
+ * @return
+ *      If no error occurs, return the count of bytes read, which is less
+ *      than length only at the end of the file. Otherwise, return -1, and
+ *      a specific error code can be retrieved by calling hive_get_error().
+ */
+HIVE_API
+ssize_t hive_ipfs_get_file_range(HiveConnect *connect, const IPFSCid *cid,
+                                 uint64_t offset, size_t length, void *to);
+
 /**
  * \~English
  * Download a file in IPFS.
@@ -669,6 +1122,138 @@ ssize_t hive_ipfs_get_file_to_buffer(HiveConnect *connect, const IPFSCid *cid,
 HIVE_API
 ssize_t hive_ipfs_get_file(HiveConnect *connect, const IPFSCid *cid, bool decrypt, const char *to);
 
+/**
+ * \~English
+ * Export the DAG under a root CID as a CAR archive, streamed into a file
+ * descriptor as it is received.
+ *
+ * @param
+ *      connect    [in] A connect instance.
+ * @param
+ *      root       [in] CID of the root of the DAG.
+ * @param
+ *      fd         [in] The file descriptor to write the archive to.
+ *
+ * @return
+ *      If no error occurs, return the length of the archive. Otherwise,
+ *      return -1, and a specific error code can be retrieved by calling
+ *      hive_get_error().
+ */
+HIVE_API
+ssize_t hive_ipfs_export_car(HiveConnect *connect, const IPFSCid *root, int fd);
+
+/**
+ * \~English
+ * Import the blocks of a CAR archive, streamed from a file descriptor as
+ * it is sent. The roots of the archive are pinned.
+ *
+ * @param
+ *      connect    [in] A connect instance.
+ * @param
+ *      fd         [in] The file descriptor to read the archive from.
+ * @param
+ *      roots      [out] CIDs of the roots of the archive.
+ * @param
+ *      count      [in] The count of CIDs roots can hold.
+ *
+ * @return
+ *      If no error occurs, return the count of roots in the archive,
+ *      which may be more than count. Otherwise, return -1, and a specific
+ *      error code can be retrieved by calling hive_get_error().
+ */
+HIVE_API
+ssize_t hive_ipfs_import_car(HiveConnect *connect, int fd, IPFSCid *roots,
+                             size_t count);
+
+/**
+ * \~English
+ * IPFS connection statistics.
+ */
+typedef struct IPFSStats {
+    /**
+     * \~English
+     * Reads sent to a second node because the first one was slow.
+     */
+    uint64_t hedges_fired;
+
+    /**
+     * \~English
+     * Hedged reads which the second node answered first.
+     */
+    uint64_t hedges_won;
+} IPFSStats;
+
+/**
+ * \~English
+ * Get the statistics of an IPFS connection.
+ *
+ * @param
+ *      connect    [in] A connect instance.
+ * @param
+ *      stats      [out] The statistics.
+ *
+ * @return
+ *      If no error occurs, return 0. Otherwise, return -1, and a specific
+ *      error code can be retrieved by calling hive_get_error().
+ */
+HIVE_API
+int hive_ipfs_get_stats(HiveConnect *connect, IPFSStats *stats);
+
+/**
+ * \~English
+ * Statistics of the memory cache of a connection, covering reads of files
+ * and key values.
+ */
+typedef struct HiveCacheStats {
+    /**
+     * \~English
+     * Reads served from memory, revalidated or not.
+     */
+    uint64_t hits;
+
+    /**
+     * \~English
+     * Hits the server was asked about first, and answered the cached
+     * copy was still current.
+     */
+    uint64_t revalidations;
+
+    /**
+     * \~English
+     * Reads which downloaded the content.
+     */
+    uint64_t misses;
+
+    /**
+     * \~English
+     * Memory taken by the cached copies, in bytes.
+     */
+    uint64_t bytes;
+
+    /**
+     * \~English
+     * Number of cached copies.
+     */
+    uint64_t objects;
+} HiveCacheStats;
+
+/**
+ * \~English
+ * Get the statistics of the memory cache of a connection. The hit rate is
+ * hits / (hits + misses).
+ *
+ * @param
+ *      connect    [in] A connect instance.
+ * @param
+ *      stats      [out] The statistics.
+ *
+ * @return
+ *      If no error occurs, return 0. Otherwise, return -1, and a specific
+ *      error code can be retrieved by calling hive_get_error().
+ */
+HIVE_API
+int hive_get_cache_stats(HiveConnect *connect, HiveCacheStats *stats);
+
 /**
  * \~English
  * Append value to the specified key.
@@ -30,6 +30,9 @@
 #include "hive_client.h"
 #include "ipfs.h"
 #include "onedrive.h"
+#include "native.h"
+#include "cache.h"
+#include "mirror.h"
 #include "mkdirs.h"
 
 typedef struct FactoryMethod {
@@ -40,6 +43,9 @@ typedef struct FactoryMethod {
 static FactoryMethod factory_methods[] = {
     {HiveBackendType_IPFS,     ipfs_client_connect     },
     {HiveBackendType_OneDrive, onedrive_client_connect },
+    {HiveBackendType_Native,   native_client_connect   },
+    {HiveBackendType_Cache,    cache_client_connect    },
+    {HiveBackendType_Mirror,   mirror_client_connect   },
     {HiveBackendType_Butt,     NULL }
 };
 
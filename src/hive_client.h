@@ -33,6 +33,20 @@ struct HiveClient {
     char data_location[0];
 };
 
+/*
+ * Rewind the source of an upload to its start, so it can be read twice.
+ * Return 0 on success.
+ */
+typedef int hive_rewind_callback_t(void *context);
+
+/*
+ * Max length of a content version, an opaque tag (e.g. an eTag) which
+ * changes whenever the content of a file or key does. Backends able to
+ * tell it cheaply implement get_file_version and get_key_version, so
+ * copies of their content can be revalidated without a download.
+ */
+#define HIVE_MAX_VERSION_LEN        (128)
+
 struct HiveConnect {
     int state;  // login state.
 
@@ -41,15 +55,26 @@ struct HiveConnect {
     ssize_t (*get_file_to_buffer)       (HiveConnect *, const char *, bool, void *, size_t);
     int     (*list_files)               (HiveConnect *, HiveFilesIterateCallback *, void *);
     int     (*delete_file)              (HiveConnect *, const char *);
+    int     (*get_file_version)         (HiveConnect *, const char *, char *, size_t);
 
     int     (*ipfs_put_file_from_buffer)(HiveConnect *, const void *, size_t, bool, IPFSCid *);
+    int     (*ipfs_add)                 (HiveConnect *, HiveReadCallback *, hive_rewind_callback_t *, void *, ssize_t, const IPFSAddOptions *, IPFSCid *);
+    int     (*ipfs_put_files)           (HiveConnect *, const IPFSAddItem *, size_t, IPFSCid *, IPFSCid *);
     ssize_t (*ipfs_get_file_length)     (HiveConnect *, const IPFSCid *cid);
+    int     (*ipfs_get_file_lengths)    (HiveConnect *, const IPFSCid *, size_t, ssize_t *);
     ssize_t (*ipfs_get_file_to_buffer)  (HiveConnect *, const IPFSCid *, bool, void *, size_t);
+    ssize_t (*ipfs_get_file_range)      (HiveConnect *, const IPFSCid *, uint64_t, size_t, void *);
+    ssize_t (*ipfs_export_car)          (HiveConnect *, const IPFSCid *, int);
+    ssize_t (*ipfs_import_car)          (HiveConnect *, int, IPFSCid *, size_t);
+    int     (*ipfs_get_stats)           (HiveConnect *, IPFSStats *);
 
     int     (*put_value)                (HiveConnect *, const char *, const void *, size_t, bool);
     int     (*set_value)                (HiveConnect *, const char *, const void *, size_t, bool);
     int     (*get_values)               (HiveConnect *, const char *, bool, HiveKeyValuesIterateCallback *, void *);
     int     (*delete_key)               (HiveConnect *, const char *);
+    int     (*get_key_version)          (HiveConnect *, const char *, char *, size_t);
+
+    int     (*get_cache_stats)          (HiveConnect *, HiveCacheStats *);
 
     int     (*disconnect)               (HiveConnect *);
     int     (*expire_token)             (HiveConnect *);
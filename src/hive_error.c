@@ -83,6 +83,18 @@ void hive_set_error(int err)
 #endif
 }
 
+bool hive_error_is_transient(int err)
+{
+    int facility = (err >> 24) & 0x0F;
+
+    return err == HIVE_GENERAL_ERROR(HIVEERR_TRY_AGAIN) ||
+           (err < 0 && (facility == HIVEF_CURL || facility == HIVEF_SYS)) ||
+           err == HIVE_HTTP_STATUS_ERROR(408) ||
+           err == HIVE_HTTP_STATUS_ERROR(429) ||
+           (err >= HIVE_HTTP_STATUS_ERROR(500) &&
+            err < HIVE_HTTP_STATUS_ERROR(600));
+}
+
 typedef struct ErrorDesc {
     int errcode;
     const char *errdesc;
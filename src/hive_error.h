@@ -27,12 +27,20 @@
 extern "C" {
 #endif
 
+#include <stdbool.h>
+
 #if defined(_WIN32) || defined(_WIN64)
 #include <crystal.h>
 #endif
 
 void hive_set_error(int err);
 
+/*
+ * Whether a call failing with err may succeed if made again: the network
+ * or the server failing, not the call itself.
+ */
+bool hive_error_is_transient(int err);
+
 typedef int strerror_func_t(int errnum, char *, size_t);
 
 int hive_register_strerror(int facility, strerror_func_t *cb);
@@ -28,6 +28,7 @@
 #endif
 
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/stat.h>
@@ -223,59 +224,87 @@ ssize_t hive_get_file(HiveConnect *connect, const char *filename, bool decrypt,
     return fsize;
 }
 
+typedef struct fd_reader {
+    int fd;
+    int err;
+} fd_reader_t;
+
+static ssize_t read_from_fd(void *buffer, size_t length, void *context)
+{
+    fd_reader_t *reader = (fd_reader_t *)context;
+    ssize_t nrd;
+
+    nrd = read(reader->fd, buffer,
+#if defined(_WIN32) || defined(_WIN64)
+               (unsigned)
+#endif
+               length);
+    if (nrd < 0)
+        reader->err = errno;
+
+    return nrd;
+}
+
+static int rewind_fd(void *context)
+{
+    fd_reader_t *reader = (fd_reader_t *)context;
+
+    if (lseek(reader->fd, 0, SEEK_SET) < 0) {
+        reader->err = errno;
+        return -1;
+    }
+
+    return 0;
+}
+
 int hive_ipfs_put_file(HiveConnect *connect, const char *from, bool encrypt,
                        IPFSCid *cid)
 {
-    ssize_t nrd;
-    uint8_t *buf;
+    fd_reader_t reader;
     size_t fsize;
     int rc;
-    int fd;
 
     if (!connect || !from || !*from || !cid) {
         hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS));
         return -1;
     }
 
-    fd = open(from, O_RDONLY);
-    if (fd < 0) {
+    if (!connect->ipfs_add) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_NOT_SUPPORTED));
+        return -1;
+    }
+
+    reader.fd = open(from, O_RDONLY);
+    if (reader.fd < 0) {
         hive_set_error(HIVE_SYS_ERROR(errno));
         return -1;
     }
+    reader.err = 0;
 
-    fsize = lseek(fd, 0, SEEK_END);
-    lseek(fd, 0, SEEK_SET);
+    fsize = lseek(reader.fd, 0, SEEK_END);
+    lseek(reader.fd, 0, SEEK_SET);
 
     if (fsize > HIVE_MAX_FILE_SIZE) {
         hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_LIMIT_EXCEEDED));
-        close(fd);
+        close(reader.fd);
         return -1;
     }
 
-    buf = (uint8_t *)calloc(1, fsize);
-    if (!buf) {
-        close(fd);
-        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY));
-        return -1;
-    }
-
-    nrd = read(fd, buf,
-#if defined(_WIN32) || defined(_WIN64)
-               (unsigned)
-#endif
-               fsize);
-    close(fd);
+    /*
+     * The file is sent as it is read rather than loaded in full first.
+     * Being seekable, it can be read once more to find out whether the
+     * node already has it.
+     */
+    rc = connect->ipfs_add(connect, read_from_fd, rewind_fd, &reader,
+                           (ssize_t)fsize, NULL, cid);
+    close(reader.fd);
 
-    if (nrd != fsize) {
-        free(buf);
-        hive_set_error(HIVE_SYS_ERROR(errno));
+    if (rc < 0) {
+        hive_set_error(reader.err ? HIVE_SYS_ERROR(reader.err) : rc);
         return -1;
     }
 
-    rc = hive_ipfs_put_file_from_buffer(connect, buf, fsize, encrypt, cid);
-    free(buf);
-
-    return rc;
+    return 0;
 }
 
 int hive_ipfs_put_file_from_buffer(HiveConnect *connect, const void *from,
@@ -302,6 +331,83 @@ int hive_ipfs_put_file_from_buffer(HiveConnect *connect, const void *from,
     return 0;
 }
 
+int hive_ipfs_add(HiveConnect *connect, HiveReadCallback *callback,
+                  void *context, ssize_t length,
+                  const IPFSAddOptions *options, IPFSCid *cid)
+{
+    int rc;
+
+    if (!connect || !callback || length < -1 || !cid ||
+        (options && options->cid_version != 0 && options->cid_version != 1)) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS));
+        return -1;
+    }
+
+    if (!connect->ipfs_add) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_NOT_SUPPORTED));
+        return -1;
+    }
+
+    rc = connect->ipfs_add(connect, callback, NULL, context, length, options,
+                           cid);
+    if (rc < 0) {
+        hive_set_error(rc);
+        return -1;
+    }
+
+    return 0;
+}
+
+int hive_ipfs_put_files(HiveConnect *connect, const IPFSAddItem *items,
+                        size_t count, IPFSCid *cids, IPFSCid *root)
+{
+    struct stat st;
+    size_t i;
+    int rc;
+
+    if (!connect || !items || !count || !cids) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS));
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        const IPFSAddItem *item = &items[i];
+
+        if ((item->name && (!*item->name || strchr(item->name, '/'))) ||
+            (!item->path && ((!item->data && item->length) ||
+                             item->length > HIVE_MAX_FILE_SIZE)) ||
+            (item->path && !*item->path)) {
+            hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS));
+            return -1;
+        }
+
+        if (item->path) {
+            if (stat(item->path, &st) < 0) {
+                hive_set_error(HIVE_SYS_ERROR(errno));
+                return -1;
+            }
+
+            if (st.st_size > HIVE_MAX_FILE_SIZE) {
+                hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_LIMIT_EXCEEDED));
+                return -1;
+            }
+        }
+    }
+
+    if (!connect->ipfs_put_files) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_NOT_SUPPORTED));
+        return -1;
+    }
+
+    rc = connect->ipfs_put_files(connect, items, count, cids, root);
+    if (rc < 0) {
+        hive_set_error(rc);
+        return -1;
+    }
+
+    return 0;
+}
+
 ssize_t hive_ipfs_get_file_length(HiveConnect *connect, const IPFSCid *cid)
 {
     ssize_t rc;
@@ -325,6 +431,38 @@ ssize_t hive_ipfs_get_file_length(HiveConnect *connect, const IPFSCid *cid)
     return rc;
 }
 
+int hive_ipfs_get_file_lengths(HiveConnect *connect, const IPFSCid *cids,
+                               size_t count, ssize_t *sizes)
+{
+    size_t i;
+    int rc;
+
+    if (!connect || !cids || !count || !sizes) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS));
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (!cids[i].content[0]) {
+            hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS));
+            return -1;
+        }
+    }
+
+    if (!connect->ipfs_get_file_lengths) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_NOT_SUPPORTED));
+        return -1;
+    }
+
+    rc = connect->ipfs_get_file_lengths(connect, cids, count, sizes);
+    if (rc < 0) {
+        hive_set_error(rc);
+        return -1;
+    }
+
+    return 0;
+}
+
 ssize_t hive_ipfs_get_file_to_buffer(HiveConnect *connect, const IPFSCid *cid,
                                      bool decrypt, void *to, size_t buflen)
 {
@@ -349,6 +487,31 @@ ssize_t hive_ipfs_get_file_to_buffer(HiveConnect *connect, const IPFSCid *cid,
     return rc;
 }
 
+ssize_t hive_ipfs_get_file_range(HiveConnect *connect, const IPFSCid *cid,
+                                 uint64_t offset, size_t length, void *to)
+{
+    ssize_t rc;
+
+    if (!connect || !cid || !cid->content[0] || !to || !length ||
+        (ssize_t)length < 0) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS));
+        return -1;
+    }
+
+    if (!connect->ipfs_get_file_range) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_NOT_SUPPORTED));
+        return -1;
+    }
+
+    rc = connect->ipfs_get_file_range(connect, cid, offset, length, to);
+    if (rc < 0) {
+        hive_set_error((int)rc);
+        return -1;
+    }
+
+    return rc;
+}
+
 ssize_t hive_ipfs_get_file(HiveConnect *connect, const IPFSCid *cid, bool decrypt,
                            const char *to)
 {
@@ -409,6 +572,99 @@ ssize_t hive_ipfs_get_file(HiveConnect *connect, const IPFSCid *cid, bool decryp
     return fsize;
 }
 
+ssize_t hive_ipfs_export_car(HiveConnect *connect, const IPFSCid *root, int fd)
+{
+    ssize_t rc;
+
+    if (!connect || !root || !root->content[0] || fd < 0) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS));
+        return -1;
+    }
+
+    if (!connect->ipfs_export_car) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_NOT_SUPPORTED));
+        return -1;
+    }
+
+    rc = connect->ipfs_export_car(connect, root, fd);
+    if (rc < 0) {
+        hive_set_error((int)rc);
+        return -1;
+    }
+
+    return rc;
+}
+
+ssize_t hive_ipfs_import_car(HiveConnect *connect, int fd, IPFSCid *roots,
+                             size_t count)
+{
+    ssize_t rc;
+
+    if (!connect || fd < 0 || (!roots && count)) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS));
+        return -1;
+    }
+
+    if (!connect->ipfs_import_car) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_NOT_SUPPORTED));
+        return -1;
+    }
+
+    rc = connect->ipfs_import_car(connect, fd, roots, count);
+    if (rc < 0) {
+        hive_set_error((int)rc);
+        return -1;
+    }
+
+    return rc;
+}
+
+int hive_ipfs_get_stats(HiveConnect *connect, IPFSStats *stats)
+{
+    int rc;
+
+    if (!connect || !stats) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS));
+        return -1;
+    }
+
+    if (!connect->ipfs_get_stats) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_NOT_SUPPORTED));
+        return -1;
+    }
+
+    rc = connect->ipfs_get_stats(connect, stats);
+    if (rc < 0) {
+        hive_set_error(rc);
+        return -1;
+    }
+
+    return 0;
+}
+
+int hive_get_cache_stats(HiveConnect *connect, HiveCacheStats *stats)
+{
+    int rc;
+
+    if (!connect || !stats) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS));
+        return -1;
+    }
+
+    if (!connect->get_cache_stats) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_NOT_SUPPORTED));
+        return -1;
+    }
+
+    rc = connect->get_cache_stats(connect, stats);
+    if (rc < 0) {
+        hive_set_error(rc);
+        return -1;
+    }
+
+    return 0;
+}
+
 int hive_delete_file(HiveConnect *connect, const char *filename)
 {
     int rc;
@@ -455,4 +711,3 @@ int hive_list_files(HiveConnect *connect, HiveFilesIterateCallback *callback,
 
     return 0;
 }
-
@@ -29,6 +29,9 @@
 #ifdef HAVE_MALLOC_H
 #include <malloc.h>
 #endif
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
 
 #include <curl/curl.h>
 #include <crystal.h>
@@ -577,6 +580,19 @@ int http_client_set_timeout(http_client_t *client, int timeout)
     return code;
 }
 
+int http_client_set_unix_socket(http_client_t *client, const char *path)
+{
+    CURLcode code;
+
+    assert(client);
+    assert(path);
+    assert(*path);
+
+    code = curl_easy_setopt(client->curl, CURLOPT_UNIX_SOCKET_PATH, path);
+
+    return code;
+}
+
 int http_client_set_version(http_client_t *client, http_version_t version)
 {
     CURLcode code;
@@ -721,17 +737,22 @@ int http_client_set_response_header(http_client_t *client,
     return 0;
 }
 
-int http_client_request(http_client_t *client)
+static void http_client_prepare(http_client_t *client)
 {
-    CURLcode code;
-
-    assert(client);
-
     if (client->hdr)
         curl_easy_setopt(client->curl, CURLOPT_HTTPHEADER, client->hdr);
 
     if (client->mime)
         curl_easy_setopt(client->curl, CURLOPT_MIMEPOST, client->mime);
+}
+
+int http_client_request(http_client_t *client)
+{
+    CURLcode code;
+
+    assert(client);
+
+    http_client_prepare(client);
 
     code = curl_easy_perform(client->curl);
     if (code != CURLE_OK) {
@@ -742,6 +763,135 @@ int http_client_request(http_client_t *client)
     return 0;
 }
 
+struct http_multi {
+    CURLM *multi;
+};
+
+static void http_multi_destroy(void *p)
+{
+    http_multi_t *multi = (http_multi_t *)p;
+
+    if (multi->multi)
+        curl_multi_cleanup(multi->multi);
+}
+
+http_multi_t *http_multi_new(void)
+{
+    http_multi_t *multi;
+
+    multi = (http_multi_t *)rc_zalloc(sizeof(http_multi_t), http_multi_destroy);
+    if (!multi)
+        return NULL;
+
+    multi->multi = curl_multi_init();
+    if (!multi->multi) {
+        vlogE("HttpClient: curl_multi_init() failure.");
+        deref(multi);
+        return NULL;
+    }
+
+    return multi;
+}
+
+void http_multi_close(http_multi_t *multi)
+{
+    if (multi)
+        deref(multi);
+}
+
+int http_multi_add(http_multi_t *multi, http_client_t *client)
+{
+    CURLMcode code;
+
+    assert(multi);
+    assert(client);
+
+    http_client_prepare(client);
+    curl_easy_setopt(client->curl, CURLOPT_PRIVATE, client);
+
+    code = curl_multi_add_handle(multi->multi, client->curl);
+    if (code != CURLM_OK) {
+        vlogE("HttpClient: Add handle to multi error (%d)", code);
+        return CURLE_OUT_OF_MEMORY;
+    }
+
+    return 0;
+}
+
+int http_multi_remove(http_multi_t *multi, http_client_t *client)
+{
+    assert(multi);
+    assert(client);
+
+    curl_multi_remove_handle(multi->multi, client->curl);
+    return 0;
+}
+
+static long long now_in_ms(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+int http_multi_wait_any(http_multi_t *multi, int timeout, http_client_t **done,
+                        int *result)
+{
+    long long deadline = timeout >= 0 ? now_in_ms() + timeout : 0;
+    CURLMcode code;
+    CURLMsg *msg;
+    int running;
+    int queued;
+    int wait;
+
+    assert(multi);
+    assert(done);
+    assert(result);
+
+    *done = NULL;
+
+    for (;;) {
+        code = curl_multi_perform(multi->multi, &running);
+        if (code != CURLM_OK) {
+            vlogE("HttpClient: Perform multi requests error (%d)", code);
+            return CURLE_FAILED_INIT;
+        }
+
+        while ((msg = curl_multi_info_read(multi->multi, &queued))) {
+            http_client_t *client = NULL;
+
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&client);
+            *result = msg->data.result;
+            curl_multi_remove_handle(multi->multi, msg->easy_handle);
+
+            *done = client;
+            return 0;
+        }
+
+        if (!running)
+            return 0;
+
+        wait = 1000;
+        if (timeout >= 0) {
+            long long left = deadline - now_in_ms();
+            if (left <= 0)
+                return 0;
+            if (left < wait)
+                wait = (int)left;
+        }
+
+        code = curl_multi_wait(multi->multi, NULL, 0, wait, NULL);
+        if (code != CURLM_OK) {
+            vlogE("HttpClient: Wait multi requests error (%d)", code);
+            return CURLE_FAILED_INIT;
+        }
+    }
+}
+
 int http_client_get_response_code(http_client_t *client, long *response_code)
 {
     CURLcode code;
@@ -759,6 +909,22 @@ int http_client_get_response_code(http_client_t *client, long *response_code)
     return 0;
 }
 
+int http_client_get_first_byte_time(http_client_t *client, double *seconds)
+{
+    CURLcode code;
+
+    assert(client);
+    assert(seconds);
+
+    code = curl_easy_getinfo(client->curl, CURLINFO_STARTTRANSFER_TIME, seconds);
+    if (code != CURLE_OK) {
+        vlogE("HttpClient: Get first byte time error (%d)", code);
+        return code;
+    }
+
+    return 0;
+}
+
 char *http_client_escape(http_client_t *client, const char *data, size_t len)
 {
     char *escaped_data;
@@ -819,3 +985,62 @@ int http_client_set_mime_instant(http_client_t *client, const char *name,
 
     return 0;
 }
+
+/*
+ * Add a part whose content is pulled from cb while the request is sent,
+ * so it is never copied in full. A negative size sends it chunked.
+ */
+int http_client_set_mime(http_client_t *client, const char *name,
+                         const char *filename, const char *type,
+                         http_client_request_body_callback_t cb, void *userdata,
+                         ssize_t size)
+{
+    curl_mimepart *part;
+
+    assert(client);
+    assert(cb);
+
+    if (!client->mime)
+        client->mime = curl_mime_init(client->curl);
+
+    part = curl_mime_addpart(client->mime);
+    curl_mime_name(part, name);
+    curl_mime_filename(part, filename);
+    curl_mime_type(part, type);
+    curl_mime_data_cb(part, size < 0 ? -1 : (curl_off_t)size, cb, NULL, NULL,
+                      userdata);
+
+    return 0;
+}
+
+/*
+ * Add a part whose content curl reads from the file at path while the
+ * request is sent.
+ */
+int http_client_set_mime_file(http_client_t *client, const char *name,
+                              const char *filename, const char *type,
+                              const char *path)
+{
+    curl_mimepart *part;
+    CURLcode code;
+
+    assert(client);
+    assert(path);
+
+    if (!client->mime)
+        client->mime = curl_mime_init(client->curl);
+
+    part = curl_mime_addpart(client->mime);
+    curl_mime_name(part, name);
+    code = curl_mime_filedata(part, path);
+    if (code != CURLE_OK) {
+        vlogE("HttpClient: Set mime file data from curl error (%d)", code);
+        return code;
+    }
+
+    if (filename)
+        curl_mime_filename(part, filename);
+    curl_mime_type(part, type);
+
+    return 0;
+}
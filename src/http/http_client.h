@@ -69,6 +69,7 @@ int http_client_set_query(http_client_t *, const char *name, const char *value);
 int http_client_set_header(http_client_t *, const char *name, const char *value);
 int http_client_set_timeout(http_client_t *, int timeout /* seconds */);
 int http_client_set_version(http_client_t *, http_version_t version);
+int http_client_set_unix_socket(http_client_t *, const char *path);
 
 int http_client_get_url_escape(http_client_t *, char **url);
 int http_client_get_scheme(http_client_t *, char **scheme);
@@ -104,9 +105,17 @@ const char *http_client_get_response_body(http_client_t *);
 size_t http_client_get_response_body_length(http_client_t *);
 char *http_client_move_response_body(http_client_t *, size_t *len);
 int http_client_get_response_code(http_client_t *, long *response_code);
+int http_client_get_first_byte_time(http_client_t *, double *seconds);
 int http_client_set_mime_instant(http_client_t *, const char *name,
                                  const char *filename, const char *type,
                                  const char *buffer, size_t bufsz);
+int http_client_set_mime(http_client_t *, const char *name,
+                         const char *filename, const char *type,
+                         http_client_request_body_callback_t cb, void *userdata,
+                         ssize_t size);
+int http_client_set_mime_file(http_client_t *, const char *name,
+                              const char *filename, const char *type,
+                              const char *path);
 
 
 /*
@@ -114,6 +123,29 @@ int http_client_set_mime_instant(http_client_t *, const char *name,
  */
 int http_client_request(http_client_t *client);
 
+/*
+ * Http multi API, driving several prepared http clients concurrently
+ * from the calling thread.
+ */
+typedef struct http_multi http_multi_t;
+
+http_multi_t *http_multi_new(void);
+
+void http_multi_close(http_multi_t *multi);
+
+int http_multi_add(http_multi_t *multi, http_client_t *client);
+
+int http_multi_remove(http_multi_t *multi, http_client_t *client);
+
+/*
+ * Run the added requests until one of them completes, which is then
+ * removed from the multi handle and returned through done together with
+ * its curl result. done is set to NULL once no request is left or the
+ * timeout (in milliseconds, negative for none) elapsed.
+ */
+int http_multi_wait_any(http_multi_t *multi, int timeout, http_client_t **done,
+                        int *result);
+
 /*
  * Escape/Unescape operation APIs.
  */
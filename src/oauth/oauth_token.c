@@ -55,6 +55,17 @@
 
 #define ARGV(args, index) (((void **)(args))[index])
 
+/*
+ * Lifetime assumed for a restored token which was persisted without it.
+ */
+#define DEFAULT_TOKEN_LIFETIME      (3600)
+#define DEFAULT_REFRESH_AHEAD       (0.2)
+
+/*
+ * Interval to wait before the background refresher retries a failure.
+ */
+#define REFRESH_RETRY_INTERVAL      (30)
+
 struct oauth_token {
     /*
      * main url part to get authorize code.
@@ -73,12 +84,15 @@ struct oauth_token {
     char *redirect_url;
 
     /*
-     * tokens.
+     * tokens. All three strings live in one allocation headed by
+     * token_type, so a refreshed set is swapped in with one pointer
+     * exchange under the lock.
      */
     char *token_type;
     char *access_token;
     char *refresh_token;
     struct timeval expires_at;
+    long lifetime;
 
     /*
      * Token should be wroteback as long as they have been
@@ -86,6 +100,36 @@ struct oauth_token {
      */
     oauth_writeback_func_t *writeback_cb;
     void *user_data;
+
+    /*
+     * Hooks to share the persistent tokens with other processes.
+     */
+    oauth_store_lock_func_t *store_lock;
+    oauth_store_reload_func_t *store_reload;
+
+    /*
+     * Guards the tokens above. Every request reads the access token, so
+     * readers share the lock and only a refresh takes it exclusively.
+     */
+    pthread_rwlock_t rwlock;
+
+    /*
+     * Protects the refresh state below; the condition is signalled
+     * whenever the tokens change.
+     */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool refreshing;
+    int refresh_rc;
+
+    /*
+     * Background refresher which renews the access token before it
+     * expires, so requests never wait for the token endpoint.
+     */
+    double refresh_ahead;
+    pthread_t refresher;
+    bool refresher_started;
+    bool stopping;
 };
 
 static void writeback_tokens(oauth_token_t *token)
@@ -101,6 +145,7 @@ static void writeback_tokens(oauth_token_t *token)
         return;
     }
 
+    pthread_rwlock_rdlock(&token->rwlock);
     cJSON_AddStringToObject(json, "client_id", token->client_id);
     if (token->token_type) {
         assert(token->access_token);
@@ -109,7 +154,9 @@ static void writeback_tokens(oauth_token_t *token)
         cJSON_AddStringToObject(json, "access_token", token->access_token);
         cJSON_AddStringToObject(json, "refresh_token", token->refresh_token);
         cJSON_AddNumberToObject(json, "expires_at", token->expires_at.tv_sec);
+        cJSON_AddNumberToObject(json, "expires_in", token->lifetime);
     }
+    pthread_rwlock_unlock(&token->rwlock);
 
     rc = token->writeback_cb(json, token->user_data);
     if (rc < 0)
@@ -123,8 +170,84 @@ static void oauth_token_destrcutor(void *p)
     oauth_token_t *token = (oauth_token_t *)p;
     assert(token);
 
+    if (token->refresher_started) {
+        pthread_mutex_lock(&token->lock);
+        token->stopping = true;
+        pthread_cond_broadcast(&token->cond);
+        pthread_mutex_unlock(&token->lock);
+
+        pthread_join(token->refresher, NULL);
+    }
+
     if (token->token_type)
         free(token->token_type);
+
+    pthread_cond_destroy(&token->cond);
+    pthread_mutex_destroy(&token->lock);
+    pthread_rwlock_destroy(&token->rwlock);
+}
+
+/*
+ * Pack the three token strings into one allocation headed by token type.
+ */
+static char *pack_tokens(const char *token_type, const char *access_token,
+                         const char *refresh_token)
+{
+    size_t mem_len = 0;
+    char *block;
+    char *p;
+
+    mem_len += strlen(token_type) + 1;
+    mem_len += strlen(access_token) + 1;
+    mem_len += strlen(refresh_token) + 1;
+
+    block = (char *)calloc(1, mem_len);
+    if (!block)
+        return NULL;
+
+    p = block;
+    strcpy(p, token_type);
+    p += strlen(p) + 1;
+    strcpy(p, access_token);
+    p += strlen(p) + 1;
+    strcpy(p, refresh_token);
+
+    return block;
+}
+
+static void notify_tokens_changed(oauth_token_t *token)
+{
+    pthread_mutex_lock(&token->lock);
+    pthread_cond_broadcast(&token->cond);
+    pthread_mutex_unlock(&token->lock);
+}
+
+/*
+ * Swap in a packed set of tokens.
+ */
+static void install_tokens(oauth_token_t *token, char *block,
+                           const struct timeval *expires_at, long lifetime)
+{
+    char *old;
+    char *p = block;
+
+    pthread_rwlock_wrlock(&token->rwlock);
+    old = token->token_type;
+
+    token->token_type = p;
+    p += strlen(p) + 1;
+    token->access_token = p;
+    p += strlen(p) + 1;
+    token->refresh_token = p;
+
+    token->expires_at = *expires_at;
+    token->lifetime = lifetime > 0 ? lifetime : DEFAULT_TOKEN_LIFETIME;
+    pthread_rwlock_unlock(&token->rwlock);
+
+    if (old)
+        free(old);
+
+    notify_tokens_changed(token);
 }
 
 static int restore_access_token(const cJSON *json, oauth_token_t *token)
@@ -134,7 +257,8 @@ static int restore_access_token(const cJSON *json, oauth_token_t *token)
     cJSON *access_token;
     cJSON *refresh_token;
     cJSON *expires_at;
-    size_t mem_len = 0;
+    cJSON *expires_in;
+    struct timeval tv = {0};
     char *p;
 
     assert(token);
@@ -165,31 +289,82 @@ static int restore_access_token(const cJSON *json, oauth_token_t *token)
         return 0;
     }
 
-    mem_len += strlen(token_type->valuestring) + 1;
-    mem_len += strlen(access_token->valuestring) + 1;
-    mem_len += strlen(refresh_token->valuestring) + 1;
-
-    token->expires_at.tv_sec = (long)expires_at->valuedouble;
-    p = (char *)calloc(1, mem_len);
+    p = pack_tokens(token_type->valuestring, access_token->valuestring,
+                    refresh_token->valuestring);
     if (!p)
         return HIVE_SYS_ERROR(errno);
 
-    token->token_type = p;
-    strcpy(p, token_type->valuestring);
-    p += strlen(p) + 1;
+    expires_in = cJSON_GetObjectItem(json, "expires_in");
+    tv.tv_sec = (long)expires_at->valuedouble;
 
-    token->access_token = p;
-    strcpy(p, access_token->valuestring);
-    p += strlen(p) + 1;
-
-    token->refresh_token = p;
-    strcpy(p, refresh_token->valuestring);
+    install_tokens(token, p, &tv,
+                   cJSON_IsNumber(expires_in) ? (long)expires_in->valuedouble : 0);
 
     vlogI("OauthToken: Successfully restore cached access token");
 
     return 0;
 }
 
+static int refresh_tokens(oauth_token_t *token);
+
+static void timeval_to_timespec(const struct timeval *tv, struct timespec *ts)
+{
+    ts->tv_sec = tv->tv_sec;
+    ts->tv_nsec = tv->tv_usec * 1000;
+}
+
+static void *refresher_entry(void *arg)
+{
+    oauth_token_t *token = (oauth_token_t *)arg;
+    struct timeval deadline;
+    struct timeval ahead;
+    struct timeval now;
+    struct timespec ts;
+    int rc;
+
+    pthread_mutex_lock(&token->lock);
+
+    while (!token->stopping) {
+        bool has_token;
+
+        pthread_rwlock_rdlock(&token->rwlock);
+        has_token = token->access_token != NULL;
+        ahead.tv_sec = (long)(token->lifetime * token->refresh_ahead);
+        ahead.tv_usec = 0;
+        timersub(&token->expires_at, &ahead, &deadline);
+        pthread_rwlock_unlock(&token->rwlock);
+
+        if (!has_token || token->refreshing) {
+            pthread_cond_wait(&token->cond, &token->lock);
+            continue;
+        }
+
+        gettimeofday(&now, NULL);
+        if (timercmp(&now, &deadline, <)) {
+            timeval_to_timespec(&deadline, &ts);
+            pthread_cond_timedwait(&token->cond, &token->lock, &ts);
+            continue;
+        }
+
+        pthread_mutex_unlock(&token->lock);
+        rc = refresh_tokens(token);
+        pthread_mutex_lock(&token->lock);
+
+        if (rc < 0 && !token->stopping) {
+            vlogW("OauthToken: Background refresh failed (0x%x), retry in %ds.",
+                  -rc, REFRESH_RETRY_INTERVAL);
+
+            gettimeofday(&now, NULL);
+            ts.tv_sec = now.tv_sec + REFRESH_RETRY_INTERVAL;
+            ts.tv_nsec = now.tv_usec * 1000;
+            pthread_cond_timedwait(&token->cond, &token->lock, &ts);
+        }
+    }
+
+    pthread_mutex_unlock(&token->lock);
+    return NULL;
+}
+
 oauth_token_t *oauth_token_new(const oauth_options_t *opts, oauth_writeback_func_t *cb,
                                void *user_data)
 {
@@ -251,6 +426,12 @@ oauth_token_t *oauth_token_new(const oauth_options_t *opts, oauth_writeback_func
 
     token->writeback_cb = cb;
     token->user_data = user_data;
+    token->store_lock = opts->store_lock;
+    token->store_reload = opts->store_reload;
+
+    pthread_rwlock_init(&token->rwlock, NULL);
+    pthread_mutex_init(&token->lock, NULL);
+    pthread_cond_init(&token->cond, NULL);
 
     /*
      * try restore access/refresh token from parsed json object.
@@ -259,6 +440,22 @@ oauth_token_t *oauth_token_new(const oauth_options_t *opts, oauth_writeback_func
     if (rc < 0)
         vlogW("OauthToken: Could not load access token from json object");
 
+    token->refresh_ahead = opts->refresh_ahead ? opts->refresh_ahead :
+                                                 DEFAULT_REFRESH_AHEAD;
+    if (token->refresh_ahead > 0) {
+        if (token->refresh_ahead > 1)
+            token->refresh_ahead = 1;
+
+        rc = pthread_create(&token->refresher, NULL, refresher_entry, token);
+        if (rc != 0) {
+            vlogE("OauthToken: Failed to create refresher thread.");
+            hive_set_error(HIVE_SYS_ERROR(rc));
+            deref(token);
+            return NULL;
+        }
+        token->refresher_started = true;
+    }
+
     return token;
 }
 
@@ -273,10 +470,12 @@ int oauth_token_reset(oauth_token_t *token)
 {
     assert(token->token_type);
 
+    pthread_rwlock_wrlock(&token->rwlock);
     free(token->token_type);
     token->token_type = NULL;
     token->access_token = NULL;
     token->refresh_token = NULL;
+    pthread_rwlock_unlock(&token->rwlock);
 
     writeback_tokens(token);
 
@@ -476,23 +675,19 @@ static char *get_authorize_code(oauth_token_t *token,
 static int decode_access_token(oauth_token_t *token, const char *json_str)
 {
     cJSON *json;
+    cJSON *token_type;
+    cJSON *access_token;
+    cJSON *refresh_token;
     cJSON *item;
     struct timeval now;
     struct timeval interval;
-    char *token_type;
-    char *access_token;
-    char *refresh_token;
+    struct timeval expires_at;
+    char *block;
     int rc;
 
 #define IS_STRING_NODE(item)    (cJSON_IsString(item) && \
                                  (item)->valuestring && *(item)->valuestring)
 
-#define FREE(ptr)               do { \
-        if ((ptr)) \
-            free((ptr)); \
-        (ptr) = NULL;  \
-    } while(0)
-
     assert(token);
     assert(json_str);
 
@@ -503,62 +698,34 @@ static int decode_access_token(oauth_token_t *token, const char *json_str)
     }
 
     // Parse "token_type" item in http response.
-    item = cJSON_GetObjectItemCaseSensitive(json, "token_type");
-    if (!IS_STRING_NODE(item)) {
+    token_type = cJSON_GetObjectItemCaseSensitive(json, "token_type");
+    if (!IS_STRING_NODE(token_type)) {
         vlogE("OauthToken: Json object named token_type doesn't exist.");
         rc = HIVE_GENERAL_ERROR(HIVEERR_BAD_JSON_FORMAT);
         goto error_exit;
     }
 
-    token_type = strdup(item->valuestring);
-    if (!token_type) {
-        vlogE("OauthToken: Failed to duplicate token type.");
-        rc = HIVE_SYS_ERROR(errno);
-        goto error_exit;
-    }
-
     // Parse 'scope' item.
     item = cJSON_GetObjectItemCaseSensitive(json, "scope");
     if (!IS_STRING_NODE(item)) {
         vlogE("OauthToken: Json object named scope doesn't exist.");
         rc = HIVE_GENERAL_ERROR(HIVEERR_BAD_JSON_FORMAT);
-        free(token_type);
         goto error_exit;
     }
 
     // Parse 'access_token' item
-    item = cJSON_GetObjectItemCaseSensitive(json, "access_token");
-    if (!IS_STRING_NODE(item)) {
+    access_token = cJSON_GetObjectItemCaseSensitive(json, "access_token");
+    if (!IS_STRING_NODE(access_token)) {
         vlogE("OauthToken: Json object named access_token doesn't exist.");
         rc = HIVE_GENERAL_ERROR(HIVEERR_BAD_JSON_FORMAT);
-        free(token_type);
-        goto error_exit;
-    }
-
-    access_token = strdup(item->valuestring);
-    if (!access_token) {
-        vlogE("OauthToken: Failed to duplicate access token.");
-        rc = HIVE_SYS_ERROR(errno);
-        free(token_type);
         goto error_exit;
     }
 
     // Parse 'refresh_token' item
-    item = cJSON_GetObjectItemCaseSensitive(json, "refresh_token");
-    if (!IS_STRING_NODE(item)) {
+    refresh_token = cJSON_GetObjectItemCaseSensitive(json, "refresh_token");
+    if (!IS_STRING_NODE(refresh_token)) {
         vlogE("OauthToken: Json object named refresh_token doesn't exist.");
         rc = HIVE_GENERAL_ERROR(HIVEERR_BAD_JSON_FORMAT);
-        free(token_type);
-        free(access_token);
-        goto error_exit;
-    }
-
-    refresh_token = strdup(item->valuestring);
-    if (!refresh_token) {
-        vlogE("OauthToken: Failed to duplicate refresh token.");
-        rc = HIVE_SYS_ERROR(errno);
-        free(token_type);
-        free(access_token);
         goto error_exit;
     }
 
@@ -567,22 +734,23 @@ static int decode_access_token(oauth_token_t *token, const char *json_str)
     if (!cJSON_IsNumber(item) || (long)item->valuedouble < 0) {
         vlogE("OauthToken: Json object named expires_in doesn't exist.");
         rc = HIVE_GENERAL_ERROR(HIVEERR_BAD_JSON_FORMAT);
-        free(token_type);
-        free(access_token);
-        free(refresh_token);
         goto error_exit;
     }
 
-    FREE(token->token_type);
-
-    token->token_type    = token_type;
-    token->access_token  = access_token;
-    token->refresh_token = refresh_token;
+    block = pack_tokens(token_type->valuestring, access_token->valuestring,
+                        refresh_token->valuestring);
+    if (!block) {
+        vlogE("OauthToken: Failed to duplicate tokens.");
+        rc = HIVE_SYS_ERROR(errno);
+        goto error_exit;
+    }
 
     gettimeofday(&now, NULL);
     interval.tv_sec = (long)item->valuedouble;
     interval.tv_usec = 0;
-    timeradd(&now, &interval, &token->expires_at);
+    timeradd(&now, &interval, &expires_at);
+
+    install_tokens(token, block, &expires_at, interval.tv_sec);
 
     cJSON_Delete(json);
     return 0;
@@ -758,8 +926,11 @@ static int refresh_access_token(oauth_token_t *token)
         goto error_exit;
     }
 
-    refresh_token = http_client_escape(httpc, token->refresh_token,
-                                       strlen(token->refresh_token));
+    pthread_rwlock_rdlock(&token->rwlock);
+    refresh_token = token->refresh_token ?
+                    http_client_escape(httpc, token->refresh_token,
+                                       strlen(token->refresh_token)) : NULL;
+    pthread_rwlock_unlock(&token->rwlock);
     if (!refresh_token) {
         vlogE("OauthToken: Failed to escape refresh token.");
         rc = HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
@@ -827,19 +998,138 @@ error_exit:
     return rc;
 }
 
+/*
+ * Check whether the tokens reloaded from the shared store were renewed by
+ * another process and are fresh enough to be used without a refresh.
+ */
+static bool tokens_renewed(oauth_token_t *token, const char *previous)
+{
+    struct timeval deadline;
+    struct timeval ahead;
+    struct timeval now;
+    bool renewed;
+
+    gettimeofday(&now, NULL);
+
+    pthread_rwlock_rdlock(&token->rwlock);
+    ahead.tv_sec = token->refresh_ahead > 0 ?
+                   (long)(token->lifetime * token->refresh_ahead) : 0;
+    ahead.tv_usec = 0;
+    timersub(&token->expires_at, &ahead, &deadline);
+
+    renewed = token->access_token &&
+              (!previous || strcmp(previous, token->access_token)) &&
+              timercmp(&now, &deadline, <);
+    pthread_rwlock_unlock(&token->rwlock);
+
+    return renewed;
+}
+
+/*
+ * Refresh the access token while holding the shared store lock. Another
+ * process may have refreshed it while we waited for the lock, in which
+ * case its tokens are adopted from the store without any network call.
+ */
+static int refresh_shared_tokens(oauth_token_t *token)
+{
+    char *previous = NULL;
+    bool locked = false;
+    cJSON *json;
+    int rc;
+
+    if (token->store_lock) {
+        rc = token->store_lock(1, token->user_data);
+        if (rc < 0)
+            vlogW("OauthToken: Failed to lock shared token store.");
+        else
+            locked = true;
+    }
+
+    json = token->store_reload ? token->store_reload(token->user_data) : NULL;
+    if (json) {
+        pthread_rwlock_rdlock(&token->rwlock);
+        if (token->access_token)
+            previous = strdup(token->access_token);
+        pthread_rwlock_unlock(&token->rwlock);
+
+        rc = restore_access_token(json, token);
+        cJSON_Delete(json);
+
+        if (!rc && tokens_renewed(token, previous)) {
+            vlogI("OauthToken: Adopt access token refreshed by another process.");
+            goto exit;
+        }
+    }
+
+    rc = refresh_access_token(token);
+
+exit:
+    if (previous)
+        free(previous);
+
+    if (locked)
+        token->store_lock(0, token->user_data);
+
+    return rc;
+}
+
+/*
+ * Refresh the access token, coalescing concurrent callers (the background
+ * refresher and any request that found the token expired) onto a single
+ * request to the token endpoint.
+ */
+static int refresh_tokens(oauth_token_t *token)
+{
+    int rc;
+
+    pthread_mutex_lock(&token->lock);
+    if (token->refreshing) {
+        while (token->refreshing)
+            pthread_cond_wait(&token->cond, &token->lock);
+        rc = token->refresh_rc;
+        pthread_mutex_unlock(&token->lock);
+        return rc;
+    }
+
+    token->refreshing = true;
+    pthread_mutex_unlock(&token->lock);
+
+    rc = refresh_shared_tokens(token);
+
+    pthread_mutex_lock(&token->lock);
+    token->refreshing = false;
+    token->refresh_rc = rc;
+    pthread_cond_broadcast(&token->cond);
+    pthread_mutex_unlock(&token->lock);
+
+    return rc;
+}
+
 void oauth_token_set_expired(oauth_token_t *token)
 {
     assert(token);
+
+    pthread_rwlock_wrlock(&token->rwlock);
     memset(&token->expires_at, 0, sizeof(struct timeval));
+    pthread_rwlock_unlock(&token->rwlock);
+
+    notify_tokens_changed(token);
 }
 
 bool oauth_token_is_expired(oauth_token_t *token)
 {
     struct timeval now;
+    bool expired;
+
     assert(token);
 
     gettimeofday(&now, NULL);
-    return timercmp(&now, &token->expires_at, >);
+
+    pthread_rwlock_rdlock(&token->rwlock);
+    expired = timercmp(&now, &token->expires_at, >);
+    pthread_rwlock_unlock(&token->rwlock);
+
+    return expired;
 }
 
 int oauth_token_check_expire(oauth_token_t *token)
@@ -849,15 +1139,29 @@ int oauth_token_check_expire(oauth_token_t *token)
     if (!oauth_token_is_expired(token))
         return 0;
 
-
-    rc = refresh_access_token(token);
+    /*
+     * Normally the background refresher renews the token well ahead of
+     * its expiry; getting here means it was disabled, failed, or the
+     * server rejected the token early.
+     */
+    rc = refresh_tokens(token);
     if (rc < 0)
         return rc;
 
     return 0;
 }
 
-char *get_bearer_token(oauth_token_t *token)
+int oauth_token_authorize(oauth_token_t *token, http_client_t *httpc)
 {
-    return token->access_token;
+    int rc;
+
+    assert(token);
+    assert(httpc);
+
+    pthread_rwlock_rdlock(&token->rwlock);
+    rc = http_client_set_header(httpc, "Authorization",
+                                token->access_token ? token->access_token : "");
+    pthread_rwlock_unlock(&token->rwlock);
+
+    return rc;
 }
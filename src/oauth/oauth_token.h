@@ -25,6 +25,20 @@
 
 typedef struct oauth_token oauth_token_t;
 typedef struct cJSON cJSON;
+typedef struct http_client http_client_t;
+
+/*
+ * The prototype of function to take (lock != 0) or release (lock == 0)
+ * the lock of persistent token storage shared with other processes.
+ */
+typedef int oauth_store_lock_func_t(int lock, void *user_data);
+
+/*
+ * The prototype of function to reload the persistent token storage. It
+ * returns the stored json object if it has been changed by others since
+ * last load or writeback, otherwise NULL. Caller deletes the object.
+ */
+typedef cJSON *oauth_store_reload_func_t(void *user_data);
 
 typedef struct oauth_options {
     const char *authorize_url;
@@ -35,6 +49,22 @@ typedef struct oauth_options {
     const char *redirect_url;
 
     const cJSON *store;
+
+    /*
+     * Fraction of the access token lifetime, counted back from its expiry,
+     * at which the token is renewed in background. 0 selects the default,
+     * a negative value disables the background renewal.
+     */
+    double refresh_ahead;
+
+    /*
+     * Optional hooks to share the persistent tokens between processes.
+     * A refresh holds the store lock and first reloads the store, so only
+     * one process asks the token endpoint and the others pick its result.
+     * Both hooks are called with the user data given to oauth_token_new().
+     */
+    oauth_store_lock_func_t *store_lock;
+    oauth_store_reload_func_t *store_reload;
 } oauth_options_t;
 
 /*
@@ -81,8 +111,10 @@ void oauth_token_set_expired(oauth_token_t *token);
 int oauth_token_check_expire(oauth_token_t *token);
 
 /*
- * Get bearer type token.
+ * Set the Authorization header of a http request with the current access
+ * token. The token may be renewed concurrently, so it is copied into the
+ * request instead of being handed out.
  */
-char *get_bearer_token(oauth_token_t *token);
+int oauth_token_authorize(oauth_token_t *token, http_client_t *httpc);
 
 #endif // __OAUTH_TOKEN_H__
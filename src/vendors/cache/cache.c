@@ -0,0 +1,1836 @@
+/*
+ * Copyright (c) 2019 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef HAVE_ARPA_INET_H
+#include <arpa/inet.h>
+#endif
+#if defined(_WIN32) || defined(_WIN64)
+#include <io.h>
+#else
+#include <dirent.h>
+#include <sys/file.h>
+#endif
+
+#include <crystal.h>
+#include <cjson/cJSON.h>
+#include <openssl/sha.h>
+
+#include "hive_error.h"
+#include "hive_client.h"
+#include "mkdirs.h"
+#include "atomic_file.h"
+#include "object_cache.h"
+#include "cache.h"
+
+#ifndef O_BINARY
+#define O_BINARY            0
+#endif
+
+#define CACHE_DIR           "cache"
+#define OBJECTS_DIR         "objects"
+#define JOURNAL_DIR         "journal"
+#define INDEX_FILE          "index.json"
+#define LOCK_FILE           "lock"
+
+#define DEFAULT_CAPACITY    (256 * 1024 * 1024)
+#define MEMORY_SHARE        (16)
+#define MAX_MEMORY_CAPACITY (32 * 1024 * 1024)
+
+#define RETRY_MIN_INTERVAL  (1)
+#define RETRY_MAX_INTERVAL  (60)
+
+#define DIGEST_LEN          (SHA256_DIGEST_LENGTH * 2)
+#define JOURNAL_NAME_LEN    (16)
+
+/*
+ * Files and keys share one index, told apart by the prefix of their
+ * names.
+ */
+#define FILE_PREFIX         "f:"
+#define KEY_PREFIX          "k:"
+#define PREFIX_LEN          (2)
+
+enum {
+    OP_PUT_FILE     = 1,
+    OP_PUT_VALUE    = 2,
+    OP_SET_VALUE    = 3
+};
+
+#define FLAG_ENCRYPT        (0x01)
+
+/*
+ * A write not written back yet is kept in a journal file of its own,
+ * named after its sequence number: this header, in network byte order,
+ * followed by the name with its terminating NUL and the data.
+ */
+typedef struct journal_record {
+    uint8_t  op;
+    uint8_t  flags;
+    uint8_t  reserved[2];
+    uint32_t name_len;
+    uint32_t data_len;
+} journal_record_t;
+
+typedef struct journal {
+    uint8_t *buf;
+    int op;
+    int flags;
+    const char *name;
+    const uint8_t *data;
+    size_t data_len;
+} journal_t;
+
+/*
+ * A write is queued when its sequence number is reserved, and is only
+ * written back once ready, with its journal on disk.
+ */
+typedef struct write_op {
+    struct write_op *next;
+    uint64_t seq;
+    bool ready;
+    char name[0];
+} write_op_t;
+
+/*
+ * What is known about a file or key: the object holding its local copy,
+ * as content digest, and the backend version the copy matches. A copy
+ * without version includes writes not written back, or was never
+ * validated, and is only served while writes are pending. The copy is
+ * plain content, as written or read with crypt set, and only served to
+ * reads asking for it in that form.
+ *
+ * A write the backend rejected for good leaves its error, and its
+ * journal, until reported.
+ */
+typedef struct item_state {
+    char version[HIVE_MAX_VERSION_LEN];
+    char digest[DIGEST_LEN + 1];
+    bool crypt;
+    int pending;
+    int staging;
+    uint64_t last_seq;
+    int error;
+    uint64_t failed_seq;
+} item_state_t;
+
+typedef struct cache_item {
+    hash_entry_t he;
+    item_state_t state;
+    char name[0];
+} cache_item_t;
+
+typedef struct CacheConnect {
+    HiveConnect base;
+    HiveConnect *backend;
+
+    object_cache_t *objects;
+    char journal_dir[PATH_MAX];
+    char index_path[PATH_MAX];
+    int lock_fd;
+
+    /*
+     * Writes are written back by a single thread, in the order they were
+     * acknowledged; the queue mirrors the journal files on disk.
+     */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    hashtable_t *items;
+    write_op_t *head;
+    write_op_t *tail;
+    uint64_t next_seq;
+    int failure;
+    bool stopping;
+    bool writer_started;
+    pthread_t writer;
+} CacheConnect;
+
+static int disconnect(HiveConnect *base)
+{
+    assert(base);
+
+    deref(base);
+    return 0;
+}
+
+static int item_name(const char *prefix, const char *name, char *buf, size_t len)
+{
+    int rc;
+
+    rc = snprintf(buf, len, "%s%s", prefix, name);
+    if (rc < 0 || rc >= (int)len)
+        return HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
+
+    return 0;
+}
+
+/*
+ * Borrowed from the index, only valid while the lock is held.
+ */
+static cache_item_t *item_get(CacheConnect *connect, const char *name,
+                              bool create)
+{
+    cache_item_t *item;
+    size_t len = strlen(name);
+
+    item = (cache_item_t *)hashtable_get(connect->items, name, len);
+    if (item) {
+        deref(item);
+        return item;
+    }
+
+    if (!create)
+        return NULL;
+
+    item = (cache_item_t *)rc_zalloc(sizeof(cache_item_t) + len + 1, NULL);
+    if (!item)
+        return NULL;
+
+    strcpy(item->name, name);
+    item->he.data = item;
+    item->he.key = item->name;
+    item->he.keylen = len;
+
+    hashtable_put(connect->items, &item->he);
+    deref(item);
+
+    return item;
+}
+
+static void item_state(CacheConnect *connect, const char *name,
+                       item_state_t *state)
+{
+    cache_item_t *item;
+
+    pthread_mutex_lock(&connect->lock);
+
+    item = item_get(connect, name, false);
+    if (item)
+        *state = item->state;
+    else
+        memset(state, 0, sizeof(*state));
+
+    pthread_mutex_unlock(&connect->lock);
+}
+
+/*
+ * Record a copy read from the backend, unless it was written meanwhile.
+ */
+static void item_settle(CacheConnect *connect, const char *name,
+                        const char *version, const char *digest, bool crypt)
+{
+    cache_item_t *item;
+
+    pthread_mutex_lock(&connect->lock);
+
+    item = item_get(connect, name, true);
+    if (item && !item->state.pending) {
+        strcpy(item->state.version, version);
+        strcpy(item->state.digest, digest);
+        item->state.crypt = crypt;
+    }
+
+    pthread_mutex_unlock(&connect->lock);
+}
+
+static void item_forget(CacheConnect *connect, const char *name)
+{
+    cache_item_t *item;
+
+    pthread_mutex_lock(&connect->lock);
+
+    item = item_get(connect, name, false);
+    if (item && !item->state.pending) {
+        item->state.version[0] = '\0';
+        item->state.digest[0] = '\0';
+    }
+
+    pthread_mutex_unlock(&connect->lock);
+}
+
+static void journal_remove(CacheConnect *connect, uint64_t seq);
+
+/*
+ * Report a write the backend rejected for good, and drop it with the
+ * local copy it went into. Called with the lock held.
+ */
+static int item_failure(CacheConnect *connect, cache_item_t *item)
+{
+    int rc = item->state.error;
+
+    if (!rc)
+        return 0;
+
+    journal_remove(connect, item->state.failed_seq);
+    item->state.error = 0;
+    item->state.failed_seq = 0;
+    item->state.version[0] = '\0';
+    item->state.digest[0] = '\0';
+
+    return rc;
+}
+
+/*
+ * The first call on a file or key after a write to it failed for good
+ * fails with the error of that write.
+ */
+static int take_failure(CacheConnect *connect, const char *name)
+{
+    cache_item_t *item;
+    int rc = 0;
+
+    pthread_mutex_lock(&connect->lock);
+
+    item = item_get(connect, name, false);
+    if (item)
+        rc = item_failure(connect, item);
+
+    pthread_mutex_unlock(&connect->lock);
+
+    return rc;
+}
+
+static void store_object(CacheConnect *connect, const void *data, size_t len,
+                         char *digest)
+{
+    static const char hex[] = "0123456789abcdef";
+    uint8_t hash[SHA256_DIGEST_LENGTH];
+    int i;
+
+    SHA256((const uint8_t *)data, len, hash);
+    for (i = 0; i < SHA256_DIGEST_LENGTH; i++) {
+        digest[i * 2] = hex[hash[i] >> 4];
+        digest[i * 2 + 1] = hex[hash[i] & 0x0F];
+    }
+    digest[DIGEST_LEN] = '\0';
+
+    object_cache_put(connect->objects, digest, data, len);
+}
+
+static int load_object(CacheConnect *connect, const char *digest,
+                       uint8_t **data, size_t *len)
+{
+    ssize_t size;
+    uint8_t *buf;
+
+    if (!digest[0])
+        return -1;
+
+    size = object_cache_length(connect->objects, digest);
+    if (size < 0)
+        return -1;
+
+    buf = (uint8_t *)malloc(size ? (size_t)size : 1);
+    if (!buf)
+        return -1;
+
+    if (object_cache_get(connect->objects, digest, buf, (size_t)size) != size) {
+        free(buf);
+        return -1;
+    }
+
+    *data = buf;
+    *len = (size_t)size;
+    return 0;
+}
+
+/*
+ * Copy a cached object out. Return its size, 0 with nothing copied
+ * (len untouched) if it is not cached, or an error.
+ */
+static int copy_object(CacheConnect *connect, const char *digest, void *to,
+                       size_t buflen, ssize_t *len)
+{
+    ssize_t size;
+
+    if (!digest[0])
+        return 0;
+
+    size = object_cache_length(connect->objects, digest);
+    if (size < 0)
+        return 0;
+
+    if (!to) {
+        *len = size;
+        return 1;
+    }
+
+    if ((size_t)size > buflen)
+        return HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
+
+    if (object_cache_get(connect->objects, digest, to, buflen) != size)
+        return 0;
+
+    *len = size;
+    return 1;
+}
+
+/*
+ * Key values are cached as one object: each value prefixed with its
+ * length, in network byte order.
+ */
+static int blob_append(uint8_t **blob, size_t *len, const void *value,
+                       size_t length)
+{
+    uint32_t prefix = htonl((uint32_t)length);
+    uint8_t *p;
+
+    p = (uint8_t *)realloc(*blob, *len + sizeof(prefix) + length);
+    if (!p)
+        return -1;
+
+    memcpy(p + *len, &prefix, sizeof(prefix));
+    memcpy(p + *len + sizeof(prefix), value, length);
+
+    *blob = p;
+    *len += sizeof(prefix) + length;
+    return 0;
+}
+
+static int blob_iterate(const uint8_t *blob, size_t len, const char *key,
+                        HiveKeyValuesIterateCallback *callback, void *context)
+{
+    size_t off = 0;
+
+    while (off < len) {
+        uint32_t length;
+
+        if (len - off < sizeof(length))
+            return HIVE_GENERAL_ERROR(HIVEERR_BAD_PERSISTENT_DATA);
+
+        memcpy(&length, blob + off, sizeof(length));
+        length = ntohl(length);
+        off += sizeof(length);
+
+        if (len - off < length)
+            return HIVE_GENERAL_ERROR(HIVEERR_BAD_PERSISTENT_DATA);
+
+        if (!callback(key, blob + off, length, context))
+            return 0;
+
+        off += length;
+    }
+
+    return 0;
+}
+
+static bool collect_value(const char *key, const void *value, size_t length,
+                          void *context)
+{
+    void **args = (void **)context;
+
+    return blob_append((uint8_t **)args[0], (size_t *)args[1], value, length) == 0;
+}
+
+static int read_file(const char *path, uint8_t **data, size_t *len)
+{
+    struct stat st;
+    uint8_t *buf;
+    size_t left;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_BINARY);
+    if (fd < 0)
+        return -1;
+
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    /* NUL terminated, for the index to be parsed in place. */
+    buf = (uint8_t *)malloc((size_t)st.st_size + 1);
+    if (!buf) {
+        close(fd);
+        return -1;
+    }
+
+    for (left = (size_t)st.st_size; left > 0; ) {
+        ssize_t nrd = read(fd, buf + (size_t)st.st_size - left,
+#if defined(_WIN32) || defined(_WIN64)
+                           (unsigned)
+#endif
+                           left);
+        if (nrd < 0 && errno == EINTR)
+            continue;
+
+        if (nrd <= 0) {
+            free(buf);
+            close(fd);
+            return -1;
+        }
+
+        left -= (size_t)nrd;
+    }
+
+    close(fd);
+
+    buf[st.st_size] = '\0';
+    *data = buf;
+    *len = (size_t)st.st_size;
+    return 0;
+}
+
+static int journal_path(CacheConnect *connect, uint64_t seq, char *path,
+                        size_t len)
+{
+    int rc;
+
+    rc = snprintf(path, len, "%s/%016llx", connect->journal_dir,
+                  (unsigned long long)seq);
+    if (rc < 0 || rc >= (int)len)
+        return HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
+
+    return 0;
+}
+
+static int journal_write(CacheConnect *connect, uint64_t seq, int op,
+                         bool encrypt, const char *name, const void *data,
+                         size_t len)
+{
+    journal_record_t record;
+    size_t name_len = strlen(name);
+    char path[PATH_MAX];
+    uint8_t *buf;
+    int rc;
+
+    rc = journal_path(connect, seq, path, sizeof(path));
+    if (rc < 0)
+        return rc;
+
+    buf = (uint8_t *)malloc(sizeof(record) + name_len + 1 + len);
+    if (!buf)
+        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+
+    memset(&record, 0, sizeof(record));
+    record.op = (uint8_t)op;
+    record.flags = encrypt ? FLAG_ENCRYPT : 0;
+    record.name_len = htonl((uint32_t)name_len);
+    record.data_len = htonl((uint32_t)len);
+
+    memcpy(buf, &record, sizeof(record));
+    memcpy(buf + sizeof(record), name, name_len + 1);
+    if (len)
+        memcpy(buf + sizeof(record) + name_len + 1, data, len);
+
+    /* Acknowledged once the rename too is durable. */
+    rc = atomic_write_file(path, buf, sizeof(record) + name_len + 1 + len,
+                           S_IRUSR | S_IWUSR);
+    if (rc == 0)
+        rc = sync_dir(connect->journal_dir);
+    if (rc < 0)
+        rc = HIVE_SYS_ERROR(errno);
+
+    free(buf);
+    return rc;
+}
+
+/*
+ * Any failure to load a journal is reported as bad data: the write it
+ * held can not be written back, however often it is retried.
+ */
+static int journal_load(CacheConnect *connect, uint64_t seq, journal_t *journal)
+{
+    journal_record_t record;
+    char path[PATH_MAX];
+    size_t name_len;
+    size_t len;
+
+    if (journal_path(connect, seq, path, sizeof(path)) < 0 ||
+        read_file(path, &journal->buf, &len) < 0)
+        return HIVE_GENERAL_ERROR(HIVEERR_BAD_PERSISTENT_DATA);
+
+    if (len < sizeof(record))
+        goto bad_data;
+
+    memcpy(&record, journal->buf, sizeof(record));
+    name_len = ntohl(record.name_len);
+    journal->op = record.op;
+    journal->flags = record.flags;
+    journal->data_len = ntohl(record.data_len);
+
+    if (record.op < OP_PUT_FILE || record.op > OP_SET_VALUE ||
+        len != sizeof(record) + name_len + 1 + journal->data_len ||
+        journal->buf[sizeof(record) + name_len] != '\0')
+        goto bad_data;
+
+    journal->name = (const char *)journal->buf + sizeof(record);
+    journal->data = journal->buf + sizeof(record) + name_len + 1;
+    return 0;
+
+bad_data:
+    free(journal->buf);
+    return HIVE_GENERAL_ERROR(HIVEERR_BAD_PERSISTENT_DATA);
+}
+
+static void journal_remove(CacheConnect *connect, uint64_t seq)
+{
+    char path[PATH_MAX];
+
+    if (journal_path(connect, seq, path, sizeof(path)) == 0)
+        unlink(path);
+}
+
+static void queue_append(CacheConnect *connect, write_op_t *op)
+{
+    op->next = NULL;
+    if (connect->tail)
+        connect->tail->next = op;
+    else
+        connect->head = op;
+    connect->tail = op;
+}
+
+static void queue_remove(CacheConnect *connect, write_op_t *op)
+{
+    write_op_t *prev = NULL;
+    write_op_t *p;
+
+    for (p = connect->head; p && p != op; p = p->next)
+        prev = p;
+
+    if (!p)
+        return;
+
+    if (prev)
+        prev->next = op->next;
+    else
+        connect->head = op->next;
+
+    if (connect->tail == op)
+        connect->tail = prev;
+}
+
+/*
+ * Store the local copy a write leaves, given the state of the item when
+ * the write was queued; an empty digest if it leaves none. A value put
+ * to a key without a complete local copy in the same form, or with
+ * other writes to it still being queued, leaves it without one, until
+ * written back and read through again.
+ */
+static void stage_copy(CacheConnect *connect, const item_state_t *base, int op,
+                       bool encrypt, const void *data, size_t len, char *digest)
+{
+    uint8_t *blob = NULL;
+    size_t blob_len = 0;
+
+    digest[0] = '\0';
+
+    if (op == OP_PUT_FILE) {
+        store_object(connect, data, len, digest);
+        return;
+    }
+
+    if (op == OP_PUT_VALUE &&
+        (base->staging || base->crypt != encrypt ||
+         load_object(connect, base->digest, &blob, &blob_len) < 0))
+        return;
+
+    if (blob_append(&blob, &blob_len, data, len) == 0)
+        store_object(connect, blob, blob_len, digest);
+
+    free(blob);
+}
+
+/*
+ * Make a queued write visible to reads and to the writer. A write
+ * published after a later one to the same item leaves its copy alone,
+ * and a value put leaves no copy if the one it was put to changed
+ * meanwhile. Called with the lock held.
+ */
+static void publish(CacheConnect *connect, cache_item_t *item,
+                    write_op_t *wop, const item_state_t *base, int op,
+                    bool encrypt, const char *digest)
+{
+    item_state_t *state = &item->state;
+
+    wop->ready = true;
+    state->pending++;
+    state->version[0] = '\0';
+
+    if (wop->seq < state->last_seq)
+        return;
+
+    if (op == OP_PUT_VALUE && (base->last_seq != state->last_seq ||
+                               strcmp(base->digest, state->digest)))
+        digest = "";
+
+    strcpy(state->digest, digest);
+    state->crypt = encrypt;
+    state->last_seq = wop->seq;
+}
+
+/*
+ * The sequence number is reserved under the lock, so writes are written
+ * back in the order they were acknowledged in. The journal and the local
+ * copy are written outside it, and the lock taken again to publish.
+ */
+static int enqueue(CacheConnect *connect, int op, bool encrypt,
+                   const char *name, const void *data, size_t len)
+{
+    char digest[DIGEST_LEN + 1];
+    cache_item_t *item;
+    item_state_t base;
+    write_op_t *wop;
+    int rc;
+
+    /* Lengths are journaled, and values prefixed, in 32 bits. */
+    if ((uint64_t)len > UINT32_MAX)
+        return HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS);
+
+    wop = (write_op_t *)malloc(sizeof(write_op_t) + strlen(name) + 1);
+    if (!wop)
+        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+
+    strcpy(wop->name, name);
+    wop->ready = false;
+
+    pthread_mutex_lock(&connect->lock);
+
+    item = item_get(connect, name, true);
+    rc = item ? item_failure(connect, item) :
+                HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+    if (rc < 0) {
+        pthread_mutex_unlock(&connect->lock);
+        free(wop);
+        return rc;
+    }
+
+    base = item->state;
+    item->state.staging++;
+    wop->seq = connect->next_seq++;
+    queue_append(connect, wop);
+
+    pthread_mutex_unlock(&connect->lock);
+
+    /* Flushed to disk before the write is acknowledged. */
+    rc = journal_write(connect, wop->seq, op, encrypt, name + PREFIX_LEN,
+                       data, len);
+    if (rc == 0)
+        stage_copy(connect, &base, op, encrypt, data, len, digest);
+
+    pthread_mutex_lock(&connect->lock);
+
+    /* Items stay in the index once added: item is still valid. */
+    item->state.staging--;
+    if (rc < 0)
+        queue_remove(connect, wop);
+    else
+        publish(connect, item, wop, &base, op, encrypt, digest);
+
+    pthread_cond_broadcast(&connect->cond);
+    pthread_mutex_unlock(&connect->lock);
+
+    if (rc < 0)
+        free(wop);
+
+    return rc;
+}
+
+/*
+ * Wait until the writes acknowledged so far are written back, so the
+ * backend can be operated on directly. Fails fast while the backend
+ * keeps failing write-backs.
+ */
+static int drain(CacheConnect *connect)
+{
+    uint64_t target;
+    int rc = 0;
+
+    pthread_mutex_lock(&connect->lock);
+
+    target = connect->next_seq;
+    while (connect->head && connect->head->seq < target && !connect->failure)
+        pthread_cond_wait(&connect->cond, &connect->lock);
+
+    if (connect->head && connect->head->seq < target)
+        rc = connect->failure;
+
+    pthread_mutex_unlock(&connect->lock);
+
+    return rc;
+}
+
+static int writeback(CacheConnect *connect, const write_op_t *op,
+                     char *version, size_t len)
+{
+    HiveConnect *backend = connect->backend;
+    journal_t journal;
+    bool encrypt;
+    int rc;
+
+    rc = journal_load(connect, op->seq, &journal);
+    if (rc < 0)
+        return rc;
+
+    encrypt = (journal.flags & FLAG_ENCRYPT) != 0;
+    rc = HIVE_GENERAL_ERROR(HIVEERR_NOT_SUPPORTED);
+    version[0] = '\0';
+
+    switch (journal.op) {
+    case OP_PUT_FILE:
+        if (backend->put_file_from_buffer)
+            rc = backend->put_file_from_buffer(backend, journal.data,
+                                               journal.data_len, encrypt,
+                                               journal.name);
+        if (!rc && backend->get_file_version &&
+            backend->get_file_version(backend, journal.name, version, len) < 0)
+            version[0] = '\0';
+        break;
+
+    case OP_PUT_VALUE:
+        if (backend->put_value)
+            rc = backend->put_value(backend, journal.name, journal.data,
+                                    journal.data_len, encrypt);
+        break;
+
+    case OP_SET_VALUE:
+        if (backend->set_value)
+            rc = backend->set_value(backend, journal.name, journal.data,
+                                    journal.data_len, encrypt);
+        if (!rc && backend->get_key_version &&
+            backend->get_key_version(backend, journal.name, version, len) < 0)
+            version[0] = '\0';
+        break;
+    }
+
+    free(journal.buf);
+    return rc;
+}
+
+/*
+ * Retire the write at the head of the queue. A write the backend
+ * rejected for good keeps its journal, and so is written back again on
+ * the next connect, until its error is reported on the item; the local
+ * copy it went into is dropped. Called with the lock held.
+ */
+static void complete(CacheConnect *connect, int rc, const char *version)
+{
+    write_op_t *op = connect->head;
+    cache_item_t *item;
+
+    connect->head = op->next;
+    if (!connect->head)
+        connect->tail = NULL;
+
+    item = item_get(connect, op->name, false);
+    if (rc < 0 && item) {
+        /* Only the last failure on an item is kept for the report. */
+        if (item->state.error)
+            journal_remove(connect, item->state.failed_seq);
+
+        item->state.error = rc;
+        item->state.failed_seq = op->seq;
+    } else {
+        journal_remove(connect, op->seq);
+    }
+
+    if (item) {
+        item->state.pending--;
+
+        if (rc < 0) {
+            item->state.version[0] = '\0';
+            item->state.digest[0] = '\0';
+        } else if (!item->state.pending) {
+            /*
+             * Where the backend version could not be told, as after
+             * putting a value, the copy is revalidated by the next read.
+             */
+            strcpy(item->state.version, version);
+        }
+    }
+
+    free(op);
+}
+
+static void *writer_entry(void *arg)
+{
+    CacheConnect *connect = (CacheConnect *)arg;
+    char version[HIVE_MAX_VERSION_LEN];
+    int interval = 0;
+    struct timeval now;
+    struct timespec ts;
+    write_op_t *op;
+    int rc;
+
+    pthread_mutex_lock(&connect->lock);
+
+    for (;;) {
+        while ((!connect->head || !connect->head->ready) && !connect->stopping)
+            pthread_cond_wait(&connect->cond, &connect->lock);
+
+        /*
+         * On disconnect, writes are written back as long as the backend
+         * takes them; the rest stay journaled for the next connect.
+         */
+        if (!connect->head || !connect->head->ready ||
+            (connect->stopping && connect->failure))
+            break;
+
+        /* Only the writer removes from the queue: op stays the head. */
+        op = connect->head;
+        pthread_mutex_unlock(&connect->lock);
+        rc = writeback(connect, op, version, sizeof(version));
+        pthread_mutex_lock(&connect->lock);
+
+        if (rc < 0 && hive_error_is_transient(rc)) {
+            connect->failure = rc;
+            pthread_cond_broadcast(&connect->cond);
+
+            interval = interval ? interval * 2 : RETRY_MIN_INTERVAL;
+            if (interval > RETRY_MAX_INTERVAL)
+                interval = RETRY_MAX_INTERVAL;
+
+            vlogW("Cache: Write back of %s failed (0x%x), retry in %ds.",
+                  op->name + PREFIX_LEN, -rc, interval);
+
+            gettimeofday(&now, NULL);
+            ts.tv_sec = now.tv_sec + interval;
+            ts.tv_nsec = now.tv_usec * 1000;
+            while (!connect->stopping &&
+                   pthread_cond_timedwait(&connect->cond, &connect->lock, &ts) != ETIMEDOUT)
+                ;
+            continue;
+        }
+
+        if (rc < 0)
+            vlogE("Cache: Write back of %s failed (0x%x), kept in journal.",
+                  op->name + PREFIX_LEN, -rc);
+
+        interval = 0;
+        connect->failure = 0;
+        complete(connect, rc, version);
+        pthread_cond_broadcast(&connect->cond);
+
+        /*
+         * A removal lost in a crash would have its write replayed over
+         * the later ones: have it durable before the next write back.
+         */
+        pthread_mutex_unlock(&connect->lock);
+        sync_dir(connect->journal_dir);
+        pthread_mutex_lock(&connect->lock);
+    }
+
+    pthread_mutex_unlock(&connect->lock);
+    return NULL;
+}
+
+static int put_file_from_buffer(HiveConnect *base, const void *from,
+                                size_t length, bool encrypt, const char *filename)
+{
+    CacheConnect *connect = (CacheConnect *)base;
+    char name[PATH_MAX];
+    int rc;
+
+    rc = item_name(FILE_PREFIX, filename, name, sizeof(name));
+    if (rc < 0)
+        return rc;
+
+    return enqueue(connect, OP_PUT_FILE, encrypt, name, from, length);
+}
+
+/*
+ * Read a file from the local copy while writes to it are pending: the
+ * cached object, or else the journal of the latest write. Return 0 when
+ * neither is left, the write having been written back meanwhile.
+ */
+static int pending_file(CacheConnect *connect, const item_state_t *state,
+                        void *to, size_t buflen, ssize_t *len)
+{
+    journal_t journal;
+    int rc;
+
+    rc = copy_object(connect, state->digest, to, buflen, len);
+    if (rc != 0)
+        return rc;
+
+    if (journal_load(connect, state->last_seq, &journal) < 0)
+        return 0;
+
+    if (to && journal.data_len > buflen) {
+        rc = HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
+    } else {
+        if (to && journal.data_len)
+            memcpy(to, journal.data, journal.data_len);
+        *len = (ssize_t)journal.data_len;
+        rc = 1;
+    }
+
+    free(journal.buf);
+    return rc;
+}
+
+/*
+ * Serve a file from its local copy if it is pending, or matches the
+ * version the backend reports, and is in the form asked for. A pending
+ * copy in the other form is written back first, for the backend to
+ * serve. A backend unreachable for the version check does not fail the
+ * read, when there is a copy to serve.
+ * Return 1 with len set on a hit, 0 on a miss with the backend version,
+ * if any, in version, or an error.
+ */
+static int lookup_file(CacheConnect *connect, const char *filename,
+                       const char *name, bool decrypt, void *to,
+                       size_t buflen, char *version, ssize_t *len)
+{
+    HiveConnect *backend = connect->backend;
+    item_state_t state;
+    int rc;
+
+    version[0] = '\0';
+
+    rc = take_failure(connect, name);
+    if (rc < 0)
+        return rc;
+
+    item_state(connect, name, &state);
+
+    if (state.pending && state.crypt == decrypt) {
+        rc = pending_file(connect, &state, to, buflen, len);
+        if (rc != 0)
+            return rc;
+
+        item_state(connect, name, &state);
+    }
+
+    if (state.pending) {
+        rc = drain(connect);
+        if (rc < 0)
+            return rc;
+
+        item_state(connect, name, &state);
+    }
+
+    if (!backend->get_file_version)
+        return 0;
+
+    rc = backend->get_file_version(backend, filename, version,
+                                   HIVE_MAX_VERSION_LEN);
+    if (rc < 0) {
+        version[0] = '\0';
+        if (!hive_error_is_transient(rc) || !state.digest[0] ||
+            state.crypt != decrypt)
+            return rc;
+    } else if (strcmp(state.version, version) || state.crypt != decrypt) {
+        return 0;
+    }
+
+    return copy_object(connect, state.digest, to, buflen, len);
+}
+
+static ssize_t get_file_length(HiveConnect *base, const char *filename)
+{
+    CacheConnect *connect = (CacheConnect *)base;
+    char version[HIVE_MAX_VERSION_LEN];
+    char name[PATH_MAX];
+    ssize_t len;
+    int rc;
+
+    rc = item_name(FILE_PREFIX, filename, name, sizeof(name));
+    if (rc < 0)
+        return rc;
+
+    /* Lengths are of the content as stored. */
+    rc = lookup_file(connect, filename, name, false, NULL, 0, version, &len);
+    if (rc < 0)
+        return rc;
+
+    if (rc > 0)
+        return len;
+
+    return connect->backend->get_file_length(connect->backend, filename);
+}
+
+static ssize_t get_file_to_buffer(HiveConnect *base, const char *filename,
+                                  bool decrypt, void *to, size_t buflen)
+{
+    CacheConnect *connect = (CacheConnect *)base;
+    HiveConnect *backend = connect->backend;
+    char version[HIVE_MAX_VERSION_LEN];
+    char digest[DIGEST_LEN + 1];
+    char name[PATH_MAX];
+    ssize_t len;
+    int rc;
+
+    rc = item_name(FILE_PREFIX, filename, name, sizeof(name));
+    if (rc < 0)
+        return rc;
+
+    rc = lookup_file(connect, filename, name, decrypt, to, buflen, version,
+                     &len);
+    if (rc < 0)
+        return rc;
+
+    if (rc > 0)
+        return len;
+
+    len = backend->get_file_to_buffer(backend, filename, decrypt, to, buflen);
+    if (len >= 0 && version[0]) {
+        store_object(connect, to, (size_t)len, digest);
+        item_settle(connect, name, version, digest, decrypt);
+    }
+
+    return len;
+}
+
+static int list_files(HiveConnect *base, HiveFilesIterateCallback *callback,
+                      void *context)
+{
+    CacheConnect *connect = (CacheConnect *)base;
+    int rc;
+
+    rc = drain(connect);
+    if (rc < 0)
+        return rc;
+
+    return connect->backend->list_files(connect->backend, callback, context);
+}
+
+static int delete_file(HiveConnect *base, const char *filename)
+{
+    CacheConnect *connect = (CacheConnect *)base;
+    char name[PATH_MAX];
+    int rc;
+
+    rc = item_name(FILE_PREFIX, filename, name, sizeof(name));
+    if (rc < 0)
+        return rc;
+
+    rc = take_failure(connect, name);
+    if (rc < 0)
+        return rc;
+
+    rc = drain(connect);
+    if (rc < 0)
+        return rc;
+
+    rc = connect->backend->delete_file(connect->backend, filename);
+    item_forget(connect, name);
+
+    return rc;
+}
+
+static int put_value(HiveConnect *base, const char *key, const void *value,
+                     size_t length, bool encrypt)
+{
+    CacheConnect *connect = (CacheConnect *)base;
+    char name[PATH_MAX];
+    int rc;
+
+    rc = item_name(KEY_PREFIX, key, name, sizeof(name));
+    if (rc < 0)
+        return rc;
+
+    return enqueue(connect, OP_PUT_VALUE, encrypt, name, value, length);
+}
+
+static int set_value(HiveConnect *base, const char *key, const void *value,
+                     size_t length, bool encrypt)
+{
+    CacheConnect *connect = (CacheConnect *)base;
+    char name[PATH_MAX];
+    int rc;
+
+    rc = item_name(KEY_PREFIX, key, name, sizeof(name));
+    if (rc < 0)
+        return rc;
+
+    return enqueue(connect, OP_SET_VALUE, encrypt, name, value, length);
+}
+
+static int get_values(HiveConnect *base, const char *key, bool decrypt,
+                      HiveKeyValuesIterateCallback *callback, void *context)
+{
+    CacheConnect *connect = (CacheConnect *)base;
+    HiveConnect *backend = connect->backend;
+    char version[HIVE_MAX_VERSION_LEN];
+    char digest[DIGEST_LEN + 1];
+    char name[PATH_MAX];
+    item_state_t state;
+    uint8_t *blob = NULL;
+    size_t len = 0;
+    void *args[2];
+    int rc;
+
+    rc = item_name(KEY_PREFIX, key, name, sizeof(name));
+    if (rc < 0)
+        return rc;
+
+    rc = take_failure(connect, name);
+    if (rc < 0)
+        return rc;
+
+    item_state(connect, name, &state);
+
+    if (state.pending) {
+        if (state.crypt == decrypt &&
+            load_object(connect, state.digest, &blob, &len) == 0)
+            goto iterate;
+
+        /*
+         * Not all values are known locally, or not in the form asked
+         * for: let the backend have them.
+         */
+        rc = drain(connect);
+        if (rc < 0)
+            return rc;
+
+        item_state(connect, name, &state);
+    }
+
+    if (!backend->get_key_version)
+        return backend->get_values(backend, key, decrypt, callback, context);
+
+    rc = backend->get_key_version(backend, key, version, sizeof(version));
+    if (rc < 0) {
+        if (!hive_error_is_transient(rc) || !state.digest[0] ||
+            state.crypt != decrypt)
+            return backend->get_values(backend, key, decrypt, callback, context);
+
+        if (load_object(connect, state.digest, &blob, &len) == 0)
+            goto iterate;
+
+        return rc;
+    }
+
+    if (!strcmp(state.version, version) && state.crypt == decrypt &&
+        load_object(connect, state.digest, &blob, &len) == 0)
+        goto iterate;
+
+    args[0] = &blob;
+    args[1] = &len;
+    rc = backend->get_values(backend, key, decrypt, collect_value, args);
+    if (rc < 0) {
+        free(blob);
+        return rc;
+    }
+
+    store_object(connect, blob ? blob : (uint8_t *)"", len, digest);
+    item_settle(connect, name, version, digest, decrypt);
+
+iterate:
+    rc = blob_iterate(blob, len, key, callback, context);
+    free(blob);
+
+    return rc;
+}
+
+static int delete_key(HiveConnect *base, const char *key)
+{
+    CacheConnect *connect = (CacheConnect *)base;
+    char name[PATH_MAX];
+    int rc;
+
+    rc = item_name(KEY_PREFIX, key, name, sizeof(name));
+    if (rc < 0)
+        return rc;
+
+    rc = take_failure(connect, name);
+    if (rc < 0)
+        return rc;
+
+    rc = drain(connect);
+    if (rc < 0)
+        return rc;
+
+    rc = connect->backend->delete_key(connect->backend, key);
+    item_forget(connect, name);
+
+    return rc;
+}
+
+/*
+ * IPFS content is addressed by its hash, and the IPFS backend keeps its
+ * own object cache: its calls are passed through untouched.
+ */
+static int ipfs_put_file_from_buffer(HiveConnect *base, const void *from,
+                                     size_t length, bool encrypt, IPFSCid *cid)
+{
+    HiveConnect *backend = ((CacheConnect *)base)->backend;
+
+    return backend->ipfs_put_file_from_buffer(backend, from, length, encrypt, cid);
+}
+
+static int ipfs_add(HiveConnect *base, HiveReadCallback *callback,
+                    hive_rewind_callback_t *rewind, void *context,
+                    ssize_t size, const IPFSAddOptions *options, IPFSCid *cid)
+{
+    HiveConnect *backend = ((CacheConnect *)base)->backend;
+
+    return backend->ipfs_add(backend, callback, rewind, context, size,
+                             options, cid);
+}
+
+static int ipfs_put_files(HiveConnect *base, const IPFSAddItem *items,
+                          size_t count, IPFSCid *cids, IPFSCid *root)
+{
+    HiveConnect *backend = ((CacheConnect *)base)->backend;
+
+    return backend->ipfs_put_files(backend, items, count, cids, root);
+}
+
+static ssize_t ipfs_get_file_length(HiveConnect *base, const IPFSCid *cid)
+{
+    HiveConnect *backend = ((CacheConnect *)base)->backend;
+
+    return backend->ipfs_get_file_length(backend, cid);
+}
+
+static int ipfs_get_file_lengths(HiveConnect *base, const IPFSCid *cids,
+                                 size_t count, ssize_t *lengths)
+{
+    HiveConnect *backend = ((CacheConnect *)base)->backend;
+
+    return backend->ipfs_get_file_lengths(backend, cids, count, lengths);
+}
+
+static ssize_t ipfs_get_file_to_buffer(HiveConnect *base, const IPFSCid *cid,
+                                       bool decrypt, void *to, size_t buflen)
+{
+    HiveConnect *backend = ((CacheConnect *)base)->backend;
+
+    return backend->ipfs_get_file_to_buffer(backend, cid, decrypt, to, buflen);
+}
+
+static ssize_t ipfs_get_file_range(HiveConnect *base, const IPFSCid *cid,
+                                   uint64_t offset, size_t length, void *to)
+{
+    HiveConnect *backend = ((CacheConnect *)base)->backend;
+
+    return backend->ipfs_get_file_range(backend, cid, offset, length, to);
+}
+
+static ssize_t ipfs_export_car(HiveConnect *base, const IPFSCid *cid, int fd)
+{
+    HiveConnect *backend = ((CacheConnect *)base)->backend;
+
+    return backend->ipfs_export_car(backend, cid, fd);
+}
+
+static ssize_t ipfs_import_car(HiveConnect *base, int fd, IPFSCid *roots,
+                               size_t count)
+{
+    HiveConnect *backend = ((CacheConnect *)base)->backend;
+
+    return backend->ipfs_import_car(backend, fd, roots, count);
+}
+
+static int ipfs_get_stats(HiveConnect *base, IPFSStats *stats)
+{
+    HiveConnect *backend = ((CacheConnect *)base)->backend;
+
+    return backend->ipfs_get_stats(backend, stats);
+}
+
+static int get_cache_stats(HiveConnect *base, HiveCacheStats *stats)
+{
+    HiveConnect *backend = ((CacheConnect *)base)->backend;
+
+    return backend->get_cache_stats(backend, stats);
+}
+
+static int expire_token(HiveConnect *base)
+{
+    HiveConnect *backend = ((CacheConnect *)base)->backend;
+
+    return backend->expire_token(backend);
+}
+
+/*
+ * The index tells which version of each file and key the cached objects
+ * match. It is saved on disconnect; without it, copies are just read
+ * through again.
+ */
+static void index_load(CacheConnect *connect)
+{
+    cJSON *json;
+    cJSON *items;
+    cJSON *entry;
+    uint8_t *buf;
+    size_t len;
+
+    if (read_file(connect->index_path, &buf, &len) < 0)
+        return;
+
+    json = cJSON_Parse((const char *)buf);
+    free(buf);
+    if (!json) {
+        vlogW("Cache: Invalid index file, ignored.");
+        return;
+    }
+
+    items = cJSON_GetObjectItemCaseSensitive(json, "items");
+    cJSON_ArrayForEach(entry, items) {
+        cJSON *name = cJSON_GetObjectItemCaseSensitive(entry, "name");
+        cJSON *version = cJSON_GetObjectItemCaseSensitive(entry, "version");
+        cJSON *digest = cJSON_GetObjectItemCaseSensitive(entry, "digest");
+        cJSON *crypt = cJSON_GetObjectItemCaseSensitive(entry, "crypt");
+        cache_item_t *item;
+
+        if (!cJSON_IsString(name) || !cJSON_IsString(version) ||
+            !cJSON_IsString(digest) ||
+            strlen(version->valuestring) >= HIVE_MAX_VERSION_LEN ||
+            strlen(digest->valuestring) != DIGEST_LEN ||
+            object_cache_length(connect->objects, digest->valuestring) < 0)
+            continue;
+
+        item = item_get(connect, name->valuestring, true);
+        if (!item)
+            break;
+
+        strcpy(item->state.version, version->valuestring);
+        strcpy(item->state.digest, digest->valuestring);
+        item->state.crypt = cJSON_IsTrue(crypt);
+    }
+
+    cJSON_Delete(json);
+}
+
+static void index_save(CacheConnect *connect)
+{
+    hashtable_iterator_t it;
+    cache_item_t *item;
+    cJSON *json;
+    cJSON *items;
+    cJSON *entry;
+    char *str;
+
+    json = cJSON_CreateObject();
+    if (!json)
+        return;
+
+    items = cJSON_AddArrayToObject(json, "items");
+    if (!items) {
+        cJSON_Delete(json);
+        return;
+    }
+
+    hashtable_iterate(connect->items, &it);
+    while (hashtable_iterator_has_next(&it)) {
+        hashtable_iterator_next(&it, NULL, NULL, (void **)&item);
+
+        if (!item->state.pending && item->state.version[0] &&
+            object_cache_length(connect->objects, item->state.digest) >= 0) {
+            entry = cJSON_CreateObject();
+            if (entry) {
+                cJSON_AddStringToObject(entry, "name", item->name);
+                cJSON_AddStringToObject(entry, "version", item->state.version);
+                cJSON_AddStringToObject(entry, "digest", item->state.digest);
+                cJSON_AddBoolToObject(entry, "crypt", item->state.crypt);
+                cJSON_AddItemToArray(items, entry);
+            }
+        }
+
+        deref(item);
+    }
+
+    str = cJSON_PrintUnformatted(json);
+    cJSON_Delete(json);
+    if (!str)
+        return;
+
+    if (atomic_write_file(connect->index_path, str, strlen(str),
+                          S_IRUSR | S_IWUSR) < 0)
+        vlogW("Cache: Can not save index file (%d).", errno);
+
+    free(str);
+}
+
+/*
+ * Queue again the writes journaled but not written back before the last
+ * disconnect. A write may have reached the backend without its journal
+ * being removed, in which case it is written back twice.
+ */
+static int journal_recover_one(CacheConnect *connect, uint64_t seq)
+{
+    char name[PATH_MAX];
+    cache_item_t *item;
+    journal_t journal;
+    write_op_t *op;
+    int rc;
+
+    rc = journal_load(connect, seq, &journal);
+    if (rc < 0) {
+        vlogW("Cache: Invalid journal %016llx, dropped.", (unsigned long long)seq);
+        journal_remove(connect, seq);
+        return 0;
+    }
+
+    rc = item_name(journal.op == OP_PUT_FILE ? FILE_PREFIX : KEY_PREFIX,
+                   journal.name, name, sizeof(name));
+    free(journal.buf);
+    if (rc < 0)
+        return rc;
+
+    op = (write_op_t *)malloc(sizeof(write_op_t) + strlen(name) + 1);
+    if (!op)
+        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+
+    item = item_get(connect, name, true);
+    if (!item) {
+        free(op);
+        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+    }
+
+    op->seq = seq;
+    op->ready = true;
+    strcpy(op->name, name);
+
+    /* Whatever copy the index had predates the write. */
+    item->state.version[0] = '\0';
+    item->state.digest[0] = '\0';
+    item->state.crypt = (journal.flags & FLAG_ENCRYPT) != 0;
+    item->state.pending++;
+    item->state.last_seq = seq;
+
+    queue_append(connect, op);
+    if (seq >= connect->next_seq)
+        connect->next_seq = seq + 1;
+
+    return 0;
+}
+
+static int compare_seq(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static int add_seq(const char *filename, uint64_t **seqs, size_t *count,
+                   size_t *capacity)
+{
+    char *end;
+    uint64_t seq;
+
+    if (strlen(filename) != JOURNAL_NAME_LEN)
+        return 0;
+
+    seq = strtoull(filename, &end, 16);
+    if (*end)
+        return 0;
+
+    if (*count == *capacity) {
+        size_t n = *capacity ? *capacity * 2 : 16;
+        uint64_t *p = (uint64_t *)realloc(*seqs, n * sizeof(uint64_t));
+
+        if (!p)
+            return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+
+        *seqs = p;
+        *capacity = n;
+    }
+
+    (*seqs)[(*count)++] = seq;
+    return 0;
+}
+
+static int journal_recover(CacheConnect *connect)
+{
+    uint64_t *seqs = NULL;
+    size_t capacity = 0;
+    size_t count = 0;
+    size_t i;
+    int rc = 0;
+
+#if defined(_WIN32) || defined(_WIN64)
+    struct _finddata_t file;
+    char pattern[PATH_MAX];
+    intptr_t handle;
+
+    rc = snprintf(pattern, sizeof(pattern), "%s/*", connect->journal_dir);
+    if (rc < 0 || rc >= (int)sizeof(pattern))
+        return HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
+
+    rc = 0;
+    handle = _findfirst(pattern, &file);
+    if (handle != -1) {
+        do {
+            rc = add_seq(file.name, &seqs, &count, &capacity);
+        } while (!rc && _findnext(handle, &file) == 0);
+        _findclose(handle);
+    }
+#else
+    struct dirent *entry;
+    DIR *dir;
+
+    dir = opendir(connect->journal_dir);
+    if (!dir)
+        return HIVE_SYS_ERROR(errno);
+
+    while (!rc && (entry = readdir(dir)) != NULL)
+        rc = add_seq(entry->d_name, &seqs, &count, &capacity);
+
+    closedir(dir);
+#endif
+
+    if (count)
+        qsort(seqs, count, sizeof(uint64_t), compare_seq);
+
+    for (i = 0; !rc && i < count; i++)
+        rc = journal_recover_one(connect, seqs[i]);
+
+    if (count)
+        vlogI("Cache: %zu writes pending from the last connect.", count);
+
+    free(seqs);
+    return rc;
+}
+
+/*
+ * One connection at a time owns a cache directory, as nothing else knows
+ * about the writes its journal holds.
+ */
+static int lock_dir(CacheConnect *connect, const char *root)
+{
+#if defined(_WIN32) || defined(_WIN64)
+    return 0;
+#else
+    char path[PATH_MAX];
+    int rc;
+
+    rc = snprintf(path, sizeof(path), "%s/%s", root, LOCK_FILE);
+    if (rc < 0 || rc >= (int)sizeof(path))
+        return HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
+
+    connect->lock_fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (connect->lock_fd < 0)
+        return HIVE_SYS_ERROR(errno);
+
+    if (flock(connect->lock_fd, LOCK_EX | LOCK_NB) < 0)
+        return errno == EWOULDBLOCK ? HIVE_GENERAL_ERROR(HIVEERR_BUSY) :
+                                      HIVE_SYS_ERROR(errno);
+
+    return 0;
+#endif
+}
+
+static void cache_connect_destructor(void *obj)
+{
+    CacheConnect *connect = (CacheConnect *)obj;
+    write_op_t *op;
+
+    if (connect->writer_started) {
+        pthread_mutex_lock(&connect->lock);
+        connect->stopping = true;
+        pthread_cond_broadcast(&connect->cond);
+        pthread_mutex_unlock(&connect->lock);
+
+        pthread_join(connect->writer, NULL);
+    }
+
+    /* Writes left in the queue stay in the journal. */
+    while ((op = connect->head) != NULL) {
+        connect->head = op->next;
+        free(op);
+    }
+
+    if (connect->items) {
+        if (connect->objects)
+            index_save(connect);
+        deref(connect->items);
+    }
+
+    if (connect->objects)
+        object_cache_close(connect->objects);
+
+    if (connect->backend)
+        deref(connect->backend);
+
+    if (connect->lock_fd >= 0)
+        close(connect->lock_fd);
+
+    pthread_cond_destroy(&connect->cond);
+    pthread_mutex_destroy(&connect->lock);
+}
+
+HiveConnect *cache_client_connect(HiveClient *client, const HiveConnectOptions *opts)
+{
+    CacheConnectOptions *options = (CacheConnectOptions *)opts;
+    HiveConnect *backend;
+    CacheConnect *connect;
+    char objects_dir[PATH_MAX];
+    char root[PATH_MAX];
+    size_t capacity;
+    size_t memory;
+    int rc;
+
+    assert(options);
+
+    if (options->backendType != HiveBackendType_Cache || !options->backend) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS));
+        return NULL;
+    }
+
+    if (options->root && *options->root)
+        rc = snprintf(root, sizeof(root), "%s", options->root);
+    else
+        rc = snprintf(root, sizeof(root), "%s/%s", client->data_location, CACHE_DIR);
+    if (rc < 0 || rc >= (int)sizeof(root)) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS));
+        return NULL;
+    }
+
+    connect = (CacheConnect *)rc_zalloc(sizeof(CacheConnect), cache_connect_destructor);
+    if (!connect) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY));
+        return NULL;
+    }
+
+    pthread_mutex_init(&connect->lock, NULL);
+    pthread_cond_init(&connect->cond, NULL);
+    connect->lock_fd = -1;
+    connect->next_seq = 1;
+    connect->backend = backend = (HiveConnect *)ref(options->backend);
+
+    rc = snprintf(connect->journal_dir, sizeof(connect->journal_dir), "%s/%s",
+                  root, JOURNAL_DIR);
+    if (rc > 0 && rc < (int)sizeof(connect->journal_dir))
+        rc = snprintf(connect->index_path, sizeof(connect->index_path), "%s/%s",
+                      root, INDEX_FILE);
+    if (rc > 0 && rc < (int)sizeof(connect->index_path))
+        rc = snprintf(objects_dir, sizeof(objects_dir), "%s/%s", root, OBJECTS_DIR);
+    if (rc < 0 || rc >= (int)sizeof(objects_dir)) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS));
+        deref(connect);
+        return NULL;
+    }
+
+    rc = mkdirs(connect->journal_dir, S_IRWXU);
+    if (rc < 0 && errno != EEXIST) {
+        hive_set_error(HIVE_SYS_ERROR(errno));
+        deref(connect);
+        return NULL;
+    }
+
+    rc = lock_dir(connect, root);
+    if (rc < 0) {
+        hive_set_error(rc);
+        deref(connect);
+        return NULL;
+    }
+
+    capacity = options->capacity ? options->capacity : DEFAULT_CAPACITY;
+    memory = capacity / MEMORY_SHARE;
+    if (memory > MAX_MEMORY_CAPACITY)
+        memory = MAX_MEMORY_CAPACITY;
+
+    connect->objects = object_cache_new(objects_dir, capacity, memory);
+    connect->items = hashtable_create(64, 0, NULL, NULL);
+    if (!connect->objects || !connect->items) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY));
+        deref(connect);
+        return NULL;
+    }
+
+    index_load(connect);
+
+    rc = journal_recover(connect);
+    if (rc < 0) {
+        hive_set_error(rc);
+        deref(connect);
+        return NULL;
+    }
+
+    rc = pthread_create(&connect->writer, NULL, writer_entry, connect);
+    if (rc != 0) {
+        vlogE("Cache: Failed to create write back thread.");
+        hive_set_error(HIVE_SYS_ERROR(rc));
+        deref(connect);
+        return NULL;
+    }
+    connect->writer_started = true;
+
+    /*
+     * Only what the backend supports is offered, so the caller gets the
+     * same answer for the rest as from the backend itself.
+     */
+    if (backend->put_file_from_buffer)
+        connect->base.put_file_from_buffer = put_file_from_buffer;
+    if (backend->get_file_length)
+        connect->base.get_file_length      = get_file_length;
+    if (backend->get_file_to_buffer)
+        connect->base.get_file_to_buffer   = get_file_to_buffer;
+    if (backend->list_files)
+        connect->base.list_files           = list_files;
+    if (backend->delete_file)
+        connect->base.delete_file          = delete_file;
+
+    if (backend->ipfs_put_file_from_buffer)
+        connect->base.ipfs_put_file_from_buffer = ipfs_put_file_from_buffer;
+    if (backend->ipfs_add)
+        connect->base.ipfs_add                  = ipfs_add;
+    if (backend->ipfs_put_files)
+        connect->base.ipfs_put_files            = ipfs_put_files;
+    if (backend->ipfs_get_file_length)
+        connect->base.ipfs_get_file_length      = ipfs_get_file_length;
+    if (backend->ipfs_get_file_lengths)
+        connect->base.ipfs_get_file_lengths     = ipfs_get_file_lengths;
+    if (backend->ipfs_get_file_to_buffer)
+        connect->base.ipfs_get_file_to_buffer   = ipfs_get_file_to_buffer;
+    if (backend->ipfs_get_file_range)
+        connect->base.ipfs_get_file_range       = ipfs_get_file_range;
+    if (backend->ipfs_export_car)
+        connect->base.ipfs_export_car           = ipfs_export_car;
+    if (backend->ipfs_import_car)
+        connect->base.ipfs_import_car           = ipfs_import_car;
+    if (backend->ipfs_get_stats)
+        connect->base.ipfs_get_stats            = ipfs_get_stats;
+
+    if (backend->put_value)
+        connect->base.put_value            = put_value;
+    if (backend->set_value)
+        connect->base.set_value            = set_value;
+    if (backend->get_values)
+        connect->base.get_values           = get_values;
+    if (backend->delete_key)
+        connect->base.delete_key           = delete_key;
+
+    if (backend->get_cache_stats)
+        connect->base.get_cache_stats      = get_cache_stats;
+    if (backend->expire_token)
+        connect->base.expire_token         = expire_token;
+    connect->base.disconnect               = disconnect;
+
+    return &connect->base;
+}
@@ -24,7 +24,14 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
 
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 #ifdef HAVE_ARPA_INET_H
 #include <arpa/inet.h>
 #endif
@@ -48,66 +55,1332 @@
 #include "ipfs_constants.h"
 #include "http_client.h"
 #include "hive_error.h"
+#include "mkdirs.h"
+#include "object_cache.h"
+#include "single_flight.h"
+#include "unixfs.h"
 #include "hive_client.h"
 #include "http_status.h"
 
-typedef struct IPFSConnect {
-    HiveConnect base;
-    ipfs_rpc_t *rpc;
-} IPFSConnect;
+/*
+ * Default disk budget of the local object cache, and the budget of its
+ * in-memory hot tier.
+ */
+#define DEFAULT_CACHE_CAPACITY  (256 * 1024 * 1024)
+#define CACHE_MEMORY_CAPACITY   (8 * 1024 * 1024)
+
+/*
+ * CIDs per /file/ls request of a batched size lookup by default, and the
+ * count of such requests in flight at once.
+ */
+#define DEFAULT_LOOKUP_BATCH_SIZE   64
+#define MAX_PARALLEL_LOOKUPS        4
+
+typedef struct IPFSConnect {
+    HiveConnect base;
+    ipfs_rpc_t *rpc;
+    object_cache_t *cache;
+    single_flight_t *flights;
+    size_t lookup_batch_size;
+} IPFSConnect;
+
+/*
+ * Map the curl result of a finished request to a hive error, and fetch
+ * its time to first byte (ms) when the node answered.
+ */
+static int __rpc_result(http_client_t *httpc, int result, double *latency)
+{
+    long resp_code = 0;
+    double seconds;
+    int rc;
+
+    if (result) {
+        if (RC_NODE_UNREACHABLE(result))
+            return HIVE_GENERAL_ERROR(HIVEERR_TRY_AGAIN);
+        /*
+         * Aborted by our own response callback, which is no fault of the
+         * node.
+         */
+        else if (result == CURLE_WRITE_ERROR)
+            return HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
+        /*
+         * Likewise the request body source gave up.
+         */
+        else if (result == CURLE_ABORTED_BY_CALLBACK)
+            return HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS);
+        else
+            return HIVE_CURL_ERROR(result);
+    }
+
+    if (!http_client_get_first_byte_time(httpc, &seconds))
+        *latency = seconds * 1000;
+
+    rc = http_client_get_response_code(httpc, &resp_code);
+    if (rc)
+        return HIVE_CURL_ERROR(rc);
+
+    if (resp_code != HttpStatus_OK)
+        return HIVE_HTTP_STATUS_ERROR(resp_code);
+
+    return 0;
+}
+
+/*
+ * Perform a request on the node acquired for it and report the outcome
+ * back to the node table, which routes later requests by it.
+ */
+static int __rpc_request(IPFSConnect *connect, http_client_t *httpc,
+                         const rpc_node_addr_t *node)
+{
+    double latency = -1;
+    int rc;
+
+    rc = http_client_request(httpc);
+    rc = __rpc_result(httpc, rc, &latency);
+
+    ipfs_rpc_release_node(connect->rpc, node, rc, latency);
+    return rc;
+}
+
+/*
+ * Fills in the request specific part of a hedgeable request; index is 0
+ * for the request to the first node and 1 for the hedge.
+ */
+typedef int rpc_setup_t(http_client_t *httpc, int index, void *context);
+
+static int __rpc_client(const rpc_node_addr_t *node, const char *api,
+                        rpc_setup_t *setup, int index, void *context,
+                        http_client_t **httpc)
+{
+    int rc;
+
+    rc = ipfs_rpc_node_client(node, api, httpc);
+    if (rc < 0)
+        return rc;
+
+    rc = setup(*httpc, index, context);
+    if (rc < 0) {
+        http_client_close(*httpc);
+        *httpc = NULL;
+        return rc;
+    }
+
+    return 0;
+}
+
+/*
+ * Perform an idempotent read. Content addressed data can be served by any
+ * node, so when the node chosen has not sent a first byte within its p95
+ * latency, the same request goes to a second node as well. The first
+ * successful response wins and the other request is cancelled. The index
+ * of the winning client is returned through winner; the caller closes
+ * both clients.
+ */
+static int __rpc_hedged_request(IPFSConnect *connect, const char *api,
+                                rpc_setup_t *setup, void *context,
+                                http_client_t *httpcs[2], int *winner)
+{
+    rpc_node_addr_t nodes[2];
+    bool running[2] = {false, false};
+    http_multi_t *multi;
+    double delay;
+    double seconds;
+    int timeout;
+    int rc;
+    int i;
+
+    httpcs[0] = NULL;
+    httpcs[1] = NULL;
+    *winner = 0;
+
+    rc = ipfs_rpc_acquire_node(connect->rpc, &nodes[0]);
+    if (rc < 0)
+        return rc;
+
+    rc = __rpc_client(&nodes[0], api, setup, 0, context, &httpcs[0]);
+    if (rc < 0) {
+        ipfs_rpc_release_node(connect->rpc, &nodes[0], rc, -1);
+        return rc;
+    }
+
+    delay = ipfs_rpc_hedge_delay(connect->rpc, &nodes[0]);
+    if (delay < 0)
+        return __rpc_request(connect, httpcs[0], &nodes[0]);
+
+    multi = http_multi_new();
+    if (!multi) {
+        rc = HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+        ipfs_rpc_release_node(connect->rpc, &nodes[0], rc, -1);
+        return rc;
+    }
+
+    http_multi_add(multi, httpcs[0]);
+    running[0] = true;
+    timeout = delay < 1 ? 1 : (int)delay;
+
+    for (;;) {
+        http_client_t *done;
+        double latency = -1;
+        int result = 0;
+
+        rc = http_multi_wait_any(multi, timeout, &done, &result);
+        if (rc) {
+            rc = HIVE_CURL_ERROR(rc);
+            break;
+        }
+
+        if (!done) {
+            if (timeout < 0) {
+                rc = HIVE_GENERAL_ERROR(HIVEERR_TRY_AGAIN);
+                break;
+            }
+
+            /*
+             * A node which started to answer is not hedged; its transfer
+             * time depends on the content, not on the node being stuck.
+             */
+            timeout = -1;
+            if (!http_client_get_first_byte_time(httpcs[0], &seconds) &&
+                seconds > 0)
+                continue;
+
+            if (ipfs_rpc_acquire_hedge_node(connect->rpc, &nodes[0], &nodes[1]) < 0)
+                continue;
+
+            rc = __rpc_client(&nodes[1], api, setup, 1, context, &httpcs[1]);
+            if (rc < 0) {
+                ipfs_rpc_release_node(connect->rpc, &nodes[1], rc, -1);
+                continue;
+            }
+
+            vlogD("IPFS: hedging %s to node %s after %dms.", api,
+                  nodes[1].ip, (int)delay);
+            http_multi_add(multi, httpcs[1]);
+            running[1] = true;
+            continue;
+        }
+
+        i = (done == httpcs[0]) ? 0 : 1;
+        running[i] = false;
+
+        rc = __rpc_result(done, result, &latency);
+        ipfs_rpc_release_node(connect->rpc, &nodes[i], rc, latency);
+
+        if (!rc) {
+            *winner = i;
+            if (i == 1)
+                ipfs_rpc_hedge_won(connect->rpc);
+            break;
+        }
+
+        if (!running[1 - i])
+            break;
+    }
+
+    /*
+     * The loser is cancelled without being accounted against its node;
+     * being slower than the winner says nothing about its health.
+     */
+    for (i = 0; i < 2; i++) {
+        if (!running[i])
+            continue;
+
+        http_multi_remove(multi, httpcs[i]);
+        ipfs_rpc_release_node(connect->rpc, &nodes[i], 0, -1);
+    }
+
+    http_multi_close(multi);
+    return rc;
+}
+
+typedef struct buffer_reader {
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+} buffer_reader_t;
+
+static ssize_t read_from_buffer(void *buffer, size_t length, void *context)
+{
+    buffer_reader_t *reader = (buffer_reader_t *)context;
+
+    if (length > reader->len - reader->pos)
+        length = reader->len - reader->pos;
+
+    memcpy(buffer, reader->data + reader->pos, length);
+    reader->pos += length;
+
+    return (ssize_t)length;
+}
+
+static size_t buffer_read_cb(char *buffer, size_t size, size_t nitems,
+                             void *userdata)
+{
+    return (size_t)read_from_buffer(buffer, size * nitems, userdata);
+}
+
+static int rewind_buffer(void *context)
+{
+    buffer_reader_t *reader = (buffer_reader_t *)context;
+
+    reader->pos = 0;
+    return 0;
+}
+
+typedef struct add_source {
+    HiveReadCallback *callback;
+    void *context;
+} add_source_t;
+
+static size_t add_read_cb(char *buffer, size_t size, size_t nitems, void *userdata)
+{
+    add_source_t *src = (add_source_t *)userdata;
+    ssize_t nrd;
+
+    nrd = src->callback(buffer, size * nitems, src->context);
+    if (nrd < 0)
+        return CURL_READFUNC_ABORT;
+
+    return (size_t)nrd;
+}
+
+static void add_set_options(http_client_t *httpc, const IPFSAddOptions *options)
+{
+    char cid_version[16];
+
+    if (options->chunker && *options->chunker)
+        http_client_set_query(httpc, "chunker", options->chunker);
+    if (options->hash && *options->hash)
+        http_client_set_query(httpc, "hash", options->hash);
+
+    sprintf(cid_version, "%d", options->cid_version);
+    http_client_set_query(httpc, "cid-version", cid_version);
+    http_client_set_query(httpc, "raw-leaves",
+                          options->raw_leaves ? "true" : "false");
+    http_client_set_query(httpc, "pin", options->pin ? "true" : "false");
+}
+
+/*
+ * Whether content added with these options gets the CID computed by
+ * unixfs_hasher, i.e. the defaults of the node.
+ */
+static bool add_default_layout(const IPFSAddOptions *options)
+{
+    if (!options)
+        return true;
+
+    return (!options->chunker || !strcmp(options->chunker, "size-262144")) &&
+           (!options->hash || !strcmp(options->hash, "sha2-256")) &&
+           !options->raw_leaves && options->cid_version == 0;
+}
+
+static int compute_cid(HiveReadCallback *callback, void *context, IPFSCid *cid)
+{
+    unixfs_hasher_t *hasher;
+    uint8_t *buf;
+    ssize_t nrd;
+    int rc = 0;
+
+    hasher = unixfs_hasher_new(NULL, NULL);
+    buf = (uint8_t *)malloc(64 * 1024);
+    if (!hasher || !buf) {
+        unixfs_hasher_free(hasher);
+        free(buf);
+        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+    }
+
+    while ((nrd = callback(buf, 64 * 1024, context)) > 0) {
+        rc = unixfs_hasher_update(hasher, buf, (size_t)nrd);
+        if (rc < 0)
+            break;
+    }
+
+    if (nrd < 0)
+        rc = HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS);
+    else if (!rc)
+        rc = unixfs_hasher_final(hasher, cid);
+
+    unixfs_hasher_free(hasher);
+    free(buf);
+    return rc;
+}
+
+/*
+ * Cache content only once it is known to match its CID, as a node
+ * handing out wrong content would otherwise poison the cache for good.
+ * Content whose CID can not be recomputed locally, e.g. added with other
+ * than the default layout, is not cached. Content whose CID the caller
+ * has just computed itself is verified already.
+ */
+static void cache_put(IPFSConnect *connect, const IPFSCid *cid,
+                      const void *data, size_t len, bool verified)
+{
+    buffer_reader_t reader;
+    IPFSCid computed;
+    int rc;
+
+    if (!connect->cache)
+        return;
+
+    if (verified) {
+        object_cache_put(connect->cache, cid->content, data, len);
+        return;
+    }
+
+    reader.data = (const uint8_t *)data;
+    reader.len = len;
+    reader.pos = 0;
+
+    rc = compute_cid(read_from_buffer, &reader, &computed);
+    if (rc < 0 || strcmp(computed.content, cid->content)) {
+        vlogD("IPFS: Content of %s not verified, not cached.",
+              cid->content);
+        return;
+    }
+
+    object_cache_put(connect->cache, cid->content, data, len);
+}
+
+/*
+ * Ask a node whether it holds the whole content behind cid by pinning
+ * it, as the add would; pinning walks the whole DAG. The node is kept
+ * offline, so that missing blocks are reported rather than searched for.
+ */
+static bool has_content(IPFSConnect *connect, const IPFSCid *cid)
+{
+    rpc_node_addr_t node;
+    http_client_t *httpc;
+    double latency = -1;
+    int rc;
+
+    rc = ipfs_rpc_acquire_node(connect->rpc, &node);
+    if (rc < 0)
+        return false;
+
+    rc = ipfs_rpc_node_client(&node, "/api/v0/pin/add", &httpc);
+    if (rc < 0) {
+        ipfs_rpc_release_node(connect->rpc, &node, rc, -1);
+        return false;
+    }
+
+    http_client_set_query(httpc, "arg", cid->content);
+    http_client_set_query(httpc, "offline", "true");
+    http_client_set_method(httpc, HTTP_METHOD_POST);
+    http_client_enable_response_body(httpc);
+
+    rc = http_client_request(httpc);
+    rc = __rpc_result(httpc, rc, &latency);
+    http_client_close(httpc);
+
+    ipfs_rpc_release_node(connect->rpc, &node, rc, latency);
+    return rc == 0;
+}
+
+/*
+ * A parallel add uploads the blocks of the DAG as the hasher completes
+ * them, a few per usable node at once, each to whichever node the
+ * routing picks.
+ */
+#define BLOCKS_PER_NODE     4
+#define MAX_BLOCK_ATTEMPTS  3
+
+/*
+ * Seconds the pinning node may spend fetching the blocks that went to
+ * other nodes.
+ */
+#define PIN_TIMEOUT         120
+
+typedef struct block_upload {
+    http_client_t *httpc;
+    rpc_node_addr_t node;
+    IPFSCid cid;
+    buffer_reader_t reader;
+    int attempts;
+} block_upload_t;
+
+typedef struct parallel_add {
+    IPFSConnect *connect;
+    http_multi_t *multi;
+    block_upload_t *slots;
+    size_t nslots;
+    size_t running;
+} parallel_add_t;
+
+static int block_put_wait(parallel_add_t *pa);
+
+static int block_put_start(parallel_add_t *pa, block_upload_t *slot)
+{
+    int rc;
+
+    /*
+     * Only this thread drives its uploads: with all slots taken, finish
+     * one of them to free one rather than wait, and wait only with none
+     * in flight.
+     */
+    while ((rc = ipfs_rpc_try_acquire_node(pa->connect->rpc, &slot->node)) ==
+           HIVE_GENERAL_ERROR(HIVEERR_BUSY) && pa->running) {
+        rc = block_put_wait(pa);
+        if (rc < 0)
+            return rc;
+    }
+
+    if (rc == HIVE_GENERAL_ERROR(HIVEERR_BUSY))
+        rc = ipfs_rpc_acquire_node(pa->connect->rpc, &slot->node);
+    if (rc < 0)
+        return rc;
+
+    rc = ipfs_rpc_node_client(&slot->node, "/api/v0/block/put", &slot->httpc);
+    if (rc < 0) {
+        ipfs_rpc_release_node(pa->connect->rpc, &slot->node, rc, -1);
+        return rc;
+    }
+
+    slot->reader.pos = 0;
+    slot->attempts++;
+
+    http_client_set_query(slot->httpc, "format", "v0");
+    http_client_set_mime(slot->httpc, "file", NULL, NULL, buffer_read_cb,
+                         &slot->reader, (ssize_t)slot->reader.len);
+    http_client_set_method(slot->httpc, HTTP_METHOD_POST);
+    http_client_enable_response_body(slot->httpc);
+
+    http_multi_add(pa->multi, slot->httpc);
+    pa->running++;
+
+    return 0;
+}
+
+/*
+ * The node names the block it stored; anything but the CID computed
+ * locally means the DAG would not be the one expected.
+ */
+static int block_put_check(block_upload_t *slot)
+{
+    cJSON *resp;
+    cJSON *key;
+    char *p;
+    int rc = 0;
+
+    p = http_client_move_response_body(slot->httpc, NULL);
+    if (!p)
+        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+
+    resp = cJSON_Parse(p);
+    free(p);
+
+    if (!resp)
+        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+
+    key = cJSON_GetObjectItemCaseSensitive(resp, "Key");
+    if (!key || !cJSON_IsString(key))
+        rc = HIVE_GENERAL_ERROR(HIVEERR_BAD_JSON_FORMAT);
+    else if (strcmp(key->valuestring, slot->cid.content))
+        rc = HIVE_GENERAL_ERROR(HIVEERR_BAD_PERSISTENT_DATA);
+
+    cJSON_Delete(resp);
+    return rc;
+}
+
+/*
+ * Wait for one block upload to finish. A block whose node failed is sent
+ * again, to whichever node is picked then.
+ */
+static int block_put_wait(parallel_add_t *pa)
+{
+    block_upload_t *slot = NULL;
+    http_client_t *done;
+    double latency = -1;
+    int result = 0;
+    size_t i;
+    int rc;
+
+    rc = http_multi_wait_any(pa->multi, -1, &done, &result);
+    if (rc)
+        return HIVE_CURL_ERROR(rc);
+
+    if (!done)
+        return 0;
+
+    for (i = 0; i < pa->nslots; i++) {
+        if (pa->slots[i].httpc == done) {
+            slot = &pa->slots[i];
+            break;
+        }
+    }
+    assert(slot);
+
+    pa->running--;
+
+    rc = __rpc_result(done, result, &latency);
+    ipfs_rpc_release_node(pa->connect->rpc, &slot->node, rc, latency);
+    if (!rc)
+        rc = block_put_check(slot);
+
+    http_client_close(done);
+    slot->httpc = NULL;
+
+    if (rc < 0 && rc != HIVE_GENERAL_ERROR(HIVEERR_BAD_PERSISTENT_DATA) &&
+        slot->attempts < MAX_BLOCK_ATTEMPTS)
+        return block_put_start(pa, slot);
+
+    free((void *)slot->reader.data);
+    slot->reader.data = NULL;
+
+    return rc;
+}
+
+static int block_put(const IPFSCid *cid, const void *block, size_t len,
+                     void *context)
+{
+    parallel_add_t *pa = (parallel_add_t *)context;
+    block_upload_t *slot = NULL;
+    uint8_t *data;
+    size_t i;
+    int rc;
+
+    while (pa->running == pa->nslots) {
+        rc = block_put_wait(pa);
+        if (rc < 0)
+            return rc;
+    }
+
+    for (i = 0; i < pa->nslots; i++) {
+        if (!pa->slots[i].httpc && !pa->slots[i].reader.data) {
+            slot = &pa->slots[i];
+            break;
+        }
+    }
+    assert(slot);
+
+    data = (uint8_t *)malloc(len);
+    if (!data)
+        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+
+    memcpy(data, block, len);
+    slot->cid = *cid;
+    slot->reader.data = data;
+    slot->reader.len = len;
+    slot->attempts = 0;
+
+    rc = block_put_start(pa, slot);
+    if (rc < 0) {
+        free(data);
+        slot->reader.data = NULL;
+    }
+
+    return rc;
+}
+
+/*
+ * The pinning node fetches the blocks it lacks from its peers. Without
+ * the nodes peered it would search for them forever, so the node is told
+ * to give up after a while, and the request is bounded in case it does
+ * not.
+ */
+static int pin_content(IPFSConnect *connect, const IPFSCid *cid)
+{
+    rpc_node_addr_t node;
+    http_client_t *httpc;
+    char timeout[16];
+    int rc;
+
+    rc = ipfs_rpc_acquire_node(connect->rpc, &node);
+    if (rc < 0)
+        return rc;
+
+    rc = ipfs_rpc_node_client(&node, "/api/v0/pin/add", &httpc);
+    if (rc < 0) {
+        ipfs_rpc_release_node(connect->rpc, &node, rc, -1);
+        return rc;
+    }
+
+    sprintf(timeout, "%ds", PIN_TIMEOUT);
+    http_client_set_query(httpc, "arg", cid->content);
+    http_client_set_query(httpc, "timeout", timeout);
+    http_client_set_method(httpc, HTTP_METHOD_POST);
+    http_client_set_timeout(httpc, PIN_TIMEOUT + 10);
+    http_client_enable_response_body(httpc);
+
+    rc = __rpc_request(connect, httpc, &node);
+    http_client_close(httpc);
+
+    if (rc < 0)
+        vlogE("IPFS: Pinning %s on %s failed (0x%x), are the nodes peered?",
+              cid->content, node.ip, -rc);
+
+    return rc;
+}
+
+/*
+ * Upload the content as the individual blocks of its DAG, built locally
+ * the way the node would build it, so that throughput scales with the
+ * nodes rather than being bound to one stream to one node. Pinning the
+ * root then has the pinning node fetch from its peers whatever blocks
+ * went elsewhere.
+ */
+static int parallel_add(IPFSConnect *connect, HiveReadCallback *callback,
+                        void *context, const IPFSAddOptions *options,
+                        IPFSCid *cid)
+{
+    unixfs_hasher_t *hasher = NULL;
+    parallel_add_t pa;
+    uint8_t *buf = NULL;
+    ssize_t nrd;
+    size_t i;
+    int rc = 0;
+
+    memset(&pa, 0, sizeof(pa));
+    pa.connect = connect;
+    pa.nslots = ipfs_rpc_usable_nodes(connect->rpc) * BLOCKS_PER_NODE;
+    if (!pa.nslots)
+        pa.nslots = BLOCKS_PER_NODE;
+
+    pa.slots = (block_upload_t *)calloc(pa.nslots, sizeof(block_upload_t));
+    pa.multi = http_multi_new();
+    hasher = unixfs_hasher_new(block_put, &pa);
+    buf = (uint8_t *)malloc(64 * 1024);
+    if (!pa.slots || !pa.multi || !hasher || !buf) {
+        rc = HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+        goto exit;
+    }
+
+    while ((nrd = callback(buf, 64 * 1024, context)) > 0) {
+        rc = unixfs_hasher_update(hasher, buf, (size_t)nrd);
+        if (rc < 0)
+            goto exit;
+    }
+
+    if (nrd < 0) {
+        rc = HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS);
+        goto exit;
+    }
+
+    rc = unixfs_hasher_final(hasher, cid);
+    while (!rc && pa.running)
+        rc = block_put_wait(&pa);
+
+    if (!rc && options->pin)
+        rc = pin_content(connect, cid);
+
+exit:
+    /*
+     * Uploads cut short by a failure elsewhere say nothing about their
+     * nodes.
+     */
+    for (i = 0; pa.slots && i < pa.nslots; i++) {
+        if (pa.slots[i].httpc) {
+            http_multi_remove(pa.multi, pa.slots[i].httpc);
+            ipfs_rpc_release_node(connect->rpc, &pa.slots[i].node, 0, -1);
+            http_client_close(pa.slots[i].httpc);
+        }
+        free((void *)pa.slots[i].reader.data);
+    }
+
+    if (pa.multi)
+        http_multi_close(pa.multi);
+    unixfs_hasher_free(hasher);
+    free(pa.slots);
+    free(buf);
+
+    return rc;
+}
+
+/*
+ * Add the content, telling through verified whether the CID was also
+ * computed locally, and so is known to match the content.
+ */
+static int __add(IPFSConnect *connect, HiveReadCallback *callback,
+                 hive_rewind_callback_t *rewind, void *context,
+                 ssize_t length, const IPFSAddOptions *options, IPFSCid *cid,
+                 bool *verified)
+{
+    rpc_node_addr_t node;
+    http_client_t *httpc;
+    add_source_t src;
+    IPFSCid computed;
+    cJSON *resp;
+    cJSON *cid_json;
+    char *p;
+    int rc;
+
+    *verified = false;
+    computed.content[0] = '\0';
+
+    if (options && options->parallel) {
+        if (!add_default_layout(options))
+            return HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS);
+
+        rc = parallel_add(connect, callback, context, options, cid);
+        *verified = rc == 0;
+        return rc;
+    }
+
+    /*
+     * Content read twice is hashed locally first, and not uploaded at all
+     * if the node has it already. Re-adding unchanged data then costs
+     * one read and a single small request. Only pinning adds are checked
+     * this way, as the check pins.
+     */
+    if (rewind && add_default_layout(options) && (!options || options->pin)) {
+        rc = compute_cid(callback, context, &computed);
+        if (rc < 0)
+            return rc;
+
+        if (has_content(connect, &computed)) {
+            *cid = computed;
+            *verified = true;
+            return 0;
+        }
+
+        if (rewind(context) < 0)
+            return HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS);
+    }
+
+    rc = ipfs_rpc_acquire_node(connect->rpc, &node);
+    if (rc < 0)
+        return rc;
+
+    rc = ipfs_rpc_node_client(&node, "/api/v0/add", &httpc);
+    if (rc < 0) {
+        ipfs_rpc_release_node(connect->rpc, &node, rc, -1);
+        return rc;
+    }
+
+    src.callback = callback;
+    src.context = context;
+
+    /*
+     * The content is pulled from the source while it is sent, so nothing
+     * is staged in memory however large it is.
+     */
+    if (options)
+        add_set_options(httpc, options);
+    http_client_set_mime(httpc, "file", NULL, NULL, add_read_cb, &src, length);
+    http_client_set_method(httpc, HTTP_METHOD_POST);
+    http_client_enable_response_body(httpc);
+
+    rc = __rpc_request(connect, httpc, &node);
+    if (rc < 0)
+        goto error_exit;
+
+    p = http_client_move_response_body(httpc, NULL);
+    http_client_close(httpc);
+    if (!p)
+        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+
+    resp = cJSON_Parse(p);
+    free(p);
+
+    if (!resp)
+        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+
+    cid_json = cJSON_GetObjectItemCaseSensitive(resp, "Hash");
+    if (!cid_json || !cJSON_IsString(cid_json) || !cid_json->string ||
+        !*cid_json->valuestring || strlen(cid_json->valuestring) >= sizeof(cid->content)) {
+        cJSON_Delete(resp);
+        return HIVE_GENERAL_ERROR(HIVEERR_BAD_JSON_FORMAT);
+    }
+
+    strcpy(cid->content, cid_json->valuestring);
+    cJSON_Delete(resp);
+
+    *verified = !strcmp(computed.content, cid->content);
+    return 0;
+
+error_exit:
+    http_client_close(httpc);
+    return rc;
+}
+
+static int add(HiveConnect *base, HiveReadCallback *callback,
+               hive_rewind_callback_t *rewind, void *context,
+               ssize_t length, const IPFSAddOptions *options, IPFSCid *cid)
+{
+    bool verified;
+
+    return __add((IPFSConnect *)base, callback, rewind, context, length,
+                 options, cid, &verified);
+}
+
+static int put_file_from_buffer(HiveConnect *base, const void *from,
+                                size_t length, bool encrypt, IPFSCid *cid)
+{
+    IPFSConnect *connect = (IPFSConnect *)base;
+    buffer_reader_t reader;
+    bool verified;
+    int rc;
+
+    reader.data = (const uint8_t *)from;
+    reader.len = length;
+    reader.pos = 0;
+
+    rc = __add(connect, read_from_buffer, rewind_buffer, &reader,
+               (ssize_t)length, NULL, cid, &verified);
+    if (rc < 0)
+        return rc;
+
+    cache_put(connect, cid, from, length, verified);
+
+    return 0;
+}
+
+/*
+ * Some commands answer with a stream of JSON lines. Each line is handed
+ * on as soon as it is complete, so only the partial last line is held.
+ */
+#define MAX_RESPONSE_LINE   (64 * 1024)
+
+typedef void json_line_callback_t(const char *line, void *context);
+
+typedef struct json_lines {
+    json_line_callback_t *callback;
+    void *context;
+    char *line;
+    size_t len;
+    size_t bufsz;
+} json_lines_t;
+
+static size_t json_lines_response_cb(char *buffer, size_t size, size_t nitems,
+                                     void *userdata)
+{
+    json_lines_t *lines = (json_lines_t *)userdata;
+    size_t total_sz = size * nitems;
+    char *eol;
+    char *p;
+
+    if (lines->len + total_sz + 1 > lines->bufsz) {
+        size_t bufsz = lines->bufsz ? lines->bufsz * 2 : 1024;
+
+        while (bufsz < lines->len + total_sz + 1)
+            bufsz *= 2;
+        if (bufsz > MAX_RESPONSE_LINE)
+            return 0;
+
+        p = (char *)realloc(lines->line, bufsz);
+        if (!p)
+            return 0;
+
+        lines->line = p;
+        lines->bufsz = bufsz;
+    }
+
+    memcpy(lines->line + lines->len, buffer, total_sz);
+    lines->len += total_sz;
+    lines->line[lines->len] = '\0';
+
+    p = lines->line;
+    while ((eol = strchr(p, '\n')) != NULL) {
+        *eol = '\0';
+        if (eol > p)
+            lines->callback(p, lines->context);
+        p = eol + 1;
+    }
+
+    lines->len -= p - lines->line;
+    memmove(lines->line, p, lines->len + 1);
+
+    return total_sz;
+}
+
+/*
+ * The CIDs of a batch add arrive one line per object in the order sent,
+ * then one for the wrapping directory.
+ */
+typedef struct add_results {
+    IPFSCid *cids;
+    size_t count;
+    size_t next;
+    IPFSCid *root;
+    bool root_seen;
+    bool bad;
+} add_results_t;
+
+static void parse_add_line(const char *line, void *context)
+{
+    add_results_t *res = (add_results_t *)context;
+    cJSON *json;
+    cJSON *hash;
+    IPFSCid *cid;
+
+    json = cJSON_Parse(line);
+    if (!json) {
+        res->bad = true;
+        return;
+    }
+
+    /*
+     * Progress reports carry no hash.
+     */
+    hash = cJSON_GetObjectItemCaseSensitive(json, "Hash");
+    if (!hash) {
+        cJSON_Delete(json);
+        return;
+    }
+
+    if (res->next < res->count)
+        cid = &res->cids[res->next++];
+    else if (res->root && !res->root_seen) {
+        cid = res->root;
+        res->root_seen = true;
+    } else
+        cid = NULL;
+
+    if (!cid || !cJSON_IsString(hash) || !*hash->valuestring ||
+        strlen(hash->valuestring) >= sizeof(cid->content))
+        res->bad = true;
+    else
+        strcpy(cid->content, hash->valuestring);
+
+    cJSON_Delete(json);
+}
+
+static int put_files(HiveConnect *base, const IPFSAddItem *items, size_t count,
+                     IPFSCid *cids, IPFSCid *root)
+{
+    IPFSConnect *connect = (IPFSConnect *)base;
+    buffer_reader_t *readers;
+    rpc_node_addr_t node;
+    http_client_t *httpc;
+    add_results_t res;
+    json_lines_t lines;
+    char name[32];
+    size_t i;
+    int rc;
+
+    readers = (buffer_reader_t *)calloc(count, sizeof(buffer_reader_t));
+    if (!readers)
+        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+
+    rc = ipfs_rpc_acquire_node(connect->rpc, &node);
+    if (rc < 0) {
+        free(readers);
+        return rc;
+    }
+
+    rc = ipfs_rpc_node_client(&node, "/api/v0/add", &httpc);
+    if (rc < 0) {
+        ipfs_rpc_release_node(connect->rpc, &node, rc, -1);
+        free(readers);
+        return rc;
+    }
+
+    memset(&res, 0, sizeof(res));
+    res.cids = cids;
+    res.count = count;
+    res.root = root;
+
+    memset(&lines, 0, sizeof(lines));
+    lines.callback = parse_add_line;
+    lines.context = &res;
+
+    if (root)
+        http_client_set_query(httpc, "wrap-with-directory", "true");
+
+    /*
+     * Every object is a part of the same multipart body. Buffers are
+     * read in place and files by curl, so nothing is copied up front.
+     */
+    for (i = 0; i < count; i++) {
+        const IPFSAddItem *item = &items[i];
+
+        if (!item->name)
+            sprintf(name, "%zu", i);
+
+        if (item->path) {
+            rc = http_client_set_mime_file(httpc, "file",
+                                           item->name ? item->name : name,
+                                           NULL, item->path);
+            if (rc) {
+                rc = HIVE_CURL_ERROR(rc);
+                ipfs_rpc_release_node(connect->rpc, &node, 0, -1);
+                goto error_exit;
+            }
+        } else {
+            readers[i].data = (const uint8_t *)item->data;
+            readers[i].len = item->length;
+            http_client_set_mime(httpc, "file", item->name ? item->name : name,
+                                 NULL, buffer_read_cb, &readers[i],
+                                 (ssize_t)item->length);
+        }
+    }
+
+    http_client_set_method(httpc, HTTP_METHOD_POST);
+    http_client_set_response_body(httpc, json_lines_response_cb, &lines);
+
+    rc = __rpc_request(connect, httpc, &node);
+    if (rc < 0)
+        goto error_exit;
+
+    if (res.bad || res.next != count || (root && !res.root_seen))
+        rc = HIVE_GENERAL_ERROR(HIVEERR_BAD_JSON_FORMAT);
+
+    if (!rc && connect->cache) {
+        for (i = 0; i < count; i++) {
+            if (!items[i].path)
+                cache_put(connect, &cids[i], items[i].data, items[i].length,
+                          false);
+        }
+    }
+
+error_exit:
+    http_client_close(httpc);
+    free(lines.line);
+    free(readers);
+    return rc;
+}
+
+static int files_stat_setup(http_client_t *httpc, int index, void *context)
+{
+    const IPFSCid *cid = (const IPFSCid *)context;
+    char path[HIVE_MAX_IPFS_CID_LEN + 8];
+
+    sprintf(path, "/ipfs/%s", cid->content);
+    http_client_set_query(httpc, "arg", path);
+    http_client_set_method(httpc, HTTP_METHOD_POST);
+    http_client_enable_response_body(httpc);
+
+    return 0;
+}
+
+static ssize_t get_file_length(HiveConnect *base, const IPFSCid *cid)
+{
+    IPFSConnect *connect = (IPFSConnect *)base;
+    http_client_t *httpcs[2];
+    ssize_t fsize;
+    cJSON *resp;
+    cJSON *size;
+    int winner;
+    char *p;
+    int rc;
+
+    /*
+     * Content behind a CID never changes, so whatever the cache holds is
+     * final and needs no revalidation.
+     */
+    if (connect->cache) {
+        fsize = object_cache_length(connect->cache, cid->content);
+        if (fsize >= 0)
+            return fsize;
+    }
+
+    /*
+     * files/stat only reads the root block of the object, which is
+     * cheaper than the deprecated file/ls listing.
+     */
+    rc = __rpc_hedged_request(connect, "/api/v0/files/stat", files_stat_setup,
+                              (void *)cid, httpcs, &winner);
+    if (rc < 0)
+        goto error_exit;
+
+    p = http_client_move_response_body(httpcs[winner], NULL);
+    http_client_close(httpcs[0]);
+    http_client_close(httpcs[1]);
+    if (!p)
+        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+
+    resp = cJSON_Parse(p);
+    free(p);
+
+    if (!resp)
+        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+
+    size = cJSON_GetObjectItemCaseSensitive(resp, "Size");
+    if (!size || !cJSON_IsNumber(size) || (ssize_t)size->valuedouble < 0) {
+        cJSON_Delete(resp);
+        return HIVE_GENERAL_ERROR(HIVEERR_BAD_JSON_FORMAT);
+    }
+
+    fsize = (ssize_t)size->valuedouble;
+    cJSON_Delete(resp);
+
+    return fsize;
+
+error_exit:
+    http_client_close(httpcs[0]);
+    http_client_close(httpcs[1]);
+    return (ssize_t)rc;
+}
+
+/*
+ * Where a /cat response goes: the caller's buffer for the first request,
+ * a buffer of its own, grown on demand, for the hedge. Either way no more
+ * than limit bytes are accepted.
+ */
+typedef struct cat_sink {
+    uint8_t *buf;
+    size_t bufsz;
+    size_t limit;
+    size_t len;
+    bool growable;
+    bool overflow;
+    ssize_t expected;
+} cat_sink_t;
+
+#define CONTENT_LENGTH_HEADER   "X-Content-Length:"
+
+static size_t get_response_header_cb(char *buffer, size_t size, size_t nitems,
+                                     void *userdata)
+{
+    cat_sink_t *sink = (cat_sink_t *)userdata;
+    size_t total_sz = size * nitems;
+    size_t hdr_len = strlen(CONTENT_LENGTH_HEADER);
+    char value[32];
+    char *endptr;
+    long long len;
+
+    if (total_sz <= hdr_len || total_sz - hdr_len >= sizeof(value))
+        return total_sz;
+
+    for (len = 0; len < (long long)hdr_len; len++) {
+        if (tolower((unsigned char)buffer[len]) !=
+            tolower((unsigned char)CONTENT_LENGTH_HEADER[len]))
+            return total_sz;
+    }
+
+    memcpy(value, buffer + hdr_len, total_sz - hdr_len);
+    value[total_sz - hdr_len] = '\0';
+
+    len = strtoll(value, &endptr, 10);
+    if (endptr == value || len < 0)
+        return total_sz;
+
+    /*
+     * The node announced the size: refuse an object which can not fit
+     * before any of it is transferred.
+     */
+    sink->expected = (ssize_t)len;
+    if ((size_t)len > sink->limit) {
+        sink->overflow = true;
+        return 0;
+    }
+
+    return total_sz;
+}
+
+static size_t get_response_body_cb(char *buffer, size_t size, size_t nitems, void *userdata)
+{
+    cat_sink_t *sink = (cat_sink_t *)userdata;
+    size_t total_sz = size * nitems;
+
+    if (sink->len + total_sz > sink->limit) {
+        sink->overflow = true;
+        return 0;
+    }
+
+    if (sink->len + total_sz > sink->bufsz) {
+        size_t bufsz = sink->bufsz ? sink->bufsz : 4096;
+        uint8_t *buf;
+
+        if (!sink->growable)
+            return 0;
+
+        while (bufsz < sink->len + total_sz)
+            bufsz *= 2;
+        if (bufsz > sink->limit)
+            bufsz = sink->limit;
+
+        buf = (uint8_t *)realloc(sink->buf, bufsz);
+        if (!buf)
+            return 0;
+
+        sink->buf = buf;
+        sink->bufsz = bufsz;
+    }
+
+    memcpy(sink->buf + sink->len, buffer, total_sz);
+    sink->len += total_sz;
+
+    return total_sz;
+}
+
+typedef struct cat_context {
+    const IPFSCid *cid;
+    bool ranged;
+    uint64_t offset;
+    cat_sink_t sinks[2];
+} cat_context_t;
+
+static int cat_setup(http_client_t *httpc, int index, void *context)
+{
+    cat_context_t *ctx = (cat_context_t *)context;
+    cat_sink_t *sink = &ctx->sinks[index];
+    char value[32];
+
+    http_client_set_query(httpc, "arg", ctx->cid->content);
+
+    /*
+     * The size announced for a slice is not that of the slice, so only
+     * the limit on the body applies to it.
+     */
+    if (ctx->ranged) {
+        sprintf(value, "%llu", (unsigned long long)ctx->offset);
+        http_client_set_query(httpc, "offset", value);
+        sprintf(value, "%llu", (unsigned long long)sink->limit);
+        http_client_set_query(httpc, "length", value);
+    } else
+        http_client_set_response_header(httpc, get_response_header_cb, sink);
+
+    http_client_set_method(httpc, HTTP_METHOD_POST);
+    http_client_set_request_body_instant(httpc, NULL, 0);
+    http_client_set_response_body(httpc, get_response_body_cb, sink);
+
+    return 0;
+}
+
+typedef struct lookup_batch {
+    http_client_t *httpc;
+    rpc_node_addr_t node;
+    size_t *indexes;
+    size_t count;
+} lookup_batch_t;
 
-static int put_file_from_buffer(HiveConnect *base, const void *from,
-                                size_t length, bool encrypt, IPFSCid *cid)
+/*
+ * Start a batch, on a node with a free slot. Callers with batches of
+ * their own in flight pass wait as false, and on HIVEERR_BUSY finish one
+ * of them instead: waiting, they would keep slots others wait for.
+ */
+static int lookup_batch_start(IPFSConnect *connect, http_multi_t *multi,
+                              const IPFSCid *cids, lookup_batch_t *batch,
+                              bool wait)
 {
-    IPFSConnect *connect = (IPFSConnect *)base;
-    char url[MAX_URL_LEN] = {0};
-    http_client_t *httpc;
-    long resp_code = 0;
-    cJSON *resp;
-    cJSON *cid_json;
-    char *p;
+    size_t i;
     int rc;
 
-    rc = ipfs_rpc_check_reachable(connect->rpc);
+    rc = wait ? ipfs_rpc_acquire_node(connect->rpc, &batch->node) :
+                ipfs_rpc_try_acquire_node(connect->rpc, &batch->node);
     if (rc < 0)
         return rc;
 
-    sprintf(url, "http://%s:%u/api/v0/add",
-            ipfs_rpc_get_current_node_ip(connect->rpc),
-            (unsigned)ipfs_rpc_get_current_node_port(connect->rpc));
-
-    httpc = http_client_new();
-    if (!httpc)
-        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
-
-    http_client_set_url(httpc, url);
-    http_client_set_mime_instant(httpc, "file", NULL, NULL, from, length);
-    http_client_set_method(httpc, HTTP_METHOD_POST);
-    http_client_enable_response_body(httpc);
-
-    rc = http_client_request(httpc);
-    if (rc) {
-        if (RC_NODE_UNREACHABLE(rc)) {
-            rc = HIVE_GENERAL_ERROR(HIVEERR_TRY_AGAIN);
-            ipfs_rpc_mark_node_unreachable(connect->rpc);
-        } else
-            rc = HIVE_CURL_ERROR(rc);
-        goto error_exit;
+    rc = ipfs_rpc_node_client(&batch->node, "/api/v0/file/ls", &batch->httpc);
+    if (rc < 0) {
+        ipfs_rpc_release_node(connect->rpc, &batch->node, rc, -1);
+        return rc;
     }
 
-    rc = http_client_get_response_code(httpc, &resp_code);
-    if (rc) {
-        rc = HIVE_CURL_ERROR(rc);
-        goto error_exit;
-    }
+    for (i = 0; i < batch->count; i++)
+        http_client_set_query(batch->httpc, "arg",
+                              cids[batch->indexes[i]].content);
+    http_client_set_method(batch->httpc, HTTP_METHOD_POST);
+    http_client_enable_response_body(batch->httpc);
 
-    if (resp_code != HttpStatus_OK) {
-        rc = HIVE_HTTP_STATUS_ERROR(resp_code);
-        goto error_exit;
-    }
+    http_multi_add(multi, batch->httpc);
+    return 0;
+}
 
-    p = http_client_move_response_body(httpc, NULL);
-    http_client_close(httpc);
+/*
+ * file/ls maps every argument to the object it resolves to, and lists the
+ * objects by that key.
+ */
+static int lookup_batch_parse(lookup_batch_t *batch, const IPFSCid *cids,
+                              ssize_t *sizes)
+{
+    cJSON *arguments;
+    cJSON *objects;
+    cJSON *resp;
+    size_t i;
+    char *p;
+    int rc = 0;
+
+    p = http_client_move_response_body(batch->httpc, NULL);
     if (!p)
         return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
 
@@ -117,192 +1390,471 @@ static int put_file_from_buffer(HiveConnect *base, const void *from,
     if (!resp)
         return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
 
-    cid_json = cJSON_GetObjectItemCaseSensitive(resp, "Hash");
-    if (!cid_json || !cJSON_IsString(cid_json) || !cid_json->string ||
-        !*cid_json->valuestring || strlen(cid_json->valuestring) >= sizeof(cid->content)) {
+    arguments = cJSON_GetObjectItemCaseSensitive(resp, "Arguments");
+    objects = cJSON_GetObjectItemCaseSensitive(resp, "Objects");
+    if (!arguments || !cJSON_IsObject(arguments) ||
+        !objects || !cJSON_IsObject(objects)) {
         cJSON_Delete(resp);
         return HIVE_GENERAL_ERROR(HIVEERR_BAD_JSON_FORMAT);
     }
 
-    strcpy(cid->content, cid_json->valuestring);
-    cJSON_Delete(resp);
+    for (i = 0; i < batch->count; i++) {
+        size_t index = batch->indexes[i];
+        cJSON *hash;
+        cJSON *object;
+        cJSON *size;
+
+        hash = cJSON_GetObjectItemCaseSensitive(arguments, cids[index].content);
+        object = cJSON_GetObjectItemCaseSensitive(objects,
+            hash && cJSON_IsString(hash) ? hash->valuestring : cids[index].content);
+        size = object ? cJSON_GetObjectItemCaseSensitive(object, "Size") : NULL;
+        if (!size || !cJSON_IsNumber(size) || size->valuedouble < 0) {
+            rc = HIVE_GENERAL_ERROR(HIVEERR_BAD_JSON_FORMAT);
+            break;
+        }
 
-    return 0;
+        sizes[index] = (ssize_t)size->valuedouble;
+    }
 
-error_exit:
-    http_client_close(httpc);
+    cJSON_Delete(resp);
     return rc;
 }
 
-static ssize_t get_file_length(HiveConnect *base, const IPFSCid *cid)
+/*
+ * Look the sizes up a batch of CIDs per request, with several requests in
+ * flight at once. Any failure fails the whole lookup.
+ */
+static int get_file_lengths(HiveConnect *base, const IPFSCid *cids,
+                            size_t count, ssize_t *sizes)
 {
     IPFSConnect *connect = (IPFSConnect *)base;
-    char url[MAX_URL_LEN] = {0};
-    http_client_t *httpc;
-    long resp_code = 0;
-    cJSON *cid_json;
-    cJSON *objects;
-    ssize_t fsize;
-    cJSON *resp;
-    cJSON *size;
-    char *p;
-    int rc;
+    lookup_batch_t batches[MAX_PARALLEL_LOOKUPS];
+    size_t *pending;
+    size_t npending = 0;
+    size_t next = 0;
+    http_multi_t *multi;
+    size_t i;
+    int running = 0;
+    int rc = 0;
 
-    rc = ipfs_rpc_check_reachable(connect->rpc);
-    if (rc < 0)
-        return rc;
+    pending = (size_t *)calloc(count, sizeof(size_t));
+    if (!pending)
+        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
 
-    sprintf(url, "http://%s:%u/api/v0/file/ls",
-            ipfs_rpc_get_current_node_ip(connect->rpc),
-            (unsigned)ipfs_rpc_get_current_node_port(connect->rpc));
+    for (i = 0; i < count; i++) {
+        sizes[i] = connect->cache ?
+                   object_cache_length(connect->cache, cids[i].content) : -1;
+        if (sizes[i] < 0)
+            pending[npending++] = i;
+    }
+
+    if (!npending) {
+        free(pending);
+        return 0;
+    }
 
-    httpc = http_client_new();
-    if (!httpc)
+    multi = http_multi_new();
+    if (!multi) {
+        free(pending);
         return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+    }
 
-    http_client_set_url(httpc, url);
-    http_client_set_query(httpc, "arg", cid->content);
-    http_client_set_method(httpc, HTTP_METHOD_POST);
-    http_client_enable_response_body(httpc);
+    memset(batches, 0, sizeof(batches));
 
-    rc = http_client_request(httpc);
-    if (rc) {
-        if (RC_NODE_UNREACHABLE(rc)) {
-            rc = HIVE_GENERAL_ERROR(HIVEERR_TRY_AGAIN);
-            ipfs_rpc_mark_node_unreachable(connect->rpc);
-        } else
+    for (;;) {
+        http_client_t *done;
+        double latency = -1;
+        int result = 0;
+
+        for (i = 0; !rc && next < npending && i < MAX_PARALLEL_LOOKUPS; i++) {
+            lookup_batch_t *batch = &batches[i];
+
+            if (batch->httpc)
+                continue;
+
+            batch->indexes = &pending[next];
+            batch->count = npending - next;
+            if (batch->count > connect->lookup_batch_size)
+                batch->count = connect->lookup_batch_size;
+
+            rc = lookup_batch_start(connect, multi, cids, batch, !running);
+            if (rc == HIVE_GENERAL_ERROR(HIVEERR_BUSY)) {
+                rc = 0;
+                break;
+            }
+            if (rc < 0)
+                break;
+
+            next += batch->count;
+            running++;
+        }
+
+        if (rc < 0 || !running)
+            break;
+
+        rc = http_multi_wait_any(multi, -1, &done, &result);
+        if (rc) {
             rc = HIVE_CURL_ERROR(rc);
-        goto error_exit;
-    }
+            break;
+        }
 
-    rc = http_client_get_response_code(httpc, &resp_code);
-    if (rc) {
-        rc = HIVE_CURL_ERROR(rc);
-        goto error_exit;
+        for (i = 0; i < MAX_PARALLEL_LOOKUPS; i++) {
+            if (batches[i].httpc == done)
+                break;
+        }
+        assert(i < MAX_PARALLEL_LOOKUPS);
+
+        rc = __rpc_result(done, result, &latency);
+        ipfs_rpc_release_node(connect->rpc, &batches[i].node, rc, latency);
+        if (!rc)
+            rc = lookup_batch_parse(&batches[i], cids, sizes);
+
+        http_client_close(done);
+        batches[i].httpc = NULL;
+        running--;
+
+        if (rc < 0)
+            break;
     }
 
-    if (resp_code != HttpStatus_OK) {
-        rc = HIVE_HTTP_STATUS_ERROR(resp_code);
-        goto error_exit;
+    /*
+     * Batches cut short by a failure elsewhere say nothing about their
+     * nodes.
+     */
+    for (i = 0; i < MAX_PARALLEL_LOOKUPS; i++) {
+        if (!batches[i].httpc)
+            continue;
+
+        http_multi_remove(multi, batches[i].httpc);
+        ipfs_rpc_release_node(connect->rpc, &batches[i].node, 0, -1);
+        http_client_close(batches[i].httpc);
     }
 
-    p = http_client_move_response_body(httpc, NULL);
-    http_client_close(httpc);
-    if (!p)
-        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+    http_multi_close(multi);
+    free(pending);
+    return rc;
+}
 
-    resp = cJSON_Parse(p);
-    free(p);
+/*
+ * Read an object, or the slice of it starting at offset when ranged, with
+ * a single /cat request streamed straight into the caller's buffer. The
+ * size of a whole object comes from the X-Content-Length header when the
+ * node sends one and from the end of the stream otherwise; an object
+ * larger than the buffer aborts the transfer as soon as that is known.
+ */
+static ssize_t cat_to_buffer(IPFSConnect *connect, const IPFSCid *cid,
+                             bool ranged, uint64_t offset,
+                             void *to, size_t buflen)
+{
+    http_client_t *httpcs[2];
+    cat_context_t ctx;
+    cat_sink_t *sink;
+    int winner;
+    int rc;
 
-    if (!resp)
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.cid = cid;
+    ctx.ranged = ranged;
+    ctx.offset = offset;
+    winner = 0;
+
+    ctx.sinks[0].buf = (uint8_t *)to;
+    ctx.sinks[0].bufsz = buflen;
+    ctx.sinks[0].limit = buflen;
+    ctx.sinks[0].expected = -1;
+
+    ctx.sinks[1].limit = buflen;
+    ctx.sinks[1].growable = true;
+    ctx.sinks[1].expected = -1;
+
+    rc = __rpc_hedged_request(connect, "/api/v0/cat", cat_setup, &ctx,
+                              httpcs, &winner);
+    http_client_close(httpcs[0]);
+    http_client_close(httpcs[1]);
+
+    sink = &ctx.sinks[winner];
+    if (!rc && winner && sink->len)
+        memcpy(to, sink->buf, sink->len);
+    free(ctx.sinks[1].buf);
+
+    if (rc == HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL) &&
+        !ctx.sinks[0].overflow && !ctx.sinks[1].overflow)
         return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
 
-    objects = cJSON_GetObjectItemCaseSensitive(resp, "Objects");
-    if (!objects || !cJSON_IsObject(objects)) {
-        cJSON_Delete(resp);
-        return HIVE_GENERAL_ERROR(HIVEERR_BAD_JSON_FORMAT);
-    }
+    if (rc < 0)
+        return rc;
 
-    cid_json = cJSON_GetObjectItemCaseSensitive(objects, cid->content);
-    if (!cid_json || !cJSON_IsObject(cid_json)) {
-        cJSON_Delete(resp);
-        return HIVE_GENERAL_ERROR(HIVEERR_BAD_JSON_FORMAT);
+    if (sink->expected >= 0 && (size_t)sink->expected != sink->len)
+        return HIVE_GENERAL_ERROR(HIVEERR_BAD_PERSISTENT_DATA);
+
+    return (ssize_t)sink->len;
+}
+
+static ssize_t get_file_to_buffer(HiveConnect *base, const IPFSCid *cid, bool decrypt, void *to, size_t buflen)
+{
+    IPFSConnect *connect = (IPFSConnect *)base;
+    flight_t *flight;
+    ssize_t fsize;
+
+    if (connect->cache) {
+        fsize = object_cache_length(connect->cache, cid->content);
+        if (fsize > (ssize_t)buflen)
+            return HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
+
+        if (fsize >= 0 &&
+            object_cache_get(connect->cache, cid->content, to, buflen) == fsize)
+            return fsize;
     }
 
-    size = cJSON_GetObjectItemCaseSensitive(cid_json, "Size");
-    if (!size || !cJSON_IsNumber(size) || (ssize_t)size->valuedouble < 0) {
-        cJSON_Delete(resp);
-        return HIVE_GENERAL_ERROR(HIVEERR_BAD_JSON_FORMAT);
+    /* Concurrent reads of the same CID share one transfer. */
+    if (!single_flight_join(connect->flights, cid->content, &flight)) {
+        fsize = single_flight_copy(flight, to, buflen);
+        single_flight_leave(connect->flights, flight);
+        return fsize;
     }
 
-    fsize = (ssize_t)size->valuedouble;
-    cJSON_Delete(resp);
+    fsize = cat_to_buffer(connect, cid, false, 0, to, buflen);
+    if (fsize >= 0)
+        cache_put(connect, cid, to, (size_t)fsize, false);
+
+    single_flight_land(connect->flights, flight, fsize < 0 ? (int)fsize : 0,
+                       to, fsize < 0 ? 0 : (size_t)fsize);
 
     return fsize;
+}
 
-error_exit:
-    http_client_close(httpc);
-    return (ssize_t)rc;
+/*
+ * Only the slice asked for is transferred; it is not cached, since the
+ * cache holds whole objects.
+ */
+static ssize_t get_file_range(HiveConnect *base, const IPFSCid *cid,
+                              uint64_t offset, size_t length, void *to)
+{
+    return cat_to_buffer((IPFSConnect *)base, cid, true, offset, to, length);
 }
 
-static size_t get_response_body_cb(char *buffer, size_t size, size_t nitems, void *userdata)
+static int __car_client(IPFSConnect *connect, const char *api,
+                        rpc_node_addr_t *node, http_client_t **httpc)
+{
+    int rc;
+
+    rc = ipfs_rpc_acquire_node(connect->rpc, node);
+    if (rc < 0)
+        return rc;
+
+    rc = ipfs_rpc_node_client(node, api, httpc);
+    if (rc < 0) {
+        ipfs_rpc_release_node(connect->rpc, node, rc, -1);
+        return rc;
+    }
+
+    http_client_set_method(*httpc, HTTP_METHOD_POST);
+
+    return 0;
+}
+
+typedef struct car_sink {
+    http_client_t *httpc;
+    int fd;
+    int err;
+    uint64_t written;
+} car_sink_t;
+
+/*
+ * The archive goes straight to the file descriptor; an error response
+ * is not part of it and is dropped.
+ */
+static size_t export_response_cb(char *buffer, size_t size, size_t nitems,
+                                 void *userdata)
 {
-    uint8_t *buf = ((void **)userdata)[0];
-    size_t bufsz = *((size_t *)(((void **)userdata)[1]));
-    size_t *actual_sz = (size_t *)(((void **)userdata)[2]);
+    car_sink_t *sink = (car_sink_t *)userdata;
     size_t total_sz = size * nitems;
+    long resp_code = 0;
+    size_t off = 0;
+    ssize_t nwr;
 
-    if (*actual_sz + total_sz > bufsz)
-        return 0;
+    http_client_get_response_code(sink->httpc, &resp_code);
+    if (resp_code != HttpStatus_OK)
+        return total_sz;
+
+    while (off < total_sz) {
+        nwr = write(sink->fd, buffer + off,
+#if defined(_WIN32) || defined(_WIN64)
+                    (unsigned)
+#endif
+                    (total_sz - off));
+        if (nwr < 0) {
+            if (errno == EINTR)
+                continue;
 
-    memcpy(buf + *actual_sz, buffer, total_sz);
-    *actual_sz += total_sz;
+            sink->err = errno;
+            return 0;
+        }
+
+        off += nwr;
+    }
 
+    sink->written += total_sz;
     return total_sz;
 }
 
-static ssize_t get_file_to_buffer(HiveConnect *base, const IPFSCid *cid, bool decrypt, void *to, size_t buflen)
+static ssize_t export_car(HiveConnect *base, const IPFSCid *root, int fd)
 {
     IPFSConnect *connect = (IPFSConnect *)base;
-    char url[MAX_URL_LEN] = {0};
+    rpc_node_addr_t node;
     http_client_t *httpc;
-    size_t actual_sz = 0;
-    long resp_code = 0;
-    ssize_t fsize;
+    car_sink_t sink;
     int rc;
-    void *args[] = {to, &buflen, &actual_sz};
 
-    fsize = get_file_length(base, cid);
-    if (fsize <= 0)
-        return fsize;
+    rc = __car_client(connect, "/api/v0/dag/export", &node, &httpc);
+    if (rc < 0)
+        return rc;
+
+    memset(&sink, 0, sizeof(sink));
+    sink.httpc = httpc;
+    sink.fd = fd;
 
-    if ((ssize_t)buflen > 0 && fsize > (ssize_t)buflen)
-        return HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
+    http_client_set_query(httpc, "arg", root->content);
+    http_client_set_response_body(httpc, export_response_cb, &sink);
+
+    rc = __rpc_request(connect, httpc, &node);
+    http_client_close(httpc);
 
-    rc = ipfs_rpc_check_reachable(connect->rpc);
     if (rc < 0)
-        return rc;
+        return sink.err ? HIVE_SYS_ERROR(sink.err) : rc;
 
-    sprintf(url, "http://%s:%u/api/v0/cat",
-            ipfs_rpc_get_current_node_ip(connect->rpc),
-            (unsigned)ipfs_rpc_get_current_node_port(connect->rpc));
+    return (ssize_t)sink.written;
+}
 
-    httpc = http_client_new();
-    if (!httpc)
-        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+typedef struct car_source {
+    int fd;
+    int err;
+} car_source_t;
 
-    http_client_set_url(httpc, url);
-    http_client_set_query(httpc, "arg", cid->content);
-    http_client_set_method(httpc, HTTP_METHOD_POST);
-    http_client_set_request_body_instant(httpc, NULL, 0);
-    http_client_set_response_body(httpc, get_response_body_cb, args);
+static size_t import_read_cb(char *buffer, size_t size, size_t nitems,
+                             void *userdata)
+{
+    car_source_t *src = (car_source_t *)userdata;
+    ssize_t nrd;
 
-    rc = http_client_request(httpc);
-    if (rc) {
-        if (RC_NODE_UNREACHABLE(rc)) {
-            rc = HIVE_GENERAL_ERROR(HIVEERR_TRY_AGAIN);
-            ipfs_rpc_mark_node_unreachable(connect->rpc);
-        } else
-            rc = HIVE_CURL_ERROR(rc);
-        goto error_exit;
+    do {
+        nrd = read(src->fd, buffer,
+#if defined(_WIN32) || defined(_WIN64)
+                   (unsigned)
+#endif
+                   (size * nitems));
+    } while (nrd < 0 && errno == EINTR);
+
+    if (nrd < 0) {
+        src->err = errno;
+        return CURL_READFUNC_ABORT;
     }
 
-    rc = http_client_get_response_code(httpc, &resp_code);
-    http_client_close(httpc);
-    if (rc)
-        return HIVE_CURL_ERROR(rc);
+    return (size_t)nrd;
+}
 
-    if (resp_code != HttpStatus_OK)
-        return HIVE_HTTP_STATUS_ERROR(resp_code);
+/*
+ * dag/import reports every root of the archive on a line of its own.
+ */
+typedef struct import_results {
+    IPFSCid *roots;
+    size_t count;
+    size_t found;
+    bool bad;
+} import_results_t;
+
+static void parse_import_line(const char *line, void *context)
+{
+    import_results_t *res = (import_results_t *)context;
+    cJSON *json;
+    cJSON *root;
+    cJSON *cid;
+    cJSON *pin_error;
+
+    json = cJSON_Parse(line);
+    if (!json) {
+        res->bad = true;
+        return;
+    }
 
-    if (fsize != actual_sz)
-        return HIVE_GENERAL_ERROR(HIVEERR_BAD_PERSISTENT_DATA);
+    root = cJSON_GetObjectItemCaseSensitive(json, "Root");
+    if (!root) {
+        cJSON_Delete(json);
+        return;
+    }
 
-    return fsize;
+    cid = cJSON_GetObjectItemCaseSensitive(root, "Cid");
+    cid = cid ? cJSON_GetObjectItemCaseSensitive(cid, "/") : NULL;
+    if (!cid || !cJSON_IsString(cid) || !*cid->valuestring ||
+        strlen(cid->valuestring) > HIVE_MAX_IPFS_CID_LEN) {
+        res->bad = true;
+        cJSON_Delete(json);
+        return;
+    }
 
-error_exit:
+    pin_error = cJSON_GetObjectItemCaseSensitive(root, "PinErrorMsg");
+    if (pin_error && cJSON_IsString(pin_error) && *pin_error->valuestring)
+        vlogW("IPFS: Imported root %s not pinned: %s.", cid->valuestring,
+              pin_error->valuestring);
+
+    if (res->found < res->count)
+        strcpy(res->roots[res->found].content, cid->valuestring);
+    res->found++;
+
+    cJSON_Delete(json);
+}
+
+static ssize_t import_car(HiveConnect *base, int fd, IPFSCid *roots,
+                          size_t count)
+{
+    IPFSConnect *connect = (IPFSConnect *)base;
+    rpc_node_addr_t node;
+    http_client_t *httpc;
+    import_results_t res;
+    json_lines_t lines;
+    car_source_t src;
+    int rc;
+
+    rc = __car_client(connect, "/api/v0/dag/import", &node, &httpc);
+    if (rc < 0)
+        return rc;
+
+    memset(&res, 0, sizeof(res));
+    res.roots = roots;
+    res.count = count;
+
+    memset(&lines, 0, sizeof(lines));
+    lines.callback = parse_import_line;
+    lines.context = &res;
+
+    src.fd = fd;
+    src.err = 0;
+
+    /*
+     * The archive is sent chunked as it is read, whatever its size.
+     */
+    http_client_set_mime(httpc, "file", NULL, NULL, import_read_cb, &src, -1);
+    http_client_set_response_body(httpc, json_lines_response_cb, &lines);
+
+    rc = __rpc_request(connect, httpc, &node);
     http_client_close(httpc);
-    return rc;
+    free(lines.line);
+
+    if (rc < 0)
+        return src.err ? HIVE_SYS_ERROR(src.err) : rc;
+
+    if (res.bad)
+        return HIVE_GENERAL_ERROR(HIVEERR_BAD_JSON_FORMAT);
+
+    return (ssize_t)res.found;
+}
+
+static int get_stats(HiveConnect *base, IPFSStats *stats)
+{
+    IPFSConnect *connect = (IPFSConnect *)base;
+
+    ipfs_rpc_get_stats(connect->rpc, stats);
+    return 0;
 }
 
 static int disconnect(HiveConnect *base)
@@ -319,6 +1871,12 @@ static void ipfs_connect_destructor(void *p)
 
     if (client->rpc)
         ipfs_rpc_close(client->rpc);
+
+    if (client->cache)
+        object_cache_close(client->cache);
+
+    if (client->flights)
+        single_flight_close(client->flights);
 }
 
 static inline bool is_valid_ip(const char *ip)
@@ -337,9 +1895,11 @@ HiveConnect *ipfs_client_connect(HiveClient *client, const HiveConnectOptions *o
 {
     IPFSConnectOptions *options = (IPFSConnectOptions *)options_base;
     ipfs_rpc_options_t *token_options;
+    char store_path[PATH_MAX];
     size_t token_options_sz;
     IPFSConnect *connect;
     size_t i;
+    int rc;
 
     assert(options);
 
@@ -352,15 +1912,47 @@ HiveConnect *ipfs_client_connect(HiveClient *client, const HiveConnectOptions *o
     if (!options->rpc_node_count)
         return NULL;
 
+    if (options->hedge_budget < 0 || options->hedge_budget > 1)
+        return NULL;
+
+    token_options->hedge_budget = options->hedge_budget;
+    token_options->state_callback = options->state_callback;
+    token_options->state_context = options->state_context;
+
+    /*
+     * Node rankings survive restarts, so short-lived processes do not pay
+     * for a probe round; without a writable location they are just lost.
+     */
+    rc = snprintf(store_path, sizeof(store_path), "%s/.data", client->data_location);
+    if (rc > 0 && rc < (int)sizeof(store_path) &&
+        (mkdirs(store_path, S_IRWXU) == 0 || errno == EEXIST)) {
+        rc = snprintf(store_path, sizeof(store_path), "%s/.data/ipfs_nodes.json",
+                      client->data_location);
+        if (rc > 0 && rc < (int)sizeof(store_path))
+            token_options->store_path = store_path;
+    }
     token_options->rpc_nodes_count = options->rpc_node_count;
     for (i = 0; i < options->rpc_node_count; ++i) {
         IPFSNode *node = &options->rpcNodes[i];
         rpc_node_t *node_options = &token_options->rpc_nodes[i];
         size_t ipv4_len;
         size_t ipv6_len;
+        size_t socket_len;
         char *endptr;
         long port;
 
+        socket_len = node->unix_socket ? strlen(node->unix_socket) : 0;
+        if (socket_len) {
+            if (socket_len >= sizeof(node_options->unix_socket))
+                return NULL;
+
+            if (!strpbrk(node->unix_socket, "/\\"))
+                return NULL;
+
+            strcpy(node_options->unix_socket, node->unix_socket);
+            continue;
+        }
+
         ipv4_len = node->ipv4 ? strlen(node->ipv4) : 0;
         ipv6_len = node->ipv6 ? strlen(node->ipv6) : 0;
 
@@ -405,15 +1997,45 @@ HiveConnect *ipfs_client_connect(HiveClient *client, const HiveConnectOptions *o
         return NULL;
 
     connect->base.ipfs_put_file_from_buffer = put_file_from_buffer;
+    connect->base.ipfs_add                  = add;
+    connect->base.ipfs_put_files            = put_files;
     connect->base.ipfs_get_file_length      = get_file_length;
+    connect->base.ipfs_get_file_lengths     = get_file_lengths;
     connect->base.ipfs_get_file_to_buffer   = get_file_to_buffer;
+    connect->base.ipfs_get_file_range       = get_file_range;
+    connect->base.ipfs_export_car           = export_car;
+    connect->base.ipfs_import_car           = import_car;
+    connect->base.ipfs_get_stats            = get_stats;
     connect->base.disconnect                = disconnect;
 
+    connect->lookup_batch_size = options->lookup_batch_size ?
+                                 options->lookup_batch_size :
+                                 DEFAULT_LOOKUP_BATCH_SIZE;
+
     connect->rpc = ipfs_rpc_new(token_options, connect);
     if (!connect->rpc) {
         deref(connect);
         return NULL;
     }
 
+    connect->flights = single_flight_new();
+    if (!connect->flights) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY));
+        deref(connect);
+        return NULL;
+    }
+
+    if (options->cache_capacity >= 0) {
+        rc = snprintf(store_path, sizeof(store_path), "%s/ipfs-cache",
+                      client->data_location);
+        if (rc > 0 && rc < (int)sizeof(store_path))
+            connect->cache = object_cache_new(store_path,
+                options->cache_capacity ? (size_t)options->cache_capacity :
+                                          DEFAULT_CACHE_CAPACITY,
+                CACHE_MEMORY_CAPACITY);
+        if (!connect->cache)
+            vlogW("IPFS: Local object cache disabled.");
+    }
+
     return &connect->base;
 }
@@ -35,6 +35,12 @@ extern "C" {
 
 #define HIVE_MAX_IPV4_ADDRESS_LEN (15)
 #define HIVE_MAX_IPV6_ADDRESS_LEN (47)
+#define HIVE_MAX_UNIX_SOCKET_PATH_LEN (103)
+
+/*
+ * A node answers on one of its ip addresses or on its Unix socket path.
+ */
+#define HIVE_MAX_NODE_ADDRESS_LEN HIVE_MAX_UNIX_SOCKET_PATH_LEN
 
 #define RC_NODE_UNREACHABLE(rc)            \
     ((rc) == CURLE_COULDNT_CONNECT      || \
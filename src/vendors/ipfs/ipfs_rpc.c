@@ -23,10 +23,28 @@
 #include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <assert.h>
+#include <sys/stat.h>
 
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 #ifdef HAVE_SYS_PARAM_H
 #include <sys/param.h>
 #endif
+#ifdef HAVE_MALLOC_H
+#include <malloc.h>
+#endif
+#ifdef HAVE_ALLOCA_H
+#include <alloca.h>
+#endif
+#if defined(_WIN32) || defined(_WIN64)
+#include <io.h>
+#endif
 
 #include <crystal.h>
 #include <cjson/cJSON.h>
@@ -37,158 +55,1134 @@
 #include "ipfs_constants.h"
 #include "http_client.h"
 #include "http_status.h"
+#include "atomic_file.h"
+
+/*
+ * Requests allowed in flight on one node; further requests go to other
+ * nodes or wait for a slot.
+ */
+#define MAX_NODE_INFLIGHT       (16)
+
+/*
+ * Smoothing factors of the latency and error moving averages.
+ */
+#define LATENCY_EWMA_ALPHA      (0.3)
+#define ERROR_EWMA_ALPHA        (0.1)
+
+/*
+ * Latency assumed for a node until it has been measured (ms).
+ */
+#define INITIAL_LATENCY         (1000.0)
+
+/*
+ * After the first node answers a probe round, keep collecting answers
+ * for this long (ms) so the other healthy nodes join the rotation too.
+ */
+#define PROBE_GRACE_TIME        (300)
+
+/*
+ * Consecutive failed requests which open the circuit of a node; a node
+ * which cannot be reached at all has it opened at once.
+ */
+#define BREAKER_FAILURE_THRESHOLD   (3)
+
+/*
+ * Bounds (seconds) of the exponential backoff between re-probes of a node
+ * whose circuit is open.
+ */
+#define MIN_REPROBE_INTERVAL    (1)
+#define MAX_REPROBE_INTERVAL    (60)
+
+/*
+ * Recent first byte times kept per node to estimate its p95 latency, and
+ * how many of them are needed before the estimate is trusted.
+ */
+#define LATENCY_SAMPLES         (64)
+#define MIN_LATENCY_SAMPLES     (16)
+
+/*
+ * Hedges that may be fired in a burst once budget has been saved up.
+ */
+#define MAX_HEDGE_CREDITS       (10.0)
+
+/*
+ * A saved node table older than this (seconds) is not trusted at
+ * startup, and a changing table is saved at most this often.
+ */
+#define NODE_STORE_MAX_AGE      (24 * 60 * 60)
+#define NODE_STORE_INTERVAL     (60)
+#define NODE_STORE_MAX_SIZE     (64 * 1024)
+
+typedef struct state_event {
+    struct state_event *next;
+    size_t index;
+    IPFSNodeState state;
+} state_event_t;
+
+typedef struct node_state {
+    /*
+     * The address that answered, empty while the node is unknown.
+     */
+    char ip[HIVE_MAX_NODE_ADDRESS_LEN + 1];
+    uint16_t port;
+
+    double latency;
+    double errors;
+    int inflight;
+
+    /*
+     * Circuit breaker. A closed node takes traffic; an open one gets none
+     * and is re-probed in background, after backoff seconds; a half-open
+     * one answered that probe and takes a single trial request, whose
+     * outcome closes or reopens the circuit. An open node without backoff
+     * has not failed but is unverified, restored from a saved table; it
+     * closes as soon as it answers a probe.
+     */
+    IPFSNodeState breaker;
+    int failures;
+    int backoff;
+    time_t next_probe;
+
+    double samples[LATENCY_SAMPLES];
+    size_t nsamples;
+    size_t next_sample;
+} node_state_t;
 
 struct ipfs_rpc {
-    char current_node_ip[HIVE_MAX_IPV6_ADDRESS_LEN  + 1];
-    uint16_t current_node_port;
+    /*
+     * Guards the node table; cond signals freed request slots.
+     */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    /*
+     * The monitor thread re-probes open nodes and delivers state changes
+     * to the application in the order they happened, so neither probes
+     * nor callbacks run on request threads.
+     */
+    pthread_t monitor;
+    pthread_cond_t monitor_cond;
+    bool monitor_started;
+    bool stopping;
+    state_event_t *events_head;
+    state_event_t *events_tail;
+    IPFSNodeStateCallback *state_callback;
+    void *state_context;
+
+    /*
+     * Where the node table is saved, so the next process starts with the
+     * nodes ranked instead of probing them all.
+     */
+    char *store_path;
+    bool dirty;
+    time_t saved_at;
+
+    /*
+     * Every hedgeable request earns hedge_budget credits, every hedge
+     * fired spends one, so hedges stay within that fraction of reads.
+     */
+    double hedge_budget;
+    double hedge_credits;
+    uint64_t hedges_fired;
+    uint64_t hedges_won;
+
+    /*
+     * Node choices draw from a seed of their own, so processes spread
+     * over nodes whether or not the application seeds rand().
+     */
+    unsigned int seed;
+
     size_t rpc_nodes_count;
+    node_state_t *states;
     rpc_node_t rpc_nodes[0];
 };
 
-static int test_reachable(const char *ipaddr, uint16_t port)
+/*
+ * Ip addresses never hold a path separator, while socket paths always do.
+ */
+static bool is_unix_socket(const char *address)
 {
-    char url[MAXPATHLEN + 1];
-    http_client_t *httpc;
+    return strpbrk(address, "/\\") != NULL;
+}
+
+int ipfs_rpc_node_client(const rpc_node_addr_t *node, const char *api,
+                         http_client_t **httpc)
+{
+    char url[MAX_URL_LEN];
+    bool local;
     int rc;
-    long resp_code;
 
-    rc = snprintf(url, sizeof(url), "http://%s:%d/version", ipaddr, port);
-    if (rc < 0 || rc >= sizeof(url)) {
-        vlogE("IpfsToken: URL too long.");
+    /*
+     * A local daemon is reached over its socket, the host of the url is
+     * then only used for the Host header.
+     */
+    local = is_unix_socket(node->ip);
+    if (local)
+        rc = snprintf(url, sizeof(url), "http://localhost%s", api);
+    else if (strchr(node->ip, ':'))
+        rc = snprintf(url, sizeof(url), "http://[%s]:%u%s", node->ip,
+                      (unsigned)node->port, api);
+    else
+        rc = snprintf(url, sizeof(url), "http://%s:%u%s", node->ip,
+                      (unsigned)node->port, api);
+
+    if (rc < 0 || rc >= (int)sizeof(url))
         return HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
-    }
 
-    httpc = http_client_new();
-    if (!httpc) {
-        vlogE("IpfsToken: failed to create http client instance.");
+    *httpc = http_client_new();
+    if (!*httpc)
         return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+
+    http_client_set_url(*httpc, url);
+    if (local)
+        http_client_set_unix_socket(*httpc, node->ip);
+
+    return 0;
+}
+
+typedef struct probe {
+    http_client_t *httpc;
+    rpc_node_addr_t addr;
+} probe_t;
+
+static http_client_t *new_probe(const char *ipaddr, uint16_t port, size_t index,
+                                probe_t *probe)
+{
+    http_client_t *httpc;
+    int rc;
+
+    strcpy(probe->addr.ip, ipaddr);
+    probe->addr.port = port;
+    probe->addr.index = index;
+
+    rc = ipfs_rpc_node_client(&probe->addr, "/version", &httpc);
+    if (rc < 0) {
+        vlogE("IpfsToken: failed to create http client instance.");
+        return NULL;
     }
 
-    http_client_set_url(httpc, url);
     http_client_set_method(httpc, HTTP_METHOD_POST);
     http_client_set_request_body_instant(httpc, NULL, 0);
     http_client_set_timeout(httpc, 5);
 
-    rc = http_client_request(httpc);
-    if (rc) {
-        rc = HIVE_CURL_ERROR(rc);
-        vlogE("IpfsToken: failed to perform http request.");
-        goto error_exit;
+    probe->httpc = httpc;
+    return httpc;
+}
+
+/*
+ * Probe every address of the given nodes at once, ipv4 and ipv6 racing
+ * each other. Unless wait_all is set, the round ends shortly after the
+ * first answer, so it costs about the latency of the fastest node instead
+ * of the timeouts of the dead ones, while still discovering the other
+ * healthy nodes. Results are written into the given states, which the
+ * caller merges into the node table.
+ */
+static int probe_nodes(const rpc_node_t *rpc_nodes, size_t nodes_cnt,
+                       node_state_t *states, bool wait_all)
+{
+    http_multi_t *multi;
+    http_client_t *done;
+    probe_t *probes;
+    size_t nprobes = 0;
+    size_t answered = 0;
+    int timeout = -1;
+    size_t i;
+    int rc;
+
+    probes = (probe_t *)calloc(nodes_cnt * 2, sizeof(probe_t));
+    if (!probes)
+        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+
+    multi = http_multi_new();
+    if (!multi) {
+        free(probes);
+        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
     }
 
-    rc = http_client_get_response_code(httpc, &resp_code);
-    http_client_close(httpc);
+    for (i = 0; i < nodes_cnt; i++) {
+        if (rpc_nodes[i].unix_socket[0]) {
+            if (new_probe(rpc_nodes[i].unix_socket, 0, i, &probes[nprobes]))
+                http_multi_add(multi, probes[nprobes++].httpc);
+            continue;
+        }
+
+        if (rpc_nodes[i].ipv4[0] &&
+            new_probe(rpc_nodes[i].ipv4, rpc_nodes[i].port, i, &probes[nprobes]))
+            http_multi_add(multi, probes[nprobes++].httpc);
 
-    if (rc) {
-        vlogE("IpfsToken: failed to get http response code.");
-        return HIVE_CURL_ERROR(rc);
+        if (rpc_nodes[i].ipv6[0] &&
+            new_probe(rpc_nodes[i].ipv6, rpc_nodes[i].port, i, &probes[nprobes]))
+            http_multi_add(multi, probes[nprobes++].httpc);
     }
 
-    if (resp_code != HttpStatus_OK) {
-        vlogE("IpfsToken: error from response (%d).", resp_code);
-        return HIVE_HTTP_STATUS_ERROR(resp_code);
+    for (;;) {
+        node_state_t *state;
+        long resp_code = 0;
+        double seconds = 0;
+        int result = 0;
+
+        rc = http_multi_wait_any(multi, timeout, &done, &result);
+        if (rc || !done)
+            break;
+
+        if (result || http_client_get_response_code(done, &resp_code) ||
+            resp_code != HttpStatus_OK)
+            continue;
+
+        for (i = 0; i < nprobes && probes[i].httpc != done; i++);
+        if (i == nprobes)
+            continue;
+
+        state = &states[probes[i].addr.index];
+        if (state->ip[0])
+            continue;
+
+        http_client_get_first_byte_time(done, &seconds);
+        strcpy(state->ip, probes[i].addr.ip);
+        state->port = probes[i].addr.port;
+        state->latency = seconds * 1000;
+        answered++;
+
+        vlogD("IpfsToken: node %s answered in %.1fms.", state->ip, state->latency);
+
+        if (timeout < 0 && !wait_all)
+            timeout = PROBE_GRACE_TIME;
     }
 
+    for (i = 0; i < nprobes; i++) {
+        http_multi_remove(multi, probes[i].httpc);
+        http_client_close(probes[i].httpc);
+    }
+
+    http_multi_close(multi);
+    free(probes);
+
+    if (!answered)
+        return HIVE_GENERAL_ERROR(HIVEERR_BAD_BOOTSTRAP_HOST);
+
     return 0;
+}
+
+static int next_backoff(int backoff)
+{
+    if (!backoff)
+        return MIN_REPROBE_INTERVAL;
+
+    return backoff * 2 < MAX_REPROBE_INTERVAL ? backoff * 2 : MAX_REPROBE_INTERVAL;
+}
+
+/*
+ * Move a node to another breaker state and queue the change for the
+ * monitor thread to report. Called with the lock held.
+ */
+static void set_breaker(ipfs_rpc_t *rpc, size_t index, IPFSNodeState breaker)
+{
+    node_state_t *state = &rpc->states[index];
+    state_event_t *event;
+
+    if (state->breaker == breaker)
+        return;
+
+    state->breaker = breaker;
+    rpc->dirty = true;
+
+    if (breaker == IPFSNodeState_Open) {
+        state->backoff = next_backoff(state->backoff);
+        state->next_probe = time(NULL) + state->backoff;
+        pthread_cond_signal(&rpc->monitor_cond);
+    } else if (breaker == IPFSNodeState_Closed) {
+        state->failures = 0;
+        state->backoff = 0;
+    }
+
+    if (!rpc->state_callback)
+        return;
+
+    event = (state_event_t *)calloc(1, sizeof(state_event_t));
+    if (!event)
+        return;
+
+    event->index = index;
+    event->state = breaker;
+
+    if (rpc->events_tail)
+        rpc->events_tail->next = event;
+    else
+        rpc->events_head = event;
+    rpc->events_tail = event;
 
-error_exit:
-    http_client_close(httpc);
-    return rc;
+    pthread_cond_signal(&rpc->monitor_cond);
 }
 
-static int select_bootstrap(rpc_node_t *rpc_nodes, size_t nodes_cnt,
-                            char *selected_ip, uint16_t *selected_port)
+static void notify_state(ipfs_rpc_t *rpc, const state_event_t *event)
 {
+    const rpc_node_t *rpc_node = &rpc->rpc_nodes[event->index];
+    IPFSNode node;
+    char port[8];
+
+    sprintf(port, "%u", (unsigned)rpc_node->port);
+    node.ipv4 = rpc_node->ipv4[0] ? rpc_node->ipv4 : NULL;
+    node.ipv6 = rpc_node->ipv6[0] ? rpc_node->ipv6 : NULL;
+    node.port = port;
+    node.unix_socket = rpc_node->unix_socket[0] ? rpc_node->unix_socket : NULL;
+
+    rpc->state_callback(event->index, &node, event->state, rpc->state_context);
+}
+
+/*
+ * Re-probe the open nodes whose backoff has elapsed. Those answering go
+ * half-open; the others wait twice as long for the next probe. Called
+ * with the lock held, which is released while probing.
+ */
+static void reprobe_nodes(ipfs_rpc_t *rpc, time_t now)
+{
+    rpc_node_t *due;
+    node_state_t *probed;
+    size_t *indexes;
+    size_t ndue = 0;
     size_t i;
-    size_t base;
-    int rc;
 
-    srand((unsigned)time(NULL));
-    base = (size_t)rand() % nodes_cnt;
-    i = base;
-
-    do {
-        if (rpc_nodes[i].ipv4[0]) {
-            rc = test_reachable(rpc_nodes[i].ipv4, rpc_nodes[i].port);
-            if (!rc) {
-                strcpy(selected_ip, rpc_nodes[i].ipv4);
-                *selected_port = rpc_nodes[i].port;
-                vlogI("IpfsToken: node selected: %s.", selected_ip);
-                return 0;
-            }
+    due = (rpc_node_t *)alloca(sizeof(rpc_node_t) * rpc->rpc_nodes_count);
+    indexes = (size_t *)alloca(sizeof(size_t) * rpc->rpc_nodes_count);
+
+    for (i = 0; i < rpc->rpc_nodes_count; i++) {
+        node_state_t *state = &rpc->states[i];
+
+        if (state->breaker != IPFSNodeState_Open || state->next_probe > now)
+            continue;
+
+        due[ndue] = rpc->rpc_nodes[i];
+        indexes[ndue++] = i;
+    }
+
+    if (!ndue)
+        return;
+
+    probed = (node_state_t *)calloc(ndue, sizeof(node_state_t));
+    if (!probed) {
+        for (i = 0; i < ndue; i++)
+            rpc->states[indexes[i]].next_probe = now + MIN_REPROBE_INTERVAL;
+        return;
+    }
+
+    pthread_mutex_unlock(&rpc->lock);
+    probe_nodes(due, ndue, probed, true);
+    pthread_mutex_lock(&rpc->lock);
+
+    for (i = 0; i < ndue; i++) {
+        node_state_t *state = &rpc->states[indexes[i]];
+
+        if (probed[i].ip[0]) {
+            strcpy(state->ip, probed[i].ip);
+            state->port = probed[i].port;
+            state->latency = probed[i].latency;
+
+            if (state->backoff) {
+                vlogI("IpfsToken: node %s answered again, on trial.", state->ip);
+                set_breaker(rpc, indexes[i], IPFSNodeState_HalfOpen);
+            } else
+                set_breaker(rpc, indexes[i], IPFSNodeState_Closed);
+        } else {
+            state->backoff = next_backoff(state->backoff);
+            state->next_probe = time(NULL) + state->backoff;
+        }
+    }
+
+    free(probed);
+    pthread_cond_broadcast(&rpc->cond);
+}
+
+static void save_nodes(ipfs_rpc_t *rpc);
+
+static void *monitor_entry(void *arg)
+{
+    ipfs_rpc_t *rpc = (ipfs_rpc_t *)arg;
+
+    pthread_mutex_lock(&rpc->lock);
+
+    while (!rpc->stopping) {
+        state_event_t *event = rpc->events_head;
+        time_t next_probe = 0;
+        time_t now;
+        size_t i;
+
+        if (event) {
+            rpc->events_head = event->next;
+            if (!rpc->events_head)
+                rpc->events_tail = NULL;
+
+            pthread_mutex_unlock(&rpc->lock);
+            notify_state(rpc, event);
+            free(event);
+            pthread_mutex_lock(&rpc->lock);
+            continue;
         }
 
-        if (rpc_nodes[i].ipv6[0]) {
-            rc = test_reachable(rpc_nodes[i].ipv6, rpc_nodes[i].port);
-            if (!rc) {
-                strcpy(selected_ip, rpc_nodes[i].ipv6);
-                *selected_port = rpc_nodes[i].port;
-                vlogI("IpfsToken: node selected: %s.", selected_ip);
-                return 0;
-            }
+        now = time(NULL);
+        reprobe_nodes(rpc, now);
+        if (rpc->stopping || rpc->events_head)
+            continue;
+
+        if (rpc->store_path && rpc->dirty &&
+            now >= rpc->saved_at + NODE_STORE_INTERVAL) {
+            pthread_mutex_unlock(&rpc->lock);
+            save_nodes(rpc);
+            pthread_mutex_lock(&rpc->lock);
+            continue;
         }
 
-        i = (i + 1) % nodes_cnt;
-    } while (i != base);
+        for (i = 0; i < rpc->rpc_nodes_count; i++) {
+            node_state_t *state = &rpc->states[i];
+
+            if (state->breaker == IPFSNodeState_Open &&
+                (!next_probe || state->next_probe < next_probe))
+                next_probe = state->next_probe;
+        }
+
+        if (rpc->store_path && rpc->dirty &&
+            (!next_probe || rpc->saved_at + NODE_STORE_INTERVAL < next_probe))
+            next_probe = rpc->saved_at + NODE_STORE_INTERVAL;
+
+        if (next_probe) {
+            struct timespec ts;
+
+            ts.tv_sec = next_probe;
+            ts.tv_nsec = 0;
+            pthread_cond_timedwait(&rpc->monitor_cond, &rpc->lock, &ts);
+        } else
+            pthread_cond_wait(&rpc->monitor_cond, &rpc->lock);
+    }
+
+    pthread_mutex_unlock(&rpc->lock);
+    return NULL;
+}
+
+static bool node_usable(const node_state_t *state)
+{
+    return state->ip[0] && state->breaker != IPFSNodeState_Open;
+}
+
+static bool node_available(const node_state_t *state)
+{
+    if (state->breaker == IPFSNodeState_HalfOpen)
+        return state->inflight == 0;
 
-    vlogE("IpfsToken: No node configured is reachable.");
-    return HIVE_GENERAL_ERROR(HIVEERR_BAD_BOOTSTRAP_HOST);
+    return state->inflight < MAX_NODE_INFLIGHT;
 }
 
-int ipfs_rpc_check_reachable(ipfs_rpc_t *rpc)
+/*
+ * Expected cost of sending one more request to a node: its smoothed
+ * latency scaled by the queue already waiting on it and by its recent
+ * error ratio.
+ */
+static double node_cost(const node_state_t *state)
+{
+    double success = 1.0 - state->errors;
+
+    if (success < 0.1)
+        success = 0.1;
+
+    return state->latency * (state->inflight + 1) / success;
+}
+
+/*
+ * Choose among the usable nodes with a free slot, other than the excluded
+ * one. Called with the lock held. Returns false if there is no candidate,
+ * with usable telling whether any node is usable at all.
+ */
+static bool pick_node(ipfs_rpc_t *rpc, size_t exclude, size_t *chosen,
+                      bool *usable)
 {
+    size_t *candidates;
+    size_t ncandidates = 0;
+    size_t i;
+
+    candidates = (size_t *)alloca(sizeof(size_t) * rpc->rpc_nodes_count);
+    *usable = false;
+
+    for (i = 0; i < rpc->rpc_nodes_count; i++) {
+        node_state_t *state = &rpc->states[i];
+
+        if (i == exclude || !node_usable(state))
+            continue;
+
+        *usable = true;
+        if (node_available(state))
+            candidates[ncandidates++] = i;
+    }
+
+    if (!ncandidates)
+        return false;
+
+    /*
+     * Power of two choices: compare two random candidates and take the
+     * cheaper, which spreads load over all healthy nodes while steering
+     * it away from slow or busy ones.
+     */
+    *chosen = candidates[rand_r(&rpc->seed) % ncandidates];
+    if (ncandidates > 1) {
+        size_t other = candidates[rand_r(&rpc->seed) % (ncandidates - 1)];
+
+        if (other == *chosen)
+            other = candidates[ncandidates - 1];
+        if (node_cost(&rpc->states[other]) < node_cost(&rpc->states[*chosen]))
+            *chosen = other;
+    }
+
+    return true;
+}
+
+static void take_node(ipfs_rpc_t *rpc, size_t index, rpc_node_addr_t *node)
+{
+    rpc->states[index].inflight++;
+    strcpy(node->ip, rpc->states[index].ip);
+    node->port = rpc->states[index].port;
+    node->index = index;
+}
+
+int ipfs_rpc_acquire_node(ipfs_rpc_t *rpc, rpc_node_addr_t *node)
+{
+    size_t chosen;
+    bool usable;
+
+    pthread_mutex_lock(&rpc->lock);
+
+    while (!pick_node(rpc, (size_t)-1, &chosen, &usable)) {
+        /*
+         * With every circuit open, fail fast rather than wait for the
+         * monitor; the caller may try again later.
+         */
+        if (!usable) {
+            pthread_mutex_unlock(&rpc->lock);
+            return HIVE_GENERAL_ERROR(HIVEERR_TRY_AGAIN);
+        }
+
+        pthread_cond_wait(&rpc->cond, &rpc->lock);
+    }
+
+    take_node(rpc, chosen, node);
+
+    pthread_mutex_unlock(&rpc->lock);
+    return 0;
+}
+
+int ipfs_rpc_try_acquire_node(ipfs_rpc_t *rpc, rpc_node_addr_t *node)
+{
+    size_t chosen;
+    bool usable;
+
+    pthread_mutex_lock(&rpc->lock);
+
+    if (!pick_node(rpc, (size_t)-1, &chosen, &usable)) {
+        pthread_mutex_unlock(&rpc->lock);
+        return usable ? HIVE_GENERAL_ERROR(HIVEERR_BUSY) :
+                        HIVE_GENERAL_ERROR(HIVEERR_TRY_AGAIN);
+    }
+
+    take_node(rpc, chosen, node);
+
+    pthread_mutex_unlock(&rpc->lock);
+    return 0;
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+double ipfs_rpc_hedge_delay(ipfs_rpc_t *rpc, const rpc_node_addr_t *node)
+{
+    double samples[LATENCY_SAMPLES];
+    node_state_t *state;
+    double delay;
+    size_t n;
+
+    if (rpc->hedge_budget <= 0)
+        return -1;
+
+    pthread_mutex_lock(&rpc->lock);
+
+    rpc->hedge_credits += rpc->hedge_budget;
+    if (rpc->hedge_credits > MAX_HEDGE_CREDITS)
+        rpc->hedge_credits = MAX_HEDGE_CREDITS;
+
+    state = &rpc->states[node->index];
+    n = state->nsamples;
+    memcpy(samples, state->samples, sizeof(double) * n);
+    delay = state->latency;
+
+    pthread_mutex_unlock(&rpc->lock);
+
+    /*
+     * Until the node has a history, wait a generous multiple of its
+     * average instead of guessing its tail.
+     */
+    if (n < MIN_LATENCY_SAMPLES)
+        return delay * 3;
+
+    qsort(samples, n, sizeof(double), compare_latency);
+    return samples[(n * 95 + 99) / 100 - 1];
+}
+
+int ipfs_rpc_acquire_hedge_node(ipfs_rpc_t *rpc, const rpc_node_addr_t *primary,
+                                rpc_node_addr_t *node)
+{
+    size_t chosen;
+    bool usable;
+
+    pthread_mutex_lock(&rpc->lock);
+
+    if (rpc->hedge_credits < 1.0 ||
+        !pick_node(rpc, primary->index, &chosen, &usable)) {
+        pthread_mutex_unlock(&rpc->lock);
+        return HIVE_GENERAL_ERROR(HIVEERR_TRY_AGAIN);
+    }
+
+    rpc->hedge_credits -= 1.0;
+    rpc->hedges_fired++;
+    take_node(rpc, chosen, node);
+
+    pthread_mutex_unlock(&rpc->lock);
+    return 0;
+}
+
+void ipfs_rpc_hedge_won(ipfs_rpc_t *rpc)
+{
+    pthread_mutex_lock(&rpc->lock);
+    rpc->hedges_won++;
+    pthread_mutex_unlock(&rpc->lock);
+}
+
+void ipfs_rpc_get_stats(ipfs_rpc_t *rpc, IPFSStats *stats)
+{
+    pthread_mutex_lock(&rpc->lock);
+    stats->hedges_fired = rpc->hedges_fired;
+    stats->hedges_won = rpc->hedges_won;
+    pthread_mutex_unlock(&rpc->lock);
+}
+
+size_t ipfs_rpc_usable_nodes(ipfs_rpc_t *rpc)
+{
+    size_t count = 0;
+    size_t i;
+
+    pthread_mutex_lock(&rpc->lock);
+    for (i = 0; i < rpc->rpc_nodes_count; i++) {
+        if (node_usable(&rpc->states[i]))
+            count++;
+    }
+    pthread_mutex_unlock(&rpc->lock);
+
+    return count;
+}
+
+/*
+ * Whether a request failed for the node rather than for itself. A node
+ * answering with an error status, e.g. 500 for a malformed CID, is
+ * healthy; only failing to reach it, or a gateway in front of it failing
+ * to, counts against it.
+ */
+static bool node_failed(int rc)
+{
+    return rc == HIVE_GENERAL_ERROR(HIVEERR_TRY_AGAIN) ||
+           (rc < 0 && ((rc >> 24) & 0x0F) == HIVEF_CURL) ||
+           rc == HIVE_HTTP_STATUS_ERROR(502) ||
+           rc == HIVE_HTTP_STATUS_ERROR(503) ||
+           rc == HIVE_HTTP_STATUS_ERROR(504);
+}
+
+void ipfs_rpc_release_node(ipfs_rpc_t *rpc, const rpc_node_addr_t *node,
+                           int rc, double latency)
+{
+    node_state_t *state;
+    bool failed;
+
+    assert(node->index < rpc->rpc_nodes_count);
+
+    failed = node_failed(rc);
+
+    pthread_mutex_lock(&rpc->lock);
+
+    state = &rpc->states[node->index];
+    state->inflight--;
+
+    /*
+     * Statistics belong to the address the request went to; a re-probe
+     * may have moved the node to its other address meanwhile.
+     */
+    if (!strcmp(state->ip, node->ip) && (failed || latency >= 0)) {
+        rpc->dirty = true;
+        state->errors += ERROR_EWMA_ALPHA * ((failed ? 1.0 : 0.0) - state->errors);
+
+        if (!failed) {
+            state->latency += LATENCY_EWMA_ALPHA * (latency - state->latency);
+
+            state->samples[state->next_sample] = latency;
+            state->next_sample = (state->next_sample + 1) % LATENCY_SAMPLES;
+            if (state->nsamples < LATENCY_SAMPLES)
+                state->nsamples++;
+        }
+
+        if (failed && state->breaker != IPFSNodeState_Open &&
+            (state->breaker == IPFSNodeState_HalfOpen ||
+             rc == HIVE_GENERAL_ERROR(HIVEERR_TRY_AGAIN) ||
+             ++state->failures >= BREAKER_FAILURE_THRESHOLD)) {
+            vlogW("IpfsToken: node %s failing, taken out of rotation.",
+                  state->ip);
+            set_breaker(rpc, node->index, IPFSNodeState_Open);
+        } else if (!failed) {
+            state->failures = 0;
+            if (state->breaker == IPFSNodeState_HalfOpen)
+                set_breaker(rpc, node->index, IPFSNodeState_Closed);
+        }
+    }
+
+    pthread_cond_broadcast(&rpc->cond);
+    pthread_mutex_unlock(&rpc->lock);
+}
+
+static const char *breaker_name(IPFSNodeState breaker)
+{
+    switch (breaker) {
+    case IPFSNodeState_Closed:
+        return "closed";
+    case IPFSNodeState_HalfOpen:
+        return "half-open";
+    default:
+        return "open";
+    }
+}
+
+static void save_nodes(ipfs_rpc_t *rpc)
+{
+    cJSON *json;
+    cJSON *nodes;
+    char *str;
+    size_t i;
     int rc;
 
-    if (rpc->current_node_ip[0])
-        return 0;
+    json = cJSON_CreateObject();
+    if (!json)
+        return;
+
+    nodes = cJSON_AddArrayToObject(json, "nodes");
+    if (!nodes) {
+        cJSON_Delete(json);
+        return;
+    }
+
+    pthread_mutex_lock(&rpc->lock);
+
+    for (i = 0; i < rpc->rpc_nodes_count; i++) {
+        const rpc_node_t *rpc_node = &rpc->rpc_nodes[i];
+        const node_state_t *state = &rpc->states[i];
+        cJSON *item;
+
+        item = cJSON_CreateObject();
+        if (!item)
+            break;
+
+        cJSON_AddItemToArray(nodes, item);
+        cJSON_AddStringToObject(item, "ipv4", rpc_node->ipv4);
+        cJSON_AddStringToObject(item, "ipv6", rpc_node->ipv6);
+        cJSON_AddStringToObject(item, "unix_socket", rpc_node->unix_socket);
+        cJSON_AddNumberToObject(item, "port", rpc_node->port);
+        cJSON_AddStringToObject(item, "address", state->ip);
+        cJSON_AddNumberToObject(item, "address_port", state->port);
+        cJSON_AddNumberToObject(item, "latency", state->latency);
+        cJSON_AddNumberToObject(item, "errors", state->errors);
+        cJSON_AddStringToObject(item, "state", breaker_name(state->breaker));
+    }
 
-    rc = select_bootstrap(rpc->rpc_nodes, rpc->rpc_nodes_count,
-                          rpc->current_node_ip, &rpc->current_node_port);
+    rpc->dirty = false;
+    rpc->saved_at = time(NULL);
+    cJSON_AddNumberToObject(json, "updated", (double)rpc->saved_at);
+
+    pthread_mutex_unlock(&rpc->lock);
+
+    str = cJSON_PrintUnformatted(json);
+    cJSON_Delete(json);
+    if (!str)
+        return;
+
+    rc = atomic_write_file(rpc->store_path, str, strlen(str), S_IRUSR | S_IWUSR);
     if (rc < 0)
-        vlogE("IpfsToken: no node configured is reachable.");
+        vlogW("IpfsToken: Can not save node table to %s (%d).",
+              rpc->store_path, errno);
+
+    free(str);
+}
+
+static cJSON *load_nodes_in_json(const char *path)
+{
+    struct stat st;
+    cJSON *json;
+    char *buf;
+    int rc;
+    int fd;
+
+    if (stat(path, &st) < 0 || !st.st_size || st.st_size > NODE_STORE_MAX_SIZE)
+        return NULL;
 
-    return rc;
+    buf = (char *)calloc(1, (size_t)st.st_size + 1);
+    if (!buf)
+        return NULL;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        free(buf);
+        return NULL;
+    }
+
+    rc = (int)read(fd, buf, (size_t)st.st_size);
+    close(fd);
+
+    json = rc == (int)st.st_size ? cJSON_Parse(buf) : NULL;
+    free(buf);
+
+    return json;
 }
 
-void ipfs_rpc_mark_node_unreachable(ipfs_rpc_t *rpc)
+static const char *json_string(const cJSON *item, const char *name)
 {
-    rpc->current_node_ip[0] = '\0';
+    const cJSON *value = cJSON_GetObjectItemCaseSensitive(item, name);
+
+    return cJSON_IsString(value) && value->valuestring ? value->valuestring : NULL;
 }
 
-const char *ipfs_rpc_get_current_node_ip(ipfs_rpc_t *rpc)
+static double json_number(const cJSON *item, const char *name, double fallback)
 {
-    return rpc->current_node_ip;
+    const cJSON *value = cJSON_GetObjectItemCaseSensitive(item, name);
+
+    return cJSON_IsNumber(value) ? value->valuedouble : fallback;
+}
+
+/*
+ * Start from the node table a previous process saved. Entries are matched
+ * to the configured nodes by their addresses, so a changed configuration
+ * only loses the entries of the nodes it changed. The best node saved as
+ * healthy takes traffic at once; the others stay unverified until the
+ * monitor has probed them. Returns false if there is nothing usable to
+ * start from, in which case all nodes are probed up front.
+ */
+static bool restore_nodes(ipfs_rpc_t *rpc)
+{
+    bool *healthy;
+    size_t best = (size_t)-1;
+    time_t now = time(NULL);
+    const cJSON *item;
+    cJSON *json;
+    cJSON *nodes;
+    double updated;
+    size_t i;
+
+    json = load_nodes_in_json(rpc->store_path);
+    if (!json)
+        return false;
+
+    updated = json_number(json, "updated", 0);
+    nodes = cJSON_GetObjectItemCaseSensitive(json, "nodes");
+    if (now - updated > NODE_STORE_MAX_AGE || updated > now + 60 ||
+        !cJSON_IsArray(nodes)) {
+        cJSON_Delete(json);
+        return false;
+    }
+
+    healthy = (bool *)alloca(sizeof(bool) * rpc->rpc_nodes_count);
+    memset(healthy, 0, sizeof(bool) * rpc->rpc_nodes_count);
+
+    cJSON_ArrayForEach(item, nodes) {
+        const char *ipv4 = json_string(item, "ipv4");
+        const char *ipv6 = json_string(item, "ipv6");
+        const char *unix_socket = json_string(item, "unix_socket");
+        const char *address = json_string(item, "address");
+        const char *breaker = json_string(item, "state");
+        double port = json_number(item, "port", -1);
+        double address_port = json_number(item, "address_port", -1);
+        double latency = json_number(item, "latency", -1);
+        double errors = json_number(item, "errors", -1);
+        node_state_t *state;
+
+        if (!ipv4 || !ipv6 || !address || !breaker ||
+            strlen(address) >= sizeof(state->ip) ||
+            address_port < 0 || address_port > 65535 ||
+            latency < 0 || errors < 0 || errors > 1)
+            continue;
+
+        /* Files written before socket nodes existed do not store one. */
+        if (!unix_socket)
+            unix_socket = "";
+
+        for (i = 0; i < rpc->rpc_nodes_count; i++) {
+            const rpc_node_t *rpc_node = &rpc->rpc_nodes[i];
+
+            if (!strcmp(rpc_node->ipv4, ipv4) && !strcmp(rpc_node->ipv6, ipv6) &&
+                !strcmp(rpc_node->unix_socket, unix_socket) &&
+                rpc_node->port == port)
+                break;
+        }
+
+        if (i == rpc->rpc_nodes_count)
+            continue;
+
+        state = &rpc->states[i];
+        strcpy(state->ip, address);
+        state->port = (uint16_t)address_port;
+        state->latency = latency;
+        state->errors = errors;
+        healthy[i] = address[0] && (address_port > 0 || is_unix_socket(address)) &&
+                     !strcmp(breaker, "closed");
+    }
+
+    cJSON_Delete(json);
+
+    for (i = 0; i < rpc->rpc_nodes_count; i++) {
+        if (healthy[i] && (best == (size_t)-1 ||
+            node_cost(&rpc->states[i]) < node_cost(&rpc->states[best])))
+            best = i;
+    }
+
+    if (best == (size_t)-1)
+        return false;
+
+    for (i = 0; i < rpc->rpc_nodes_count; i++) {
+        if (i == best)
+            continue;
+
+        rpc->states[i].breaker = IPFSNodeState_Open;
+        rpc->states[i].next_probe = now;
+    }
+
+    vlogI("IpfsToken: Starting with saved node %s, verifying the others.",
+          rpc->states[best].ip);
+    return true;
 }
 
-uint16_t ipfs_rpc_get_current_node_port(ipfs_rpc_t *rpc)
+static void ipfs_rpc_destructor(void *p)
 {
-    return rpc->current_node_port;
+    ipfs_rpc_t *rpc = (ipfs_rpc_t *)p;
+    state_event_t *event;
+
+    if (rpc->monitor_started) {
+        pthread_mutex_lock(&rpc->lock);
+        rpc->stopping = true;
+        pthread_cond_signal(&rpc->monitor_cond);
+        pthread_mutex_unlock(&rpc->lock);
+
+        pthread_join(rpc->monitor, NULL);
+    }
+
+    if (rpc->store_path) {
+        if (rpc->dirty)
+            save_nodes(rpc);
+        free(rpc->store_path);
+    }
+
+    while ((event = rpc->events_head)) {
+        rpc->events_head = event->next;
+        free(event);
+    }
+
+    pthread_cond_destroy(&rpc->monitor_cond);
+    pthread_cond_destroy(&rpc->cond);
+    pthread_mutex_destroy(&rpc->lock);
 }
 
 ipfs_rpc_t *ipfs_rpc_new(ipfs_rpc_options_t *options, void *user_data)
 {
     ipfs_rpc_t *tmp;
+    node_state_t *probed;
     size_t bootstraps_nbytes;
+    size_t states_offset;
+    size_t states_nbytes;
+    size_t i;
     int rc;
 
     bootstraps_nbytes = sizeof(options->rpc_nodes[0]) * options->rpc_nodes_count;
-    tmp = rc_zalloc(sizeof(ipfs_rpc_t) + bootstraps_nbytes, NULL);
+    states_offset = (bootstraps_nbytes + sizeof(double) - 1) & ~(sizeof(double) - 1);
+    states_nbytes = sizeof(node_state_t) * options->rpc_nodes_count;
+    tmp = rc_zalloc(sizeof(ipfs_rpc_t) + states_offset + states_nbytes,
+                    ipfs_rpc_destructor);
     if (!tmp) {
         hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY));
         return NULL;
     }
 
+    pthread_mutex_init(&tmp->lock, NULL);
+    pthread_cond_init(&tmp->cond, NULL);
+    pthread_cond_init(&tmp->monitor_cond, NULL);
+    tmp->seed = (unsigned int)time(NULL) ^ (unsigned int)getpid() ^
+                (unsigned int)(uintptr_t)tmp;
+
     memcpy(tmp->rpc_nodes, options->rpc_nodes, bootstraps_nbytes);
     tmp->rpc_nodes_count = options->rpc_nodes_count;
+    tmp->hedge_budget = options->hedge_budget;
+    tmp->state_callback = options->state_callback;
+    tmp->state_context = options->state_context;
+    tmp->states = (node_state_t *)((char *)tmp->rpc_nodes + states_offset);
+
+    for (i = 0; i < tmp->rpc_nodes_count; i++)
+        tmp->states[i].latency = INITIAL_LATENCY;
 
-    rc = select_bootstrap(options->rpc_nodes, options->rpc_nodes_count,
-                          tmp->current_node_ip, &tmp->current_node_port);
+    if (options->store_path) {
+        tmp->store_path = strdup(options->store_path);
+        if (!tmp->store_path) {
+            hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY));
+            deref(tmp);
+            return NULL;
+        }
+
+        if (restore_nodes(tmp))
+            goto start_monitor;
+    }
+
+    probed = (node_state_t *)calloc(tmp->rpc_nodes_count, sizeof(node_state_t));
+    if (!probed) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY));
+        deref(tmp);
+        return NULL;
+    }
+
+    rc = probe_nodes(tmp->rpc_nodes, tmp->rpc_nodes_count, probed, false);
     if (rc < 0) {
         vlogE("IpfsToken: No configured node is reachable.");
         hive_set_error(rc);
+        free(probed);
+        deref(tmp);
+        return NULL;
+    }
+
+    /*
+     * Nodes which did not answer in time start with their circuit open
+     * and are picked up by the monitor once they do.
+     */
+    pthread_mutex_lock(&tmp->lock);
+    for (i = 0; i < tmp->rpc_nodes_count; i++) {
+        node_state_t *state = &tmp->states[i];
+
+        if (probed[i].ip[0]) {
+            strcpy(state->ip, probed[i].ip);
+            state->port = probed[i].port;
+            state->latency = probed[i].latency;
+        } else
+            set_breaker(tmp, i, IPFSNodeState_Open);
+    }
+    tmp->dirty = true;
+    pthread_mutex_unlock(&tmp->lock);
+    free(probed);
+
+start_monitor:
+    rc = pthread_create(&tmp->monitor, NULL, monitor_entry, tmp);
+    if (rc != 0) {
+        vlogE("IpfsToken: Failed to create node monitor thread.");
+        hive_set_error(HIVE_SYS_ERROR(rc));
         deref(tmp);
         return NULL;
     }
+    tmp->monitor_started = true;
 
     return tmp;
 }
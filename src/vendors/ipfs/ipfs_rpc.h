@@ -31,16 +31,32 @@ extern "C" {
 
 #include "ela_hive.h"
 #include "ipfs_constants.h"
+#include "http_client.h"
 
 typedef struct ipfs_rpc ipfs_rpc_t;
 
 typedef struct rpc_node {
     char ipv4[HIVE_MAX_IPV4_ADDRESS_LEN  + 1];
     char ipv6[HIVE_MAX_IPV6_ADDRESS_LEN  + 1];
+    char unix_socket[HIVE_MAX_UNIX_SOCKET_PATH_LEN + 1];
     uint16_t port;
 } rpc_node_t;
 
+/*
+ * The node a request is routed to. Requests work on this copy, so the
+ * routing table may change while they are in flight.
+ */
+typedef struct rpc_node_addr {
+    char ip[HIVE_MAX_NODE_ADDRESS_LEN + 1];
+    uint16_t port;
+    size_t index;
+} rpc_node_addr_t;
+
 typedef struct ipfs_rpc_options {
+    double hedge_budget;
+    IPFSNodeStateCallback *state_callback;
+    void *state_context;
+    const char *store_path;
     size_t rpc_nodes_count;
     rpc_node_t rpc_nodes[0];
 } ipfs_rpc_options_t;
@@ -51,10 +67,52 @@ int ipfs_rpc_synchronize(ipfs_rpc_t *rpc);
 int ipfs_rpc_reset(ipfs_rpc_t *rpc);
 int ipfs_rpc_get_uid_info(ipfs_rpc_t *rpc, char **result);
 const char *ipfs_rpc_get_uid(ipfs_rpc_t *rpc);
-const char *ipfs_rpc_get_current_node_ip(ipfs_rpc_t *rpc);
-uint16_t ipfs_rpc_get_current_node_port(ipfs_rpc_t *rpc);
-int ipfs_rpc_check_reachable(ipfs_rpc_t *rpc);
-void ipfs_rpc_mark_node_unreachable(ipfs_rpc_t *rpc);
+
+/*
+ * Pick a node for one request and account it as in flight on that node.
+ * Every acquired node must be released with the outcome of the request:
+ * rc is the request result (HIVEERR_TRY_AGAIN meaning the node could not
+ * be reached) and latency the time to first byte in milliseconds, or a
+ * negative value if unknown. Only transport failures count against the
+ * node; an error status it answers with does not.
+ */
+int ipfs_rpc_acquire_node(ipfs_rpc_t *rpc, rpc_node_addr_t *node);
+
+/*
+ * Acquire a node without waiting for a slot, failing with HIVEERR_BUSY
+ * when every usable node is full. Callers holding requests of their own
+ * in flight, which only they drive, must not wait: they would keep the
+ * slots others wait for.
+ */
+int ipfs_rpc_try_acquire_node(ipfs_rpc_t *rpc, rpc_node_addr_t *node);
+void ipfs_rpc_release_node(ipfs_rpc_t *rpc, const rpc_node_addr_t *node,
+                           int rc, double latency);
+
+/*
+ * Hedging of idempotent reads. ipfs_rpc_hedge_delay is called once per
+ * hedgeable request and returns how long (ms) to wait for the first byte
+ * from the given node before hedging, the node's p95 latency, or a
+ * negative value if hedging is disabled. ipfs_rpc_acquire_hedge_node then
+ * picks a second node, failing if the hedge budget is spent or no other
+ * node is available.
+ */
+double ipfs_rpc_hedge_delay(ipfs_rpc_t *rpc, const rpc_node_addr_t *node);
+int ipfs_rpc_acquire_hedge_node(ipfs_rpc_t *rpc, const rpc_node_addr_t *primary,
+                                rpc_node_addr_t *node);
+void ipfs_rpc_hedge_won(ipfs_rpc_t *rpc);
+void ipfs_rpc_get_stats(ipfs_rpc_t *rpc, IPFSStats *stats);
+
+/*
+ * Count of nodes currently in rotation, i.e. whose circuit is not open.
+ */
+size_t ipfs_rpc_usable_nodes(ipfs_rpc_t *rpc);
+
+/*
+ * Create a http client for the given api of the node, reaching it over
+ * its Unix socket when the node is local.
+ */
+int ipfs_rpc_node_client(const rpc_node_addr_t *node, const char *api,
+                         http_client_t **httpc);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,408 @@
+/*
+ * Copyright (c) 2019 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <openssl/sha.h>
+
+#include "hive_error.h"
+#include "unixfs.h"
+
+/*
+ * The defaults of go-ipfs: size-262144 chunker, balanced layout.
+ */
+#define CHUNK_SIZE          (256 * 1024)
+#define MAX_LINKS           174
+#define MAX_DEPTH           8
+
+/*
+ * sha2-256 multihash: code 0x12, length 0x20, digest.
+ */
+#define MULTIHASH_LEN       (2 + SHA256_DIGEST_LENGTH)
+
+#define UNIXFS_RAW          0
+#define UNIXFS_FILE         2
+
+/*
+ * Upper bound of a serialized internal node: every link takes at most
+ * 2 + 2 + 34 + 2 + 11 bytes and every block size 11 more.
+ */
+#define NODE_BUF_SIZE       (MAX_LINKS * 64 + 32)
+
+/*
+ * Room around the chunk for the encoding of a leaf, so that the leaf
+ * block is built in place.
+ */
+#define LEAF_HEADER_ROOM    16
+#define LEAF_TRAILER_ROOM   16
+
+typedef struct dag_link {
+    uint8_t hash[MULTIHASH_LEN];
+    uint64_t tsize;     // serialized size of the whole subtree
+    uint64_t fsize;     // file bytes in the subtree
+} dag_link_t;
+
+typedef struct dag_level {
+    size_t count;
+    dag_link_t links[MAX_LINKS];
+} dag_level_t;
+
+struct unixfs_hasher {
+    unixfs_block_callback_t *callback;
+    void *context;
+    uint8_t *leaf;
+    uint8_t *chunk;
+    size_t chunk_len;
+    uint64_t nleaves;
+    int depth;
+    dag_level_t levels[MAX_DEPTH];
+    uint8_t node[NODE_BUF_SIZE];
+};
+
+static size_t varint_len(uint64_t v)
+{
+    size_t len = 1;
+
+    while (v >= 0x80) {
+        v >>= 7;
+        len++;
+    }
+
+    return len;
+}
+
+static size_t put_varint(uint8_t *p, uint64_t v)
+{
+    size_t len = 0;
+
+    while (v >= 0x80) {
+        p[len++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[len++] = (uint8_t)v;
+
+    return len;
+}
+
+static void multihash(const uint8_t *data, size_t len, uint8_t *hash)
+{
+    hash[0] = 0x12;
+    hash[1] = SHA256_DIGEST_LENGTH;
+    SHA256(data, len, hash + 2);
+}
+
+static void base58_encode(const uint8_t *data, size_t len, char *out);
+
+static int emit_block(unixfs_hasher_t *hasher, const uint8_t *hash,
+                      const uint8_t *block, size_t len)
+{
+    IPFSCid cid;
+
+    if (!hasher->callback)
+        return 0;
+
+    base58_encode(hash, MULTIHASH_LEN, cid.content);
+    return hasher->callback(&cid, block, len, hasher->context);
+}
+
+/*
+ * A leaf is the chunk wrapped in a UnixFS Data message inside a dag-pb
+ * node without links, encoded around the chunk where it lies.
+ */
+static int hash_leaf(unixfs_hasher_t *hasher, dag_link_t *link)
+{
+    size_t len = hasher->chunk_len;
+    uint8_t header[LEAF_HEADER_ROOM];
+    size_t header_len = 0;
+    uint8_t *trailer;
+    size_t trailer_len = 0;
+    size_t data_len;
+    uint8_t *block;
+    size_t block_len;
+
+    /*
+     * go-ipfs makes the first chunk a file node, since it becomes the
+     * root if no more data follows, and all other chunks raw nodes. An
+     * empty file has no data field at all.
+     */
+    data_len = 2 + (len ? 1 + varint_len(len) + len : 0) + 1 + varint_len(len);
+
+    header[header_len++] = 0x0a;
+    header_len += put_varint(header + header_len, data_len);
+    header[header_len++] = 0x08;
+    header[header_len++] = hasher->nleaves ? UNIXFS_RAW : UNIXFS_FILE;
+    if (len) {
+        header[header_len++] = 0x12;
+        header_len += put_varint(header + header_len, len);
+    }
+
+    block = hasher->chunk - header_len;
+    memcpy(block, header, header_len);
+
+    trailer = hasher->chunk + len;
+    trailer[trailer_len++] = 0x18;
+    trailer_len += put_varint(trailer + trailer_len, len);
+
+    block_len = header_len + len + trailer_len;
+    multihash(block, block_len, link->hash);
+
+    link->tsize = block_len;
+    link->fsize = len;
+
+    hasher->nleaves++;
+
+    return emit_block(hasher, link->hash, block, block_len);
+}
+
+/*
+ * An internal node lists its children (links first, as dag-pb encodes
+ * them) and a UnixFS file message carrying their sizes.
+ */
+static int hash_node(unixfs_hasher_t *hasher, dag_level_t *level,
+                     dag_link_t *link)
+{
+    uint8_t *p = hasher->node;
+    uint64_t tsize = 0;
+    uint64_t fsize = 0;
+    size_t data_len;
+    size_t i;
+
+    for (i = 0; i < level->count; i++) {
+        dag_link_t *child = &level->links[i];
+
+        *p++ = 0x12;
+        p += put_varint(p, 2 + MULTIHASH_LEN + 2 + 1 + varint_len(child->tsize));
+        *p++ = 0x0a;
+        *p++ = MULTIHASH_LEN;
+        memcpy(p, child->hash, MULTIHASH_LEN);
+        p += MULTIHASH_LEN;
+        *p++ = 0x12;    // empty name
+        *p++ = 0x00;
+        *p++ = 0x18;
+        p += put_varint(p, child->tsize);
+
+        tsize += child->tsize;
+        fsize += child->fsize;
+    }
+
+    data_len = 2 + 1 + varint_len(fsize);
+    for (i = 0; i < level->count; i++)
+        data_len += 1 + varint_len(level->links[i].fsize);
+
+    *p++ = 0x0a;
+    p += put_varint(p, data_len);
+    *p++ = 0x08;
+    *p++ = UNIXFS_FILE;
+    *p++ = 0x18;
+    p += put_varint(p, fsize);
+    for (i = 0; i < level->count; i++) {
+        *p++ = 0x20;
+        p += put_varint(p, level->links[i].fsize);
+    }
+
+    multihash(hasher->node, p - hasher->node, link->hash);
+    link->tsize = (p - hasher->node) + tsize;
+    link->fsize = fsize;
+
+    level->count = 0;
+
+    return emit_block(hasher, link->hash, hasher->node, p - hasher->node);
+}
+
+/*
+ * Append a child to the node being filled at the given level. A full
+ * node is closed only once another child arrives, so that the tree
+ * never grows a level more than it needs.
+ */
+static int push_link(unixfs_hasher_t *hasher, int depth, const dag_link_t *link)
+{
+    dag_level_t *level;
+    dag_link_t parent;
+    int rc;
+
+    if (depth >= MAX_DEPTH)
+        return HIVE_GENERAL_ERROR(HIVEERR_LIMIT_EXCEEDED);
+
+    level = &hasher->levels[depth];
+    if (level->count == MAX_LINKS) {
+        rc = hash_node(hasher, level, &parent);
+        if (rc < 0)
+            return rc;
+
+        rc = push_link(hasher, depth + 1, &parent);
+        if (rc < 0)
+            return rc;
+    }
+
+    level->links[level->count++] = *link;
+    if (depth + 1 > hasher->depth)
+        hasher->depth = depth + 1;
+
+    return 0;
+}
+
+static int flush_chunk(unixfs_hasher_t *hasher)
+{
+    dag_link_t leaf;
+    int rc;
+
+    rc = hash_leaf(hasher, &leaf);
+    hasher->chunk_len = 0;
+    if (rc < 0)
+        return rc;
+
+    return push_link(hasher, 0, &leaf);
+}
+
+static void base58_encode(const uint8_t *data, size_t len, char *out)
+{
+    static const char alphabet[] =
+        "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+    uint8_t digits[MULTIHASH_LEN * 2];
+    size_t ndigits = 0;
+    size_t zeros = 0;
+    size_t i, j;
+
+    while (zeros < len && !data[zeros])
+        zeros++;
+
+    for (i = zeros; i < len; i++) {
+        unsigned int carry = data[i];
+
+        for (j = 0; j < ndigits; j++) {
+            carry += (unsigned int)digits[j] << 8;
+            digits[j] = carry % 58;
+            carry /= 58;
+        }
+
+        while (carry) {
+            digits[ndigits++] = carry % 58;
+            carry /= 58;
+        }
+    }
+
+    for (i = 0; i < zeros; i++)
+        *out++ = '1';
+    while (ndigits)
+        *out++ = alphabet[digits[--ndigits]];
+    *out = '\0';
+}
+
+unixfs_hasher_t *unixfs_hasher_new(unixfs_block_callback_t *callback,
+                                   void *context)
+{
+    unixfs_hasher_t *hasher;
+
+    hasher = (unixfs_hasher_t *)calloc(1, sizeof(unixfs_hasher_t));
+    if (!hasher)
+        return NULL;
+
+    hasher->leaf = (uint8_t *)malloc(LEAF_HEADER_ROOM + CHUNK_SIZE +
+                                     LEAF_TRAILER_ROOM);
+    if (!hasher->leaf) {
+        free(hasher);
+        return NULL;
+    }
+
+    hasher->chunk = hasher->leaf + LEAF_HEADER_ROOM;
+    hasher->callback = callback;
+    hasher->context = context;
+
+    return hasher;
+}
+
+int unixfs_hasher_update(unixfs_hasher_t *hasher, const void *data,
+                         size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    size_t n;
+    int rc;
+
+    while (len) {
+        n = CHUNK_SIZE - hasher->chunk_len;
+        if (n > len)
+            n = len;
+
+        memcpy(hasher->chunk + hasher->chunk_len, p, n);
+        hasher->chunk_len += n;
+        p += n;
+        len -= n;
+
+        if (hasher->chunk_len == CHUNK_SIZE) {
+            rc = flush_chunk(hasher);
+            if (rc < 0)
+                return rc;
+        }
+    }
+
+    return 0;
+}
+
+int unixfs_hasher_final(unixfs_hasher_t *hasher, IPFSCid *cid)
+{
+    dag_level_t *level;
+    dag_link_t parent;
+    int depth;
+    int rc;
+
+    if (hasher->chunk_len || !hasher->nleaves) {
+        rc = flush_chunk(hasher);
+        if (rc < 0)
+            return rc;
+    }
+
+    /*
+     * Close the nodes still open, bottom up, until a single root is
+     * left. A lone chunk is its own root.
+     */
+    for (depth = 0; depth < hasher->depth; depth++) {
+        level = &hasher->levels[depth];
+        if (depth == hasher->depth - 1 && level->count == 1)
+            break;
+
+        if (!level->count)
+            continue;
+
+        rc = hash_node(hasher, level, &parent);
+        if (rc < 0)
+            return rc;
+
+        rc = push_link(hasher, depth + 1, &parent);
+        if (rc < 0)
+            return rc;
+    }
+
+    base58_encode(hasher->levels[depth].links[0].hash, MULTIHASH_LEN,
+                  cid->content);
+    return 0;
+}
+
+void unixfs_hasher_free(unixfs_hasher_t *hasher)
+{
+    if (!hasher)
+        return;
+
+    free(hasher->leaf);
+    free(hasher);
+}
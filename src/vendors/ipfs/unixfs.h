@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2019 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __UNIXFS_H__
+#define __UNIXFS_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include "ela_hive.h"
+
+typedef struct unixfs_hasher unixfs_hasher_t;
+
+/*
+ * Called with every block of the DAG as soon as it is complete, children
+ * before their parents and the root last. The block is only valid during
+ * the call. A negative return value aborts hashing with that error.
+ */
+typedef int unixfs_block_callback_t(const IPFSCid *cid, const void *block,
+                                    size_t len, void *context);
+
+/*
+ * Compute the CID an IPFS node assigns to a file added with the default
+ * parameters: 256 KiB fixed-size chunks wrapped in UnixFS dag-pb nodes,
+ * the balanced layout with 174 links per node, sha2-256 and CID version
+ * 0. The content is fed in pieces, in constant memory. callback may be
+ * NULL when only the CID is of interest.
+ */
+unixfs_hasher_t *unixfs_hasher_new(unixfs_block_callback_t *callback,
+                                   void *context);
+
+int unixfs_hasher_update(unixfs_hasher_t *hasher, const void *data,
+                         size_t len);
+
+int unixfs_hasher_final(unixfs_hasher_t *hasher, IPFSCid *cid);
+
+void unixfs_hasher_free(unixfs_hasher_t *hasher);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __UNIXFS_H__
@@ -0,0 +1,982 @@
+/*
+ * Copyright (c) 2019 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+#include <crystal.h>
+
+#include "hive_error.h"
+#include "hive_client.h"
+#include "mirror.h"
+
+#define MAX_BACKENDS            (16)
+
+/*
+ * Smoothing factors of the latency and error moving averages, and the
+ * latency assumed for a backend until it has been measured (ms).
+ */
+#define LATENCY_EWMA_ALPHA      (0.3)
+#define ERROR_EWMA_ALPHA        (0.1)
+#define INITIAL_LATENCY         (1000.0)
+
+/*
+ * Workers making calls on the backends other than the first, which the
+ * calling thread makes them on itself.
+ */
+#define WORKERS_PER_BACKEND     (2)
+
+enum {
+    OP_PUT_FILE = 1,
+    OP_GET_FILE_LENGTH,
+    OP_GET_FILE,
+    OP_LIST_FILES,
+    OP_DELETE_FILE,
+    OP_IPFS_PUT_FILE,
+    OP_IPFS_ADD,
+    OP_IPFS_GET_FILE_LENGTH,
+    OP_IPFS_GET_FILE,
+    OP_IPFS_GET_FILE_RANGE,
+    OP_PUT_VALUE,
+    OP_SET_VALUE,
+    OP_GET_VALUES,
+    OP_DELETE_KEY
+};
+
+/*
+ * The arguments of one call, made on one backend after another for a
+ * read, or on all of them at once for a write.
+ */
+typedef struct mirror_call {
+    int op;
+    const char *name;
+    const IPFSCid *cid;
+    const void *from;
+    void *to;
+    size_t length;
+    uint64_t offset;
+    bool crypt;
+    const IPFSAddOptions *options;
+
+    HiveKeyValuesIterateCallback *values_callback;
+    void *context;
+
+    /*
+     * Set once an entry has been handed to the caller, after which a
+     * failing read can no longer move to another backend.
+     */
+    bool delivered;
+} mirror_call_t;
+
+typedef struct backend_state {
+    HiveConnect *connect;
+    double latency;
+    double errors;
+    bool measured;
+} backend_state_t;
+
+enum {
+    TASK_QUEUED = 1,
+    TASK_RUNNING,
+    TASK_DONE
+};
+
+/*
+ * One backend's share of a call made on all of them.
+ */
+typedef struct task {
+    struct task *next;
+    struct MirrorConnect *connect;
+    mirror_call_t *call;
+    size_t index;
+    int state;
+    int rc;
+    IPFSCid cid;
+
+    /* The backend's own pass over the content, if adding. */
+    size_t pos;
+
+    /* The files the backend listed, if listing. */
+    char **names;
+    size_t count;
+    size_t capacity;
+    bool truncated;
+} task_t;
+
+typedef struct MirrorConnect {
+    HiveConnect base;
+    size_t quorum;
+
+    /*
+     * Guards the statistics of the backends, and the queue of tasks the
+     * workers take from.
+     */
+    pthread_mutex_t lock;
+    pthread_cond_t queued;
+    pthread_cond_t done;
+    task_t *head;
+    task_t *tail;
+    bool stopping;
+    size_t nworkers;
+    pthread_t workers[(MAX_BACKENDS - 1) * WORKERS_PER_BACKEND];
+
+    size_t count;
+    backend_state_t backends[0];
+} MirrorConnect;
+
+static int disconnect(HiveConnect *base)
+{
+    assert(base);
+
+    deref(base);
+    return 0;
+}
+
+/*
+ * A write reaching only a quorum leaves the others without the content,
+ * so a backend not having it is no reason to give up on the rest.
+ */
+static bool is_missing(int rc)
+{
+    return rc == HIVE_GENERAL_ERROR(HIVEERR_NOT_EXIST) ||
+           rc == HIVE_HTTP_STATUS_ERROR(404);
+}
+
+static double now_ms(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static void record(MirrorConnect *connect, size_t index, int rc, double started)
+{
+    backend_state_t *state = &connect->backends[index];
+    double latency = now_ms() - started;
+    bool failed = hive_error_is_transient(rc);
+
+    pthread_mutex_lock(&connect->lock);
+
+    state->errors += ERROR_EWMA_ALPHA * ((failed ? 1.0 : 0.0) - state->errors);
+
+    if (!failed && !state->measured) {
+        state->latency = latency;
+        state->measured = true;
+    } else if (!failed) {
+        state->latency += LATENCY_EWMA_ALPHA * (latency - state->latency);
+    }
+
+    pthread_mutex_unlock(&connect->lock);
+}
+
+/*
+ * Expected cost of a read from a backend: its smoothed latency scaled by
+ * its recent error ratio. Called with the lock held.
+ */
+static double backend_cost(const backend_state_t *state)
+{
+    double success = 1.0 - state->errors;
+
+    if (success < 0.1)
+        success = 0.1;
+
+    return (state->measured ? state->latency : INITIAL_LATENCY) / success;
+}
+
+/*
+ * Order the backends by the cost of reading from them, the cheapest
+ * first.
+ */
+static void read_order(MirrorConnect *connect, size_t *order)
+{
+    double costs[MAX_BACKENDS];
+    size_t i, j;
+
+    pthread_mutex_lock(&connect->lock);
+    for (i = 0; i < connect->count; i++)
+        costs[i] = backend_cost(&connect->backends[i]);
+    pthread_mutex_unlock(&connect->lock);
+
+    for (i = 0; i < connect->count; i++) {
+        for (j = i; j > 0 && costs[order[j - 1]] > costs[i]; j--)
+            order[j] = order[j - 1];
+        order[j] = i;
+    }
+}
+
+static bool collect_file(const char *filename, void *context)
+{
+    task_t *task = (task_t *)context;
+    char **names;
+    char *name;
+
+    if (!filename)
+        return true;
+
+    if (task->count == task->capacity) {
+        size_t capacity = task->capacity ? task->capacity * 2 : 64;
+
+        names = (char **)realloc(task->names, capacity * sizeof(char *));
+        if (!names) {
+            task->truncated = true;
+            return false;
+        }
+
+        task->names = names;
+        task->capacity = capacity;
+    }
+
+    name = strdup(filename);
+    if (!name) {
+        task->truncated = true;
+        return false;
+    }
+
+    task->names[task->count++] = name;
+    return true;
+}
+
+static ssize_t read_content(void *buffer, size_t length, void *context)
+{
+    task_t *task = (task_t *)context;
+    size_t left = task->call->length - task->pos;
+
+    if (length > left)
+        length = left;
+
+    memcpy(buffer, (const uint8_t *)task->call->from + task->pos, length);
+    task->pos += length;
+
+    return (ssize_t)length;
+}
+
+static int rewind_content(void *context)
+{
+    task_t *task = (task_t *)context;
+
+    task->pos = 0;
+    return 0;
+}
+
+static bool deliver_value(const char *key, const void *value, size_t length,
+                          void *context)
+{
+    mirror_call_t *call = (mirror_call_t *)context;
+
+    call->delivered = true;
+    return call->values_callback(key, value, length, call->context);
+}
+
+/*
+ * Make a call on one backend. The task is given for writes and listings,
+ * which are made on all backends at once, and is NULL for reads.
+ */
+static ssize_t call_one(HiveConnect *backend, mirror_call_t *call, task_t *task)
+{
+    switch (call->op) {
+    case OP_PUT_FILE:
+        return backend->put_file_from_buffer(backend, call->from, call->length,
+                                             call->crypt, call->name);
+    case OP_GET_FILE_LENGTH:
+        return backend->get_file_length(backend, call->name);
+    case OP_GET_FILE:
+        return backend->get_file_to_buffer(backend, call->name, call->crypt,
+                                           call->to, call->length);
+    case OP_LIST_FILES:
+        return backend->list_files(backend, collect_file, task);
+    case OP_DELETE_FILE:
+        return backend->delete_file(backend, call->name);
+    case OP_IPFS_PUT_FILE:
+        return backend->ipfs_put_file_from_buffer(backend, call->from,
+                                                  call->length, call->crypt,
+                                                  &task->cid);
+    case OP_IPFS_ADD:
+        return backend->ipfs_add(backend, read_content, rewind_content, task,
+                                 (ssize_t)call->length, call->options,
+                                 &task->cid);
+    case OP_IPFS_GET_FILE_LENGTH:
+        return backend->ipfs_get_file_length(backend, call->cid);
+    case OP_IPFS_GET_FILE:
+        return backend->ipfs_get_file_to_buffer(backend, call->cid, call->crypt,
+                                                call->to, call->length);
+    case OP_IPFS_GET_FILE_RANGE:
+        return backend->ipfs_get_file_range(backend, call->cid, call->offset,
+                                            call->length, call->to);
+    case OP_PUT_VALUE:
+        return backend->put_value(backend, call->name, call->from, call->length,
+                                  call->crypt);
+    case OP_SET_VALUE:
+        return backend->set_value(backend, call->name, call->from, call->length,
+                                  call->crypt);
+    case OP_GET_VALUES:
+        return backend->get_values(backend, call->name, call->crypt,
+                                   deliver_value, call);
+    case OP_DELETE_KEY:
+        return backend->delete_key(backend, call->name);
+    default:
+        assert(0);
+        return HIVE_GENERAL_ERROR(HIVEERR_NOT_SUPPORTED);
+    }
+}
+
+/*
+ * Read from the cheapest backend, moving on to the next one while the
+ * read fails transiently or finds nothing, until one answers. Return the
+ * outcome of the last backend tried.
+ */
+static ssize_t mirror_read(MirrorConnect *connect, mirror_call_t *call)
+{
+    size_t order[MAX_BACKENDS];
+    ssize_t rc = 0;
+    double started;
+    size_t i;
+    int err;
+
+    read_order(connect, order);
+
+    for (i = 0; i < connect->count; i++) {
+        started = now_ms();
+        rc = call_one(connect->backends[order[i]].connect, call, NULL);
+        err = rc < 0 ? (int)rc : 0;
+        record(connect, order[i], err, started);
+
+        if (!err || call->delivered ||
+            (!hive_error_is_transient(err) && !is_missing(err)))
+            break;
+
+        if (i + 1 < connect->count)
+            vlogD("Mirror: backend %zu failed to read (0x%x), trying backend %zu.",
+                  order[i], err, order[i + 1]);
+    }
+
+    return rc;
+}
+
+static void run_task(task_t *task)
+{
+    HiveConnect *backend = task->connect->backends[task->index].connect;
+    double started;
+    ssize_t rc;
+
+    started = now_ms();
+    rc = call_one(backend, task->call, task);
+    task->rc = rc < 0 ? (int)rc : 0;
+    record(task->connect, task->index, task->rc, started);
+
+    if (!task->rc && task->truncated)
+        task->rc = HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+}
+
+/*
+ * Called with the lock held.
+ */
+static void queue_remove(MirrorConnect *connect, task_t *task)
+{
+    task_t *prev = NULL;
+    task_t *t;
+
+    for (t = connect->head; t && t != task; t = t->next)
+        prev = t;
+
+    if (!t)
+        return;
+
+    if (prev)
+        prev->next = task->next;
+    else
+        connect->head = task->next;
+
+    if (connect->tail == task)
+        connect->tail = prev;
+}
+
+static void *worker_entry(void *arg)
+{
+    MirrorConnect *connect = (MirrorConnect *)arg;
+    task_t *task;
+
+    pthread_mutex_lock(&connect->lock);
+
+    for (;;) {
+        while (!connect->head && !connect->stopping)
+            pthread_cond_wait(&connect->queued, &connect->lock);
+
+        if (!connect->head)
+            break;
+
+        task = connect->head;
+        queue_remove(connect, task);
+        task->state = TASK_RUNNING;
+
+        pthread_mutex_unlock(&connect->lock);
+        run_task(task);
+        pthread_mutex_lock(&connect->lock);
+
+        task->state = TASK_DONE;
+        pthread_cond_broadcast(&connect->done);
+    }
+
+    pthread_mutex_unlock(&connect->lock);
+    return NULL;
+}
+
+/*
+ * Make a call on all backends at once, and wait for all of them, so it
+ * takes about as long as the slowest instead of the sum. The calling
+ * thread makes it on the first backend itself, then on the backends no
+ * worker took meanwhile: the call goes on however busy the workers are.
+ */
+static void broadcast(MirrorConnect *connect, mirror_call_t *call, task_t *tasks)
+{
+    size_t i;
+
+    memset(tasks, 0, sizeof(task_t) * connect->count);
+
+    pthread_mutex_lock(&connect->lock);
+
+    for (i = 0; i < connect->count; i++) {
+        tasks[i].connect = connect;
+        tasks[i].call = call;
+        tasks[i].index = i;
+        tasks[i].state = TASK_QUEUED;
+
+        if (i == 0)
+            continue;
+
+        if (connect->tail)
+            connect->tail->next = &tasks[i];
+        else
+            connect->head = &tasks[i];
+        connect->tail = &tasks[i];
+    }
+
+    pthread_cond_broadcast(&connect->queued);
+    pthread_mutex_unlock(&connect->lock);
+
+    run_task(&tasks[0]);
+
+    pthread_mutex_lock(&connect->lock);
+
+    for (i = 1; i < connect->count; i++) {
+        if (tasks[i].state != TASK_QUEUED)
+            continue;
+
+        queue_remove(connect, &tasks[i]);
+        tasks[i].state = TASK_RUNNING;
+
+        pthread_mutex_unlock(&connect->lock);
+        run_task(&tasks[i]);
+        pthread_mutex_lock(&connect->lock);
+
+        tasks[i].state = TASK_DONE;
+    }
+
+    for (i = 1; i < connect->count; i++) {
+        while (tasks[i].state != TASK_DONE)
+            pthread_cond_wait(&connect->done, &connect->lock);
+    }
+
+    pthread_mutex_unlock(&connect->lock);
+}
+
+/*
+ * Make a write on all backends. It succeeds if it succeeded on a quorum
+ * of them; a failed write may still have been made on some. Deleting
+ * succeeds if a quorum either deleted the content or did not have it,
+ * and at least one did.
+ */
+static int mirror_write(MirrorConnect *connect, mirror_call_t *call, IPFSCid *cid)
+{
+    task_t tasks[MAX_BACKENDS];
+    const IPFSCid *agreed = NULL;
+    bool deleting;
+    size_t succeeded = 0;
+    size_t missing = 0;
+    int rc = 0;
+    size_t i;
+
+    broadcast(connect, call, tasks);
+
+    deleting = call->op == OP_DELETE_FILE || call->op == OP_DELETE_KEY;
+
+    for (i = 0; i < connect->count; i++) {
+        task_t *task = &tasks[i];
+
+        /* Content addressed backends must agree on the address. */
+        if (!task->rc &&
+            (call->op == OP_IPFS_PUT_FILE || call->op == OP_IPFS_ADD)) {
+            if (!agreed) {
+                agreed = &task->cid;
+            } else if (strcmp(agreed->content, task->cid.content)) {
+                vlogW("Mirror: backend %zu stored the content as %s instead of %s.",
+                      i, task->cid.content, agreed->content);
+                task->rc = HIVE_GENERAL_ERROR(HIVEERR_BAD_PERSISTENT_DATA);
+            }
+        }
+
+        if (!task->rc)
+            succeeded++;
+        else if (deleting && is_missing(task->rc))
+            missing++;
+        else if (!rc)
+            rc = task->rc;
+    }
+
+    if (succeeded && succeeded + missing >= connect->quorum) {
+        if (agreed)
+            *cid = *agreed;
+        return 0;
+    }
+
+    if (!succeeded && missing == connect->count)
+        return tasks[0].rc;
+
+    vlogW("Mirror: write made on %zu of %zu backends, short of the quorum of %zu.",
+          succeeded, connect->count, connect->quorum);
+
+    return rc ? rc : tasks[0].rc;
+}
+
+static int put_file_from_buffer(HiveConnect *base, const void *from,
+                                size_t length, bool encrypt, const char *filename)
+{
+    mirror_call_t call = {
+        .op     = OP_PUT_FILE,
+        .name   = filename,
+        .from   = from,
+        .length = length,
+        .crypt  = encrypt
+    };
+
+    return mirror_write((MirrorConnect *)base, &call, NULL);
+}
+
+static ssize_t get_file_length(HiveConnect *base, const char *filename)
+{
+    mirror_call_t call = {
+        .op     = OP_GET_FILE_LENGTH,
+        .name   = filename
+    };
+
+    return mirror_read((MirrorConnect *)base, &call);
+}
+
+static ssize_t get_file_to_buffer(HiveConnect *base, const char *filename,
+                                  bool decrypt, void *to, size_t buflen)
+{
+    mirror_call_t call = {
+        .op     = OP_GET_FILE,
+        .name   = filename,
+        .to     = to,
+        .length = buflen,
+        .crypt  = decrypt
+    };
+
+    return mirror_read((MirrorConnect *)base, &call);
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*
+ * Each write reached a quorum of the backends, so the listings of any
+ * count - quorum + 1 of them together hold every file: they are merged,
+ * each file listed once. A file deleted on a quorum only may still be
+ * listed.
+ */
+static int list_files(HiveConnect *base, HiveFilesIterateCallback *callback,
+                      void *context)
+{
+    MirrorConnect *connect = (MirrorConnect *)base;
+    mirror_call_t call = {
+        .op     = OP_LIST_FILES
+    };
+    task_t tasks[MAX_BACKENDS];
+    char **names = NULL;
+    size_t listed = 0;
+    size_t count = 0;
+    size_t i, j;
+    int rc = 0;
+
+    broadcast(connect, &call, tasks);
+
+    for (i = 0; i < connect->count; i++) {
+        if (!tasks[i].rc) {
+            listed++;
+            count += tasks[i].count;
+        } else if (!rc) {
+            rc = tasks[i].rc;
+        }
+    }
+
+    if (listed < connect->count - connect->quorum + 1) {
+        vlogW("Mirror: files listed by %zu of %zu backends, too few to hold them all.",
+              listed, connect->count);
+        goto exit;
+    }
+
+    rc = 0;
+    names = (char **)malloc(count ? count * sizeof(char *) : 1);
+    if (!names) {
+        rc = HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+        goto exit;
+    }
+
+    count = 0;
+    for (i = 0; i < connect->count; i++) {
+        for (j = 0; !tasks[i].rc && j < tasks[i].count; j++)
+            names[count++] = tasks[i].names[j];
+    }
+
+    qsort(names, count, sizeof(char *), compare_names);
+
+    for (i = 0; i < count; i++) {
+        if (i > 0 && !strcmp(names[i], names[i - 1]))
+            continue;
+
+        if (!callback(names[i], context))
+            goto exit;
+    }
+
+    callback(NULL, context);
+
+exit:
+    free(names);
+    for (i = 0; i < connect->count; i++) {
+        for (j = 0; j < tasks[i].count; j++)
+            free(tasks[i].names[j]);
+        free(tasks[i].names);
+    }
+
+    return rc;
+}
+
+static int delete_file(HiveConnect *base, const char *filename)
+{
+    mirror_call_t call = {
+        .op     = OP_DELETE_FILE,
+        .name   = filename
+    };
+
+    return mirror_write((MirrorConnect *)base, &call, NULL);
+}
+
+static int ipfs_put_file_from_buffer(HiveConnect *base, const void *from,
+                                     size_t length, bool encrypt, IPFSCid *cid)
+{
+    mirror_call_t call = {
+        .op     = OP_IPFS_PUT_FILE,
+        .from   = from,
+        .length = length,
+        .crypt  = encrypt
+    };
+
+    return mirror_write((MirrorConnect *)base, &call, cid);
+}
+
+/*
+ * The content is read once, and each backend adds it from memory; it
+ * must fit in HIVE_MAX_FILE_SIZE.
+ */
+static int ipfs_add(HiveConnect *base, HiveReadCallback *callback,
+                    hive_rewind_callback_t *rewind, void *context,
+                    ssize_t length, const IPFSAddOptions *options, IPFSCid *cid)
+{
+    mirror_call_t call = {
+        .op      = OP_IPFS_ADD,
+        .options = options
+    };
+    size_t capacity = 0;
+    size_t len = 0;
+    uint8_t *buf = NULL;
+    uint8_t *p;
+    ssize_t nrd;
+    int rc;
+
+    do {
+        if (len == capacity) {
+            if (len > HIVE_MAX_FILE_SIZE) {
+                free(buf);
+                return HIVE_GENERAL_ERROR(HIVEERR_LIMIT_EXCEEDED);
+            }
+
+            /* One more byte than announced, to read the end at once. */
+            capacity = capacity ? capacity * 2 :
+                       length >= 0 ? (size_t)length + 1 : 64 * 1024;
+            if (capacity > HIVE_MAX_FILE_SIZE + 1)
+                capacity = HIVE_MAX_FILE_SIZE + 1;
+
+            p = (uint8_t *)realloc(buf, capacity);
+            if (!p) {
+                free(buf);
+                return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+            }
+            buf = p;
+        }
+
+        nrd = callback(buf + len, capacity - len, context);
+        if (nrd > 0)
+            len += (size_t)nrd;
+    } while (nrd > 0);
+
+    if (nrd < 0) {
+        free(buf);
+        return HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS);
+    }
+
+    call.from = buf;
+    call.length = len;
+
+    rc = mirror_write((MirrorConnect *)base, &call, cid);
+    free(buf);
+
+    return rc;
+}
+
+static ssize_t ipfs_get_file_length(HiveConnect *base, const IPFSCid *cid)
+{
+    mirror_call_t call = {
+        .op     = OP_IPFS_GET_FILE_LENGTH,
+        .cid    = cid
+    };
+
+    return mirror_read((MirrorConnect *)base, &call);
+}
+
+static ssize_t ipfs_get_file_to_buffer(HiveConnect *base, const IPFSCid *cid,
+                                       bool decrypt, void *to, size_t buflen)
+{
+    mirror_call_t call = {
+        .op     = OP_IPFS_GET_FILE,
+        .cid    = cid,
+        .to     = to,
+        .length = buflen,
+        .crypt  = decrypt
+    };
+
+    return mirror_read((MirrorConnect *)base, &call);
+}
+
+static ssize_t ipfs_get_file_range(HiveConnect *base, const IPFSCid *cid,
+                                   uint64_t offset, size_t length, void *to)
+{
+    mirror_call_t call = {
+        .op     = OP_IPFS_GET_FILE_RANGE,
+        .cid    = cid,
+        .to     = to,
+        .length = length,
+        .offset = offset
+    };
+
+    return mirror_read((MirrorConnect *)base, &call);
+}
+
+static int put_value(HiveConnect *base, const char *key, const void *value,
+                     size_t length, bool encrypt)
+{
+    mirror_call_t call = {
+        .op     = OP_PUT_VALUE,
+        .name   = key,
+        .from   = value,
+        .length = length,
+        .crypt  = encrypt
+    };
+
+    return mirror_write((MirrorConnect *)base, &call, NULL);
+}
+
+static int set_value(HiveConnect *base, const char *key, const void *value,
+                     size_t length, bool encrypt)
+{
+    mirror_call_t call = {
+        .op     = OP_SET_VALUE,
+        .name   = key,
+        .from   = value,
+        .length = length,
+        .crypt  = encrypt
+    };
+
+    return mirror_write((MirrorConnect *)base, &call, NULL);
+}
+
+static int get_values(HiveConnect *base, const char *key, bool decrypt,
+                      HiveKeyValuesIterateCallback *callback, void *context)
+{
+    mirror_call_t call = {
+        .op              = OP_GET_VALUES,
+        .name            = key,
+        .crypt           = decrypt,
+        .values_callback = callback,
+        .context         = context
+    };
+
+    return (int)mirror_read((MirrorConnect *)base, &call);
+}
+
+static int delete_key(HiveConnect *base, const char *key)
+{
+    mirror_call_t call = {
+        .op     = OP_DELETE_KEY,
+        .name   = key
+    };
+
+    return mirror_write((MirrorConnect *)base, &call, NULL);
+}
+
+static int expire_token(HiveConnect *base)
+{
+    MirrorConnect *connect = (MirrorConnect *)base;
+    HiveConnect *backend;
+    int rc = 0;
+    size_t i;
+    int err;
+
+    for (i = 0; i < connect->count; i++) {
+        backend = connect->backends[i].connect;
+        if (!backend->expire_token)
+            continue;
+
+        err = backend->expire_token(backend);
+        if (err < 0 && !rc)
+            rc = err;
+    }
+
+    return rc;
+}
+
+static void mirror_connect_destructor(void *obj)
+{
+    MirrorConnect *connect = (MirrorConnect *)obj;
+    size_t i;
+
+    pthread_mutex_lock(&connect->lock);
+    connect->stopping = true;
+    pthread_cond_broadcast(&connect->queued);
+    pthread_mutex_unlock(&connect->lock);
+
+    for (i = 0; i < connect->nworkers; i++)
+        pthread_join(connect->workers[i], NULL);
+
+    for (i = 0; i < connect->count; i++)
+        deref(connect->backends[i].connect);
+
+    pthread_cond_destroy(&connect->done);
+    pthread_cond_destroy(&connect->queued);
+    pthread_mutex_destroy(&connect->lock);
+}
+
+/*
+ * An entry is offered only if every backend implements it, so a write
+ * reaches all of them and any of them can serve a read.
+ */
+#define OFFER(entry)                                                \
+    do {                                                            \
+        size_t __i;                                                 \
+        for (__i = 0; __i < connect->count; __i++) {                \
+            if (!connect->backends[__i].connect->entry)             \
+                break;                                              \
+        }                                                           \
+        if (__i == connect->count)                                  \
+            connect->base.entry = entry;                            \
+    } while (0)
+
+HiveConnect *mirror_client_connect(HiveClient *client, const HiveConnectOptions *opts)
+{
+    MirrorConnectOptions *options = (MirrorConnectOptions *)opts;
+    MirrorConnect *connect;
+    size_t i;
+
+    assert(options);
+
+    if (options->backendType != HiveBackendType_Mirror || !options->backends ||
+        !options->count || options->count > MAX_BACKENDS ||
+        options->quorum > options->count) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS));
+        return NULL;
+    }
+
+    for (i = 0; i < options->count; i++) {
+        if (!options->backends[i]) {
+            hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS));
+            return NULL;
+        }
+    }
+
+    connect = (MirrorConnect *)rc_zalloc(sizeof(MirrorConnect) +
+                        sizeof(backend_state_t) * options->count,
+                        mirror_connect_destructor);
+    if (!connect) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY));
+        return NULL;
+    }
+
+    pthread_mutex_init(&connect->lock, NULL);
+    pthread_cond_init(&connect->queued, NULL);
+    pthread_cond_init(&connect->done, NULL);
+    connect->quorum = options->quorum ? options->quorum : options->count;
+    connect->count = options->count;
+
+    for (i = 0; i < options->count; i++)
+        connect->backends[i].connect = (HiveConnect *)ref(options->backends[i]);
+
+    /* Without workers, callers make their calls on each backend in turn. */
+    for (i = 0; i < (connect->count - 1) * WORKERS_PER_BACKEND; i++) {
+        if (pthread_create(&connect->workers[i], NULL, worker_entry, connect)) {
+            vlogW("Mirror: Failed to create worker thread.");
+            break;
+        }
+        connect->nworkers++;
+    }
+
+    OFFER(put_file_from_buffer);
+    OFFER(get_file_length);
+    OFFER(get_file_to_buffer);
+    OFFER(list_files);
+    OFFER(delete_file);
+
+    OFFER(ipfs_put_file_from_buffer);
+    OFFER(ipfs_add);
+    OFFER(ipfs_get_file_length);
+    OFFER(ipfs_get_file_to_buffer);
+    OFFER(ipfs_get_file_range);
+
+    OFFER(put_value);
+    OFFER(set_value);
+    OFFER(get_values);
+    OFFER(delete_key);
+
+    connect->base.disconnect   = disconnect;
+    connect->base.expire_token = expire_token;
+
+    return &connect->base;
+}
@@ -0,0 +1,1222 @@
+/*
+ * Copyright (c) 2019 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_ARPA_INET_H
+#include <arpa/inet.h>
+#endif
+#if defined(_WIN32) || defined(_WIN64)
+#include <io.h>
+#else
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#endif
+
+#include <crystal.h>
+
+#include "hive_error.h"
+#include "hive_client.h"
+#include "mkdirs.h"
+#include "atomic_file.h"
+#include "native.h"
+
+#ifndef O_BINARY
+#define O_BINARY            0
+#endif
+
+#if defined(_WIN32) || defined(_WIN64)
+#define fsync(fd)           _commit(fd)
+#define ftruncate(fd, len)  _chsize_s(fd, len)
+#endif
+
+#define FILES_DIR           "files"
+#define KEYS_LOG            "keys.log"
+
+#define MAX_KEY_LEN         (1024)
+
+/*
+ * Files are written under a temporary name first: a fixed one in the
+ * same directory, or on Windows the name with the ".XXXXXX" suffix of
+ * atomic_write_file, which must fit in the name limit too.
+ */
+#define TMP_PREFIX          ".hive-tmp"
+#if defined(_WIN32) || defined(_WIN64)
+#define MAX_FILENAME_LEN    (255 - 7)
+#else
+#define MAX_FILENAME_LEN    (255)
+#endif
+
+/*
+ * The key log is rewritten without its dead records when it is opened,
+ * once it is this big and most of it is dead.
+ */
+#define COMPACT_MIN_SIZE    (1024 * 1024)
+
+/*
+ * The key log is a sequence of records, each a header followed by the key
+ * and the value, all integers in network byte order. Records are only
+ * ever appended; the latest SET or DELETE of a key supersedes whatever
+ * was recorded for it before. The checksum covers the rest of the record,
+ * so a record torn by a crash ends the log instead of corrupting it.
+ */
+enum {
+    KV_OP_PUT       = 1,
+    KV_OP_SET       = 2,
+    KV_OP_DELETE    = 3
+};
+
+typedef struct kv_record {
+    uint32_t checksum;
+    uint8_t  op;
+    uint8_t  reserved[3];
+    uint32_t key_len;
+    uint32_t val_len;
+} kv_record_t;
+
+typedef struct kv_value {
+    uint64_t offset;
+    uint32_t length;
+} kv_value_t;
+
+/*
+ * The values of a key, as offsets into the log: the log is the only copy
+ * of the data, the index just tells where to read it.
+ */
+typedef struct kv_key {
+    hash_entry_t he;
+    kv_value_t *values;
+    size_t count;
+    size_t capacity;
+    char key[0];
+} kv_key_t;
+
+typedef struct NativeConnect {
+    HiveConnect base;
+
+    char files_dir[PATH_MAX];
+    char log_path[PATH_MAX];
+
+    /*
+     * The key log may be shared by several processes: appends are
+     * serialized with a lock on the log, and the log identity last seen
+     * tells whether another process has compacted it since.
+     */
+    pthread_mutex_t lock;
+    hashtable_t *keys;
+    int log_fd;
+    struct stat log_stat;
+    uint64_t log_end;
+    uint64_t live;
+} NativeConnect;
+
+static int disconnect(HiveConnect *base)
+{
+    assert(base);
+
+    deref(base);
+    return 0;
+}
+
+static bool valid_filename(const char *filename)
+{
+    /*
+     * Names starting with a dot are reserved for files being written.
+     */
+    return filename[0] != '.' && !strpbrk(filename, "/\\") &&
+           strlen(filename) <= MAX_FILENAME_LEN;
+}
+
+static int file_path(NativeConnect *connect, const char *filename,
+                     char *path, size_t len)
+{
+    int rc;
+
+    if (!valid_filename(filename))
+        return HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS);
+
+    rc = snprintf(path, len, "%s/%s", connect->files_dir, filename);
+    if (rc < 0 || rc >= (int)len)
+        return HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
+
+    return 0;
+}
+
+static int write_all(int fd, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+
+    while (len > 0) {
+        ssize_t nwr = write(fd, p,
+#if defined(_WIN32) || defined(_WIN64)
+                            (unsigned)
+#endif
+                            len);
+        if (nwr < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        p += nwr;
+        len -= (size_t)nwr;
+    }
+
+    return 0;
+}
+
+static int read_all(int fd, void *data, size_t len)
+{
+    uint8_t *p = (uint8_t *)data;
+
+    while (len > 0) {
+        ssize_t nrd = read(fd, p,
+#if defined(_WIN32) || defined(_WIN64)
+                           (unsigned)
+#endif
+                           len);
+        if (nrd < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        if (!nrd) {
+            errno = EIO;
+            return -1;
+        }
+
+        p += nrd;
+        len -= (size_t)nrd;
+    }
+
+    return 0;
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+static int write_file(NativeConnect *connect, const char *path,
+                      const void *data, size_t len)
+{
+    if (atomic_write_file(path, data, len, S_IRUSR | S_IWUSR) < 0)
+        return HIVE_SYS_ERROR(errno);
+
+    return 0;
+}
+#else
+/*
+ * The content is written to an anonymous file where the kernel supports
+ * it (O_TMPFILE), which only gets a name with linkat() once it is
+ * complete and flushed, so a crash never leaves a partial file behind.
+ * Either way the file is renamed over the target, so readers see the old
+ * or the new content in full, never a mix, and a mapping of the old one
+ * stays valid.
+ */
+static int write_file(NativeConnect *connect, const char *path,
+                      const void *data, size_t len)
+{
+    char tmp_path[PATH_MAX];
+    bool anonymous = false;
+    int rc;
+    int fd = -1;
+
+#ifdef O_TMPFILE
+    fd = open(connect->files_dir, O_TMPFILE | O_WRONLY, S_IRUSR | S_IWUSR);
+    if (fd >= 0)
+        anonymous = true;
+    else if (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL)
+        return HIVE_SYS_ERROR(errno);
+#endif
+
+    /*
+     * The descriptor number is unique in the process while the file is
+     * open, so it keeps concurrent writers of the same name apart.
+     */
+    if (anonymous)
+        rc = snprintf(tmp_path, sizeof(tmp_path), "%s/" TMP_PREFIX ".%d.%d",
+                      connect->files_dir, (int)getpid(), fd);
+    else
+        rc = snprintf(tmp_path, sizeof(tmp_path), "%s/" TMP_PREFIX ".XXXXXX",
+                      connect->files_dir);
+    if (rc < 0 || rc >= (int)sizeof(tmp_path)) {
+        if (fd >= 0)
+            close(fd);
+        return HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
+    }
+
+    if (!anonymous) {
+        fd = mkstemp(tmp_path);
+        if (fd < 0)
+            return HIVE_SYS_ERROR(errno);
+    }
+
+    if (write_all(fd, data, len) < 0 || fsync(fd) < 0)
+        goto error_exit;
+
+#ifdef O_TMPFILE
+    if (anonymous) {
+        char proc_path[64];
+
+        sprintf(proc_path, "/proc/self/fd/%d", fd);
+        if (linkat(AT_FDCWD, proc_path, AT_FDCWD, tmp_path, AT_SYMLINK_FOLLOW) < 0)
+            goto error_exit;
+    }
+#endif
+
+    close(fd);
+    fd = -1;
+
+    if (rename(tmp_path, path) < 0)
+        goto error_exit;
+
+    /* A rename is only durable once the directory holding it is. */
+    if (sync_dir(connect->files_dir) < 0)
+        return HIVE_SYS_ERROR(errno);
+
+    return 0;
+
+error_exit:
+    rc = HIVE_SYS_ERROR(errno);
+    if (fd >= 0)
+        close(fd);
+    unlink(tmp_path);
+    return rc;
+}
+#endif
+
+static int put_file_from_buffer(HiveConnect *base, const void *from,
+                                size_t length, bool encrypt, const char *filename)
+{
+    NativeConnect *connect = (NativeConnect *)base;
+    char path[PATH_MAX];
+    int rc;
+
+    rc = file_path(connect, filename, path, sizeof(path));
+    if (rc < 0)
+        return rc;
+
+    return write_file(connect, path, from, length);
+}
+
+static ssize_t get_file_length(HiveConnect *base, const char *filename)
+{
+    NativeConnect *connect = (NativeConnect *)base;
+    char path[PATH_MAX];
+    struct stat st;
+    int rc;
+
+    rc = file_path(connect, filename, path, sizeof(path));
+    if (rc < 0)
+        return rc;
+
+    if (stat(path, &st) < 0)
+        rc = errno == ENOENT ? HIVE_GENERAL_ERROR(HIVEERR_NOT_EXIST) :
+                               HIVE_SYS_ERROR(errno);
+    else if (!S_ISREG(st.st_mode))
+        rc = HIVE_GENERAL_ERROR(HIVEERR_NOT_EXIST);
+
+    if (rc < 0)
+        return rc;
+
+    return (ssize_t)st.st_size;
+}
+
+static ssize_t get_file_to_buffer(HiveConnect *base, const char *filename,
+                                  bool decrypt, void *to, size_t buflen)
+{
+    NativeConnect *connect = (NativeConnect *)base;
+    char path[PATH_MAX];
+    struct stat st;
+    size_t fsize;
+    int rc;
+    int fd;
+
+    rc = file_path(connect, filename, path, sizeof(path));
+    if (rc < 0)
+        return rc;
+
+    fd = open(path, O_RDONLY | O_BINARY);
+    if (fd < 0) {
+        rc = errno == ENOENT ? HIVE_GENERAL_ERROR(HIVEERR_NOT_EXIST) :
+                               HIVE_SYS_ERROR(errno);
+        return rc;
+    }
+
+    if (fstat(fd, &st) < 0) {
+        rc = HIVE_SYS_ERROR(errno);
+        close(fd);
+        return rc;
+    }
+
+    fsize = (size_t)st.st_size;
+    if (!S_ISREG(st.st_mode))
+        rc = HIVE_GENERAL_ERROR(HIVEERR_NOT_EXIST);
+    else if (fsize > buflen)
+        rc = HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
+
+    if (rc < 0 || !fsize) {
+        close(fd);
+        return rc;
+    }
+
+#if defined(_WIN32) || defined(_WIN64)
+    rc = read_all(fd, to, fsize) < 0 ? HIVE_SYS_ERROR(errno) : 0;
+    close(fd);
+#else
+    {
+        /*
+         * Files are replaced by rename, never rewritten in place, so the
+         * mapping sees one consistent version whatever writers do.
+         */
+        void *data = mmap(NULL, fsize, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        rc = data == MAP_FAILED ? HIVE_SYS_ERROR(errno) : 0;
+        close(fd);
+
+        if (!rc) {
+            memcpy(to, data, fsize);
+            munmap(data, fsize);
+        }
+    }
+#endif
+
+    if (rc < 0)
+        return rc;
+
+    return (ssize_t)fsize;
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+static int list_files(HiveConnect *base, HiveFilesIterateCallback *callback,
+                      void *context)
+{
+    NativeConnect *connect = (NativeConnect *)base;
+    struct _finddata_t file;
+    char pattern[PATH_MAX];
+    intptr_t handle;
+    int rc;
+
+    rc = snprintf(pattern, sizeof(pattern), "%s/*", connect->files_dir);
+    if (rc < 0 || rc >= (int)sizeof(pattern))
+        return HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
+
+    handle = _findfirst(pattern, &file);
+    if (handle == -1) {
+        if (errno != ENOENT)
+            return HIVE_SYS_ERROR(errno);
+
+        callback(NULL, context);
+        return 0;
+    }
+
+    do {
+        if (file.name[0] == '.' || (file.attrib & _A_SUBDIR))
+            continue;
+
+        if (!callback(file.name, context)) {
+            _findclose(handle);
+            return 0;
+        }
+    } while (_findnext(handle, &file) == 0);
+
+    _findclose(handle);
+    callback(NULL, context);
+    return 0;
+}
+#else
+static int list_files(HiveConnect *base, HiveFilesIterateCallback *callback,
+                      void *context)
+{
+    NativeConnect *connect = (NativeConnect *)base;
+    struct dirent *file;
+    DIR *dir;
+
+    dir = opendir(connect->files_dir);
+    if (!dir)
+        return HIVE_SYS_ERROR(errno);
+
+    while ((file = readdir(dir))) {
+        struct stat st;
+
+        if (file->d_name[0] == '.')
+            continue;
+
+        if (fstatat(dirfd(dir), file->d_name, &st, 0) < 0 ||
+            !S_ISREG(st.st_mode))
+            continue;
+
+        if (!callback(file->d_name, context)) {
+            closedir(dir);
+            return 0;
+        }
+    }
+
+    closedir(dir);
+    callback(NULL, context);
+    return 0;
+}
+#endif
+
+static int delete_file(HiveConnect *base, const char *filename)
+{
+    NativeConnect *connect = (NativeConnect *)base;
+    char path[PATH_MAX];
+    int rc;
+
+    rc = file_path(connect, filename, path, sizeof(path));
+    if (rc < 0)
+        return rc;
+
+    if (unlink(path) < 0)
+        return errno == ENOENT ? HIVE_GENERAL_ERROR(HIVEERR_NOT_EXIST) :
+                                 HIVE_SYS_ERROR(errno);
+
+    return 0;
+}
+
+static int get_file_version(HiveConnect *base, const char *filename,
+                            char *version, size_t len)
+{
+    NativeConnect *connect = (NativeConnect *)base;
+    char path[PATH_MAX];
+    struct stat st;
+    long nsec = 0;
+    int rc;
+
+    rc = file_path(connect, filename, path, sizeof(path));
+    if (rc < 0)
+        return rc;
+
+    if (stat(path, &st) < 0)
+        return errno == ENOENT ? HIVE_GENERAL_ERROR(HIVEERR_NOT_EXIST) :
+                                 HIVE_SYS_ERROR(errno);
+
+#if defined(__linux__)
+    nsec = st.st_mtim.tv_nsec;
+#endif
+
+    /* Every write renames a new file in, with its own inode. */
+    rc = snprintf(version, len, "%llx-%llx-%llx.%lx",
+                  (unsigned long long)st.st_ino,
+                  (unsigned long long)st.st_size,
+                  (unsigned long long)st.st_mtime, nsec);
+    if (rc < 0 || rc >= (int)len)
+        return HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
+
+    return 0;
+}
+
+/*
+ * FNV-1a, enough to tell a torn record from a complete one.
+ */
+static uint32_t checksum(uint32_t hash, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+static uint32_t record_checksum(const kv_record_t *record, const void *payload,
+                                size_t len)
+{
+    uint32_t hash = 2166136261U;
+
+    hash = checksum(hash, (const uint8_t *)record + sizeof(record->checksum),
+                    sizeof(*record) - sizeof(record->checksum));
+    return checksum(hash, payload, len);
+}
+
+static size_t record_size(size_t key_len, size_t val_len)
+{
+    return sizeof(kv_record_t) + key_len + val_len;
+}
+
+static void kv_key_destructor(void *p)
+{
+    kv_key_t *kv = (kv_key_t *)p;
+
+    if (kv->values)
+        free(kv->values);
+}
+
+static kv_key_t *kv_key_get(NativeConnect *connect, const char *key,
+                            size_t key_len, bool create)
+{
+    kv_key_t *kv;
+
+    kv = (kv_key_t *)hashtable_get(connect->keys, key, key_len);
+    if (kv) {
+        /* Borrowed from the index, only valid while the lock is held. */
+        deref(kv);
+        return kv;
+    }
+
+    if (!create)
+        return NULL;
+
+    kv = (kv_key_t *)rc_zalloc(sizeof(kv_key_t) + key_len + 1, kv_key_destructor);
+    if (!kv)
+        return NULL;
+
+    memcpy(kv->key, key, key_len);
+    kv->key[key_len] = '\0';
+    kv->he.data = kv;
+    kv->he.key = kv->key;
+    kv->he.keylen = key_len;
+
+    hashtable_put(connect->keys, &kv->he);
+    deref(kv);
+
+    return kv;
+}
+
+static void kv_key_clear(NativeConnect *connect, kv_key_t *kv)
+{
+    size_t i;
+
+    for (i = 0; i < kv->count; i++)
+        connect->live -= record_size(kv->he.keylen, kv->values[i].length);
+
+    kv->count = 0;
+}
+
+/*
+ * Fold one record, whose value starts at the given log offset, into the
+ * index.
+ */
+static int kv_apply(NativeConnect *connect, int op, const char *key,
+                    size_t key_len, uint64_t offset, size_t val_len)
+{
+    kv_value_t *values;
+    kv_key_t *kv;
+
+    if (op == KV_OP_DELETE) {
+        kv = kv_key_get(connect, key, key_len, false);
+        if (!kv)
+            return 0;
+
+        kv_key_clear(connect, kv);
+        kv = (kv_key_t *)hashtable_remove(connect->keys, key, key_len);
+        if (kv)
+            deref(kv);
+        return 0;
+    }
+
+    kv = kv_key_get(connect, key, key_len, true);
+    if (!kv)
+        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+
+    if (op == KV_OP_SET)
+        kv_key_clear(connect, kv);
+
+    if (kv->count == kv->capacity) {
+        size_t capacity = kv->capacity ? kv->capacity * 2 : 4;
+
+        values = (kv_value_t *)realloc(kv->values, capacity * sizeof(kv_value_t));
+        if (!values)
+            return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+
+        kv->values = values;
+        kv->capacity = capacity;
+    }
+
+    kv->values[kv->count].offset = offset;
+    kv->values[kv->count].length = (uint32_t)val_len;
+    kv->count++;
+    connect->live += record_size(key_len, val_len);
+
+    return 0;
+}
+
+/*
+ * Index the records appended since the last call, up to the first
+ * incomplete one: it is either still being written by another process or
+ * was torn by a crash, and is looked at again next time.
+ */
+static int kv_catch_up(NativeConnect *connect)
+{
+    uint8_t *payload = NULL;
+    struct stat st;
+    int rc = 0;
+
+    if (fstat(connect->log_fd, &st) < 0)
+        return HIVE_SYS_ERROR(errno);
+
+    if (lseek(connect->log_fd, (off_t)connect->log_end, SEEK_SET) < 0)
+        return HIVE_SYS_ERROR(errno);
+
+    while (connect->log_end + sizeof(kv_record_t) <= (uint64_t)st.st_size) {
+        kv_record_t record;
+        size_t key_len;
+        size_t val_len;
+        size_t size;
+
+        if (read_all(connect->log_fd, &record, sizeof(record)) < 0)
+            break;
+
+        key_len = ntohl(record.key_len);
+        val_len = ntohl(record.val_len);
+        if (record.op < KV_OP_PUT || record.op > KV_OP_DELETE ||
+            !key_len || key_len > MAX_KEY_LEN || val_len > HIVE_MAX_VALUE_LEN)
+            break;
+
+        size = record_size(key_len, val_len);
+        if (connect->log_end + size > (uint64_t)st.st_size)
+            break;
+
+        if (!payload) {
+            payload = (uint8_t *)malloc(MAX_KEY_LEN + HIVE_MAX_VALUE_LEN);
+            if (!payload) {
+                rc = HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+                break;
+            }
+        }
+
+        if (read_all(connect->log_fd, payload, key_len + val_len) < 0 ||
+            record_checksum(&record, payload, key_len + val_len) !=
+                ntohl(record.checksum))
+            break;
+
+        rc = kv_apply(connect, record.op, (const char *)payload, key_len,
+                      connect->log_end + sizeof(record) + key_len, val_len);
+        if (rc < 0)
+            break;
+
+        connect->log_end += size;
+    }
+
+    if (payload)
+        free(payload);
+
+    return rc;
+}
+
+static int kv_open_log(NativeConnect *connect)
+{
+    if (connect->log_fd >= 0)
+        close(connect->log_fd);
+
+    hashtable_clear(connect->keys);
+    connect->log_end = 0;
+    connect->live = 0;
+
+    connect->log_fd = open(connect->log_path, O_RDWR | O_CREAT | O_BINARY,
+                           S_IRUSR | S_IWUSR);
+    if (connect->log_fd < 0)
+        return HIVE_SYS_ERROR(errno);
+
+    if (fstat(connect->log_fd, &connect->log_stat) < 0)
+        return HIVE_SYS_ERROR(errno);
+
+    return kv_catch_up(connect);
+}
+
+/*
+ * Whether another process has compacted the log, i.e. replaced the file
+ * since it was opened.
+ */
+static bool kv_log_replaced(NativeConnect *connect)
+{
+#if !defined(_WIN32) && !defined(_WIN64)
+    struct stat st;
+
+    if (stat(connect->log_path, &st) < 0)
+        return true;
+
+    return st.st_ino != connect->log_stat.st_ino ||
+           st.st_dev != connect->log_stat.st_dev;
+#else
+    return false;
+#endif
+}
+
+/*
+ * Bring the index up to date with the log, re-reading it in full if it
+ * has been replaced.
+ */
+static int kv_sync(NativeConnect *connect)
+{
+    if (kv_log_replaced(connect)) {
+        vlogD("Native: Key log compacted by another process, reloaded.");
+        return kv_open_log(connect);
+    }
+
+    return kv_catch_up(connect);
+}
+
+/*
+ * flock() rather than fcntl() locks: they belong to the open file, so
+ * they also keep apart two connections to the same root in one process.
+ */
+static int kv_lock_log(NativeConnect *connect, bool lock)
+{
+#if !defined(_WIN32) && !defined(_WIN64)
+    int rc;
+
+    do {
+        rc = flock(connect->log_fd, lock ? LOCK_EX : LOCK_UN);
+    } while (rc < 0 && errno == EINTR);
+
+    if (rc < 0)
+        return HIVE_SYS_ERROR(errno);
+#endif
+
+    return 0;
+}
+
+/*
+ * Take the write lock on the current log and index what others appended.
+ * A log replaced while waiting for the lock is re-opened, the lock held
+ * was on a file nobody reads any more.
+ */
+static int kv_begin_write(NativeConnect *connect)
+{
+    int rc;
+
+    for (;;) {
+        rc = kv_lock_log(connect, true);
+        if (rc < 0)
+            return rc;
+
+        if (!kv_log_replaced(connect))
+            break;
+
+        kv_lock_log(connect, false);
+        rc = kv_open_log(connect);
+        if (rc < 0)
+            return rc;
+    }
+
+    rc = kv_catch_up(connect);
+    if (rc < 0)
+        kv_lock_log(connect, false);
+
+    return rc;
+}
+
+static int kv_append(NativeConnect *connect, int op, const char *key,
+                     const void *value, size_t length)
+{
+    kv_record_t *record;
+    size_t key_len = strlen(key);
+    size_t size;
+    struct stat st;
+    int rc;
+
+    if (key_len > MAX_KEY_LEN)
+        return HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS);
+
+    size = record_size(key_len, length);
+    record = (kv_record_t *)malloc(size);
+    if (!record)
+        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+
+    memset(record, 0, sizeof(*record));
+    record->op = (uint8_t)op;
+    record->key_len = htonl((uint32_t)key_len);
+    record->val_len = htonl((uint32_t)length);
+    memcpy(record + 1, key, key_len);
+    if (length)
+        memcpy((uint8_t *)(record + 1) + key_len, value, length);
+    record->checksum = htonl(record_checksum(record, record + 1, key_len + length));
+
+    pthread_mutex_lock(&connect->lock);
+
+    rc = kv_begin_write(connect);
+    if (rc < 0) {
+        pthread_mutex_unlock(&connect->lock);
+        free(record);
+        return rc;
+    }
+
+    /*
+     * Holding the write lock, anything past the indexed end is a record
+     * torn by a writer that crashed: drop it before appending.
+     */
+    if (fstat(connect->log_fd, &st) < 0 ||
+        ((uint64_t)st.st_size > connect->log_end &&
+         ftruncate(connect->log_fd, (off_t)connect->log_end) < 0) ||
+        lseek(connect->log_fd, (off_t)connect->log_end, SEEK_SET) < 0 ||
+        write_all(connect->log_fd, record, size) < 0 ||
+        fsync(connect->log_fd) < 0) {
+        rc = HIVE_SYS_ERROR(errno);
+        vlogE("Native: Append to key log failed (%d).", errno);
+    } else {
+        rc = kv_apply(connect, op, key, key_len,
+                      connect->log_end + sizeof(*record) + key_len, length);
+        connect->log_end += size;
+    }
+
+    kv_lock_log(connect, false);
+    pthread_mutex_unlock(&connect->lock);
+    free(record);
+
+    return rc;
+}
+
+/*
+ * Rewrite the log with the live values only. Called with the write lock
+ * held and the index up to date; other processes notice the new file by
+ * its identity and re-read it.
+ */
+static int kv_compact(NativeConnect *connect)
+{
+    hashtable_iterator_t it;
+    uint8_t *buf;
+    uint8_t *p;
+    size_t size = 0;
+    kv_key_t *kv;
+    int rc = 0;
+
+    hashtable_iterate(connect->keys, &it);
+    while (hashtable_iterator_has_next(&it)) {
+        size_t i;
+
+        hashtable_iterator_next(&it, NULL, NULL, (void **)&kv);
+        for (i = 0; i < kv->count; i++)
+            size += record_size(kv->he.keylen, kv->values[i].length);
+        deref(kv);
+    }
+
+    buf = (uint8_t *)malloc(size ? size : 1);
+    if (!buf)
+        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+
+    p = buf;
+    hashtable_iterate(connect->keys, &it);
+    while (hashtable_iterator_has_next(&it) && !rc) {
+        size_t i;
+
+        hashtable_iterator_next(&it, NULL, NULL, (void **)&kv);
+        for (i = 0; i < kv->count && !rc; i++) {
+            uint8_t *payload = p + sizeof(kv_record_t);
+            kv_record_t record;
+
+            memset(&record, 0, sizeof(record));
+            record.op = i ? KV_OP_PUT : KV_OP_SET;
+            record.key_len = htonl((uint32_t)kv->he.keylen);
+            record.val_len = htonl(kv->values[i].length);
+            memcpy(payload, kv->key, kv->he.keylen);
+
+            if (lseek(connect->log_fd, (off_t)kv->values[i].offset, SEEK_SET) < 0 ||
+                read_all(connect->log_fd, payload + kv->he.keylen,
+                         kv->values[i].length) < 0) {
+                rc = HIVE_SYS_ERROR(errno);
+                break;
+            }
+
+            record.checksum = htonl(record_checksum(&record, payload,
+                                        kv->he.keylen + kv->values[i].length));
+            memcpy(p, &record, sizeof(record));
+            p += record_size(kv->he.keylen, kv->values[i].length);
+        }
+        deref(kv);
+    }
+
+    if (!rc && atomic_write_file(connect->log_path, buf, size,
+                                 S_IRUSR | S_IWUSR) < 0)
+        rc = HIVE_SYS_ERROR(errno);
+    free(buf);
+
+    if (rc < 0)
+        return rc;
+
+    vlogI("Native: Key log compacted to %zu bytes.", size);
+    return 0;
+}
+
+static void kv_maybe_compact(NativeConnect *connect)
+{
+    int rc;
+
+    if (connect->log_end < COMPACT_MIN_SIZE || connect->live * 2 > connect->log_end)
+        return;
+
+    if (kv_begin_write(connect) < 0)
+        return;
+
+    rc = connect->live * 2 > connect->log_end ? 0 : kv_compact(connect);
+    kv_lock_log(connect, false);
+
+    if (!rc)
+        kv_open_log(connect);
+}
+
+static int put_value(HiveConnect *base, const char *key, const void *value,
+                     size_t length, bool encrypt)
+{
+    return kv_append((NativeConnect *)base, KV_OP_PUT, key, value, length);
+}
+
+static int set_value(HiveConnect *base, const char *key, const void *value,
+                     size_t length, bool encrypt)
+{
+    return kv_append((NativeConnect *)base, KV_OP_SET, key, value, length);
+}
+
+static int get_values(HiveConnect *base, const char *key, bool decrypt,
+                      HiveKeyValuesIterateCallback *callback, void *context)
+{
+    NativeConnect *connect = (NativeConnect *)base;
+    kv_value_t *values = NULL;
+    uint8_t *buf = NULL;
+    size_t count = 0;
+    size_t total = 0;
+    size_t i;
+    kv_key_t *kv;
+    int rc;
+
+    /*
+     * The values are copied out under the lock, so the callback is free
+     * to call back into this connection.
+     */
+    pthread_mutex_lock(&connect->lock);
+
+    rc = kv_sync(connect);
+    if (rc < 0) {
+        pthread_mutex_unlock(&connect->lock);
+        return rc;
+    }
+
+    kv = kv_key_get(connect, key, strlen(key), false);
+    if (!kv || !kv->count) {
+        pthread_mutex_unlock(&connect->lock);
+        return 0;
+    }
+
+    count = kv->count;
+    for (i = 0; i < count; i++)
+        total += kv->values[i].length;
+
+    values = (kv_value_t *)malloc(count * sizeof(kv_value_t));
+    buf = (uint8_t *)malloc(total ? total : 1);
+    if (!values || !buf) {
+        pthread_mutex_unlock(&connect->lock);
+        rc = HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+        goto exit;
+    }
+
+    memcpy(values, kv->values, count * sizeof(kv_value_t));
+    for (i = 0, total = 0; i < count; i++) {
+        if (lseek(connect->log_fd, (off_t)values[i].offset, SEEK_SET) < 0 ||
+            read_all(connect->log_fd, buf + total, values[i].length) < 0) {
+            rc = HIVE_SYS_ERROR(errno);
+            break;
+        }
+        total += values[i].length;
+    }
+
+    pthread_mutex_unlock(&connect->lock);
+
+    if (rc < 0)
+        goto exit;
+
+    for (i = 0, total = 0; i < count; i++) {
+        if (!callback(key, buf + total, values[i].length, context))
+            break;
+        total += values[i].length;
+    }
+
+exit:
+    if (values)
+        free(values);
+    if (buf)
+        free(buf);
+
+    return rc;
+}
+
+static int delete_key(HiveConnect *base, const char *key)
+{
+    NativeConnect *connect = (NativeConnect *)base;
+    bool exists;
+    int rc;
+
+    pthread_mutex_lock(&connect->lock);
+    rc = kv_sync(connect);
+    exists = kv_key_get(connect, key, strlen(key), false) != NULL;
+    pthread_mutex_unlock(&connect->lock);
+
+    if (rc < 0)
+        return rc;
+
+    /* Deleting a missing key is not an error, and not worth a record. */
+    if (!exists)
+        return 0;
+
+    return kv_append(connect, KV_OP_DELETE, key, NULL, 0);
+}
+
+static int get_key_version(HiveConnect *base, const char *key,
+                           char *version, size_t len)
+{
+    NativeConnect *connect = (NativeConnect *)base;
+    kv_key_t *kv;
+    int rc;
+
+    pthread_mutex_lock(&connect->lock);
+
+    rc = kv_sync(connect);
+    if (rc < 0) {
+        pthread_mutex_unlock(&connect->lock);
+        return rc;
+    }
+
+    /*
+     * Any change of a key appends a record, so the offset of its last
+     * value, within this incarnation of the log, identifies its content.
+     */
+    kv = kv_key_get(connect, key, strlen(key), false);
+    if (!kv || !kv->count)
+        rc = HIVE_GENERAL_ERROR(HIVEERR_NOT_EXIST);
+    else
+        rc = snprintf(version, len, "%llx-%llx",
+                      (unsigned long long)connect->log_stat.st_ino,
+                      (unsigned long long)kv->values[kv->count - 1].offset);
+
+    pthread_mutex_unlock(&connect->lock);
+
+    if (rc < 0)
+        return rc;
+
+    if (rc >= (int)len)
+        return HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
+
+    return 0;
+}
+
+static void native_connect_destructor(void *obj)
+{
+    NativeConnect *connect = (NativeConnect *)obj;
+
+    if (connect->log_fd >= 0)
+        close(connect->log_fd);
+
+    if (connect->keys)
+        deref(connect->keys);
+
+    pthread_mutex_destroy(&connect->lock);
+}
+
+HiveConnect *native_client_connect(HiveClient *client, const HiveConnectOptions *opts)
+{
+    NativeConnectOptions *options = (NativeConnectOptions *)opts;
+    NativeConnect *connect;
+    char root[PATH_MAX];
+    int rc;
+
+    assert(options);
+
+    if (options->backendType != HiveBackendType_Native) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS));
+        return NULL;
+    }
+
+    if (options->root && *options->root)
+        rc = snprintf(root, sizeof(root), "%s", options->root);
+    else
+        rc = snprintf(root, sizeof(root), "%s/native", client->data_location);
+    if (rc < 0 || rc >= (int)sizeof(root)) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS));
+        return NULL;
+    }
+
+    connect = (NativeConnect *)rc_zalloc(sizeof(NativeConnect), native_connect_destructor);
+    if (!connect) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY));
+        return NULL;
+    }
+
+    pthread_mutex_init(&connect->lock, NULL);
+    connect->log_fd = -1;
+
+    rc = snprintf(connect->files_dir, sizeof(connect->files_dir), "%s/%s",
+                  root, FILES_DIR);
+    if (rc > 0 && rc < (int)sizeof(connect->files_dir))
+        rc = snprintf(connect->log_path, sizeof(connect->log_path), "%s/%s",
+                      root, KEYS_LOG);
+    if (rc < 0 || rc >= (int)sizeof(connect->log_path)) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS));
+        deref(connect);
+        return NULL;
+    }
+
+    rc = mkdirs(connect->files_dir, S_IRWXU);
+    if (rc < 0 && errno != EEXIST) {
+        hive_set_error(HIVE_SYS_ERROR(errno));
+        deref(connect);
+        return NULL;
+    }
+
+    connect->keys = hashtable_create(64, 0, NULL, NULL);
+    if (!connect->keys) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY));
+        deref(connect);
+        return NULL;
+    }
+
+    rc = kv_open_log(connect);
+    if (rc < 0) {
+        hive_set_error(rc);
+        deref(connect);
+        return NULL;
+    }
+
+    kv_maybe_compact(connect);
+
+    connect->base.put_file_from_buffer = put_file_from_buffer;
+    connect->base.get_file_length      = get_file_length;
+    connect->base.get_file_to_buffer   = get_file_to_buffer;
+    connect->base.list_files           = list_files;
+    connect->base.delete_file          = delete_file;
+    connect->base.get_file_version     = get_file_version;
+    connect->base.put_value            = put_value;
+    connect->base.set_value            = set_value;
+    connect->base.get_values           = get_values;
+    connect->base.delete_key           = delete_key;
+    connect->base.get_key_version      = get_key_version;
+    connect->base.disconnect           = disconnect;
+
+    return &connect->base;
+}
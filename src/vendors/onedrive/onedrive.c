@@ -26,6 +26,8 @@
 #include <errno.h>
 #include <assert.h>
 #include <limits.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
 #ifdef HAVE_UNISTD_H
@@ -39,6 +41,7 @@
 #endif
 
 #include <string.h>
+#include <curl/curl.h>
 #include <crystal.h>
 #include <cjson/cJSON.h>
 
@@ -47,13 +50,82 @@
 #include "http_client.h"
 #include "http_status.h"
 #include "mkdirs.h"
+#include "atomic_file.h"
 #include "oauth_token.h"
 #include "hive_client.h"
+#include "negative_cache.h"
+#include "hot_cache.h"
+#include "single_flight.h"
+
+/*
+ * Upload precondition: NULL overwrites the item unconditionally,
+ * ETAG_ABSENT requires the item not to exist yet, and any other value
+ * is the eTag the item must still carry.
+ */
+#define ETAG_ABSENT         ""
+#define MAX_ETAG_LEN        (128)
+
+#define KV_MAX_RETRIES      (5)
+#define KV_RETRY_BASE_MS    (50)
+
+#define RC_CONTENT_CHANGED  HIVE_HTTP_STATUS_ERROR(HttpStatus_PreconditionFailed)
+
+/*
+ * How long (in seconds) a confirmed absence of a remote path is trusted
+ * before asking the server again.
+ */
+#define NEGATIVE_CACHE_TTL  (30)
+
+#define RC_NOT_FOUND        HIVE_HTTP_STATUS_ERROR(HttpStatus_NotFound)
+
+#define RC_NOT_MODIFIED     HIVE_HTTP_STATUS_ERROR(HttpStatus_NotModified)
+
+#define DEFAULT_MEMORY_CACHE_CAPACITY   (8 * 1024 * 1024)
+
+/*
+ * A request rejected with 401 has already marked the token expired, so
+ * replaying it once goes out with a freshly refreshed token.
+ */
+#define RC_TOKEN_REJECTED   HIVE_GENERAL_ERROR(HIVEERR_TRY_AGAIN)
+
+#define REPLAY_IF_TOKEN_REJECTED(rc, call)                      \
+    do {                                                        \
+        (rc) = (call);                                          \
+        if ((rc) == RC_TOKEN_REJECTED) {                        \
+            vlogD("OneDrive: Access token rejected, replay request."); \
+            (rc) = (call);                                      \
+        }                                                       \
+    } while (0)
+
+#define IS_PRECONDITION_FAILED(rc)                              \
+    ((rc) == HIVE_HTTP_STATUS_ERROR(HttpStatus_PreconditionFailed) || \
+     (rc) == HIVE_HTTP_STATUS_ERROR(HttpStatus_Conflict))
 
 typedef struct OneDriveConnect {
     HiveConnect base;
     oauth_token_t *token;
+    negative_cache_t *absent;
+    hot_cache_t *hot;
+    int max_age;
+    single_flight_t *flights;
     char keystore_path[PATH_MAX];
+
+    /*
+     * The keystore is shared by all processes using the same data
+     * location: refreshes are serialized with a lock on a companion
+     * file, and the keystore identity (inode and mtime) last seen tells
+     * whether another process has replaced it since.
+     */
+    int lock_fd;
+    struct stat keystore_stat;
+
+    /*
+     * Retries are jittered from a seed of their own, so processes sharing
+     * the keystore do not retry in lockstep whether or not the
+     * application seeds rand().
+     */
+    pthread_mutex_t seed_lock;
+    unsigned int seed;
 } OneDriveConnect;
 
 static int disconnect(HiveConnect *base)
@@ -102,42 +174,101 @@ static cJSON *load_keystore_in_json(const char *path)
     return json;
 }
 
+static bool keystore_changed(const struct stat *st, const struct stat *seen)
+{
+    return st->st_ino != seen->st_ino || st->st_dev != seen->st_dev ||
+           st->st_mtime != seen->st_mtime || st->st_size != seen->st_size;
+}
+
 static int oauth_writeback(const cJSON *json, void *user_data)
 {
     OneDriveConnect *connect = (OneDriveConnect *)user_data;
     char *json_str;
-    int json_str_len;
-    int fd;
-    int bytes;
+    int rc;
 
     json_str = cJSON_PrintUnformatted(json);
     if (!json_str || !*json_str)
         return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
 
-    fd = open(connect->keystore_path, O_WRONLY | O_TRUNC | O_CREAT,
-              S_IRUSR | S_IWUSR);
-    if (fd < 0) {
-        free(json_str);
+    /*
+     * Other processes may read the keystore at any time, so it is
+     * replaced as a whole rather than truncated and rewritten in place.
+     */
+    rc = atomic_write_file(connect->keystore_path, json_str,
+                           strlen(json_str) + 1, S_IRUSR | S_IWUSR);
+    free(json_str);
+
+    if (rc < 0)
         return HIVE_SYS_ERROR(errno);
-    }
 
-    json_str_len = (int)strlen(json_str);
-    bytes = (int)write(fd, json_str, json_str_len + 1);
-    free(json_str);
-    close(fd);
+    stat(connect->keystore_path, &connect->keystore_stat);
+    return 0;
+}
+
+static int oauth_store_lock(int lock, void *user_data)
+{
+#if !defined(_WIN32) && !defined(_WIN64)
+    OneDriveConnect *connect = (OneDriveConnect *)user_data;
+    struct flock fl;
+    int rc;
 
-    if (bytes != json_str_len + 1)
+    if (connect->lock_fd < 0)
+        return 0;
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = lock ? F_WRLCK : F_UNLCK;
+    fl.l_whence = SEEK_SET;
+
+    do {
+        rc = fcntl(connect->lock_fd, F_SETLKW, &fl);
+    } while (rc < 0 && errno == EINTR);
+
+    if (rc < 0)
         return HIVE_SYS_ERROR(errno);
+#endif
 
     return 0;
 }
 
+static cJSON *oauth_store_reload(void *user_data)
+{
+    OneDriveConnect *connect = (OneDriveConnect *)user_data;
+    struct stat st;
+    cJSON *json;
+
+    if (stat(connect->keystore_path, &st) < 0 ||
+        !keystore_changed(&st, &connect->keystore_stat))
+        return NULL;
+
+    json = load_keystore_in_json(connect->keystore_path);
+    if (!json)
+        return NULL;
+
+    vlogD("OneDrive: Keystore changed by another process, reloaded.");
+    connect->keystore_stat = st;
+    return json;
+}
+
 static void onedrive_connect_destructor(void *obj)
 {
     OneDriveConnect *connect = (OneDriveConnect *)obj;
 
     if (connect->token)
         oauth_token_delete(connect->token);
+
+    if (connect->absent)
+        negative_cache_close(connect->absent);
+
+    if (connect->hot)
+        hot_cache_close(connect->hot);
+
+    if (connect->flights)
+        single_flight_close(connect->flights);
+
+    if (connect->lock_fd >= 0)
+        close(connect->lock_fd);
+
+    pthread_mutex_destroy(&connect->seed_lock);
 }
 
 static int expire_token(HiveConnect *base)
@@ -195,7 +326,7 @@ static int __create_folder(OneDriveConnect *connect, http_client_t *httpc,
     http_client_set_url(httpc, url);
     http_client_set_method(httpc, HTTP_METHOD_POST);
     http_client_set_header(httpc, "Content-Type", "application/json");
-    http_client_set_header(httpc, "Authorization", get_bearer_token(connect->token));
+    oauth_token_authorize(connect->token, httpc);
     http_client_set_request_body_instant(httpc, body, strlen(body));
 
     rc = http_client_request(httpc);
@@ -218,8 +349,20 @@ static int __create_folder(OneDriveConnect *connect, http_client_t *httpc,
     return 0;
 }
 
+static void __set_precondition(http_client_t *httpc, const char *etag)
+{
+    if (!etag)
+        return;
+
+    if (!*etag)
+        http_client_set_header(httpc, "If-None-Match", "*");
+    else
+        http_client_set_header(httpc, "If-Match", etag);
+}
+
 static int __upload_file(OneDriveConnect *connect, http_client_t *httpc,
-                         const char *file_path, const void *from, size_t length)
+                         const char *file_path, const void *from, size_t length,
+                         const char *etag)
 {
     char url[MAX_URL_LEN] = {0};
     long resp_code = 0;
@@ -229,7 +372,8 @@ static int __upload_file(OneDriveConnect *connect, http_client_t *httpc,
 
     http_client_set_url(httpc, url);
     http_client_set_method(httpc, HTTP_METHOD_PUT);
-    http_client_set_header(httpc, "Authorization", get_bearer_token(connect->token));
+    oauth_token_authorize(connect->token, httpc);
+    __set_precondition(httpc, etag);
     http_client_set_request_body_instant(httpc, length ? from : NULL, length);
 
     rc = http_client_request(httpc);
@@ -254,8 +398,11 @@ static int __upload_file(OneDriveConnect *connect, http_client_t *httpc,
 static int __create_upload_session(OneDriveConnect *connect,
                                    http_client_t *httpc,
                                    const char *file_path,
+                                   const char *etag,
                                    void *upload_url, size_t len)
 {
+    static const char create_only_body[] =
+        "{\"item\":{\"@microsoft.graph.conflictBehavior\":\"fail\"}}";
     char url[MAX_URL_LEN] = {0};
     cJSON *upload_url_json;
     long resp_code = 0;
@@ -267,8 +414,14 @@ static int __create_upload_session(OneDriveConnect *connect,
 
     http_client_set_url(httpc, url);
     http_client_set_method(httpc, HTTP_METHOD_POST);
-    http_client_set_header(httpc, "Authorization", get_bearer_token(connect->token));
-    http_client_set_request_body_instant(httpc, NULL, 0);
+    oauth_token_authorize(connect->token, httpc);
+    __set_precondition(httpc, etag);
+    if (etag && !*etag) {
+        http_client_set_header(httpc, "Content-Type", "application/json");
+        http_client_set_request_body_instant(httpc, create_only_body,
+                                             strlen(create_only_body));
+    } else
+        http_client_set_request_body_instant(httpc, NULL, 0);
     http_client_enable_response_body(httpc);
 
     rc = http_client_request(httpc);
@@ -348,7 +501,8 @@ static int __upload_to_session(OneDriveConnect *connect, http_client_t *httpc,
 static int __put_file_from_buffer(OneDriveConnect *connect,
                                   const void *from, size_t length,
                                   bool encrypt,
-                                  const char *path)
+                                  const char *path,
+                                  const char *etag)
 {
     char url[MAX_URL_LEN] = {0};
     char path_tmp[PATH_MAX];
@@ -364,10 +518,29 @@ static int __put_file_from_buffer(OneDriveConnect *connect,
     if (!httpc)
         return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
 
+    /*
+     * Whether or not the upload goes through, the cached copy may be
+     * outdated from now on.
+     */
+    if (connect->hot)
+        hot_cache_remove(connect->hot, path);
+
     if (length <= 4 * 1024 * 1024) {
-        rc = __upload_file(connect, httpc, path, from, length);
+        rc = __upload_file(connect, httpc, path, from, length, etag);
         http_client_close(httpc);
-        return rc;
+
+        /*
+         * Reads from now on do not join one started before the upload,
+         * and those do not cache what they read.
+         */
+        single_flight_forget(connect->flights, path);
+        if (connect->hot)
+            hot_cache_remove(connect->hot, path);
+        if (rc < 0)
+            return rc;
+
+        negative_cache_remove(connect->absent, path);
+        return 0;
     }
 
     strcpy(path_tmp, path);
@@ -381,7 +554,7 @@ static int __put_file_from_buffer(OneDriveConnect *connect,
 
     http_client_reset(httpc);
 
-    rc = __create_upload_session(connect, httpc, path, url, sizeof(url));
+    rc = __create_upload_session(connect, httpc, path, etag, url, sizeof(url));
     if (rc < 0) {
         http_client_close(httpc);
         return rc;
@@ -391,9 +564,14 @@ static int __put_file_from_buffer(OneDriveConnect *connect,
 
     rc = __upload_to_session(connect, httpc, url, from, length);
     http_client_close(httpc);
+
+    single_flight_forget(connect->flights, path);
+    if (connect->hot)
+        hot_cache_remove(connect->hot, path);
     if (rc < 0)
         return rc;
 
+    negative_cache_remove(connect->absent, path);
     return 0;
 }
 
@@ -402,27 +580,39 @@ static int put_file_from_buffer(HiveConnect *base, const void *from,
 {
     OneDriveConnect *connect = (OneDriveConnect *)base;
     char path[PATH_MAX] = {0};
+    int rc;
 
     snprintf(path, sizeof(path), "%s/%s", FILES_DIR, filename);
 
-    return __put_file_from_buffer(connect, from, length, encrypt, path);
+    REPLAY_IF_TOKEN_REJECTED(rc, __put_file_from_buffer(connect, from, length,
+                                                        encrypt, path, NULL));
+    return rc;
 }
 
+/*
+ * With an eTag, the server answers RC_NOT_MODIFIED while the item still
+ * carries it.
+ */
 static int __get_file_info(OneDriveConnect *connect, http_client_t *httpc, const char *file_path,
-                           const char *query, cJSON **response)
+                           const char *query, const char *etag, cJSON **response)
 {
     char url[MAX_URL_LEN] = {0};
+    uint64_t generation;
     long resp_code = 0;
     cJSON *resp;
     char *p;
     int rc;
 
+    generation = negative_cache_generation(connect->absent);
+
     sprintf(url, "%s:%s", APP_ROOT, file_path);
 
     http_client_set_url(httpc, url);
     http_client_set_query(httpc, "select", query);
     http_client_set_method(httpc, HTTP_METHOD_GET);
-    http_client_set_header(httpc, "Authorization", get_bearer_token(connect->token));
+    oauth_token_authorize(connect->token, httpc);
+    if (etag)
+        http_client_set_header(httpc, "If-None-Match", etag);
     http_client_enable_response_body(httpc);
 
     rc = http_client_request(httpc);
@@ -438,6 +628,9 @@ static int __get_file_info(OneDriveConnect *connect, http_client_t *httpc, const
         return HIVE_GENERAL_ERROR(HIVEERR_TRY_AGAIN);
     }
 
+    if (resp_code == HttpStatus_NotFound)
+        negative_cache_put(connect->absent, file_path, generation);
+
     if (resp_code != HttpStatus_OK)
         return HIVE_HTTP_STATUS_ERROR(resp_code);
 
@@ -461,6 +654,17 @@ static int __get_file_info(OneDriveConnect *connect, http_client_t *httpc, const
         }
     }
 
+    if (strstr(query, "eTag")) {
+        cJSON *etag;
+
+        etag = cJSON_GetObjectItemCaseSensitive(resp, "eTag");
+        if (!etag || !cJSON_IsString(etag) || !etag->valuestring ||
+            !*etag->valuestring || strlen(etag->valuestring) >= MAX_ETAG_LEN) {
+            cJSON_Delete(resp);
+            return HIVE_GENERAL_ERROR(HIVEERR_BAD_JSON_FORMAT);
+        }
+    }
+
     if (strstr(query, "@microsoft.graph.downloadUrl")) {
         cJSON *download_url;
 
@@ -477,14 +681,45 @@ static int __get_file_info(OneDriveConnect *connect, http_client_t *httpc, const
     return 0;
 }
 
+/*
+ * Find the copy of a remote file read last, if it is cached in memory.
+ * A copy confirmed within max_age seconds is fresh and served as is; any
+ * other is revalidated with its eTag.
+ */
+static hot_object_t *__hot_lookup(OneDriveConnect *connect, const char *file_path,
+                                  int max_age, bool *fresh)
+{
+    *fresh = false;
+
+    if (!connect->hot)
+        return NULL;
+
+    return hot_cache_get(connect->hot, file_path, max_age, fresh);
+}
+
 static ssize_t __get_file_length(OneDriveConnect *connect, const char *file_path)
 {
     http_client_t *httpc;
+    hot_object_t *object;
     ssize_t fsize;
     cJSON *resp;
     cJSON *size;
+    bool fresh;
     int rc;
 
+    object = __hot_lookup(connect, file_path, connect->max_age, &fresh);
+    if (object) {
+        fsize = (ssize_t)object->size;
+        deref(object);
+        if (fresh) {
+            hot_cache_count(connect->hot, HOT_CACHE_HIT);
+            return fsize;
+        }
+    }
+
+    if (negative_cache_is_absent(connect->absent, file_path))
+        return RC_NOT_FOUND;
+
     rc = oauth_token_check_expire(connect->token);
     if (rc < 0)
         return rc;
@@ -493,7 +728,7 @@ static ssize_t __get_file_length(OneDriveConnect *connect, const char *file_path
     if (!httpc)
         return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
 
-    rc = __get_file_info(connect, httpc, file_path, "size", &resp);
+    rc = __get_file_info(connect, httpc, file_path, "size", NULL, &resp);
     http_client_close(httpc);
     if (rc < 0)
         return rc;
@@ -509,38 +744,50 @@ static ssize_t get_file_length(HiveConnect *base, const char *filename)
 {
     OneDriveConnect *connect = (OneDriveConnect *)base;
     char file_path[PATH_MAX];
+    ssize_t fsize;
     int rc;
 
     rc = snprintf(file_path, sizeof(file_path), "%s/%s", FILES_DIR, filename);
     if (rc < 0 || rc >= sizeof(file_path))
         return HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
 
-    return __get_file_length(connect, file_path);
+    REPLAY_IF_TOKEN_REJECTED(fsize, __get_file_length(connect, file_path));
+    return fsize;
 }
 
 static size_t __download_file_response_body_callback(char *buffer, size_t size,
                                                      size_t nitems, void *userdata)
 {
     size_t total_sz = size * nitems;
-    uint8_t **buf = (uint8_t **)userdata;
+    uint8_t **buf = (uint8_t **)((void **)userdata)[0];
+    size_t *left = (size_t *)((void **)userdata)[1];
+
+    if (total_sz > *left)
+        return 0;
 
     memcpy(*buf, buffer, total_sz);
     *buf += total_sz;
+    *left -= total_sz;
 
     return total_sz;
 }
 
-static int __download_file(OneDriveConnect *connect, http_client_t *httpc, const char *download_url, void *buf)
+static int __download_file(OneDriveConnect *connect, http_client_t *httpc,
+                           const char *download_url, void *buf, size_t len)
 {
     long resp_code;
+    size_t left = len;
+    void *args[] = {&buf, &left};
     int rc;
 
     http_client_set_url(httpc, download_url);
     http_client_set_method(httpc, HTTP_METHOD_GET);
     http_client_enable_response_body(httpc);
-    http_client_set_response_body(httpc, __download_file_response_body_callback, &buf);
+    http_client_set_response_body(httpc, __download_file_response_body_callback, args);
 
     rc = http_client_request(httpc);
+    if (rc == CURLE_WRITE_ERROR)
+        return RC_CONTENT_CHANGED;
     if (rc)
         return HIVE_CURL_ERROR(rc);
 
@@ -551,35 +798,89 @@ static int __download_file(OneDriveConnect *connect, http_client_t *httpc, const
     if (resp_code != HttpStatus_OK)
         return HIVE_HTTP_STATUS_ERROR(resp_code);
 
+    /*
+     * The item has been rewritten since its size was queried.
+     */
+    if (left)
+        return RC_CONTENT_CHANGED;
+
     return 0;
 }
 
+static ssize_t __copy_cached(OneDriveConnect *connect, hot_object_t *object,
+                             hot_cache_outcome_t outcome, void *to, size_t buflen)
+{
+    size_t size = object->size;
+    int rc = 0;
+
+    if (size > buflen)
+        rc = HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
+    else if (size)
+        memcpy(to, object->data, size);
+
+    deref(object);
+
+    if (rc < 0)
+        return rc;
+
+    hot_cache_count(connect->hot, outcome);
+    return (ssize_t)size;
+}
+
 static ssize_t __get_file_to_buffer(OneDriveConnect *connect, const char *file_path,
                                     bool decrypt, void *to, size_t buflen)
 {
+    hot_object_t *object;
     http_client_t *httpc;
     cJSON *download_url;
+    uint64_t generation;
     ssize_t fsize;
     cJSON *resp;
     cJSON *size;
+    cJSON *etag;
+    bool fresh;
     int rc;
 
-    rc = oauth_token_check_expire(connect->token);
-    if (rc < 0)
-        return rc;
+    if (negative_cache_is_absent(connect->absent, file_path))
+        return RC_NOT_FOUND;
 
-    httpc = http_client_new();
-    if (!httpc)
-        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+    object = __hot_lookup(connect, file_path, connect->max_age, &fresh);
+    if (object && fresh)
+        return __copy_cached(connect, object, HOT_CACHE_HIT, to, buflen);
 
+    generation = connect->hot ? hot_cache_generation(connect->hot) : 0;
+
+    rc = oauth_token_check_expire(connect->token);
+    httpc = rc < 0 ? NULL : http_client_new();
+    if (!httpc) {
+        if (object)
+            deref(object);
+        return rc < 0 ? rc : HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+    }
+
+    /*
+     * A cached copy is revalidated and the download skipped in the same
+     * round trip.
+     */
     rc = __get_file_info(connect, httpc, file_path,
-                         "size,@microsoft.graph.downloadUrl", &resp);
+                         "size,eTag,@microsoft.graph.downloadUrl",
+                         object ? object->tag : NULL, &resp);
+    if (object && rc == RC_NOT_MODIFIED) {
+        http_client_close(httpc);
+        hot_cache_validate(connect->hot, file_path, object->tag);
+        return __copy_cached(connect, object, HOT_CACHE_REVALIDATED, to, buflen);
+    }
+
+    if (object)
+        deref(object);
+
     if (rc < 0) {
         http_client_close(httpc);
         return rc;
     }
 
     size = cJSON_GetObjectItemCaseSensitive(resp, "size");
+    etag = cJSON_GetObjectItemCaseSensitive(resp, "eTag");
     fsize = (ssize_t)size->valuedouble;
     download_url = cJSON_GetObjectItemCaseSensitive(resp, "@microsoft.graph.downloadUrl");
 
@@ -589,14 +890,17 @@ static ssize_t __get_file_to_buffer(OneDriveConnect *connect, const char *file_p
         return HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
     }
 
-    if (!fsize) {
-        cJSON_Delete(resp);
-        http_client_close(httpc);
-        return 0;
+    if (fsize) {
+        http_client_reset(httpc);
+        rc = __download_file(connect, httpc, download_url->valuestring, to, fsize);
+    }
+
+    if (!rc && connect->hot) {
+        hot_cache_put(connect->hot, file_path, etag->valuestring, to,
+                      (size_t)fsize, generation);
+        hot_cache_count(connect->hot, HOT_CACHE_MISS);
     }
 
-    http_client_reset(httpc);
-    rc = __download_file(connect, httpc, download_url->valuestring, to);
     cJSON_Delete(resp);
     http_client_close(httpc);
     if (rc < 0)
@@ -610,19 +914,33 @@ static ssize_t get_file_to_buffer(HiveConnect *base, const char *filename,
 {
     OneDriveConnect *connect = (OneDriveConnect *)base;
     char file_path[PATH_MAX];
+    flight_t *flight;
+    ssize_t fsize;
     int rc;
 
     rc = snprintf(file_path, sizeof(file_path), "%s/%s", FILES_DIR, filename);
     if (rc < 0 || rc >= sizeof(file_path))
         return HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
 
-    return __get_file_to_buffer(connect, file_path, decrypt, to, buflen);
+    /* Concurrent reads of the same file share one request chain. */
+    if (!single_flight_join(connect->flights, file_path, &flight)) {
+        fsize = single_flight_copy(flight, to, buflen);
+        single_flight_leave(connect->flights, flight);
+        return fsize;
+    }
+
+    REPLAY_IF_TOKEN_REJECTED(fsize, __get_file_to_buffer(connect, file_path,
+                                                         decrypt, to, buflen));
+    single_flight_land(connect->flights, flight, fsize < 0 ? (int)fsize : 0,
+                       to, fsize < 0 ? 0 : (size_t)fsize);
+    return fsize;
 }
 
 static int __delete_file(OneDriveConnect *connect, const char *file_path)
 {
     char url[MAX_URL_LEN] = {0};
     http_client_t *httpc;
+    uint64_t generation;
     long resp_code = 0;
     int rc;
 
@@ -630,6 +948,8 @@ static int __delete_file(OneDriveConnect *connect, const char *file_path)
     if (rc < 0)
         return rc;
 
+    generation = negative_cache_generation(connect->absent);
+
     httpc = http_client_new();
     if (!httpc)
         return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
@@ -637,9 +957,10 @@ static int __delete_file(OneDriveConnect *connect, const char *file_path)
     sprintf(url, "%s:%s:", APP_ROOT, file_path);
     http_client_set_url(httpc, url);
     http_client_set_method(httpc, HTTP_METHOD_DELETE);
-    http_client_set_header(httpc, "Authorization", get_bearer_token(connect->token));
+    oauth_token_authorize(connect->token, httpc);
 
     rc = http_client_request(httpc);
+    single_flight_forget(connect->flights, file_path);
     if (rc) {
         rc = HIVE_CURL_ERROR(rc);
         goto error_exit;
@@ -656,9 +977,16 @@ static int __delete_file(OneDriveConnect *connect, const char *file_path)
         return HIVE_GENERAL_ERROR(HIVEERR_TRY_AGAIN);
     }
 
-    if (resp_code != HttpStatus_NoContent)
+    if (resp_code != HttpStatus_NoContent && resp_code != HttpStatus_NotFound)
         return HIVE_HTTP_STATUS_ERROR(resp_code);
 
+    negative_cache_put(connect->absent, file_path, generation);
+    if (connect->hot)
+        hot_cache_remove(connect->hot, file_path);
+
+    if (resp_code == HttpStatus_NotFound)
+        return RC_NOT_FOUND;
+
     return 0;
 
 error_exit:
@@ -676,7 +1004,56 @@ static int delete_file(HiveConnect *base, const char *filename)
     if (rc < 0 || rc >= sizeof(file_path))
         return HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
 
-    return __delete_file(connect, file_path);
+    REPLAY_IF_TOKEN_REJECTED(rc, __delete_file(connect, file_path));
+    return rc;
+}
+
+static int __get_version(OneDriveConnect *connect, const char *path,
+                         char *version, size_t len)
+{
+    http_client_t *httpc;
+    cJSON *etag;
+    cJSON *resp;
+    int rc;
+
+    if (negative_cache_is_absent(connect->absent, path))
+        return RC_NOT_FOUND;
+
+    rc = oauth_token_check_expire(connect->token);
+    if (rc < 0)
+        return rc;
+
+    httpc = http_client_new();
+    if (!httpc)
+        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+
+    rc = __get_file_info(connect, httpc, path, "eTag", NULL, &resp);
+    http_client_close(httpc);
+    if (rc < 0)
+        return rc;
+
+    etag = cJSON_GetObjectItemCaseSensitive(resp, "eTag");
+    rc = snprintf(version, len, "%s", etag->valuestring);
+    cJSON_Delete(resp);
+    if (rc < 0 || rc >= (int)len)
+        return HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
+
+    return 0;
+}
+
+static int get_file_version(HiveConnect *base, const char *filename,
+                            char *version, size_t len)
+{
+    OneDriveConnect *connect = (OneDriveConnect *)base;
+    char file_path[PATH_MAX];
+    int rc;
+
+    rc = snprintf(file_path, sizeof(file_path), "%s/%s", FILES_DIR, filename);
+    if (rc < 0 || rc >= sizeof(file_path))
+        return HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
+
+    REPLAY_IF_TOKEN_REJECTED(rc, __get_version(connect, file_path, version, len));
+    return rc;
 }
 
 static int __merge_array(cJSON *sub, cJSON *array)
@@ -736,12 +1113,37 @@ static void __notify_user_files(cJSON *array, HiveFilesIterateCallback *callback
     callback(NULL, context);
 }
 
-static int list_files(HiveConnect *base, HiveFilesIterateCallback *callback, void *context)
+/*
+ * A complete listing of a folder tells which names do NOT exist in it, so
+ * it is folded into the negative cache to answer later misses locally.
+ */
+static void __seed_absent(OneDriveConnect *connect, const char *folder,
+                          cJSON *array, uint64_t generation)
+{
+    const char **names;
+    cJSON *item;
+    size_t count = 0;
+
+    names = (const char **)calloc(cJSON_GetArraySize(array) + 1, sizeof(char *));
+    if (!names)
+        return;
+
+    cJSON_ArrayForEach(item, array) {
+        cJSON *name = cJSON_GetObjectItemCaseSensitive(item, "name");
+        names[count++] = name->valuestring;
+    }
+
+    negative_cache_seed(connect->absent, folder, names, count, generation);
+    free(names);
+}
+
+static int __list_files(OneDriveConnect *connect,
+                        HiveFilesIterateCallback *callback, void *context)
 {
-    OneDriveConnect *connect = (OneDriveConnect *)base;
     char url[MAX_URL_LEN] = {0};
     char *next_url = NULL;
     http_client_t *httpc;
+    uint64_t generation;
     cJSON *json = NULL;
     long resp_code;
     cJSON *array;
@@ -751,6 +1153,8 @@ static int list_files(HiveConnect *base, HiveFilesIterateCallback *callback, voi
     if (rc < 0)
         return rc;
 
+    generation = negative_cache_generation(connect->absent);
+
     httpc = http_client_new();
     if (!httpc)
         return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
@@ -772,7 +1176,7 @@ static int list_files(HiveConnect *base, HiveFilesIterateCallback *callback, voi
         http_client_reset(httpc);
         http_client_set_url(httpc, next_url);
         http_client_set_method(httpc, HTTP_METHOD_GET);
-        http_client_set_header(httpc, "Authorization", get_bearer_token(connect->token));
+        oauth_token_authorize(connect->token, httpc);
         http_client_enable_response_body(httpc);
 
         rc = http_client_request(httpc);
@@ -840,6 +1244,7 @@ static int list_files(HiveConnect *base, HiveFilesIterateCallback *callback, voi
         else {
             next_url = NULL;
             cJSON_Delete(json);
+            __seed_absent(connect, FILES_DIR, array, generation);
             __notify_user_files(array, callback, context);
             rc = 0;
         }
@@ -854,55 +1259,256 @@ error_exit:
     return rc;
 }
 
+static int list_files(HiveConnect *base, HiveFilesIterateCallback *callback, void *context)
+{
+    OneDriveConnect *connect = (OneDriveConnect *)base;
+    int rc;
+
+    REPLAY_IF_TOKEN_REJECTED(rc, __list_files(connect, callback, context));
+    return rc;
+}
+
 typedef struct KVEntry {
     uint32_t val_len;
     uint8_t  val[0];
 } KVEntry;
 
+static void __backoff(OneDriveConnect *connect, int attempt)
+{
+    useconds_t delay;
+    int jitter;
+
+    pthread_mutex_lock(&connect->seed_lock);
+    jitter = rand_r(&connect->seed) % KV_RETRY_BASE_MS;
+    pthread_mutex_unlock(&connect->seed_lock);
+
+    delay = (KV_RETRY_BASE_MS << attempt) + jitter;
+    usleep(delay * 1000);
+}
+
+/*
+ * Load the whole content of a key file together with its eTag, reserving
+ * extra bytes at the tail of the returned buffer. A missing file yields an
+ * empty content and ETAG_ABSENT, so a later conditional upload only
+ * succeeds if nobody has created the file in between.
+ */
+static int __load_absent_file(size_t reserved, uint8_t **content,
+                              size_t *length, char *etag, size_t etag_len)
+{
+    uint8_t *buf;
+
+    buf = calloc(1, reserved ? reserved : 1);
+    if (!buf)
+        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+
+    snprintf(etag, etag_len, "%s", ETAG_ABSENT);
+    *content = buf;
+    *length = 0;
+    return 0;
+}
+
+static int __load_cached(OneDriveConnect *connect, hot_object_t *object,
+                         hot_cache_outcome_t outcome, size_t reserved,
+                         uint8_t **content, size_t *length, char *etag,
+                         size_t etag_len)
+{
+    uint8_t *buf;
+    int rc;
+
+    rc = snprintf(etag, etag_len, "%s", object->tag);
+    if (rc < 0 || rc >= (int)etag_len) {
+        deref(object);
+        return HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
+    }
+
+    buf = calloc(1, (object->size + reserved) ? (object->size + reserved) : 1);
+    if (!buf) {
+        deref(object);
+        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+    }
+
+    memcpy(buf, object->data, object->size);
+    *content = buf;
+    *length = object->size;
+    deref(object);
+
+    hot_cache_count(connect->hot, outcome);
+    return 0;
+}
+
+/*
+ * Readers pass the configured max_age; read-modify-write cycles pass 0,
+ * as they need the current eTag for their conditional upload.
+ */
+static int __load_file_once(OneDriveConnect *connect, const char *file_path,
+                            int max_age, size_t reserved, uint8_t **content,
+                            size_t *length, char *etag, size_t etag_len)
+{
+    hot_object_t *object;
+    http_client_t *httpc;
+    cJSON *download_url;
+    cJSON *etag_json;
+    uint64_t generation;
+    ssize_t fsize;
+    uint8_t *buf;
+    cJSON *resp;
+    cJSON *size;
+    bool fresh;
+    int rc;
+
+    if (negative_cache_is_absent(connect->absent, file_path))
+        return __load_absent_file(reserved, content, length, etag, etag_len);
+
+    object = __hot_lookup(connect, file_path, max_age, &fresh);
+    if (object && fresh)
+        return __load_cached(connect, object, HOT_CACHE_HIT, reserved,
+                             content, length, etag, etag_len);
+
+    generation = connect->hot ? hot_cache_generation(connect->hot) : 0;
+
+    rc = oauth_token_check_expire(connect->token);
+    httpc = rc < 0 ? NULL : http_client_new();
+    if (!httpc) {
+        if (object)
+            deref(object);
+        return rc < 0 ? rc : HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+    }
+
+    rc = __get_file_info(connect, httpc, file_path,
+                         "size,eTag,@microsoft.graph.downloadUrl",
+                         object ? object->tag : NULL, &resp);
+    if (object && rc == RC_NOT_MODIFIED) {
+        http_client_close(httpc);
+        hot_cache_validate(connect->hot, file_path, object->tag);
+        return __load_cached(connect, object, HOT_CACHE_REVALIDATED, reserved,
+                             content, length, etag, etag_len);
+    }
+
+    if (object)
+        deref(object);
+
+    if (rc == RC_NOT_FOUND) {
+        http_client_close(httpc);
+        return __load_absent_file(reserved, content, length, etag, etag_len);
+    }
+
+    if (rc < 0) {
+        http_client_close(httpc);
+        return rc;
+    }
+
+    size = cJSON_GetObjectItemCaseSensitive(resp, "size");
+    etag_json = cJSON_GetObjectItemCaseSensitive(resp, "eTag");
+    download_url = cJSON_GetObjectItemCaseSensitive(resp, "@microsoft.graph.downloadUrl");
+    fsize = (ssize_t)size->valuedouble;
+
+    rc = snprintf(etag, etag_len, "%s", etag_json->valuestring);
+    if (rc < 0 || rc >= (int)etag_len) {
+        cJSON_Delete(resp);
+        http_client_close(httpc);
+        return HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
+    }
+
+    buf = calloc(1, (fsize + reserved) ? (fsize + reserved) : 1);
+    if (!buf) {
+        cJSON_Delete(resp);
+        http_client_close(httpc);
+        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+    }
+
+    if (fsize > 0) {
+        http_client_reset(httpc);
+        rc = __download_file(connect, httpc, download_url->valuestring, buf, fsize);
+    } else
+        rc = 0;
+
+    cJSON_Delete(resp);
+    http_client_close(httpc);
+
+    if (rc < 0) {
+        free(buf);
+        return rc;
+    }
+
+    if (connect->hot) {
+        hot_cache_put(connect->hot, file_path, etag, buf, (size_t)fsize,
+                      generation);
+        hot_cache_count(connect->hot, HOT_CACHE_MISS);
+    }
+
+    *content = buf;
+    *length = (size_t)fsize;
+    return 0;
+}
+
+static int __load_file(OneDriveConnect *connect, const char *file_path,
+                       int max_age, size_t reserved, uint8_t **content,
+                       size_t *length, char *etag, size_t etag_len)
+{
+    int attempt;
+    int rc;
+
+    for (attempt = 0; ; attempt++) {
+        REPLAY_IF_TOKEN_REJECTED(rc, __load_file_once(connect, file_path,
+                                                      max_age, reserved, content,
+                                                      length, etag, etag_len));
+        if (rc != RC_CONTENT_CHANGED || attempt + 1 >= KV_MAX_RETRIES)
+            return rc;
+
+        __backoff(connect, attempt);
+    }
+}
+
+
 static int put_value(HiveConnect *base, const char *key, const void *value,
                      size_t length, bool encrypt)
 {
     OneDriveConnect *connect = (OneDriveConnect *)base;
     char path[PATH_MAX] = {0};
-    ssize_t size_new;
-    ssize_t size;
+    char etag[MAX_ETAG_LEN];
+    size_t size;
     KVEntry *kv;
     uint8_t *buf;
+    int attempt;
     int rc;
 
     snprintf(path, sizeof(path), "%s/%s", KEYS_DIR, key);
 
-    size = __get_file_length(connect, path);
-    if ((int)size == HIVE_HTTP_STATUS_ERROR(HttpStatus_NotFound))
-        size = 0;
-    else if (size < 0)
-        return (int)size;
+    /*
+     * Appending is a read-modify-write of the key file. The upload is made
+     * conditional on the eTag of the version we read; if another writer got
+     * in first, re-read its version, re-append and try again.
+     */
+    for (attempt = 0; ; attempt++) {
+        rc = __load_file(connect, path, 0, sizeof(KVEntry) + length, &buf,
+                         &size, etag, sizeof(etag));
+        if (rc < 0)
+            return rc;
 
-    size_new = size + sizeof(KVEntry) + length;
-    buf = calloc(1, size_new);
-    if (!buf)
-        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+        kv = (KVEntry *)(buf + size);
+        kv->val_len = htonl((uint32_t)length);
+        memcpy(kv->val, value, length);
 
-    if (size > 0) {
-        rc = (int)__get_file_to_buffer(connect, path, encrypt, buf, size);
-        if (rc < 0) {
-            free(buf);
+        REPLAY_IF_TOKEN_REJECTED(rc, __put_file_from_buffer(connect, buf,
+                                             size + sizeof(KVEntry) + length,
+                                             encrypt, path, etag));
+        free(buf);
+
+        if (!IS_PRECONDITION_FAILED(rc))
             return rc;
-        }
 
-        if (rc != (int)size) {
-            free(buf);
-            return HIVE_GENERAL_ERROR(HIVEERR_INVALID_PERSISTENCE_FILE);
-        }
-    }
+        /* The key exists remotely, whatever the negative cache believed. */
+        negative_cache_remove(connect->absent, path);
 
-    kv = (KVEntry *)(buf + size);
-    kv->val_len = htonl((uint32_t)length);
-    memcpy(kv->val, value, length);
+        if (attempt + 1 >= KV_MAX_RETRIES)
+            break;
 
-    rc = __put_file_from_buffer(connect, buf, size_new, encrypt, path);
-    free(buf);
+        vlogD("OneDrive: Key %s changed concurrently, retry appending.", key);
+        __backoff(connect, attempt);
+    }
 
+    vlogW("OneDrive: Give up appending to key %s after %d conflicts.",
+          key, KV_MAX_RETRIES);
     return rc;
 }
 
@@ -923,8 +1529,9 @@ static int set_value(HiveConnect *base, const char *key, const void *value,
     kv->val_len = htonl((uint32_t)length);
     memcpy(kv->val, value, length);
 
-    rc = __put_file_from_buffer(connect, kv, sizeof(KVEntry) + length,
-                                encrypt, path);
+    REPLAY_IF_TOKEN_REJECTED(rc, __put_file_from_buffer(connect, kv,
+                                                        sizeof(KVEntry) + length,
+                                                        encrypt, path, NULL));
     free(kv);
 
     return rc;
@@ -935,42 +1542,46 @@ static int get_values(HiveConnect *base, const char *key, bool decrypt,
 {
     OneDriveConnect *connect = (OneDriveConnect *)base;
     char path[PATH_MAX] = {0};
+    char etag[MAX_ETAG_LEN];
+    flight_t *flight;
     ssize_t data_len;
+    size_t size;
     bool proceed;
+    uint8_t *buf;
     KVEntry *kv;
-    ssize_t rc;
-    void *buf;
+    int rc;
 
     snprintf(path, sizeof(path), "%s/%s", KEYS_DIR, key);
 
-    data_len = __get_file_length(connect, path);
-    if ((int)data_len == HIVE_HTTP_STATUS_ERROR(HttpStatus_NotFound))
-        data_len = 0;
-    else if (data_len < 0)
-        return (int)data_len;
-
-    if (data_len > 0 && data_len <= sizeof(KVEntry))
-        return HIVE_GENERAL_ERROR(HIVEERR_BAD_PERSISTENT_DATA);
-
-    if (!data_len)
-        return 0;
+    /*
+     * Concurrent reads of the same key share one load. Values are parsed
+     * in place, so followers take a copy, before any callback runs.
+     */
+    if (!single_flight_join(connect->flights, path, &flight)) {
+        rc = single_flight_dup(flight, &buf, &size);
+        single_flight_leave(connect->flights, flight);
+    } else {
+        rc = __load_file(connect, path, connect->max_age, 0, &buf, &size,
+                         etag, sizeof(etag));
+        single_flight_land(connect->flights, flight, rc, rc < 0 ? NULL : buf,
+                           rc < 0 ? 0 : size);
+    }
 
-    buf = calloc(1, data_len);
-    if (!buf)
-        return HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY);
+    if (rc < 0)
+        return rc;
 
-    rc = __get_file_to_buffer(connect, path, decrypt, buf, data_len);
-    if (rc < 0) {
+    data_len = (ssize_t)size;
+    if (data_len > 0 && data_len <= sizeof(KVEntry)) {
         free(buf);
-        return (int)rc;
+        return HIVE_GENERAL_ERROR(HIVEERR_BAD_PERSISTENT_DATA);
     }
 
-    if (rc != data_len) {
+    if (!data_len) {
         free(buf);
-        return HIVE_GENERAL_ERROR(HIVEERR_INVALID_PERSISTENCE_FILE);
+        return 0;
     }
 
-    kv = buf;
+    kv = (KVEntry *)buf;
     while (1) {
         size_t entry_len;
 
@@ -1006,13 +1617,39 @@ static int delete_key(HiveConnect *base, const char *key)
 
     snprintf(path, sizeof(path), "%s/%s", KEYS_DIR, key);
 
-    rc = __delete_file(connect, path);
+    REPLAY_IF_TOKEN_REJECTED(rc, __delete_file(connect, path));
     if (rc < 0 && rc != HIVE_HTTP_STATUS_ERROR(HttpStatus_NotFound))
         return rc;
 
     return 0;
 }
 
+static int get_cache_stats(HiveConnect *base, HiveCacheStats *stats)
+{
+    OneDriveConnect *connect = (OneDriveConnect *)base;
+
+    if (!connect->hot)
+        return HIVE_GENERAL_ERROR(HIVEERR_NOT_SUPPORTED);
+
+    hot_cache_get_stats(connect->hot, stats);
+    return 0;
+}
+
+static int get_key_version(HiveConnect *base, const char *key,
+                           char *version, size_t len)
+{
+    OneDriveConnect *connect = (OneDriveConnect *)base;
+    char path[PATH_MAX];
+    int rc;
+
+    rc = snprintf(path, sizeof(path), "%s/%s", KEYS_DIR, key);
+    if (rc < 0 || rc >= sizeof(path))
+        return HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
+
+    REPLAY_IF_TOKEN_REJECTED(rc, __get_version(connect, path, version, len));
+    return rc;
+}
+
 HiveConnect *onedrive_client_connect(HiveClient *client, const HiveConnectOptions *opts)
 {
     OneDriveConnectOptions *options = (OneDriveConnectOptions *)opts;
@@ -1039,6 +1676,38 @@ HiveConnect *onedrive_client_connect(HiveClient *client, const HiveConnectOption
         return NULL;
     }
 
+    connect->lock_fd = -1;
+    pthread_mutex_init(&connect->seed_lock, NULL);
+    connect->seed = (unsigned int)time(NULL) ^ (unsigned int)getpid() ^
+                    (unsigned int)(uintptr_t)connect;
+
+    connect->absent = negative_cache_new(NEGATIVE_CACHE_TTL);
+    if (!connect->absent) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY));
+        deref(connect);
+        return NULL;
+    }
+
+    if (options->memory_cache_capacity >= 0) {
+        connect->hot = hot_cache_new(options->memory_cache_capacity ?
+                                     (size_t)options->memory_cache_capacity :
+                                     DEFAULT_MEMORY_CACHE_CAPACITY);
+        if (!connect->hot) {
+            hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY));
+            deref(connect);
+            return NULL;
+        }
+    }
+    connect->max_age = options->memory_cache_max_age > 0 ?
+                       options->memory_cache_max_age : 0;
+
+    connect->flights = single_flight_new();
+    if (!connect->flights) {
+        hive_set_error(HIVE_GENERAL_ERROR(HIVEERR_OUT_OF_MEMORY));
+        deref(connect);
+        return NULL;
+    }
+
     rc = snprintf(connect->keystore_path, sizeof(connect->keystore_path),
                   "%s/.data/onedrive.json", client->data_location);
     if (rc < 0 || rc >= (int)sizeof(connect->keystore_path)) {
@@ -1055,7 +1724,15 @@ HiveConnect *onedrive_client_connect(HiveClient *client, const HiveConnectOption
         return NULL;
     }
 
-    if (!access(connect->keystore_path, F_OK)) {
+#if !defined(_WIN32) && !defined(_WIN64)
+    rc = snprintf(path_tmp, sizeof(path_tmp), "%s.lock", connect->keystore_path);
+    if (rc > 0 && rc < (int)sizeof(path_tmp))
+        connect->lock_fd = open(path_tmp, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (connect->lock_fd < 0)
+        vlogW("OneDrive: Can not open keystore lock, tokens are not shared.");
+#endif
+
+    if (!stat(connect->keystore_path, &connect->keystore_stat)) {
         keystore = load_keystore_in_json(connect->keystore_path);
         if (!keystore) {
             hive_set_error(HIVE_SYS_ERROR(errno));
@@ -1070,6 +1747,9 @@ HiveConnect *onedrive_client_connect(HiveClient *client, const HiveConnectOption
     oauth_opts.client_id     = options->client_id;
     oauth_opts.scope         = options->scope;
     oauth_opts.redirect_url  = options->redirect_url;
+    oauth_opts.refresh_ahead = options->token_refresh_ahead;
+    oauth_opts.store_lock    = oauth_store_lock;
+    oauth_opts.store_reload  = oauth_store_reload;
 
     connect->token = oauth_token_new(&oauth_opts, &oauth_writeback, connect);
     if (keystore)
@@ -1085,10 +1765,13 @@ HiveConnect *onedrive_client_connect(HiveClient *client, const HiveConnectOption
     connect->base.get_file_to_buffer   = get_file_to_buffer;
     connect->base.list_files           = list_files;
     connect->base.delete_file          = delete_file;
+    connect->base.get_file_version     = get_file_version;
     connect->base.put_value            = put_value;
     connect->base.set_value            = set_value;
     connect->base.get_values           = get_values;
     connect->base.delete_key           = delete_key;
+    connect->base.get_key_version      = get_key_version;
+    connect->base.get_cache_stats      = get_cache_stats;
     connect->base.disconnect           = disconnect;
     connect->base.expire_token         = expire_token;
 
@@ -0,0 +1,417 @@
+/*
+ * Copyright (c) 2019 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <crystal.h>
+#include <ela_hive.h>
+#include <hive_client.h>
+#include <CUnit/Basic.h>
+
+#include "../test_context.h"
+#include "../../config.h"
+
+#define WAIT_STEP_MS        (100)
+#define WAIT_MAX_MS         (10 * 1000)
+
+/*
+ * An in memory backend holding one file, to tell what the cache forwards
+ * and what it serves itself. Offline, it fails as an unreachable server
+ * would; rejecting, it fails writes for good. Its versions are told
+ * apart from those of earlier backends, which the cache may still know.
+ */
+typedef struct {
+    HiveConnect base;
+    pthread_mutex_t lock;
+    long epoch;
+    bool offline;
+    bool reject;
+    int version;
+    int reads;
+    int writes;
+    size_t len;
+    char data[64];
+} fake_backend_t;
+
+static int fake_put_file_from_buffer(HiveConnect *base, const void *from,
+                                     size_t length, bool encrypt,
+                                     const char *filename)
+{
+    fake_backend_t *fake = (fake_backend_t *)base;
+    int rc = 0;
+
+    pthread_mutex_lock(&fake->lock);
+
+    if (fake->offline)
+        rc = HIVE_GENERAL_ERROR(HIVEERR_TRY_AGAIN);
+    else if (fake->reject)
+        rc = HIVE_HTTP_STATUS_ERROR(403);
+    else if (length > sizeof(fake->data))
+        rc = HIVE_GENERAL_ERROR(HIVEERR_LIMIT_EXCEEDED);
+
+    if (!rc) {
+        memcpy(fake->data, from, length);
+        fake->len = length;
+        fake->version++;
+        fake->writes++;
+    }
+
+    pthread_mutex_unlock(&fake->lock);
+    return rc;
+}
+
+static ssize_t fake_get_file_length(HiveConnect *base, const char *filename)
+{
+    fake_backend_t *fake = (fake_backend_t *)base;
+    ssize_t len;
+
+    pthread_mutex_lock(&fake->lock);
+    len = fake->offline ? (int)HIVE_GENERAL_ERROR(HIVEERR_TRY_AGAIN) :
+          !fake->version ? (int)HIVE_GENERAL_ERROR(HIVEERR_NOT_EXIST) :
+                           (ssize_t)fake->len;
+    pthread_mutex_unlock(&fake->lock);
+
+    return len;
+}
+
+static ssize_t fake_get_file_to_buffer(HiveConnect *base, const char *filename,
+                                       bool decrypt, void *to, size_t buflen)
+{
+    fake_backend_t *fake = (fake_backend_t *)base;
+    ssize_t len;
+
+    pthread_mutex_lock(&fake->lock);
+
+    len = fake_get_file_length(base, filename);
+    if (len >= 0 && (size_t)len > buflen)
+        len = (int)HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
+
+    if (len >= 0) {
+        memcpy(to, fake->data, fake->len);
+        fake->reads++;
+    }
+
+    pthread_mutex_unlock(&fake->lock);
+    return len;
+}
+
+static int fake_delete_file(HiveConnect *base, const char *filename)
+{
+    fake_backend_t *fake = (fake_backend_t *)base;
+
+    pthread_mutex_lock(&fake->lock);
+    fake->len = 0;
+    fake->version = 0;
+    pthread_mutex_unlock(&fake->lock);
+
+    return 0;
+}
+
+static int fake_get_file_version(HiveConnect *base, const char *filename,
+                                 char *version, size_t len)
+{
+    fake_backend_t *fake = (fake_backend_t *)base;
+    int rc = 0;
+
+    pthread_mutex_lock(&fake->lock);
+
+    if (fake->offline)
+        rc = HIVE_GENERAL_ERROR(HIVEERR_TRY_AGAIN);
+    else if (!fake->version)
+        rc = HIVE_GENERAL_ERROR(HIVEERR_NOT_EXIST);
+    else
+        snprintf(version, len, "%ld-%d", fake->epoch, fake->version);
+
+    pthread_mutex_unlock(&fake->lock);
+    return rc;
+}
+
+static void fake_destructor(void *obj)
+{
+    fake_backend_t *fake = (fake_backend_t *)obj;
+
+    pthread_mutex_destroy(&fake->lock);
+}
+
+static int fake_disconnect(HiveConnect *base)
+{
+    deref(base);
+    return 0;
+}
+
+static fake_backend_t *fake_backend_new()
+{
+    static int instances;
+    fake_backend_t *fake;
+    pthread_mutexattr_t attr;
+
+    fake = (fake_backend_t *)rc_zalloc(sizeof(fake_backend_t), fake_destructor);
+    if (!fake)
+        return NULL;
+
+    /* Recursive: reads take the length under the lock. */
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&fake->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    fake->epoch = (long)time(NULL) * 100 + instances++ % 100;
+
+    fake->base.put_file_from_buffer = fake_put_file_from_buffer;
+    fake->base.get_file_length      = fake_get_file_length;
+    fake->base.get_file_to_buffer   = fake_get_file_to_buffer;
+    fake->base.delete_file          = fake_delete_file;
+    fake->base.get_file_version     = fake_get_file_version;
+    fake->base.disconnect           = fake_disconnect;
+
+    return fake;
+}
+
+static int fake_get(fake_backend_t *fake, int *field)
+{
+    int value;
+
+    pthread_mutex_lock(&fake->lock);
+    value = *field;
+    pthread_mutex_unlock(&fake->lock);
+
+    return value;
+}
+
+static void fake_set(fake_backend_t *fake, bool *field, bool value)
+{
+    pthread_mutex_lock(&fake->lock);
+    *field = value;
+    pthread_mutex_unlock(&fake->lock);
+}
+
+/*
+ * Wait for the write back thread to have the backend take writes
+ * count writes in all.
+ */
+static bool wait_writes(fake_backend_t *fake, int count)
+{
+    int waited;
+
+    for (waited = 0; waited < WAIT_MAX_MS; waited += WAIT_STEP_MS) {
+        if (fake_get(fake, &fake->writes) >= count)
+            return true;
+
+        usleep(WAIT_STEP_MS * 1000);
+    }
+
+    return false;
+}
+
+static HiveConnect *cache_connect(fake_backend_t *fake)
+{
+    char root[PATH_MAX];
+    CacheConnectOptions opts = {
+        .backendType = HiveBackendType_Cache,
+        .backend     = &fake->base,
+        .root        = root,
+        .capacity    = 0
+    };
+
+    /* Apart from the cache of the suite, which holds its own lock. */
+    snprintf(root, sizeof(root), "%s/cache-cases", global_config.data_location);
+
+    return hive_client_connect(test_ctx.client, (HiveConnectOptions *)&opts);
+}
+
+static bool read_equals(HiveConnect *connect, const char *filename,
+                        const char *str)
+{
+    char buf[64];
+    ssize_t len;
+
+    len = hive_get_file_to_buffer(connect, filename, false, buf, sizeof(buf));
+
+    return len == (ssize_t)strlen(str) && !memcmp(buf, str, (size_t)len);
+}
+
+void cache_write_back_test(void)
+{
+    const char *filename = "write_back.txt";
+    fake_backend_t *fake;
+    HiveConnect *connect;
+    int rc;
+
+    fake = fake_backend_new();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(fake);
+
+    connect = cache_connect(fake);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(connect);
+
+    /* Acknowledged, and served, while the backend is unreachable. */
+    fake_set(fake, &fake->offline, true);
+    rc = hive_put_file_from_buffer(connect, "hello", 5, false, filename);
+    CU_ASSERT_EQUAL(rc, 0);
+    CU_ASSERT_TRUE(read_equals(connect, filename, "hello"));
+    CU_ASSERT_EQUAL(fake_get(fake, &fake->writes), 0);
+
+    fake_set(fake, &fake->offline, false);
+    CU_ASSERT_TRUE(wait_writes(fake, 1));
+    CU_ASSERT_TRUE(fake->len == 5 && !memcmp(fake->data, "hello", 5));
+
+    /* Written back, the copy is served as long as the version holds. */
+    CU_ASSERT_TRUE(read_equals(connect, filename, "hello"));
+    CU_ASSERT_EQUAL(fake_get(fake, &fake->reads), 0);
+
+    hive_client_disconnect(connect);
+    deref(fake);
+}
+
+void cache_journal_replay_test(void)
+{
+    const char *filename = "replay.txt";
+    fake_backend_t *fake;
+    HiveConnect *connect;
+    int rc;
+
+    fake = fake_backend_new();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(fake);
+
+    connect = cache_connect(fake);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(connect);
+
+    fake_set(fake, &fake->offline, true);
+    rc = hive_put_file_from_buffer(connect, "journaled", 9, false, filename);
+    CU_ASSERT_EQUAL(rc, 0);
+
+    /* Not written back before the disconnect: left in the journal. */
+    hive_client_disconnect(connect);
+    CU_ASSERT_EQUAL(fake_get(fake, &fake->writes), 0);
+
+    connect = cache_connect(fake);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(connect);
+
+    /* Still served from the journal, then written back once online. */
+    CU_ASSERT_TRUE(read_equals(connect, filename, "journaled"));
+    fake_set(fake, &fake->offline, false);
+    CU_ASSERT_TRUE(wait_writes(fake, 1));
+    CU_ASSERT_TRUE(fake->len == 9 && !memcmp(fake->data, "journaled", 9));
+
+    hive_client_disconnect(connect);
+    deref(fake);
+}
+
+void cache_offline_read_test(void)
+{
+    const char *filename = "offline.txt";
+    fake_backend_t *fake;
+    HiveConnect *connect;
+
+    fake = fake_backend_new();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(fake);
+
+    fake_put_file_from_buffer(&fake->base, "remote", 6, false, filename);
+
+    connect = cache_connect(fake);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(connect);
+
+    CU_ASSERT_TRUE(read_equals(connect, filename, "remote"));
+    CU_ASSERT_EQUAL(fake_get(fake, &fake->reads), 1);
+
+    /* The copy read through is served while the backend is unreachable. */
+    fake_set(fake, &fake->offline, true);
+    CU_ASSERT_TRUE(read_equals(connect, filename, "remote"));
+    CU_ASSERT_EQUAL(fake_get(fake, &fake->reads), 1);
+
+    hive_client_disconnect(connect);
+    deref(fake);
+}
+
+void cache_revalidate_test(void)
+{
+    const char *filename = "revalidate.txt";
+    fake_backend_t *fake;
+    HiveConnect *connect;
+
+    fake = fake_backend_new();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(fake);
+
+    fake_put_file_from_buffer(&fake->base, "first", 5, false, filename);
+
+    connect = cache_connect(fake);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(connect);
+
+    CU_ASSERT_TRUE(read_equals(connect, filename, "first"));
+    CU_ASSERT_TRUE(read_equals(connect, filename, "first"));
+    CU_ASSERT_EQUAL(fake_get(fake, &fake->reads), 1);
+
+    /* Changed behind the cache: the new version is read through. */
+    fake_put_file_from_buffer(&fake->base, "second", 6, false, filename);
+    CU_ASSERT_TRUE(read_equals(connect, filename, "second"));
+    CU_ASSERT_EQUAL(fake_get(fake, &fake->reads), 2);
+
+    hive_client_disconnect(connect);
+    deref(fake);
+}
+
+void cache_write_failure_test(void)
+{
+    const char *filename = "failure.txt";
+    fake_backend_t *fake;
+    HiveConnect *connect;
+    char buf[64];
+    ssize_t len;
+    int waited;
+    int rc;
+
+    fake = fake_backend_new();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(fake);
+
+    connect = cache_connect(fake);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(connect);
+
+    fake_set(fake, &fake->reject, true);
+    rc = hive_put_file_from_buffer(connect, "rejected", 8, false, filename);
+    CU_ASSERT_EQUAL(rc, 0);
+
+    /* Until written back, the write is served; then its failure is. */
+    for (waited = 0; waited < WAIT_MAX_MS; waited += WAIT_STEP_MS) {
+        len = hive_get_file_to_buffer(connect, filename, false, buf, sizeof(buf));
+        if (len < 0)
+            break;
+
+        usleep(WAIT_STEP_MS * 1000);
+    }
+    CU_ASSERT_EQUAL(len, -1);
+    CU_ASSERT_EQUAL(hive_get_error(), (int)HIVE_HTTP_STATUS_ERROR(403));
+
+    /* Reported once: the backend is asked again, and has nothing. */
+    len = hive_get_file_to_buffer(connect, filename, false, buf, sizeof(buf));
+    CU_ASSERT_EQUAL(len, -1);
+    CU_ASSERT_EQUAL(hive_get_error(), (int)HIVE_GENERAL_ERROR(HIVEERR_NOT_EXIST));
+
+    hive_client_disconnect(connect);
+    deref(fake);
+}
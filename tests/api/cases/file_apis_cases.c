@@ -312,3 +312,36 @@ void delete_nonexist_file_test(void)
     rc = hive_delete_file(test_ctx.connect, "nonexist");
     CU_ASSERT_TRUE(rc < 0);
 }
+
+void recreate_file_test(void)
+{
+    char buf[32];
+    ssize_t fsize;
+    int rc;
+
+    fsize = hive_get_file_length(test_ctx.connect, "recreate.txt");
+    CU_ASSERT_TRUE_FATAL(fsize < 0);
+
+    rc = __put_file_from_buffer_test("recreate.txt", "hello world");
+    CU_ASSERT_TRUE_FATAL(rc == 0);
+
+    rc = __delete_file_test("recreate.txt");
+    CU_ASSERT_TRUE_FATAL(rc == 0);
+
+    fsize = hive_get_file_length(test_ctx.connect, "recreate.txt");
+    CU_ASSERT_TRUE(fsize < 0);
+
+    rc = __put_file_from_buffer_test("recreate.txt", "hello world!");
+    CU_ASSERT_TRUE_FATAL(rc == 0);
+
+    /* The write clears what the probe above learnt. */
+    fsize = hive_get_file_length(test_ctx.connect, "recreate.txt");
+    CU_ASSERT_EQUAL(fsize, 12);
+
+    fsize = hive_get_file_to_buffer(test_ctx.connect, "recreate.txt", true,
+                                    buf, sizeof(buf));
+    CU_ASSERT_TRUE(fsize == 12 && !memcmp(buf, "hello world!", 12));
+
+    rc = hive_delete_file(test_ctx.connect, "recreate.txt");
+    CU_ASSERT_TRUE(rc == 0);
+}
@@ -34,6 +34,7 @@ DECL_TESTCASE(get_nonexist_file_to_buffer_test)
 DECL_TESTCASE(get_file_test)
 DECL_TESTCASE(get_nonexist_file_test)
 DECL_TESTCASE(delete_nonexist_file_test)
+DECL_TESTCASE(recreate_file_test)
 
 #define DEFINE_FILE_APIS_CASES                         \
     DEFINE_TESTCASE(put_file_test),                    \
@@ -44,6 +45,7 @@ DECL_TESTCASE(delete_nonexist_file_test)
     DEFINE_TESTCASE(get_nonexist_file_to_buffer_test), \
     DEFINE_TESTCASE(get_file_test),                    \
     DEFINE_TESTCASE(get_nonexist_file_test),           \
-    DEFINE_TESTCASE(delete_nonexist_file_test)
+    DEFINE_TESTCASE(delete_nonexist_file_test),        \
+    DEFINE_TESTCASE(recreate_file_test)
 
 #endif /* __FILE_APIS_CASES_H__ */
@@ -22,6 +22,7 @@
 
 #include <fcntl.h>
 #include <stdlib.h>
+#include <time.h>
 
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
@@ -31,6 +32,12 @@
 #include <io.h>
 #include <sys/stat.h>
 #include <crystal.h>
+#else
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #endif
 
 #include <ela_hive.h>
@@ -139,3 +146,411 @@ void ipfs_put_file_from_buffer_test(void)
     remove(to);
     CU_ASSERT_TRUE_FATAL(nrd == strlen("hello world!") && !strcmp(buf, "hello world!"));
 }
+
+#if !defined(_WIN32) && !defined(_WIN64)
+/*
+ * A node answering probes at once, so it ranks first, but holding every
+ * other request without a byte of answer until the client gives up, so
+ * reads sent to it get hedged to the real node.
+ */
+typedef struct slow_node {
+    int fd;
+    uint16_t port;
+    pthread_t thread;
+} slow_node_t;
+
+static void *slow_node_entry(void *arg)
+{
+    static const char version[] = "HTTP/1.1 200 OK\r\n"
+                                  "Content-Type: application/json\r\n"
+                                  "Content-Length: 15\r\n"
+                                  "Connection: close\r\n\r\n"
+                                  "{\"Version\":\"0\"}";
+    slow_node_t *node = (slow_node_t *)arg;
+    struct timeval tv = { .tv_sec = 5, .tv_usec = 0 };
+    char req[4096];
+    ssize_t n;
+    int fd;
+
+    while ((fd = accept(node->fd, NULL, NULL)) >= 0) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        n = recv(fd, req, sizeof(req) - 1, 0);
+        if (n > 0) {
+            req[n] = 0;
+            if (strstr(req, " /version "))
+                send(fd, version, strlen(version), 0);
+            else
+                while (recv(fd, req, sizeof(req), 0) > 0);
+        }
+
+        close(fd);
+    }
+
+    return NULL;
+}
+
+static int slow_node_start(slow_node_t *node)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    node->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (node->fd < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(node->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(node->fd, 32) < 0 ||
+        getsockname(node->fd, (struct sockaddr *)&addr, &len) < 0 ||
+        pthread_create(&node->thread, NULL, slow_node_entry, node) != 0) {
+        close(node->fd);
+        return -1;
+    }
+
+    node->port = ntohs(addr.sin_port);
+    return 0;
+}
+
+static void slow_node_stop(slow_node_t *node)
+{
+    shutdown(node->fd, SHUT_RDWR);
+    close(node->fd);
+    pthread_join(node->thread, NULL);
+}
+#endif
+
+void ipfs_stats_test(void)
+{
+    IPFSStats before;
+    IPFSStats after;
+    IPFSCid cid_tmp;
+    ssize_t fsize;
+    char buf[128];
+    int rc;
+    int i;
+
+    rc = hive_ipfs_get_stats(test_ctx.connect, NULL);
+    CU_ASSERT_TRUE_FATAL(rc == -1);
+
+    rc = hive_ipfs_get_stats(test_ctx.connect, &before);
+    CU_ASSERT_TRUE_FATAL(rc == 0);
+    CU_ASSERT_TRUE_FATAL(before.hedges_won <= before.hedges_fired);
+
+    rc = hive_ipfs_put_file_from_buffer(test_ctx.connect, "hello world",
+                                        strlen("hello world"), true, &cid_tmp);
+    CU_ASSERT_TRUE_FATAL(rc == 0);
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    {
+        slow_node_t slow;
+        HiveConnect *connect;
+        IPFSNode nodes[2];
+        char port[8];
+        IPFSConnectOptions opts = {
+            .backendType    = HiveBackendType_IPFS,
+            .rpc_node_count = 2,
+            .rpcNodes       = nodes,
+            .hedge_budget   = 1.0,
+            .cache_capacity = -1
+        };
+
+        rc = slow_node_start(&slow);
+        CU_ASSERT_TRUE_FATAL(rc == 0);
+
+        memset(nodes, 0, sizeof(nodes));
+        nodes[0].ipv4 = "127.0.0.1";
+        sprintf(port, "%u", (unsigned)slow.port);
+        nodes[0].port = port;
+        nodes[1] = *global_config.ipfs_rpc_nodes[0];
+
+        /* Reads go to the slow node first, which ranks best, and are hedged. */
+        connect = hive_client_connect(test_ctx.client, (HiveConnectOptions *)&opts);
+        if (!connect) {
+            slow_node_stop(&slow);
+            CU_FAIL("connect with slow node failure.");
+            return;
+        }
+
+        rc = hive_ipfs_get_stats(connect, &before);
+        CU_ASSERT_TRUE(rc == 0);
+
+        for (i = 0; i < 5; i++) {
+            memset(buf, 0, sizeof(buf));
+            fsize = hive_ipfs_get_file_to_buffer(connect, &cid_tmp, true,
+                                                 buf, sizeof(buf));
+            CU_ASSERT_TRUE(fsize == strlen("hello world") && !strcmp(buf, "hello world"));
+        }
+
+        rc = hive_ipfs_get_stats(connect, &after);
+        hive_client_disconnect(connect);
+        slow_node_stop(&slow);
+
+        CU_ASSERT_TRUE_FATAL(rc == 0);
+        CU_ASSERT_TRUE_FATAL(after.hedges_fired > before.hedges_fired);
+        CU_ASSERT_TRUE_FATAL(after.hedges_won > before.hedges_won);
+        CU_ASSERT_TRUE_FATAL(after.hedges_won <= after.hedges_fired);
+        return;
+    }
+#endif
+
+    for (i = 0; i < 20; i++) {
+        memset(buf, 0, sizeof(buf));
+        fsize = hive_ipfs_get_file_to_buffer(test_ctx.connect, &cid_tmp, true,
+                                             buf, sizeof(buf));
+        CU_ASSERT_TRUE_FATAL(fsize == strlen("hello world") && !strcmp(buf, "hello world"));
+    }
+
+    rc = hive_ipfs_get_stats(test_ctx.connect, &after);
+    CU_ASSERT_TRUE_FATAL(rc == 0);
+    CU_ASSERT_TRUE_FATAL(after.hedges_fired >= before.hedges_fired);
+    CU_ASSERT_TRUE_FATAL(after.hedges_won >= before.hedges_won);
+    CU_ASSERT_TRUE_FATAL(after.hedges_won <= after.hedges_fired);
+}
+
+typedef struct chunked_source {
+    const char *data;
+    size_t len;
+} chunked_source_t;
+
+static ssize_t read_in_chunks(void *buffer, size_t length, void *context)
+{
+    chunked_source_t *src = (chunked_source_t *)context;
+
+    /* Hand out a few bytes at a time to exercise the streaming path. */
+    if (length > 4)
+        length = 4;
+    if (length > src->len)
+        length = src->len;
+
+    memcpy(buffer, src->data, length);
+    src->data += length;
+    src->len -= length;
+
+    return (ssize_t)length;
+}
+
+void ipfs_add_test(void)
+{
+    chunked_source_t src;
+    IPFSCid cid_tmp;
+    ssize_t fsize;
+    char buf[128];
+    int rc;
+    IPFSCid cid = {
+        .content = "Qmf412jQZiuVUtdgnB36FXFX7xg5V6KEbSJ4dpQuhkLyfD"
+    };
+    IPFSCid raw_cid = {
+        .content = "bafkreifzjut3te2nhyekklss27nh3k72ysco7y32koao5eei66wof36n5e"
+    };
+    IPFSAddOptions options = {
+        .chunker = "size-262144",
+        .raw_leaves = true,
+        .cid_version = 1,
+        .hash = "sha2-256",
+        .pin = true
+    };
+
+    src.data = "hello world";
+    src.len = strlen("hello world");
+
+    rc = hive_ipfs_add(test_ctx.connect, read_in_chunks, &src, -1, NULL, &cid_tmp);
+    CU_ASSERT_TRUE_FATAL(rc == 0);
+    CU_ASSERT_TRUE_FATAL(!strcmp(cid_tmp.content, cid.content));
+
+    src.data = "hello world";
+    src.len = strlen("hello world");
+
+    rc = hive_ipfs_add(test_ctx.connect, read_in_chunks, &src,
+                       strlen("hello world"), &options, &cid_tmp);
+    CU_ASSERT_TRUE_FATAL(rc == 0);
+    CU_ASSERT_TRUE_FATAL(!strcmp(cid_tmp.content, raw_cid.content));
+
+    memset(buf, 0, sizeof(buf));
+    fsize = hive_ipfs_get_file_to_buffer(test_ctx.connect, &raw_cid, true, buf, sizeof(buf));
+    CU_ASSERT_TRUE_FATAL(fsize == strlen("hello world") && !strcmp(buf, "hello world"));
+
+    options.cid_version = 2;
+    rc = hive_ipfs_add(test_ctx.connect, read_in_chunks, &src, -1, &options, &cid_tmp);
+    CU_ASSERT_TRUE_FATAL(rc == -1);
+}
+
+void ipfs_put_files_test(void)
+{
+    IPFSCid cids[3];
+    IPFSCid root;
+    ssize_t fsize;
+    char buf[128];
+    int rc;
+    IPFSAddItem items[] = {
+        { .name = "a", .data = "hello world", .length = strlen("hello world") },
+        { .name = "b", .data = "hello world!", .length = strlen("hello world!") },
+        { .name = "c", .data = "", .length = 0 }
+    };
+
+    rc = hive_ipfs_put_files(test_ctx.connect, items, 3, cids, NULL);
+    CU_ASSERT_TRUE_FATAL(rc == 0);
+    CU_ASSERT_TRUE_FATAL(!strcmp(cids[0].content, "Qmf412jQZiuVUtdgnB36FXFX7xg5V6KEbSJ4dpQuhkLyfD"));
+    CU_ASSERT_TRUE_FATAL(!strcmp(cids[1].content, "QmTp2hEo8eXRp6wg7jXv1BLCMh5a4F3B7buAUZNZUu772j"));
+    CU_ASSERT_TRUE_FATAL(!strcmp(cids[2].content, "QmbFMke1KXqnYyBBWxB74N4c5SBnJMVAiMNRcGu6x1AwQH"));
+
+    memset(&root, 0, sizeof(root));
+    rc = hive_ipfs_put_files(test_ctx.connect, items, 3, cids, &root);
+    CU_ASSERT_TRUE_FATAL(rc == 0);
+    CU_ASSERT_TRUE_FATAL(*root.content);
+    CU_ASSERT_TRUE_FATAL(!strcmp(cids[1].content, "QmTp2hEo8eXRp6wg7jXv1BLCMh5a4F3B7buAUZNZUu772j"));
+
+    memset(buf, 0, sizeof(buf));
+    fsize = hive_ipfs_get_file_to_buffer(test_ctx.connect, &cids[1], true, buf, sizeof(buf));
+    CU_ASSERT_TRUE_FATAL(fsize == strlen("hello world!") && !strcmp(buf, "hello world!"));
+
+    items[0].name = "a/b";
+    rc = hive_ipfs_put_files(test_ctx.connect, items, 3, cids, NULL);
+    CU_ASSERT_TRUE_FATAL(rc == -1);
+}
+
+void ipfs_get_file_range_test(void)
+{
+    IPFSCid cid_tmp;
+    ssize_t nrd;
+    char buf[128];
+    int rc;
+
+    rc = hive_ipfs_put_file_from_buffer(test_ctx.connect, "hello world",
+                                        strlen("hello world"), true, &cid_tmp);
+    CU_ASSERT_TRUE_FATAL(rc == 0);
+
+    memset(buf, 0, sizeof(buf));
+    nrd = hive_ipfs_get_file_range(test_ctx.connect, &cid_tmp, 6, 3, buf);
+    CU_ASSERT_TRUE_FATAL(nrd == 3 && !strcmp(buf, "wor"));
+
+    memset(buf, 0, sizeof(buf));
+    nrd = hive_ipfs_get_file_range(test_ctx.connect, &cid_tmp, 6, sizeof(buf), buf);
+    CU_ASSERT_TRUE_FATAL(nrd == strlen("world") && !strcmp(buf, "world"));
+
+    nrd = hive_ipfs_get_file_range(test_ctx.connect, &cid_tmp, 0, 0, buf);
+    CU_ASSERT_TRUE_FATAL(nrd == -1);
+}
+
+void ipfs_get_file_lengths_test(void)
+{
+    IPFSCid cids[3];
+    ssize_t sizes[3];
+    int rc;
+    IPFSAddItem items[] = {
+        { .data = "hello world", .length = strlen("hello world") },
+        { .data = "hello world!", .length = strlen("hello world!") },
+        { .data = "hello", .length = strlen("hello") }
+    };
+
+    rc = hive_ipfs_put_files(test_ctx.connect, items, 3, cids, NULL);
+    CU_ASSERT_TRUE_FATAL(rc == 0);
+
+    rc = hive_ipfs_get_file_lengths(test_ctx.connect, cids, 3, sizes);
+    CU_ASSERT_TRUE_FATAL(rc == 0);
+    CU_ASSERT_TRUE_FATAL(sizes[0] == strlen("hello world"));
+    CU_ASSERT_TRUE_FATAL(sizes[1] == strlen("hello world!"));
+    CU_ASSERT_TRUE_FATAL(sizes[2] == strlen("hello"));
+}
+
+void ipfs_parallel_add_test(void)
+{
+    chunked_source_t src;
+    IPFSCid cid_seq;
+    IPFSCid cid_par;
+    size_t len = 3 * 256 * 1024 + 100;
+    char *data;
+    ssize_t nrd;
+    char buf[128];
+    size_t i;
+    int rc;
+    IPFSAddOptions options = {
+        .pin = true,
+        .parallel = true
+    };
+
+    data = (char *)malloc(len);
+    CU_ASSERT_TRUE_FATAL(data != NULL);
+
+    srand((unsigned)time(NULL));
+    for (i = 0; i < len; i++)
+        data[i] = (char)rand();
+
+    rc = hive_ipfs_put_file_from_buffer(test_ctx.connect, data, len, false, &cid_seq);
+    if (rc < 0) {
+        free(data);
+        CU_FAIL("sequential add failure.");
+        return;
+    }
+
+    src.data = data;
+    src.len = len;
+    rc = hive_ipfs_add(test_ctx.connect, read_in_chunks, &src, -1, &options, &cid_par);
+    if (rc < 0) {
+        free(data);
+        CU_FAIL("parallel add failure.");
+        return;
+    }
+
+    CU_ASSERT_TRUE(!strcmp(cid_seq.content, cid_par.content));
+
+    nrd = hive_ipfs_get_file_range(test_ctx.connect, &cid_par, 2 * 256 * 1024 + 10,
+                                   sizeof(buf), buf);
+    CU_ASSERT_TRUE(nrd == sizeof(buf) &&
+                   !memcmp(buf, data + 2 * 256 * 1024 + 10, sizeof(buf)));
+
+    src.data = data;
+    src.len = len;
+    options.raw_leaves = true;
+    rc = hive_ipfs_add(test_ctx.connect, read_in_chunks, &src, -1, &options, &cid_par);
+    free(data);
+    CU_ASSERT_TRUE_FATAL(rc == -1);
+}
+
+void ipfs_car_test(void)
+{
+    char path[1024];
+    IPFSCid roots[2];
+    IPFSCid cid;
+    ssize_t len;
+    ssize_t nroots;
+    int rc;
+    int fd;
+
+    rc = hive_ipfs_put_file_from_buffer(test_ctx.connect, "hello world",
+                                        strlen("hello world"), true, &cid);
+    CU_ASSERT_TRUE_FATAL(rc == 0);
+
+    sprintf(path, "%s/XXXXXX", global_config.data_location);
+
+    fd = mkstemp(path);
+    if (fd < 0) {
+        CU_FAIL("mkstemp failure.");
+        return;
+    }
+
+    len = hive_ipfs_export_car(test_ctx.connect, &cid, fd);
+    close(fd);
+    if (len <= (ssize_t)strlen("hello world")) {
+        remove(path);
+        CU_FAIL("export car failure.");
+        return;
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        remove(path);
+        CU_FAIL("open file failure.");
+        return;
+    }
+
+    memset(roots, 0, sizeof(roots));
+    nroots = hive_ipfs_import_car(test_ctx.connect, fd, roots, 2);
+    close(fd);
+    remove(path);
+    CU_ASSERT_TRUE_FATAL(nroots == 1);
+    CU_ASSERT_TRUE_FATAL(!strcmp(roots[0].content, cid.content));
+}
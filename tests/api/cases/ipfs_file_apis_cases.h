@@ -27,9 +27,23 @@
 
 DECL_TESTCASE(ipfs_put_file_test)
 DECL_TESTCASE(ipfs_put_file_from_buffer_test)
+DECL_TESTCASE(ipfs_stats_test)
+DECL_TESTCASE(ipfs_add_test)
+DECL_TESTCASE(ipfs_put_files_test)
+DECL_TESTCASE(ipfs_get_file_range_test)
+DECL_TESTCASE(ipfs_get_file_lengths_test)
+DECL_TESTCASE(ipfs_parallel_add_test)
+DECL_TESTCASE(ipfs_car_test)
 
 #define DEFINE_IPFS_FILE_APIS_CASES      \
     DEFINE_TESTCASE(ipfs_put_file_test), \
-    DEFINE_TESTCASE(ipfs_put_file_from_buffer_test)
+    DEFINE_TESTCASE(ipfs_put_file_from_buffer_test), \
+    DEFINE_TESTCASE(ipfs_stats_test), \
+    DEFINE_TESTCASE(ipfs_add_test), \
+    DEFINE_TESTCASE(ipfs_put_files_test), \
+    DEFINE_TESTCASE(ipfs_get_file_range_test), \
+    DEFINE_TESTCASE(ipfs_get_file_lengths_test), \
+    DEFINE_TESTCASE(ipfs_parallel_add_test), \
+    DEFINE_TESTCASE(ipfs_car_test)
 
 #endif /* __IPFS_FILE_APIS_CASES_H__ */
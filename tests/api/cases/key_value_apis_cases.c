@@ -20,6 +20,9 @@
  * SOFTWARE.
  */
 
+#include <stdio.h>
+#include <pthread.h>
+
 #include <ela_hive.h>
 #include <CUnit/Basic.h>
 
@@ -107,3 +110,60 @@ void key_value_apis_test(void)
     rc = hive_delete_key(test_ctx.connect, "key");
     CU_ASSERT_TRUE(rc == 0);
 }
+
+#define CONCURRENT_WRITERS      2
+#define VALUES_PER_WRITER       3
+
+static void *concurrent_put_entry(void *arg)
+{
+    int id = (int)(intptr_t)arg;
+    char value[32];
+    int i;
+
+    for (i = 0; i < VALUES_PER_WRITER; i++) {
+        sprintf(value, "writer%d-value%d", id, i);
+        if (hive_put_value(test_ctx.connect, "concurrent_key", value,
+                           strlen(value) + 1, true) < 0)
+            return (void *)-1;
+    }
+
+    return NULL;
+}
+
+static bool count_values_cb(const char *key, const void *value, size_t length,
+                            void *context)
+{
+    (*(int *)context)++;
+    return true;
+}
+
+void key_value_concurrent_put_test(void)
+{
+    pthread_t tids[CONCURRENT_WRITERS];
+    void *result;
+    int failures = 0;
+    int count = 0;
+    int rc;
+    int i;
+
+    hive_delete_key(test_ctx.connect, "concurrent_key");
+
+    for (i = 0; i < CONCURRENT_WRITERS; i++) {
+        rc = pthread_create(&tids[i], NULL, concurrent_put_entry, (void *)(intptr_t)i);
+        CU_ASSERT_TRUE_FATAL(rc == 0);
+    }
+
+    for (i = 0; i < CONCURRENT_WRITERS; i++) {
+        pthread_join(tids[i], &result);
+        if (result)
+            failures++;
+    }
+
+    rc = hive_get_values(test_ctx.connect, "concurrent_key", true,
+                         count_values_cb, &count);
+    hive_delete_key(test_ctx.connect, "concurrent_key");
+
+    CU_ASSERT_TRUE(failures == 0);
+    CU_ASSERT_TRUE(rc == 0);
+    CU_ASSERT_TRUE(count == CONCURRENT_WRITERS * VALUES_PER_WRITER);
+}
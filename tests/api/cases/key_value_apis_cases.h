@@ -26,8 +26,10 @@
 #include "case.h"
 
 DECL_TESTCASE(key_value_apis_test)
+DECL_TESTCASE(key_value_concurrent_put_test)
 
-#define DEFINE_KEY_APIS_CASES \
-    DEFINE_TESTCASE(key_value_apis_test)
+#define DEFINE_KEY_APIS_CASES                 \
+    DEFINE_TESTCASE(key_value_apis_test),     \
+    DEFINE_TESTCASE(key_value_concurrent_put_test)
 
 #endif /* __KEY_VALUE_APIS_CASES_H__ */
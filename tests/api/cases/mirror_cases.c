@@ -0,0 +1,525 @@
+/*
+ * Copyright (c) 2019 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <crystal.h>
+#include <ela_hive.h>
+#include <hive_client.h>
+#include <CUnit/Basic.h>
+
+#include "../test_context.h"
+#include "../../config.h"
+
+#define FAKE_FILES          (8)
+#define FAKE_COUNT          (3)
+
+/*
+ * An in memory backend, to tell which backends the mirror calls. Offline,
+ * it fails as an unreachable server would; it takes delay milliseconds to
+ * answer each call.
+ */
+typedef struct {
+    HiveConnect base;
+    pthread_mutex_t lock;
+    bool offline;
+    int delay;
+    int reads;
+    struct {
+        char name[32];
+        char data[32];
+        size_t len;
+    } files[FAKE_FILES];
+} fake_backend_t;
+
+/*
+ * Called with the lock held. Sleeps without it, calls being made on all
+ * backends at once.
+ */
+static int fake_enter(fake_backend_t *fake)
+{
+    int delay = fake->delay;
+
+    if (delay) {
+        pthread_mutex_unlock(&fake->lock);
+        usleep(delay * 1000);
+        pthread_mutex_lock(&fake->lock);
+    }
+
+    return fake->offline ? (int)HIVE_GENERAL_ERROR(HIVEERR_TRY_AGAIN) : 0;
+}
+
+/*
+ * Called with the lock held.
+ */
+static int fake_find(fake_backend_t *fake, const char *filename)
+{
+    int i;
+
+    for (i = 0; i < FAKE_FILES; i++) {
+        if (!strcmp(fake->files[i].name, filename))
+            return i;
+    }
+
+    return -1;
+}
+
+static int fake_put_file_from_buffer(HiveConnect *base, const void *from,
+                                     size_t length, bool encrypt,
+                                     const char *filename)
+{
+    fake_backend_t *fake = (fake_backend_t *)base;
+    int rc;
+    int i;
+
+    pthread_mutex_lock(&fake->lock);
+
+    rc = fake_enter(fake);
+    if (!rc) {
+        i = fake_find(fake, filename);
+        if (i < 0)
+            i = fake_find(fake, "");
+
+        if (i < 0 || length > sizeof(fake->files[i].data) ||
+            strlen(filename) >= sizeof(fake->files[i].name)) {
+            rc = HIVE_GENERAL_ERROR(HIVEERR_LIMIT_EXCEEDED);
+        } else {
+            strcpy(fake->files[i].name, filename);
+            memcpy(fake->files[i].data, from, length);
+            fake->files[i].len = length;
+        }
+    }
+
+    pthread_mutex_unlock(&fake->lock);
+    return rc;
+}
+
+static ssize_t fake_get_file_length(HiveConnect *base, const char *filename)
+{
+    fake_backend_t *fake = (fake_backend_t *)base;
+    ssize_t len;
+    int i;
+
+    pthread_mutex_lock(&fake->lock);
+
+    len = fake_enter(fake);
+    if (!len) {
+        i = fake_find(fake, filename);
+        len = i < 0 ? (int)HIVE_GENERAL_ERROR(HIVEERR_NOT_EXIST) :
+                      (ssize_t)fake->files[i].len;
+    }
+
+    pthread_mutex_unlock(&fake->lock);
+    return len;
+}
+
+static ssize_t fake_get_file_to_buffer(HiveConnect *base, const char *filename,
+                                       bool decrypt, void *to, size_t buflen)
+{
+    fake_backend_t *fake = (fake_backend_t *)base;
+    ssize_t len;
+    int i;
+
+    pthread_mutex_lock(&fake->lock);
+
+    len = fake_enter(fake);
+    if (!len) {
+        i = fake_find(fake, filename);
+        if (i < 0) {
+            len = (int)HIVE_GENERAL_ERROR(HIVEERR_NOT_EXIST);
+        } else if (fake->files[i].len > buflen) {
+            len = (int)HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL);
+        } else {
+            memcpy(to, fake->files[i].data, fake->files[i].len);
+            len = (ssize_t)fake->files[i].len;
+            fake->reads++;
+        }
+    }
+
+    pthread_mutex_unlock(&fake->lock);
+    return len;
+}
+
+static int fake_list_files(HiveConnect *base, HiveFilesIterateCallback *callback,
+                           void *context)
+{
+    fake_backend_t *fake = (fake_backend_t *)base;
+    int rc;
+    int i;
+
+    pthread_mutex_lock(&fake->lock);
+
+    rc = fake_enter(fake);
+    for (i = 0; !rc && i < FAKE_FILES; i++) {
+        if (fake->files[i].name[0] && !callback(fake->files[i].name, context))
+            break;
+    }
+
+    if (!rc && i == FAKE_FILES)
+        callback(NULL, context);
+
+    pthread_mutex_unlock(&fake->lock);
+    return rc;
+}
+
+/*
+ * Content is addressed by a hash of it, the same on every backend.
+ */
+static int fake_ipfs_add(HiveConnect *base, HiveReadCallback *callback,
+                         hive_rewind_callback_t *rewind, void *context,
+                         ssize_t length, const IPFSAddOptions *options,
+                         IPFSCid *cid)
+{
+    uint32_t hash = 2166136261U;
+    char data[33];
+    size_t len = 0;
+    ssize_t nrd = 0;
+    size_t i;
+
+    while (len < sizeof(data) &&
+           (nrd = callback(data + len, sizeof(data) - len, context)) > 0)
+        len += (size_t)nrd;
+
+    if (len == sizeof(data))
+        return HIVE_GENERAL_ERROR(HIVEERR_LIMIT_EXCEEDED);
+    if (nrd < 0)
+        return HIVE_GENERAL_ERROR(HIVEERR_INVALID_ARGS);
+
+    for (i = 0; i < len; i++)
+        hash = (hash ^ (uint8_t)data[i]) * 16777619U;
+    snprintf(cid->content, sizeof(cid->content), "fake%08x", hash);
+
+    return fake_put_file_from_buffer(base, data, len, false, cid->content);
+}
+
+static int fake_delete_file(HiveConnect *base, const char *filename)
+{
+    fake_backend_t *fake = (fake_backend_t *)base;
+    int rc;
+    int i;
+
+    pthread_mutex_lock(&fake->lock);
+
+    rc = fake_enter(fake);
+    if (!rc) {
+        i = fake_find(fake, filename);
+        if (i < 0)
+            rc = HIVE_GENERAL_ERROR(HIVEERR_NOT_EXIST);
+        else
+            memset(&fake->files[i], 0, sizeof(fake->files[i]));
+    }
+
+    pthread_mutex_unlock(&fake->lock);
+    return rc;
+}
+
+static void fake_destructor(void *obj)
+{
+    fake_backend_t *fake = (fake_backend_t *)obj;
+
+    pthread_mutex_destroy(&fake->lock);
+}
+
+static int fake_disconnect(HiveConnect *base)
+{
+    deref(base);
+    return 0;
+}
+
+static fake_backend_t *fake_backend_new()
+{
+    fake_backend_t *fake;
+
+    fake = (fake_backend_t *)rc_zalloc(sizeof(fake_backend_t), fake_destructor);
+    if (!fake)
+        return NULL;
+
+    pthread_mutex_init(&fake->lock, NULL);
+
+    fake->base.put_file_from_buffer = fake_put_file_from_buffer;
+    fake->base.get_file_length      = fake_get_file_length;
+    fake->base.get_file_to_buffer   = fake_get_file_to_buffer;
+    fake->base.list_files           = fake_list_files;
+    fake->base.delete_file          = fake_delete_file;
+    fake->base.ipfs_add             = fake_ipfs_add;
+    fake->base.disconnect           = fake_disconnect;
+
+    return fake;
+}
+
+static int fake_reads(fake_backend_t *fake)
+{
+    int reads;
+
+    pthread_mutex_lock(&fake->lock);
+    reads = fake->reads;
+    pthread_mutex_unlock(&fake->lock);
+
+    return reads;
+}
+
+static void fake_set_offline(fake_backend_t *fake, bool offline)
+{
+    pthread_mutex_lock(&fake->lock);
+    fake->offline = offline;
+    pthread_mutex_unlock(&fake->lock);
+}
+
+static void fake_set_delay(fake_backend_t *fake, int delay)
+{
+    pthread_mutex_lock(&fake->lock);
+    fake->delay = delay;
+    pthread_mutex_unlock(&fake->lock);
+}
+
+/*
+ * Connect a mirror of count new fake backends, which are left in fakes.
+ */
+static HiveConnect *mirror_connect(fake_backend_t **fakes, size_t count,
+                                   size_t quorum)
+{
+    HiveConnect *backends[FAKE_COUNT];
+    MirrorConnectOptions opts = {
+        .backendType = HiveBackendType_Mirror,
+        .backends    = backends,
+        .count       = count,
+        .quorum      = quorum
+    };
+    HiveConnect *connect;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        fakes[i] = fake_backend_new();
+        backends[i] = fakes[i] ? &fakes[i]->base : NULL;
+    }
+
+    connect = hive_client_connect(test_ctx.client, (HiveConnectOptions *)&opts);
+
+    /* The mirror holds its own references. */
+    for (i = 0; i < count; i++) {
+        if (fakes[i])
+            deref(fakes[i]);
+    }
+
+    return connect;
+}
+
+static bool read_equals(HiveConnect *connect, const char *filename,
+                        const char *str)
+{
+    char buf[32];
+    ssize_t len;
+
+    len = hive_get_file_to_buffer(connect, filename, false, buf, sizeof(buf));
+
+    return len == (ssize_t)strlen(str) && !memcmp(buf, str, (size_t)len);
+}
+
+void mirror_quorum_failure_test(void)
+{
+    fake_backend_t *fakes[FAKE_COUNT];
+    HiveConnect *connect;
+    int rc;
+
+    connect = mirror_connect(fakes, FAKE_COUNT, 2);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(connect);
+
+    /* Made on two of three: enough. */
+    fake_set_offline(fakes[0], true);
+    rc = hive_put_file_from_buffer(connect, "quorum", 6, false, "quorum.txt");
+    CU_ASSERT_EQUAL(rc, 0);
+
+    /* Made on one of three: not enough, though made there. */
+    fake_set_offline(fakes[1], true);
+    rc = hive_put_file_from_buffer(connect, "short", 5, false, "short.txt");
+    CU_ASSERT_EQUAL(rc, -1);
+    CU_ASSERT_EQUAL(hive_get_error(), (int)HIVE_GENERAL_ERROR(HIVEERR_TRY_AGAIN));
+    CU_ASSERT_TRUE(read_equals(&fakes[2]->base, "short.txt", "short"));
+
+    hive_client_disconnect(connect);
+}
+
+void mirror_read_fallback_test(void)
+{
+    fake_backend_t *fakes[FAKE_COUNT];
+    HiveConnect *connect;
+    int rc;
+
+    connect = mirror_connect(fakes, 2, 1);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(connect);
+
+    /* Missing on the first backend: read from the second. */
+    rc = fake_put_file_from_buffer(&fakes[1]->base, "second", 6, false,
+                                   "fallback.txt");
+    CU_ASSERT_EQUAL(rc, 0);
+    CU_ASSERT_TRUE(read_equals(connect, "fallback.txt", "second"));
+    CU_ASSERT_EQUAL(fake_reads(fakes[1]), 1);
+
+    /* Unreachable: read from the other, whichever is tried first. */
+    rc = hive_put_file_from_buffer(connect, "both", 4, false, "both.txt");
+    CU_ASSERT_EQUAL(rc, 0);
+
+    fake_set_offline(fakes[0], true);
+    CU_ASSERT_TRUE(read_equals(connect, "both.txt", "both"));
+    fake_set_offline(fakes[0], false);
+
+    fake_set_offline(fakes[1], true);
+    CU_ASSERT_TRUE(read_equals(connect, "both.txt", "both"));
+    fake_set_offline(fakes[1], false);
+
+    /* Missing everywhere: not found, not retried forever. */
+    CU_ASSERT_EQUAL(hive_get_file_length(connect, "none.txt"), -1);
+    CU_ASSERT_EQUAL(hive_get_error(), (int)HIVE_GENERAL_ERROR(HIVEERR_NOT_EXIST));
+
+    hive_client_disconnect(connect);
+}
+
+void mirror_latency_order_test(void)
+{
+    fake_backend_t *fakes[FAKE_COUNT];
+    HiveConnect *connect;
+    int reads;
+    int rc;
+    int i;
+
+    connect = mirror_connect(fakes, FAKE_COUNT, 0);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(connect);
+
+    fake_set_delay(fakes[0], 60);
+    fake_set_delay(fakes[1], 30);
+
+    /* Made on all at once, the write measures them all. */
+    rc = hive_put_file_from_buffer(connect, "latency", 7, false, "latency.txt");
+    CU_ASSERT_EQUAL(rc, 0);
+
+    for (i = 0; i < 10; i++)
+        CU_ASSERT_TRUE(read_equals(connect, "latency.txt", "latency"));
+
+    CU_ASSERT_EQUAL(fake_reads(fakes[0]), 0);
+    CU_ASSERT_EQUAL(fake_reads(fakes[1]), 0);
+    CU_ASSERT_EQUAL(fake_reads(fakes[2]), 10);
+
+    /* Turned slow, the fastest loses its reads to the next. */
+    fake_set_delay(fakes[2], 120);
+
+    for (i = 0; i < 10; i++)
+        CU_ASSERT_TRUE(read_equals(connect, "latency.txt", "latency"));
+
+    reads = fake_reads(fakes[1]);
+    CU_ASSERT_TRUE(reads > 0);
+    CU_ASSERT_EQUAL(fake_reads(fakes[0]) + reads + fake_reads(fakes[2]), 20);
+
+    hive_client_disconnect(connect);
+}
+
+static bool collect_names(const char *filename, void *context)
+{
+    char *names = (char *)context;
+
+    if (filename) {
+        strcat(names, filename);
+        strcat(names, ";");
+    }
+
+    return true;
+}
+
+void mirror_merged_list_test(void)
+{
+    fake_backend_t *fakes[FAKE_COUNT];
+    HiveConnect *connect;
+    char names[256];
+    int rc;
+
+    connect = mirror_connect(fakes, FAKE_COUNT, 2);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(connect);
+
+    /* Each on a quorum, no backend has them all. */
+    fake_put_file_from_buffer(&fakes[0]->base, "a", 1, false, "a.txt");
+    fake_put_file_from_buffer(&fakes[1]->base, "a", 1, false, "a.txt");
+    fake_put_file_from_buffer(&fakes[1]->base, "b", 1, false, "b.txt");
+    fake_put_file_from_buffer(&fakes[2]->base, "b", 1, false, "b.txt");
+    fake_put_file_from_buffer(&fakes[2]->base, "c", 1, false, "c.txt");
+    fake_put_file_from_buffer(&fakes[0]->base, "c", 1, false, "c.txt");
+
+    names[0] = 0;
+    rc = hive_list_files(connect, collect_names, names);
+    CU_ASSERT_EQUAL(rc, 0);
+    CU_ASSERT_STRING_EQUAL(names, "a.txt;b.txt;c.txt;");
+
+    /* Two listings still hold every file. */
+    fake_set_offline(fakes[1], true);
+    names[0] = 0;
+    rc = hive_list_files(connect, collect_names, names);
+    CU_ASSERT_EQUAL(rc, 0);
+    CU_ASSERT_STRING_EQUAL(names, "a.txt;b.txt;c.txt;");
+
+    /* One may not. */
+    fake_set_offline(fakes[2], true);
+    rc = hive_list_files(connect, collect_names, names);
+    CU_ASSERT_EQUAL(rc, -1);
+
+    hive_client_disconnect(connect);
+}
+
+void mirror_ipfs_put_file_test(void)
+{
+    fake_backend_t *fakes[FAKE_COUNT];
+    HiveConnect *connect;
+    char path[PATH_MAX];
+    IPFSCid cid;
+    FILE *fp;
+    int rc;
+    int i;
+
+    snprintf(path, sizeof(path), "%s/mirror-ipfs.txt",
+             global_config.data_location);
+    fp = fopen(path, "w");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(fp);
+    fputs("mirrored", fp);
+    fclose(fp);
+
+    connect = mirror_connect(fakes, FAKE_COUNT, 2);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(connect);
+
+    /* Read once from the file, added to every backend. */
+    rc = hive_ipfs_put_file(connect, path, false, &cid);
+    CU_ASSERT_EQUAL(rc, 0);
+    for (i = 0; i < FAKE_COUNT; i++)
+        CU_ASSERT_TRUE(read_equals(&fakes[i]->base, cid.content, "mirrored"));
+
+    /* Added to one of three: short of the quorum. */
+    fake_set_offline(fakes[0], true);
+    fake_set_offline(fakes[1], true);
+    rc = hive_ipfs_put_file(connect, path, false, &cid);
+    CU_ASSERT_EQUAL(rc, -1);
+
+    hive_client_disconnect(connect);
+    remove(path);
+}
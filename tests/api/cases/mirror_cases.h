@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2019 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __MIRROR_CASES_H__
+#define __MIRROR_CASES_H__
+
+#include "case.h"
+
+DECL_TESTCASE(mirror_quorum_failure_test)
+DECL_TESTCASE(mirror_read_fallback_test)
+DECL_TESTCASE(mirror_latency_order_test)
+DECL_TESTCASE(mirror_merged_list_test)
+DECL_TESTCASE(mirror_ipfs_put_file_test)
+
+#define DEFINE_MIRROR_CASES                         \
+    DEFINE_TESTCASE(mirror_quorum_failure_test),    \
+    DEFINE_TESTCASE(mirror_read_fallback_test),     \
+    DEFINE_TESTCASE(mirror_latency_order_test),     \
+    DEFINE_TESTCASE(mirror_merged_list_test),       \
+    DEFINE_TESTCASE(mirror_ipfs_put_file_test)
+
+#endif /* __MIRROR_CASES_H__ */
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2019 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <ela_hive.h>
+#include <CUnit/Basic.h>
+
+#include "single_flight.h"
+
+/*
+ * Long enough for a reader thread started before to have joined.
+ */
+#define JOIN_DELAY_US       (100 * 1000)
+
+typedef struct {
+    single_flight_t *sf;
+    const char *key;
+    size_t buflen;
+    bool dup;
+    bool led;
+    ssize_t rc;
+    char buf[32];
+    pthread_t thread;
+} reader_t;
+
+/*
+ * Read key through the flights: a reader leading a flight of its own
+ * reads "own".
+ */
+static void *reader_entry(void *arg)
+{
+    reader_t *reader = (reader_t *)arg;
+    flight_t *flight;
+    uint8_t *data;
+    size_t size;
+    int rc;
+
+    reader->led = single_flight_join(reader->sf, reader->key, &flight);
+    if (reader->led) {
+        memcpy(reader->buf, "own", 3);
+        reader->rc = 3;
+        single_flight_land(reader->sf, flight, 0, reader->buf, 3);
+        return NULL;
+    }
+
+    if (!reader->dup) {
+        reader->rc = single_flight_copy(flight, reader->buf, reader->buflen);
+    } else {
+        rc = single_flight_dup(flight, &data, &size);
+        reader->rc = rc < 0 ? rc : (ssize_t)size;
+        if (rc == 0) {
+            memcpy(reader->buf, data, size);
+            free(data);
+        }
+    }
+
+    single_flight_leave(reader->sf, flight);
+    return NULL;
+}
+
+static void reader_start(reader_t *reader, single_flight_t *sf, size_t buflen,
+                         bool dup)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->sf = sf;
+    reader->key = "key";
+    reader->buflen = buflen;
+    reader->dup = dup;
+
+    CU_ASSERT_TRUE_FATAL(pthread_create(&reader->thread, NULL, reader_entry,
+                                        reader) == 0);
+}
+
+static bool reader_got(reader_t *reader, bool led, const char *str)
+{
+    pthread_join(reader->thread, NULL);
+
+    return reader->led == led && reader->rc == (ssize_t)strlen(str) &&
+           !memcmp(reader->buf, str, strlen(str));
+}
+
+/*
+ * Lead a flight on key, have readers follow it, and land rc and str.
+ */
+static void lead(single_flight_t *sf, reader_t *readers, int count,
+                 size_t buflen, bool dup, int rc, const char *str)
+{
+    flight_t *flight;
+    int i;
+
+    CU_ASSERT_TRUE_FATAL(single_flight_join(sf, "key", &flight));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(flight);
+
+    for (i = 0; i < count; i++)
+        reader_start(&readers[i], sf, buflen, dup);
+
+    usleep(JOIN_DELAY_US);
+    single_flight_land(sf, flight, rc, str, str ? strlen(str) : 0);
+}
+
+void single_flight_copy_test(void)
+{
+    single_flight_t *sf;
+    reader_t readers[2];
+
+    sf = single_flight_new();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(sf);
+
+    lead(sf, readers, 2, sizeof(readers[0].buf), false, 0, "hello");
+    CU_ASSERT_TRUE(reader_got(&readers[0], false, "hello"));
+    CU_ASSERT_TRUE(reader_got(&readers[1], false, "hello"));
+
+    /* Landed: the next reader leads a flight of its own. */
+    reader_start(&readers[0], sf, sizeof(readers[0].buf), false);
+    CU_ASSERT_TRUE(reader_got(&readers[0], true, "own"));
+
+    single_flight_close(sf);
+}
+
+void single_flight_dup_test(void)
+{
+    single_flight_t *sf;
+    reader_t readers[2];
+
+    sf = single_flight_new();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(sf);
+
+    lead(sf, readers, 2, 0, true, 0, "values");
+    CU_ASSERT_TRUE(reader_got(&readers[0], false, "values"));
+    CU_ASSERT_TRUE(reader_got(&readers[1], false, "values"));
+
+    single_flight_close(sf);
+}
+
+void single_flight_leader_error_test(void)
+{
+    single_flight_t *sf;
+    reader_t readers[2];
+    int rc = HIVE_HTTP_STATUS_ERROR(404);
+
+    sf = single_flight_new();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(sf);
+
+    lead(sf, readers, 1, sizeof(readers[0].buf), false, rc, NULL);
+    lead(sf, readers + 1, 1, 0, true, rc, NULL);
+
+    pthread_join(readers[0].thread, NULL);
+    pthread_join(readers[1].thread, NULL);
+    CU_ASSERT_TRUE(!readers[0].led && readers[0].rc == rc);
+    CU_ASSERT_TRUE(!readers[1].led && readers[1].rc == rc);
+
+    single_flight_close(sf);
+}
+
+void single_flight_small_buffer_test(void)
+{
+    single_flight_t *sf;
+    reader_t readers[2];
+
+    sf = single_flight_new();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(sf);
+
+    /* A follower's buffer too small is reported, not read again. */
+    lead(sf, readers, 1, 2, false, 0, "hello");
+    pthread_join(readers[0].thread, NULL);
+    CU_ASSERT_FALSE(readers[0].led);
+    CU_ASSERT_EQUAL(readers[0].rc, (int)HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL));
+
+    /* The leader's too small: the followers read again, themselves. */
+    lead(sf, readers, 2, sizeof(readers[0].buf), false,
+         HIVE_GENERAL_ERROR(HIVEERR_BUFFER_TOO_SMALL), NULL);
+    pthread_join(readers[0].thread, NULL);
+    pthread_join(readers[1].thread, NULL);
+    CU_ASSERT_TRUE(readers[0].led || readers[1].led);
+    CU_ASSERT_TRUE(readers[0].rc == 3 && !memcmp(readers[0].buf, "own", 3));
+    CU_ASSERT_TRUE(readers[1].rc == 3 && !memcmp(readers[1].buf, "own", 3));
+
+    single_flight_close(sf);
+}
+
+void single_flight_forget_test(void)
+{
+    flight_t *stale, *fresh;
+    single_flight_t *sf;
+    reader_t reader;
+
+    sf = single_flight_new();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(sf);
+
+    /* A slow read in flight when the key is written. */
+    CU_ASSERT_TRUE_FATAL(single_flight_join(sf, "key", &stale));
+    single_flight_forget(sf, "key");
+
+    /* Reads after the write do not join it, but lead a new flight. */
+    CU_ASSERT_TRUE_FATAL(single_flight_join(sf, "key", &fresh));
+
+    /* The slow read landing leaves the new flight in place. */
+    single_flight_land(sf, stale, 0, "stale", 5);
+
+    reader_start(&reader, sf, sizeof(reader.buf), false);
+    usleep(JOIN_DELAY_US);
+    single_flight_land(sf, fresh, 0, "fresh", 5);
+    CU_ASSERT_TRUE(reader_got(&reader, false, "fresh"));
+
+    single_flight_close(sf);
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2019 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __SINGLE_FLIGHT_CASES_H__
+#define __SINGLE_FLIGHT_CASES_H__
+
+#include "case.h"
+
+DECL_TESTCASE(single_flight_copy_test)
+DECL_TESTCASE(single_flight_dup_test)
+DECL_TESTCASE(single_flight_leader_error_test)
+DECL_TESTCASE(single_flight_small_buffer_test)
+DECL_TESTCASE(single_flight_forget_test)
+
+#define DEFINE_SINGLE_FLIGHT_CASES                     \
+    DEFINE_TESTCASE(single_flight_copy_test),          \
+    DEFINE_TESTCASE(single_flight_dup_test),           \
+    DEFINE_TESTCASE(single_flight_leader_error_test),  \
+    DEFINE_TESTCASE(single_flight_small_buffer_test),  \
+    DEFINE_TESTCASE(single_flight_forget_test)
+
+#endif /* __SINGLE_FLIGHT_CASES_H__ */
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2019 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <CUnit/Basic.h>
+#include <ela_hive.h>
+
+#include "../cases/case.h"
+#include "../cases/cache_cases.h"
+#include "../cases/file_apis_cases.h"
+#include "../cases/key_value_apis_cases.h"
+#include "../test_context.h"
+
+static HiveConnect *backend;
+
+static CU_TestInfo cases[] = {
+    DEFINE_FILE_APIS_CASES,
+    DEFINE_KEY_APIS_CASES,
+    DEFINE_CACHE_CASES,
+    DEFINE_TESTCASE_NULL
+};
+
+CU_TestInfo* cache_get_cases()
+{
+    return cases;
+}
+
+int cache_suite_init()
+{
+    NativeConnectOptions native_opts = {
+        .backendType = HiveBackendType_Native,
+        .root        = NULL
+    };
+    CacheConnectOptions opts = {
+        .backendType = HiveBackendType_Cache,
+        .root        = NULL,
+        .capacity    = 0
+    };
+
+    /* The native backend reports versions, so reads go through the cache. */
+    backend = hive_client_connect(test_ctx.client, (HiveConnectOptions *)&native_opts);
+    if (!backend) {
+        CU_FAIL("Error: test suite initialize error");
+        return -1;
+    }
+
+    opts.backend = backend;
+    test_ctx.connect = hive_client_connect(test_ctx.client, (HiveConnectOptions *)&opts);
+    if (!test_ctx.connect) {
+        hive_client_disconnect(backend);
+        backend = NULL;
+        CU_FAIL("Error: test suite initialize error");
+        return -1;
+    }
+
+    return 0;
+}
+
+int cache_suite_cleanup()
+{
+    test_context_reset();
+
+    if (backend) {
+        hive_client_disconnect(backend);
+        backend = NULL;
+    }
+
+    return 0;
+}
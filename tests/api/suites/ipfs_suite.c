@@ -56,12 +56,15 @@ int ipfs_suite_init()
         node->ipv4 = global_config.ipfs_rpc_nodes[i]->ipv4;
         node->ipv6 = global_config.ipfs_rpc_nodes[i]->ipv6;
         node->port = global_config.ipfs_rpc_nodes[i]->port;
+        node->unix_socket = global_config.ipfs_rpc_nodes[i]->unix_socket;
     }
 
     IPFSConnectOptions opts = {
         .backendType    = HiveBackendType_IPFS,
         .rpc_node_count = global_config.ipfs_rpc_nodes_sz,
-        .rpcNodes       = nodes
+        .rpcNodes       = nodes,
+        .hedge_budget   = 0.1,
+        .lookup_batch_size = 2
     };
 
     test_ctx.connect = hive_client_connect(test_ctx.client, (HiveConnectOptions *)&opts);
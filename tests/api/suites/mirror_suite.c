@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2019 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <limits.h>
+#include <CUnit/Basic.h>
+#include <ela_hive.h>
+
+#include "../cases/case.h"
+#include "../cases/file_apis_cases.h"
+#include "../cases/key_value_apis_cases.h"
+#include "../cases/mirror_cases.h"
+#include "../test_context.h"
+#include "../../config.h"
+
+#define MIRROR_COUNT    2
+
+static HiveConnect *backends[MIRROR_COUNT];
+
+static CU_TestInfo cases[] = {
+    DEFINE_FILE_APIS_CASES,
+    DEFINE_KEY_APIS_CASES,
+    DEFINE_MIRROR_CASES,
+    DEFINE_TESTCASE_NULL
+};
+
+CU_TestInfo* mirror_get_cases()
+{
+    return cases;
+}
+
+static void close_backends()
+{
+    int i;
+
+    for (i = 0; i < MIRROR_COUNT; i++) {
+        if (backends[i]) {
+            hive_client_disconnect(backends[i]);
+            backends[i] = NULL;
+        }
+    }
+}
+
+int mirror_suite_init()
+{
+    char roots[MIRROR_COUNT][PATH_MAX];
+    NativeConnectOptions native_opts = {
+        .backendType = HiveBackendType_Native
+    };
+    MirrorConnectOptions opts = {
+        .backendType = HiveBackendType_Mirror,
+        .backends    = backends,
+        .count       = MIRROR_COUNT,
+        .quorum      = 0
+    };
+    int i;
+
+    /* Two native backends in directories of their own. */
+    for (i = 0; i < MIRROR_COUNT; i++) {
+        snprintf(roots[i], sizeof(roots[i]), "%s/mirror%d",
+                 global_config.data_location, i);
+        native_opts.root = roots[i];
+
+        backends[i] = hive_client_connect(test_ctx.client, (HiveConnectOptions *)&native_opts);
+        if (!backends[i]) {
+            close_backends();
+            CU_FAIL("Error: test suite initialize error");
+            return -1;
+        }
+    }
+
+    test_ctx.connect = hive_client_connect(test_ctx.client, (HiveConnectOptions *)&opts);
+    if (!test_ctx.connect) {
+        close_backends();
+        CU_FAIL("Error: test suite initialize error");
+        return -1;
+    }
+
+    return 0;
+}
+
+int mirror_suite_cleanup()
+{
+    test_context_reset();
+    close_backends();
+
+    return 0;
+}
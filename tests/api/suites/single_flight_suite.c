@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2019 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <CUnit/Basic.h>
+
+#include "../cases/case.h"
+#include "../cases/single_flight_cases.h"
+
+static CU_TestInfo cases[] = {
+    DEFINE_SINGLE_FLIGHT_CASES,
+    DEFINE_TESTCASE_NULL
+};
+
+CU_TestInfo* single_flight_get_cases()
+{
+    return cases;
+}
+
+/*
+ * Unit cases of the internal read coalescing: no connection needed.
+ */
+int single_flight_suite_init()
+{
+    return 0;
+}
+
+int single_flight_suite_cleanup()
+{
+    return 0;
+}
@@ -26,10 +26,18 @@
 #include "suite.h"
 #include "ipfs_suite.h"
 #include "onedrive_suite.h"
+#include "native_suite.h"
+#include "cache_suite.h"
+#include "mirror_suite.h"
+#include "single_flight_suite.h"
 
 TestSuite suites[] = {
     DEFINE_ONEDRIVE_TESTSUITE,
     DEFINE_IPFS_TESTSUITE,
+    DEFINE_NATIVE_TESTSUITE,
+    DEFINE_CACHE_TESTSUITE,
+    DEFINE_MIRROR_TESTSUITE,
+    DEFINE_SINGLE_FLIGHT_TESTSUITE,
     DEFINE_TESTSUITE_NULL
 };
 